@@ -0,0 +1,144 @@
+// minecontrol-admission.cpp
+#include "minecontrol-admission.h"
+#include "minecontrol-misc-types.h"
+#include <rlibrary/rstringstream.h>
+using namespace rtypes;
+using namespace minecraft_controller;
+
+static double monotonic_seconds()
+{
+    return monotonic_microseconds() / 1000000.0;
+}
+
+// minecraft_controller::client_admission::host_state
+
+client_admission::host_state::host_state()
+    : connections(0), connectTokens(-1.0), loginTokens(-1.0), lastRefill(0.0)
+{
+}
+
+// minecraft_controller::client_admission
+
+/*static*/ mutex client_admission::_mtx("admission");
+/*static*/ uint32 client_admission::_maxClients = 64;
+/*static*/ uint32 client_admission::_maxClientsPerHost = 8;
+/*static*/ uint32 client_admission::_connectRate = 30;
+/*static*/ uint32 client_admission::_loginRate = 10;
+/*static*/ uint32 client_admission::_clientCount = 0;
+/*static*/ uint32 client_admission::_sweepCounter = 0;
+/*static*/ std::map<std::string,client_admission::host_state> client_admission::_hosts;
+/*static*/ bool client_admission::admit_connection(const str& address,socket_family family)
+{
+    bool admit = true;
+    std::string key = _hostKey(address,family);
+    _mtx.lock();
+    if (_maxClients>0 && _clientCount>=_maxClients)
+        admit = false;
+    else if (family == socket_family_inet) {
+        // per-host limits only apply to remote clients: local clients all
+        // look like the same host
+        host_state& host = _refill(key);
+        if (_maxClientsPerHost>0 && host.connections>=_maxClientsPerHost)
+            admit = false;
+        else if (_connectRate > 0) {
+            if (host.connectTokens < 1.0)
+                admit = false;
+            else
+                host.connectTokens -= 1.0;
+        }
+        if (admit)
+            ++host.connections;
+        else
+            _prune(key);
+    }
+    if (admit)
+        ++_clientCount;
+    // every so often sweep out idle hosts that haven't been back since they were refused
+    if (++_sweepCounter%256 == 0) {
+        std::map<std::string,host_state>::iterator iter = _hosts.begin();
+        while (iter != _hosts.end()) {
+            std::string k = (iter++)->first;
+            _prune(k);
+        }
+    }
+    _mtx.unlock();
+    return admit;
+}
+/*static*/ void client_admission::release_connection(const str& address,socket_family family)
+{
+    _mtx.lock();
+    if (_clientCount > 0)
+        --_clientCount;
+    if (family == socket_family_inet) {
+        std::string key = _hostKey(address,family);
+        std::map<std::string,host_state>::iterator iter = _hosts.find(key);
+        if (iter != _hosts.end()) {
+            if (iter->second.connections > 0)
+                --iter->second.connections;
+            _prune(key);
+        }
+    }
+    _mtx.unlock();
+}
+/*static*/ bool client_admission::allow_login(const str& address,socket_family family,int peerUid)
+{
+    bool allow = true;
+    if (_loginRate > 0) {
+        // one local user guessing passwords shouldn't lock the others out
+        std::string key = _hostKey(address,family,peerUid);
+        _mtx.lock();
+        host_state& host = _refill(key);
+        if (host.loginTokens < 1.0)
+            allow = false;
+        else
+            host.loginTokens -= 1.0;
+        _mtx.unlock();
+    }
+    return allow;
+}
+/*static*/ std::string client_admission::_hostKey(const str& address,socket_family family,int peerUid)
+{
+    if (family == socket_family_unix) {
+        // these cannot collide with an address string
+        if (peerUid < 0)
+            return "@local";
+        stringstream key;
+        key << "@local:" << peerUid;
+        return key.get_device().c_str();
+    }
+    return address.c_str();
+}
+/*static*/ client_admission::host_state& client_admission::_refill(const std::string& key)
+{
+    // refill the host's token buckets based on the time since the last refill;
+    // each bucket holds at most one minute's worth of tokens; a new host starts
+    // out with full buckets
+    double now = monotonic_seconds();
+    host_state& host = _hosts[key];
+    if (host.connectTokens < 0.0) {
+        host.connectTokens = _connectRate;
+        host.loginTokens = _loginRate;
+    }
+    else {
+        double elapsed = now - host.lastRefill;
+        host.connectTokens += elapsed * _connectRate / 60.0;
+        if (host.connectTokens > _connectRate)
+            host.connectTokens = _connectRate;
+        host.loginTokens += elapsed * _loginRate / 60.0;
+        if (host.loginTokens > _loginRate)
+            host.loginTokens = _loginRate;
+    }
+    host.lastRefill = now;
+    return host;
+}
+/*static*/ void client_admission::_prune(const std::string& key)
+{
+    // forget about a host once it has no connections and its buckets have
+    // refilled; this keeps scanners from growing the table without bound
+    std::map<std::string,host_state>::iterator iter = _hosts.find(key);
+    if (iter!=_hosts.end() && iter->second.connections==0) {
+        _refill(key);
+        if (iter->second.connectTokens>=_connectRate && iter->second.loginTokens>=_loginRate)
+            _hosts.erase(iter);
+    }
+}
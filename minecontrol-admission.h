@@ -0,0 +1,74 @@
+// minecontrol-admission.h
+#ifndef MINECONTROL_ADMISSION_H
+#define MINECONTROL_ADMISSION_H
+#include "socket.h"
+#include "mutex.h"
+#include <string>
+#include <map>
+
+namespace minecraft_controller
+{
+    // static class that decides whether new client connections and login
+    // attempts are allowed; connections are checked by the listening socket
+    // right after they are accepted (before any per-connection resources are
+    // allocated); a limit of zero disables that check
+    class client_admission
+    {
+    public:
+        // maximum number of clients connected at once (local and remote)
+        static void set_max_clients(rtypes::uint32 limit)
+        { _maxClients = limit; }
+        // maximum number of clients connected at once from a single remote host
+        static void set_max_clients_per_host(rtypes::uint32 limit)
+        { _maxClientsPerHost = limit; }
+        // number of new connections allowed per minute from a single remote host
+        static void set_connect_rate(rtypes::uint32 perMinute)
+        { _connectRate = perMinute; }
+        // number of login attempts allowed per minute from a single host
+        static void set_login_rate(rtypes::uint32 perMinute)
+        { _loginRate = perMinute; }
+
+        // socket admission filter: if true is returned the connection is counted
+        // against the limits and must later be passed to 'release_connection'
+        static bool admit_connection(const rtypes::str& address,socket_family family);
+        static void release_connection(const rtypes::str& address,socket_family family);
+
+        // takes a token from the host's login bucket; false means the attempt
+        // should be refused without checking the credentials; local clients
+        // get a bucket per user ('peerUid' from SO_PEERCRED, or -1 if unknown)
+        static bool allow_login(const rtypes::str& address,socket_family family,int peerUid);
+    private:
+        struct host_state
+        {
+            host_state();
+
+            rtypes::uint32 connections;
+            double connectTokens;
+            double loginTokens;
+            double lastRefill; // seconds on the monotonic clock
+        };
+
+        static mutex _mtx;
+        static rtypes::uint32 _maxClients;
+        static rtypes::uint32 _maxClientsPerHost;
+        static rtypes::uint32 _connectRate;
+        static rtypes::uint32 _loginRate;
+        static rtypes::uint32 _clientCount;
+        static rtypes::uint32 _sweepCounter;
+        static std::map<std::string,host_state> _hosts;
+
+        static std::string _hostKey(const rtypes::str& address,socket_family family,int peerUid = -1);
+        static host_state& _refill(const std::string& key);
+        static void _prune(const std::string& key);
+    };
+}
+
+#endif
+
+/*
+ * Local Variables:
+ * mode:c++
+ * indent-tabs-mode:nil
+ * tab-width:4
+ * End:
+ */
@@ -1,6 +1,8 @@
 // minecontrol-authority.cpp
 #include "minecontrol-authority.h"
+#include "minecontrol-metrics.h"
 #include "minecontrol-protocol.h"
+#include "minecontrol-user-fs.h"
 #include "minecraft-controller.h"
 #include "minecraft-server.h"
 #include <rlibrary/rfile.h>
@@ -14,304 +16,47 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
 #include <limits.h>
 #include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+#ifndef __APPLE__
+#include <sys/inotify.h>
+#endif
+#include <algorithm>
+#include <vector>
 using namespace rtypes;
 using namespace minecraft_controller;
 
-/*static*/ minecraft_server_message* minecraft_server_message::generate_message(const str& serverLineText)
-{
-    /* the parallel arrays MESSAGE_GISTS and GIST_FORMATS define the search
-       order for message patters (formats); they are arranged (hopefully) by
-       most frequent message gist kinds first; if you need to add a gist kind,
-       make sure to update both arrays */
-    static const char* const GENERAL_FORMAT = "[%S] [%S]: %S";
-    static const uint32 MESSAGE_GIST_COUNT = 17;
-    static const minecraft_server_message_gist MESSAGE_GISTS[] = {
-        gist_player_chat,
-        gist_server_chat,
-        gist_server_secret_chat,
-        gist_player_teleported,
-        gist_testblock_failure,
-        gist_testblock_success,
-        gist_player_login,
-        gist_player_id,
-        gist_player_join,
-        gist_player_leave,
-        gist_player_losecon_logout,
-        gist_player_achievement,
-        gist_server_start,
-        gist_server_start_bind,
-        gist_server_shutdown,
-        gist_player_losecon_error,
-        gist_server_generic // base case; let this be the last element in this array
-    };
-    static const char* const GIST_FORMATS[] = {
-        "<%S> %S", // gist_player_chat
-        "[%S] %S", // gist_server_chat
-        "You whisper to %S: %S", // gist_server_secret_chat
-        "Teleported %S to %S,%w%S,%w%S", // gist_player_teleported
-        "The block at %S,%w%S,%w%S is %S%o (expected: %S)%o.", // gist_testblock_failure
-        "Successfully found the block at %S,%w%S,%w%S%o.", // gist_testblock_success
-        "%S[/%S] logged in with entity id %S at (%S, %S, %S)", // gist_player_login
-        "UUID of player %S is %S", // gist_player_id
-        "%S joined the game", // gist_player_join
-        "%S left the game", // gist_player_leave
-        "%S lost connection: TextComponent{%S, %S, style=Style{%S, %S, %S, %S, %S, %S, %S, %S}}", // gist_player_losecon_logout
-        "%S has just earned the achievement [%S]", // gist_player_achievement
-        "Starting minecraft server version %S", // gist_server_start
-        "Starting Minecraft server on %S", // gist_server_start_bind
-        "Stopping server", // gist_server_shutdown
-        "com.mojang.authlib.GameProfile@%S[id=%S,name=%S,properties=%S,legacy=%S] (/%S) lost connection: Disconnected", // gist_player_losecon_error
-        "%S", // gist_server_generic (this is the base case; let this be the last element in this array)
-    };
-    dynamic_array<str> tokens;
-    if (!_payloadParse(GENERAL_FORMAT,serverLineText.c_str(),tokens) || tokens.size()<3)
-        return NULL;
-    str time(tokens[0]), type(tokens[1]), payload(tokens[2]);
-    uint32 i = 0;
-    while (i < MESSAGE_GIST_COUNT) {
-        tokens.clear();
-        if ( _payloadParse(GIST_FORMATS[i],payload.c_str(),tokens) )
-            return new minecraft_server_message(serverLineText,payload,tokens,GIST_FORMATS[i],time,type,MESSAGE_GISTS[i]);
-        ++i;
-    }
-    return NULL;
-}
-minecraft_server_message::minecraft_server_message(const str& originalPayload,const str& payload,const dynamic_array<str>& tokens,const char* formatString,const str& timeMessage,const str& typeMessage,minecraft_server_message_gist messageGist)
-    : _gist(messageGist), _originalPayload(originalPayload), _payload(payload), _tokens(tokens), _formatString(formatString)
+// gets the directories searched for authority programs, in search order
+static void authority_directories(dynamic_array<str>& out,const user_info& userInfo,
+    const minecraft_server_init_manager& initInfo,minecontrol_authority::path_type filter)
 {
-    _good = true;
-    if (sscanf(timeMessage.c_str(),"%u:%u:%u",&_hour,&_minute,&_second) != 3)
-        _good = false;
-    else if (typeMessage == "Server thread/INFO")
-        _type = main_info;
-    else if (typeMessage == "Server thread/WARN")
-        _type = main_warn;
-    else if ( rutil_strncmp(typeMessage.c_str(),"User Authenticator",18) ) {
-        const char* p = typeMessage.c_str();
-        while (*p && *p!='/')
-            ++p;
-        if (*p == '/') {
-            ++p;
-            if ( rutil_strcmp(p,"WARN") )
-                _type = auth_warn;
-            else if ( rutil_strcmp(p,"INFO") )
-                _type = auth_info;
-        }
-    }
-    else if (typeMessage == "Server Shutdown Thread/INFO")
-        _type = shdw_info;
-    else if (typeMessage == "Server Shutdown Thread/WARN")
-        _type = shdw_warn;
-    else
-        _type = type_unkn;
-}
-str minecraft_server_message::get_type_string() const
-{
-    static const char* const DEFAULT = "unknown-msg";
-    switch (_type) {
-    case main_info:
-        return "main-info";
-    case main_warn:
-        return "main-warning";
-    case auth_info:
-        return "auth-info";
-    case auth_warn:
-        return "auth-warning";
-    case shdw_info:
-        return "shutdown-info";
-    case shdw_warn:
-        return "shutdown-warning";
-    default:
-        return DEFAULT;
-    }
-    return DEFAULT;
-}
-str minecraft_server_message::get_gist_string() const
-{
-    // these strings determine what an authority program
-    // sees as its first token on an input line
-    static const char* const DEFAULT = "unknown";
-    switch (_gist) {
-    case gist_server_start:
-        return "start";
-    case gist_server_start_bind:
-        return "bind";
-    case gist_server_chat:
-        return "server-chat";
-    case gist_server_secret_chat:
-        return "server-secret-chat";
-    case gist_server_shutdown:
-        return "shutdown";
-    case gist_player_id:
-        return "player-id";
-    case gist_player_login:
-        return "login";
-    case gist_player_join:
-        return "join";
-    case gist_player_losecon_logout:
-        return "logout-connection";
-    case gist_player_losecon_error:
-        return "lost-connection";
-    case gist_player_leave:
-        return "leave";
-    case gist_player_chat:
-        return "chat";
-    case gist_player_achievement:
-        return "achievement";
-    case gist_player_teleported:
-        return "player-teleported";
-    case gist_testblock_success:
-        return "testblock-success";
-    case gist_testblock_failure:
-        return "testblock-failure";
-    default:
-        return DEFAULT;
-    }
-    return DEFAULT;
-}
-/*static*/ bool minecraft_server_message::_payloadParse(const char* format,const char* source,dynamic_array<str>& tokens)
-{
-    str token;
-    while (*format && *source) {
-        if (*format == '%') {
-            ++format;
-            if (*format == 0)
-                return false; // bad format string
-            if (*format == '%') {
-                // escaped percent sign character
-                if (*source != *format)
-                    return false;
-            }
-            else {
-                token.clear();
-                if (*format == 'S') {
-                    // find token until delimiter character
-                    char delim;
-                    char optional = -1;
-                    ++format;
-                    delim = *format;
-                    if (delim == '%') {
-                        // Handle format specifier
-                        char nxt = format[1];
-                        if (nxt != 0) {
-                            if (nxt == 'o' && format[2] != 0) {
-                                // Allow for optional delimiter characters. If
-                                // the optional character is not matched then
-                                // the next character must be matched.
-                                delim = format[2];
-                                optional = format[3];
-                            }
-                            else {
-                                // Cannot have format specifier as delimiter.
-                                throw minecontrol_authority_error();
-                            }
-                            format += 2;
-                        }
-                    }
-                    while (*source && *source!=delim && *source!=optional) {
-                        token.push_back(*source);
-                        ++source;
-                    }
-                    if (*source != delim && *source != optional) {
-                        return false;
-                    }
-                    if (*source == optional) {
-                        format += 1;
-                    }
-                }
-                else if (*format == 's') {
-                    // find token until whitespace
-                    while (*source && *source!=' ' && *source!='\t' && *source!='\n') {
-                        token.push_back(*source);
-                        ++source;
-                    }
-                }
-                else if (*format == 'w') {
-                    // search through any whitespace (this is mainly used in format strings to
-                    // maintain compatibility between server versions)
-                    while (*source && isspace(*source))
-                        ++source;
-                    ++format;
-                    continue;
-                }
-                else if (*format == 'o') {
-                    // The next character is optional. This cannot appear at the
-                    // end of a string for obvious reasons.
-                    if (format[1] != 0) {
-                        if (*source == format[1]) {
-                            source += 1;
-                        }
-                        format += 2;
-                        continue;
-                    }
-                }
-                else
-                    throw minecontrol_authority_error(); // bad format character
-                // not every special sequence produces a token
-                if (token.length() > 0)
-                    tokens.push_back(token);
-            }
-            // seek to next character if possible
-            if (*format)
-                ++format;
-            else if (!*source)
-                return true; // string matched
-            if (*source)
-                ++source;
-            continue;
-        }
-        if (*format != *source)
-            return false;
-        ++format;
-        ++source;
-    }
-
-    // Handle the case where the optional character to be (potentially) omitted
-    // occurs at the end of string.
-    if (*format == '%' && format[1] == 'o' && format[2] != 0) {
-        if (*source == format[2]) {
-            source += 1;
-        }
-        format += 3;
-    }
-
-    return *format == *source;
-}
-
-/* static */
-void minecontrol_authority::
-list_authority_programs(rtypes::dynamic_array<str>& out,const user_info& userInfo,path_type filter)
-{
-    dynamic_array<str> paths;
-
     // Grab system paths for authority programs.
-    if (filter == authority_any_path || authority_system_path) {
+    if (filter == minecontrol_authority::authority_any_path || filter == minecontrol_authority::authority_system_path) {
         str path;
-        int iter = 0;
-        const char* const PATH = AUTHORITY_EXE_PATH;
-        while (PATH[iter] != 0) {
-            if (PATH[iter] == ':') {
-                paths.push_back(path);
+        for (const char* p = minecontrol_authority::AUTHORITY_EXE_PATH;*p != 0;++p) {
+            if (*p == ':') {
+                if (path.length() > 0)
+                    out.push_back(path);
                 path.clear();
-                iter += 1;
             }
-            path.append(PATH[iter++]);
+            else
+                path.push_back(*p);
         }
         if (path.length() > 0) {
-            paths.push_back(path);
+            out.push_back(path);
         }
     }
 
     // Grab path for user programs.
-    if (filter == authority_any_path || filter == authority_user_path) {
-        minecraft_server_init_manager initInfo;
+    if (filter == minecontrol_authority::authority_any_path || filter == minecontrol_authority::authority_user_path) {
         stringstream formatter;
 
-        initInfo.read_from_file();
         if (initInfo.alternate_home().length() > 0) {
             formatter << initInfo.alternate_home() << '/' << userInfo.userName;
         }
@@ -319,47 +64,31 @@ list_authority_programs(rtypes::dynamic_array<str>& out,const user_info& userInf
             formatter << userInfo.homeDirectory;
         }
         formatter << '/' << minecraft_server_info::MINECRAFT_USER_DIRECTORY;
-        paths.push_back(static_cast<str&>(formatter.get_device()));
+        out.push_back(static_cast<str&>(formatter.get_device()));
     }
+}
 
-    // Add all executable file names to the list.
-    for (size_type i = 0;i < paths.size();++i) {
-        const str& path = paths[i];
-        DIR* dir = opendir(path.c_str());
-
-        if (dir != nullptr) {
-            while (true) {
-                struct stat st;
-                struct dirent* result;
-                result = readdir(dir);
-
-                if (result == nullptr) {
-                    break;
-                }
-                if (result->d_type != DT_REG && result->d_type != DT_LNK) {
-                    continue;
-                }
-
-                stringstream filePath(path.c_str());
-                filePath << '/' << result->d_name;
-                if (stat(filePath.get_device().c_str(),&st) == -1) {
-                    continue;
-                }
+/* static */
+void minecontrol_authority::
+list_authority_programs(rtypes::dynamic_array<str>& out,const user_info& userInfo,path_type filter)
+{
+    dynamic_array<str> paths;
 
-                if ((st.st_mode & S_IXUSR) != 0) {
-                    out.push_back(result->d_name);
-                }
-            }
+    authority_directories(paths,userInfo,*minecraft_server_init_manager::get_snapshot(),filter);
 
-            closedir(dir);
-        }
+    // Add all executable file names to the list.
+    for (size_type i = 0;i < paths.size();++i) {
+        authority_program_index::list(paths[i],userInfo.uid,userInfo.gid,out);
     }
 }
 
 const char* const minecontrol_authority::AUTHORITY_EXE_PATH = "/usr/lib/minecontrol:/usr/local/lib/minecontrol"; // standard authority program location
 const char* const minecontrol_authority::AUTHORITY_EXEC_FILE = "minecontrol.exec";
-minecontrol_authority::minecontrol_authority(const pipe& ioChannel,int fderr,const str& serverDirectory,const user_info& userInfo)
-    : _iochannel(ioChannel), _fderr(fderr), _serverDirectory(serverDirectory), _login(userInfo)
+minecontrol_authority::minecontrol_authority(const pipe& ioChannel,int fderr,const str& serverDirectory,const user_info& userInfo,
+    const str& cgroupLeaf,const std::shared_ptr<minecraft_startup_listener>& startupListener)
+    : _iochannel(ioChannel), _fderr(fderr), _serverDirectory(serverDirectory), _login(userInfo), _cgroupLeaf(cgroupLeaf),
+      _startupListener(startupListener), _childMtx("authority-children"), _clientMtx("authority-clients"),
+      _archive(serverDirectory,userInfo.uid,userInfo.gid), _ledger(serverDirectory,userInfo.uid,userInfo.gid,true)
 {
     _childCnt = 0;
     for (int i = 0;i < ALLOWED_CHILDREN;++i) {
@@ -369,6 +98,11 @@ minecontrol_authority::minecontrol_authority(const pipe& ioChannel,int fderr,con
     _trun = true;
     _consoleEnabled = true;
     _threadCondition = true;
+    _firstLineTime = _bindTime = _readyTime = 0;
+    _lineCount.store(0);
+    for (int i = 0;i < gist_count;++i)
+        _gistCount[i].store(0);
+    _consoleDrops.store(0);
     // start default programs from _serverDirectory/AUTHORITY_EXEC_FILE
     file execFile;
     str execFileName = _serverDirectory;
@@ -485,14 +219,17 @@ minecontrol_authority::execute_result minecontrol_authority::run_auth_process(st
     static const int ARGV_BUF_SIZE = 512;
     pid_t pid;
     int index;
+    uint64 spawnBegin = monotonic_microseconds();
     if (ppid != NULL)
         *ppid = -1;
     // the entire operation needs to be atomic; if the lock is aquired after the 
     // processing thread shuts down, the _consoleEnabled flag should be false
     _childMtx.lock();
     // if this flag is false then the processing thread most certainly is winding down
-    if (!_consoleEnabled)
+    if (!_consoleEnabled) {
+        _childMtx.unlock();
         return authority_exec_not_ready;
+    }
     // see if there is a slot for a new child process
     index = 0;
     while (index<ALLOWED_CHILDREN && _childID[index]!=-1)
@@ -506,24 +243,59 @@ minecontrol_authority::execute_result minecontrol_authority::run_auth_process(st
         _childMtx.unlock();
         return authority_exec_cannot_run;
     }
+    // Prepare command-line arguments and find the program before forking: the
+    // child must not parse the init file, search directories or take any locks
+    // between fork and exec.
+    const char* program;
+    const char* argv[ARGV_BUF_SIZE];
+    if ( !_prepareArgs(&commandLine[0],&program,argv,ARGV_BUF_SIZE) ) {
+        _childStdIn[index].close();
+        _childMtx.unlock();
+        return authority_exec_too_many_arguments;
+    }
+
+    // Modify path to point to minecontrol authority exe locations. There are
+    // several standard, system locations that are hard-coded. The other
+    // location is the user's "minecraft" directory under their home
+    // directory. The base path may be changed by the alt-home setting.
+    dynamic_array<str> directories;
+    stringstream pathEnv;
+    authority_directories(directories,_login,*minecraft_server_init_manager::get_snapshot(),authority_any_path);
+    for (size_type i = 0;i < directories.size();++i) {
+        if (i > 0)
+            pathEnv << ':';
+        pathEnv << directories[i];
+    }
+    pathEnv.flush_output();
+
+    // Resolve a bare program name to an absolute path using the index so that
+    // the child doesn't have to search PATH.
+    str programPath;
+    if (::strchr(program,'/') == NULL) {
+        if ( !authority_program_index::resolve(program,directories,_login.uid,_login.gid,programPath) ) {
+            _childStdIn[index].close();
+            _childMtx.unlock();
+            return authority_exec_program_not_found;
+        }
+        program = programPath.c_str();
+    }
+
     // fork process
     pid = fork();
     if (pid == -1) {
         _childMtx.unlock();
         return authority_exec_cannot_run;
     }
+    if (pid > 0)
+        minecontrol_metrics::observe(minecontrol_metrics::hist_authority_spawn,monotonic_microseconds() - spawnBegin);
     if (pid == 0) { // child process
-        const char* program;
-        const char* argv[ARGV_BUF_SIZE];
+        // Join the server's cgroup while we still have the privileges to do so.
+        if (_cgroupLeaf.length() > 0 && !minecraft_server_cgroup::join(_cgroupLeaf.c_str()))
+            _exit((int)authority_exec_attr_fail);
 
         // Change process umask to deny write to group and others.
         umask(S_IWGRP | S_IWOTH);
 
-        // Prepare command-line arguments.
-        if ( !_prepareArgs(&commandLine[0],&program,argv,ARGV_BUF_SIZE) ) {
-            _exit((int)authority_exec_too_many_arguments);
-        }
-
         // Change permissions for this process.
 #ifdef __APPLE__
         if (setgid(_login.gid) == -1 || setegid(_login.gid) == -1
@@ -563,22 +335,8 @@ minecontrol_authority::execute_result minecontrol_authority::run_auth_process(st
             ::close(fd);
         }
 
-        // Modify path to point to minecontrol authority exe locations. There
-        // are several standard, system locations that are hard-coded. The other
-        // location is the user's "minecraft" directory under their home
-        // directory. The base path may be changed by the alt-home setting.
-        minecraft_server_init_manager initInfo;
-        stringstream path(AUTHORITY_EXE_PATH);
-        path << ':';
-        initInfo.read_from_file();
-        if (initInfo.alternate_home().length() > 0) {
-            path << initInfo.alternate_home() << '/' << _login.userName;
-        }
-        else {
-            path << _login.homeDirectory;
-        }
-        path << '/' << minecraft_server_info::MINECRAFT_USER_DIRECTORY;
-        if (setenv("PATH",path.get_device().c_str(),1) == -1) {
+        // Let the authority program find other authority programs.
+        if (setenv("PATH",pathEnv.get_device().c_str(),1) == -1) {
             _exit((int)authority_exec_attr_fail);
         }
 
@@ -589,7 +347,7 @@ minecontrol_authority::execute_result minecontrol_authority::run_auth_process(st
         }
 
         // Attempt to execute the specified authority program.
-        if (execvp(program,(char* const*)argv) == -1) {
+        if (execv(program,(char* const*)argv) == -1) {
             if (errno == ENOENT)
                 _exit((int)authority_exec_program_not_found);
             if (errno == ENOEXEC)
@@ -694,6 +452,31 @@ void minecontrol_authority::process_message(const minecraft_server_message* mess
         _serverVersion = message->get_token(0);
     }
 
+    // keep the player ledger
+    if ( message->good() ) {
+        uint64 now = ::time(NULL);
+        switch (message->get_gist()) {
+        case gist_player_id:
+            _ledger.player_id(now,message->get_token(0).c_str(),message->get_token(1).c_str());
+            break;
+        case gist_player_join:
+            _ledger.join(now,message->get_token(0).c_str());
+            break;
+        case gist_player_leave:
+        case gist_player_losecon_logout:
+            _ledger.leave(now,message->get_token(0).c_str());
+            break;
+        case gist_player_losecon_error:
+            _ledger.leave(now,message->get_token(2).c_str());
+            break;
+        case gist_server_shutdown:
+            _ledger.reset(now);
+            break;
+        default:
+            break;
+        }
+    }
+
     // if there are any child programs running, send a parsed version of the
     // message to them on their stdin; also check the status of the running
     // process for termination
@@ -748,6 +531,26 @@ void minecontrol_authority::process_message(const minecraft_server_message* mess
 
     _childMtx.unlock();
 }
+int minecontrol_authority::get_console_subscribers() const
+{
+    int count = 0;
+    _clientMtx.lock();
+    for (size_type i = 0;i < _clientchannels.size();++i)
+        if (_clientchannels[i] != NULL)
+            ++count;
+    _clientMtx.unlock();
+    return count;
+}
+int minecontrol_authority::get_child_count() const
+{
+    int count = 0;
+    _childMtx.lock();
+    for (int i = 0;i < ALLOWED_CHILDREN;++i)
+        if (_childID[i] != -1)
+            ++count;
+    _childMtx.unlock();
+    return count;
+}
 bool minecontrol_authority::is_responsive() const
 {
 #ifdef __APPLE__
@@ -799,6 +602,8 @@ bool minecontrol_authority::is_responsive() const
         }
         buflen += object->_iochannel.get_last_byte_count();
         msgbuf[buflen] = 0;
+        // every line from one read is archived with the same time
+        uint64 readTime = ::time(NULL);
         // go through the bytes received from the Minecraft server; find complete
         // messages and process them
         while (true) {
@@ -828,6 +633,7 @@ bool minecontrol_authority::is_responsive() const
             msg[msglen] = 0;
 
             // if clients are registered with the authority, send the message as is
+            uint64 fanoutBegin = monotonic_microseconds();
             object->_clientMtx.lock();
             for (size_type i = 0;i < object->_clientchannels.size();++i) {
                 if (object->_clientchannels[i] != NULL) {
@@ -836,12 +642,46 @@ bool minecontrol_authority::is_responsive() const
                     conmsg.add_field("Status","message");
                     conmsg.add_field("Payload",msg);
                     conmsg.write_protocol_message(*object->_clientchannels[i]);
+                    // console writes are synchronous, so a client that can't keep
+                    // up shows up as a failed write rather than a backlog
+                    if (object->_clientchannels[i]->get_last_operation_status() == bad_write)
+                        object->_consoleDrops.store(object->_consoleDrops.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
                 }
             }
             object->_clientMtx.unlock();
 
             minecraft_server_message* pmessage;
+            uint64 parseBegin = monotonic_microseconds();
             pmessage = minecraft_server_message::generate_message(msg);
+            minecontrol_metrics::observe(minecontrol_metrics::hist_console_fanout,parseBegin - fanoutBegin);
+            minecontrol_metrics::observe(minecontrol_metrics::hist_line_parse,monotonic_microseconds() - parseBegin);
+            // this thread is the only writer, so a plain store will do
+            object->_lineCount.store(object->_lineCount.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+            if (pmessage != NULL && pmessage->good()) {
+                std::atomic<uint64>& gistCount = object->_gistCount[pmessage->get_gist()];
+                gistCount.store(gistCount.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+            }
+            object->_archive.append(readTime,pmessage!=NULL && pmessage->good() ? int(pmessage->get_gist()) : -1,msg,msglen);
+            if (object->_readyTime == 0) {
+                // note start-up milestones
+                uint64 now = monotonic_milliseconds();
+                if (object->_firstLineTime == 0)
+                    object->_firstLineTime = now;
+                if (pmessage != NULL && pmessage->good()) {
+                    if (pmessage->get_gist() == gist_server_start_bind)
+                        object->_bindTime = now;
+                    else if (pmessage->get_gist() == gist_server_ready)
+                        object->_readyTime = now;
+                }
+            }
+            if (object->_startupListener) {
+                // report start-up progress until the server says it's done
+                object->_startupListener->startup_line(msg,pmessage);
+                if (pmessage != NULL && pmessage->good() && pmessage->get_gist() == gist_server_ready) {
+                    object->_startupListener->startup_finished(true);
+                    object->_startupListener.reset();
+                }
+            }
             if (pmessage != NULL) {
                 object->process_message(pmessage);
                 delete pmessage;
@@ -852,6 +692,15 @@ bool minecontrol_authority::is_responsive() const
         }
     }
 
+    // whoever was still online left with the server
+    object->_ledger.reset(::time(NULL));
+
+    // the server went away before it was ready
+    if (object->_startupListener) {
+        object->_startupListener->startup_finished(false);
+        object->_startupListener.reset();
+    }
+
     // disable clients from plugging in and also disable new executable programs
     // from being started by remote clients
     object->_consoleEnabled = false;
@@ -964,3 +813,198 @@ rstream& minecraft_controller::operator <<(rstream& stream,minecontrol_authority
         stream << "the reason was unspecified";
     return stream;
 }
+
+// minecraft_controller::authority_program_index
+
+// the programs found in a directory: regular files with any execute bit set;
+// entries are shared by all users and are replaced, never modified
+struct authority_program_index::_directory
+{
+    std::vector<std::string> programs; // sorted
+    int watch; // inotify watch descriptor or -1 if not watched
+    timespec modified; // used to revalidate unwatched directories
+};
+/*static*/ mutex authority_program_index::_mtx("authority-program-index");
+/*static*/ std::map<std::string,std::shared_ptr<const authority_program_index::_directory> > authority_program_index::_directories;
+/*static*/ std::map<int,std::string> authority_program_index::_watches;
+/*static*/ uint64 authority_program_index::_changes = 0;
+/*static*/ int authority_program_index::_inotifyFd = -1;
+/*static*/ pthread_t authority_program_index::_threadID;
+/*static*/ volatile bool authority_program_index::_threadCondition = false;
+/*static*/ void authority_program_index::start_watcher()
+{
+#ifndef __APPLE__
+    _inotifyFd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotifyFd == -1) {
+        minecontrold::standardLog << "authority program directories will be revalidated by modification time" << endline;
+        return;
+    }
+    _threadCondition = true;
+    if (::pthread_create(&_threadID,NULL,&authority_program_index::_watch_thread,NULL) != 0)
+        throw minecontrol_authority_error();
+#endif
+}
+/*static*/ void authority_program_index::stop_watcher()
+{
+    if (_threadCondition) {
+        _threadCondition = false;
+        if (::pthread_join(_threadID,NULL) != 0)
+            throw minecontrol_authority_error();
+    }
+}
+/*static*/ void authority_program_index::list(const str& directory,int uid,int gid,dynamic_array<str>& out)
+{
+    user_fs_scope scope(uid,gid);
+    std::shared_ptr<const _directory> entry = _lookup(directory);
+    if (entry != nullptr) {
+        for (size_type i = 0;i < entry->programs.size();++i) {
+            stringstream filePath(directory.c_str());
+            filePath << '/' << entry->programs[i].c_str();
+            if (::faccessat(AT_FDCWD,filePath.get_device().c_str(),X_OK,AT_EACCESS) == 0)
+                out.push_back(entry->programs[i].c_str());
+        }
+    }
+}
+/*static*/ bool authority_program_index::resolve(const char* program,const dynamic_array<str>& directories,
+    int uid,int gid,str& outPath)
+{
+    // the execute bits are checked by the kernel against the user's filesystem
+    // credentials; a root-squashed home is also only readable this way
+    user_fs_scope scope(uid,gid);
+    for (size_type i = 0;i < directories.size();++i) {
+        std::shared_ptr<const _directory> entry = _lookup(directories[i]);
+        if (entry!=nullptr && std::binary_search(entry->programs.begin(),entry->programs.end(),std::string(program))) {
+            outPath = directories[i];
+            outPath.push_back('/');
+            outPath += program;
+            if (::faccessat(AT_FDCWD,outPath.c_str(),X_OK,AT_EACCESS) == 0)
+                return true;
+        }
+    }
+    return false;
+}
+/*static*/ std::shared_ptr<const authority_program_index::_directory> authority_program_index::_lookup(const str& directory)
+{
+    struct stat st;
+    std::shared_ptr<const _directory> entry;
+    _mtx.lock();
+    auto iter = _directories.find(directory.c_str());
+    if (iter != _directories.end())
+        entry = iter->second;
+    uint64 changes = _changes;
+    _mtx.unlock();
+
+    // a watched entry is erased as soon as its directory changes; an unwatched one
+    // is good while the directory's modification time stays the same
+    if (entry != nullptr) {
+        if (entry->watch != -1)
+            return entry;
+        if (::stat(directory.c_str(),&st) == 0) {
+#ifdef __APPLE__
+            const timespec& modified = st.st_mtimespec;
+#else
+            const timespec& modified = st.st_mtim;
+#endif
+            if (modified.tv_sec==entry->modified.tv_sec && modified.tv_nsec==entry->modified.tv_nsec)
+                return entry;
+        }
+    }
+
+    // (re)scan the directory; watch it first so that no change goes unnoticed
+    std::shared_ptr<_directory> fresh = std::make_shared<_directory>();
+    fresh->watch = -1;
+#ifndef __APPLE__
+    if (_inotifyFd != -1)
+        fresh->watch = ::inotify_add_watch(_inotifyFd,directory.c_str(),
+            IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF);
+#endif
+    DIR* dir = nullptr;
+    if (::stat(directory.c_str(),&st)==-1 || (dir = opendir(directory.c_str()))==nullptr) {
+        _unwatch(fresh->watch);
+        return nullptr;
+    }
+#ifdef __APPLE__
+    fresh->modified = st.st_mtimespec;
+#else
+    fresh->modified = st.st_mtim;
+#endif
+    while (true) {
+        struct dirent* result;
+        result = readdir(dir);
+
+        if (result == nullptr) {
+            break;
+        }
+        if (result->d_type != DT_REG && result->d_type != DT_LNK && result->d_type != DT_UNKNOWN) {
+            continue;
+        }
+
+        stringstream filePath(directory.c_str());
+        filePath << '/' << result->d_name;
+        if (stat(filePath.get_device().c_str(),&st) == -1 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+
+        if ((st.st_mode & (S_IXUSR|S_IXGRP|S_IXOTH)) != 0) {
+            fresh->programs.push_back(result->d_name);
+        }
+    }
+    closedir(dir);
+    std::sort(fresh->programs.begin(),fresh->programs.end());
+
+    // only cache the scan if no change was reported while it ran
+    _mtx.lock();
+    if (fresh->watch != -1)
+        _watches[fresh->watch] = directory.c_str();
+    if (changes == _changes)
+        _directories[directory.c_str()] = fresh;
+    _mtx.unlock();
+    return fresh;
+}
+/*static*/ void authority_program_index::_unwatch(int watch)
+{
+#ifndef __APPLE__
+    // a watch the index already knows about belongs to an earlier scan of the
+    // same directory; the watch thread forgets it once it goes away
+    if (watch == -1)
+        return;
+    _mtx.lock();
+    bool known = _watches.find(watch) != _watches.end();
+    _mtx.unlock();
+    if (!known)
+        ::inotify_rm_watch(_inotifyFd,watch);
+#endif
+}
+/*static*/ void* authority_program_index::_watch_thread(void*)
+{
+#ifndef __APPLE__
+    while (_threadCondition) {
+        pollfd pfd;
+        pfd.fd = _inotifyFd;
+        pfd.events = POLLIN;
+        if (::poll(&pfd,1,1000) <= 0)
+            continue;
+        char buffer[4096] __attribute__((aligned(__alignof__(inotify_event))));
+        ssize_t len;
+        while ((len = ::read(_inotifyFd,buffer,sizeof(buffer))) > 0) {
+            _mtx.lock();
+            for (char* p = buffer;p < buffer+len;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+                auto iter = _watches.find(event->wd);
+                if (iter != _watches.end()) {
+                    // the next lookup rescans the directory
+                    _directories.erase(iter->second);
+                    if (event->mask & IN_IGNORED)
+                        _watches.erase(iter);
+                }
+                ++_changes;
+                p += sizeof(inotify_event) + event->len;
+            }
+            _mtx.unlock();
+        }
+    }
+    ::close(_inotifyFd);
+    _inotifyFd = -1;
+#endif
+    return NULL;
+}
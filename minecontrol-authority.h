@@ -2,11 +2,17 @@
 #ifndef MINECONTROL_AUTHORITY_H
 #define MINECONTROL_AUTHORITY_H
 #include "minecontrol-misc-types.h"
+#include "minecraft-server-archive.h"
+#include "minecraft-player-ledger.h"
 #include "pipe.h"
 #include "socket.h"
 #include "mutex.h"
 #include <rlibrary/rdynarray.h>
 #include <rlibrary/rstream.h>
+#include <string>
+#include <map>
+#include <memory>
+#include <atomic>
 
 namespace minecraft_controller
 {
@@ -33,6 +39,8 @@ namespace minecraft_controller
         gist_server_generic,
         gist_server_start,
         gist_server_start_bind,
+        gist_server_prepare_spawn,
+        gist_server_ready,
         gist_server_chat,
         gist_server_secret_chat,
         gist_server_shutdown,
@@ -46,7 +54,8 @@ namespace minecraft_controller
         gist_player_achievement,
         gist_player_teleported,
         gist_testblock_success,
-        gist_testblock_failure
+        gist_testblock_failure,
+        gist_count // number of gist kinds; not a gist
     };
 
     /* represents a message printed on the minecraft server process's standard output channel */
@@ -65,6 +74,7 @@ namespace minecraft_controller
         { return _gist; }
         rtypes::str get_type_string() const;
         rtypes::str get_gist_string() const;
+        static const char* gist_name(minecraft_server_message_gist gist);
         rtypes::uint32 get_hour() const
         { return _hour; }
         rtypes::uint32 get_minute() const
@@ -103,6 +113,19 @@ namespace minecraft_controller
         const char* _formatString;
     };
 
+    /* receives the lines a Minecraft server prints while it starts up; an authority
+       notifies its listener (from the processing thread) until the server reports
+       that it is ready or until the server process goes away */
+    class minecraft_startup_listener
+    {
+    public:
+        virtual ~minecraft_startup_listener() {}
+
+        // 'message' is NULL if the line wasn't in the regular server format
+        virtual void startup_line(const char* line,const minecraft_server_message* message) = 0;
+        virtual void startup_finished(bool ready) = 0;
+    };
+
     /* represents an object that authoritatively manages
      * the server (either directly or indirectly) via
      * messages received from/sent to the minecraft server
@@ -143,7 +166,9 @@ namespace minecraft_controller
         };
 
 
-        minecontrol_authority(const pipe& ioChannel,int fderr,const rtypes::str& serverDirectory,const user_info& login);
+        minecontrol_authority(const pipe& ioChannel,int fderr,const rtypes::str& serverDirectory,const user_info& login,
+            const rtypes::str& cgroupLeaf = rtypes::str(),
+            const std::shared_ptr<minecraft_startup_listener>& startupListener = std::shared_ptr<minecraft_startup_listener>());
         ~minecontrol_authority() noexcept(false);
 
         console_result client_console_operation(socket& clientChannel); // blocks
@@ -156,6 +181,37 @@ namespace minecraft_controller
 
         bool is_responsive() const; // determine if server process is still responsive
 
+        // start-up milestones as monotonic_milliseconds() values; each is zero until
+        // the server has printed its first line, bound its address or reported that
+        // it is ready (the "Done" line)
+        rtypes::uint64 get_first_line_time() const
+        { return _firstLineTime; }
+        rtypes::uint64 get_bind_time() const
+        { return _bindTime; }
+        rtypes::uint64 get_ready_time() const
+        { return _readyTime; }
+        bool is_ready() const
+        { return _readyTime != 0; }
+
+        // counters for the metrics endpoint; the line and gist counts are only
+        // written by the processing thread
+        rtypes::uint64 get_line_count() const
+        { return _lineCount.load(std::memory_order_relaxed); }
+        rtypes::uint64 get_gist_count(minecraft_server_message_gist gist) const
+        { return _gistCount[gist].load(std::memory_order_relaxed); }
+        rtypes::uint64 get_console_drops() const
+        { return _consoleDrops.load(std::memory_order_relaxed); }
+        int get_console_subscribers() const;
+        int get_child_count() const;
+
+        // every line the server prints is kept in the server's archive
+        minecraft_server_archive& get_archive()
+        { return _archive; }
+
+        // player joins and leaves are recorded in the server's ledger
+        const minecraft_player_ledger& get_ledger() const
+        { return _ledger; }
+
         static void list_authority_programs(rtypes::dynamic_array<rtypes::str>& out,
             const user_info& userInfo,
             path_type filter);
@@ -172,6 +228,8 @@ namespace minecraft_controller
         int _fderr; /* file descriptor for authority programs' stderr; assume it stays valid throughout the lifetime of the object */
         rtypes::str _serverDirectory; // directory of server files that the authority manages; becomes the current working directory for the child authority process
         user_info _login; // login information for user running minecraft server
+        rtypes::str _cgroupLeaf; // cgroup directory that authority programs join (if not empty)
+        std::shared_ptr<minecraft_startup_listener> _startupListener; // only touched by the processing thread once it runs
         rtypes::str _serverVersion; // version string captured from log
         rtypes::dynamic_array<socket*> _clientchannels; // sockets used for client communications using minecontrol protocol; empty if no clients registered
         pipe _childStdIn[ALLOWED_CHILDREN]; // write-only pipe (in parent) to child stdin
@@ -183,11 +241,52 @@ namespace minecraft_controller
         mutable pthread_t _threadID; // processing threadID
         volatile bool _threadCondition;
         volatile bool _consoleEnabled;
+        volatile rtypes::uint64 _firstLineTime, _bindTime, _readyTime;
+        std::atomic<rtypes::uint64> _lineCount;
+        std::atomic<rtypes::uint64> _gistCount[gist_count];
+        std::atomic<rtypes::uint64> _consoleDrops; // console messages a client failed to take
+        minecraft_server_archive _archive; // appended to by the processing thread
+        minecraft_player_ledger _ledger; // likewise
 
         static bool _prepareArgs(char* commandLine,const char** outProgram,const char** outArgv,int size);
     };
 
     rtypes::rstream& operator <<(rtypes::rstream&,minecontrol_authority::execute_result);
+
+    /* index of the executable programs in the authority program directories; a
+       directory is scanned the first time it is needed and then kept current by
+       inotify (or revalidated by its modification time if it can't be watched) */
+    class authority_program_index
+    {
+    public:
+        // starts/stops the thread that applies inotify events to the index
+        static void start_watcher();
+        static void stop_watcher();
+
+        // appends the names of the programs in 'directory' that the user identified
+        // by 'uid' and 'gid' may execute to 'out'
+        static void list(const rtypes::str& directory,int uid,int gid,rtypes::dynamic_array<rtypes::str>& out);
+
+        // finds the first directory (in order) that contains a program with the
+        // specified name that the user may execute and assigns its absolute path
+        // to 'outPath'; all filesystem access uses the user's credentials
+        static bool resolve(const char* program,const rtypes::dynamic_array<rtypes::str>& directories,
+            int uid,int gid,rtypes::str& outPath);
+    private:
+        struct _directory;
+
+        static mutex _mtx; // protects everything below
+        static std::map<std::string,std::shared_ptr<const _directory> > _directories;
+        static std::map<int,std::string> _watches; // watch descriptor to directory
+        static rtypes::uint64 _changes; // incremented for each inotify event
+        static int _inotifyFd;
+        static pthread_t _threadID;
+        static volatile bool _threadCondition;
+
+        static std::shared_ptr<const _directory> _lookup(const rtypes::str& directory);
+        static void _unwatch(int watch);
+        static void* _watch_thread(void*);
+    };
 }
 
 #endif
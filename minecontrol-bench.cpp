@@ -0,0 +1,554 @@
+// minecontrol-bench.cpp - concurrent client benchmark for minecontrold
+//
+// Opens many connections to a running minecontrold, each of which runs a
+// scripted mix of protocol requests at a fixed rate, and reports per-request
+// latency percentiles, errors and the daemon's thread count and memory use.
+// See test/scale-bench.sh for running it against a throwaway daemon.
+#include "minecontrol-protocol.h"
+#include "domain-socket.h"
+#include "net-socket.h"
+#include "minecontrol-histogram.h"
+#include "minecontrol-misc-types.h"
+#include <rlibrary/rutility.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+using namespace rtypes;
+using namespace minecraft_controller;
+
+static const char* PROGRAM_NAME;
+static const char* DOMAIN_NAME = "@minecontrol";
+static const char* SERVICE_PORT = "44446";
+
+// the requests that make up a connection's script
+enum bench_op
+{
+    op_connect, // connect, HELLO and log in again (each step is timed separately)
+    op_status,
+    op_server_ls,
+    op_count,
+
+    // timed steps of op_connect
+    step_hello = op_count,
+    step_login,
+    step_total
+};
+
+static const char* const OP_NAMES[step_total] = {
+    "connect", "status", "server-ls", "hello", "login"
+};
+
+struct bench_options
+{
+    int connections;
+    double rate; // requests per second per connection
+    double duration;
+    int weights[op_count];
+    const char* host; // use TLS to this host instead of the domain socket
+    const char* username; // password login over TLS
+    const char* password;
+    int servers; // fake servers to start before the run
+    int daemonPid;
+};
+
+static bench_options options;
+static str token; // session token for TLS connections (from a peer login)
+static volatile bool running = true;
+
+struct bench_connection
+{
+    pthread_t thread;
+    latency_histogram latency[step_total];
+    unsigned long long errors[step_total];
+    unsigned long long offset; // staggers the connections' schedules
+    std::string lastError;
+};
+
+/* bench_session:
+ *  one connection to the daemon over either transport
+ */
+class bench_session
+{
+public:
+    bench_session()
+        : _sock(NULL), _address(NULL) {}
+    ~bench_session()
+    { close(); }
+
+    bool connect()
+    {
+        close();
+        if (options.host != NULL) {
+            _sock = new network_socket;
+            _address = new network_socket_address(options.host,SERVICE_PORT);
+            _address->setEncrypted(true);
+        }
+        else {
+            _sock = new domain_socket;
+            _address = new domain_socket_address(DOMAIN_NAME);
+        }
+        _sock->open();
+        if ( !_sock->connect(*_address) )
+            return false;
+        _stream.assign(*_sock);
+        return true;
+    }
+    void close()
+    {
+        if (_sock != NULL) {
+            _stream.close();
+            delete _sock;
+            delete _address;
+            _sock = NULL;
+            _address = NULL;
+        }
+    }
+
+    bool hello()
+    {
+        minecontrol_message req("HELLO");
+        req.add_field("Name","minecontrol-bench");
+        req.add_field("Version","1");
+        req.add_field(minecontrol_message::FRAMING_FIELD,minecontrol_message::FRAMING_BINARY);
+        _stream << req;
+        _stream >> response;
+        if (!response.good() || !response.is_command("greetings"))
+            return false;
+        str key, value;
+        while (response.get_field_key_stream() >> key) {
+            response.get_field_value_stream() >> value;
+            rutil_to_lower_ref(value);
+            if (key=="framing" && value==minecontrol_message::FRAMING_BINARY)
+                _sock->set_framing(socket_framing_binary);
+        }
+        return true;
+    }
+
+    // logs in by peer credentials on the domain socket; over TLS the
+    // session token is resumed unless a password was given
+    bool login(bool wantToken = false)
+    {
+        if (options.host == NULL) {
+            request.begin("LOGIN");
+            request.enqueue_field_name("Method");
+            request << "peer" << newline;
+            if (wantToken) {
+                request.enqueue_field_name("Token");
+                request << "yes" << newline;
+            }
+            request << flush;
+        }
+        else if (options.password != NULL) {
+            request.begin("LOGIN");
+            request.enqueue_field_name("Username");
+            request.enqueue_field_name("Password");
+            request << options.username << newline << options.password << flush;
+        }
+        else {
+            request.begin("RESUME");
+            request.enqueue_field_name("Token");
+            request << token << flush;
+        }
+        return send() && response.is_command("message");
+    }
+
+    bool send()
+    {
+        _stream << request.get_message();
+        _stream >> response;
+        return response.good();
+    }
+
+    // the first value of the specified field (or the empty string)
+    str field(const char* name)
+    {
+        str key, value;
+        while (response.get_field_key_stream() >> key) {
+            response.get_field_value_stream() >> value;
+            if (key == name)
+                return value;
+        }
+        return str();
+    }
+
+    minecontrol_message_buffer request;
+    minecontrol_message response;
+private:
+    minecraft_controller::socket* _sock;
+    socket_address* _address;
+    socket_stream _stream;
+};
+
+// runs the steps of op_connect, recording each one; false if a step failed
+static bool reconnect(bench_session& session,bench_connection& conn)
+{
+    unsigned long long t = monotonic_microseconds();
+    if (!session.connect() || !session.hello()) {
+        ++conn.errors[step_hello];
+        conn.lastError = "cannot connect and say HELLO";
+        session.close();
+        return false;
+    }
+    unsigned long long u = monotonic_microseconds();
+    conn.latency[step_hello].add(u - t);
+    if ( !session.login() ) {
+        ++conn.errors[step_login];
+        conn.lastError = session.response.is_command("error") ? session.field("payload").c_str() : "login failed";
+        session.close();
+        return false;
+    }
+    conn.latency[step_login].add(monotonic_microseconds() - u);
+    return true;
+}
+
+static void* connection_thread(void* param)
+{
+    bench_connection& conn = *reinterpret_cast<bench_connection*>(param);
+    bench_session session;
+    bool connected = false;
+    int totalWeight = 0;
+    for (int i = 0;i < op_count;++i)
+        totalWeight += options.weights[i];
+
+    // requests are sent on a fixed schedule; latency is measured from the
+    // scheduled time so that a slow daemon is not hidden by the client
+    // waiting on it (no coordinated omission)
+    unsigned long long interval = (unsigned long long)(1000000 / options.rate);
+    unsigned long long next = monotonic_microseconds() + conn.offset;
+    for (unsigned long long n = 0;running;++n) {
+        unsigned long long t = monotonic_microseconds();
+        if (next > t)
+            usleep(useconds_t(next - t));
+        if (!running)
+            break;
+        t = next;
+        next += interval;
+
+        int pick = int(n % totalWeight), op = 0;
+        while (pick >= options.weights[op])
+            pick -= options.weights[op++];
+        if (!connected || op == op_connect) {
+            connected = reconnect(session,conn);
+            if (connected)
+                conn.latency[op_connect].add(monotonic_microseconds() - t);
+            else
+                ++conn.errors[op_connect];
+            continue;
+        }
+
+        session.request.begin(op == op_status ? "STATUS" : "SERVER-LS");
+        session.request << flush;
+        if ( !session.send() ) {
+            ++conn.errors[op];
+            conn.lastError = "connection lost";
+            session.close();
+            connected = false;
+            continue;
+        }
+        // failed requests are only counted; the histogram holds successes
+        if ( session.response.is_command("error") ) {
+            ++conn.errors[op];
+            conn.lastError = session.field("payload").c_str();
+            continue;
+        }
+        conn.latency[op].add(monotonic_microseconds() - t);
+    }
+    return NULL;
+}
+
+// the pid of the process listening on the domain socket
+static int daemon_pid()
+{
+    int fd = ::socket(AF_UNIX,SOCK_STREAM,0);
+    if (fd == -1)
+        return -1;
+    sockaddr_un addr;
+    size_t len = std::strlen(DOMAIN_NAME);
+    std::memset(&addr,0,sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path,DOMAIN_NAME,sizeof(addr.sun_path)-1);
+    if (DOMAIN_NAME[0] == '@')
+        addr.sun_path[0] = 0;
+    ucred cred;
+    socklen_t credlen = sizeof(cred);
+    int pid = -1;
+    if (::connect(fd,reinterpret_cast<sockaddr*>(&addr),socklen_t(sizeof(sa_family_t)+len)) == 0
+        && getsockopt(fd,SOL_SOCKET,SO_PEERCRED,&cred,&credlen) == 0)
+        pid = cred.pid;
+    ::close(fd);
+    return pid;
+}
+
+// reads the thread count and resident set size (kB) of a process
+static bool process_stats(int pid,long& threads,long& rss)
+{
+    char path[64], line[256];
+    std::snprintf(path,sizeof(path),"/proc/%d/status",pid);
+    FILE* f = std::fopen(path,"r");
+    if (f == NULL)
+        return false;
+    threads = rss = -1;
+    while (std::fgets(line,sizeof(line),f) != NULL) {
+        if (std::strncmp(line,"Threads:",8) == 0)
+            threads = std::atol(line+8);
+        else if (std::strncmp(line,"VmRSS:",6) == 0)
+            rss = std::atol(line+6);
+    }
+    std::fclose(f);
+    return threads >= 0 && rss >= 0;
+}
+
+// prints one line of the report
+static void print_row(const char* name,const latency_histogram& hist,unsigned long long errors)
+{
+    std::printf("%-10s %10llu %8llu %10llu %10llu %10llu %10llu\n",name,(unsigned long long)hist.count(),errors,
+        (unsigned long long)hist.quantile(0.5),(unsigned long long)hist.quantile(0.99),
+        (unsigned long long)hist.quantile(0.999),(unsigned long long)hist.max());
+}
+
+// parses "name=weight,..." over the op names
+static bool parse_mix(const char* spec)
+{
+    std::string s(spec);
+    for (int i = 0;i < op_count;++i)
+        options.weights[i] = 0;
+    for (size_t at = 0;at <= s.length();) {
+        size_t comma = s.find(',',at);
+        if (comma == std::string::npos)
+            comma = s.length();
+        std::string item(s,at,comma-at);
+        size_t eq = item.find('=');
+        if (eq == std::string::npos)
+            return false;
+        int i = 0;
+        while (i < op_count && item.compare(0,eq,OP_NAMES[i]) != 0)
+            ++i;
+        if (i >= op_count)
+            return false;
+        options.weights[i] = std::atoi(item.c_str()+eq+1);
+        at = comma + 1;
+    }
+    int total = 0;
+    for (int i = 0;i < op_count;++i)
+        total += options.weights[i];
+    return total > 0;
+}
+
+// starts (or stops) the fake servers bench-0, bench-1, ... over the domain socket
+static bool fake_servers(bool start)
+{
+    const char* host = options.host;
+    options.host = NULL;
+    bench_session session;
+    bool ok = session.connect() && session.hello() && session.login(start && host!=NULL);
+    options.host = host;
+    if (!ok) {
+        std::fprintf(stderr,"%s: cannot log in by peer credentials on %s\n",PROGRAM_NAME,DOMAIN_NAME);
+        return false;
+    }
+    if (start && host != NULL && options.password == NULL) {
+        token = session.field("token");
+        if (token.length() == 0) {
+            std::fprintf(stderr,"%s: the daemon did not issue a session token for TLS connections\n",PROGRAM_NAME);
+            return false;
+        }
+    }
+    if (start) {
+        for (int i = 0;i < options.servers;++i) {
+            char name[32];
+            std::snprintf(name,sizeof(name),"bench-%d",i);
+            session.request.begin("START");
+            session.request.enqueue_field_name("ServerName");
+            session.request.enqueue_field_name("IsNew");
+            session.request << name << newline << "yes" << flush;
+            if (!session.send() || !session.response.is_command("list-message")) {
+                std::fprintf(stderr,"%s: cannot start fake server '%s'\n",PROGRAM_NAME,name);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // stop every server listed as "bench-<n>: id=<id> ..."
+    session.request.begin("STATUS");
+    session.request << flush;
+    if ( !session.send() )
+        return false;
+    std::vector<unsigned long> ids;
+    str key, value;
+    while (session.response.get_field_key_stream() >> key) {
+        session.response.get_field_value_stream() >> value;
+        const char* id = std::strstr(value.c_str(),": id=");
+        if (std::strncmp(value.c_str(),"bench-",6) == 0 && id != NULL)
+            ids.push_back(std::strtoul(id+5,NULL,10));
+    }
+    for (size_t i = 0;i < ids.size();++i) {
+        session.request.begin("STOP");
+        session.request.enqueue_field_name("ServerID");
+        session.request << uint32(ids[i]) << flush;
+        session.send();
+    }
+    return true;
+}
+
+static void usage()
+{
+    std::fprintf(stderr,"usage: %s [-c connections] [-r requests-per-second] [-d seconds] [-m op=weight,...]\n"
+        "       [-s fake-servers] [-t host [-u user -p password]] [-n socket-name] [-P daemon-pid]\n"
+        "ops: connect (reconnect, HELLO and log in), status, server-ls\n",PROGRAM_NAME);
+    std::exit(1);
+}
+
+int main(int argc,char* argv[])
+{
+    int opt;
+    PROGRAM_NAME = argv[0];
+    options.connections = 100;
+    options.rate = 10;
+    options.duration = 10;
+    options.weights[op_connect] = 1;
+    options.weights[op_status] = 5;
+    options.weights[op_server_ls] = 4;
+    options.host = options.username = options.password = NULL;
+    options.servers = 0;
+    options.daemonPid = -1;
+    while ((opt = getopt(argc,argv,"c:r:d:m:s:t:u:p:n:P:")) != -1) {
+        switch (opt) {
+        case 'c':
+            options.connections = std::atoi(optarg);
+            break;
+        case 'r':
+            options.rate = std::atof(optarg);
+            break;
+        case 'd':
+            options.duration = std::atof(optarg);
+            break;
+        case 'm':
+            if ( !parse_mix(optarg) )
+                usage();
+            break;
+        case 's':
+            options.servers = std::atoi(optarg);
+            break;
+        case 't':
+            options.host = optarg;
+            break;
+        case 'u':
+            options.username = optarg;
+            break;
+        case 'p':
+            options.password = optarg;
+            break;
+        case 'n':
+            DOMAIN_NAME = optarg;
+            break;
+        case 'P':
+            options.daemonPid = std::atoi(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (options.connections<1 || options.rate<=0 || options.duration<=0 || options.servers<0
+        || (options.password!=NULL && options.username==NULL))
+        usage();
+
+    SSL_library_init();
+    SSL_load_error_strings();
+    OpenSSL_add_all_algorithms();
+    ::signal(SIGPIPE,SIG_IGN);
+    if (options.daemonPid == -1)
+        options.daemonPid = daemon_pid();
+    if ( !fake_servers(true) )
+        return 1;
+
+    long threads[3], rss[3]; // at start, peak and end
+    bool haveStats = options.daemonPid>0 && process_stats(options.daemonPid,threads[0],rss[0]);
+    if (haveStats) {
+        threads[1] = threads[2] = threads[0];
+        rss[1] = rss[2] = rss[0];
+    }
+
+    // connection threads don't need much stack
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr,256*1024);
+    std::vector<bench_connection> conns(options.connections);
+    int started = 0;
+    for (;started < options.connections;++started) {
+        for (int j = 0;j < step_total;++j)
+            conns[started].errors[j] = 0;
+        conns[started].offset = (unsigned long long)(1000000 / options.rate) * started / options.connections;
+        if (pthread_create(&conns[started].thread,&attr,&connection_thread,&conns[started]) != 0) {
+            std::fprintf(stderr,"%s: could only create %d connection threads\n",PROGRAM_NAME,started);
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    // sample the daemon while the load runs
+    unsigned long long start = monotonic_microseconds(), end = start + (unsigned long long)(options.duration * 1000000);
+    while (monotonic_microseconds() < end) {
+        usleep(100000);
+        long t, r;
+        if (haveStats && process_stats(options.daemonPid,t,r)) {
+            if (t > threads[1])
+                threads[1] = t;
+            if (r > rss[1])
+                rss[1] = r;
+            threads[2] = t;
+            rss[2] = r;
+        }
+    }
+    running = false;
+    for (int i = 0;i < started;++i)
+        pthread_join(conns[i].thread,NULL);
+    double elapsed = (monotonic_microseconds() - start) / 1e6;
+    if (options.servers > 0)
+        fake_servers(false);
+
+    // report
+    latency_histogram totals[step_total], all;
+    unsigned long long errors[step_total] = {0}, requests = 0, failed = 0;
+    std::string lastError;
+    for (int i = 0;i < started;++i) {
+        for (int j = 0;j < step_total;++j) {
+            totals[j].merge(conns[i].latency[j]);
+            errors[j] += conns[i].errors[j];
+        }
+        if (!conns[i].lastError.empty())
+            lastError = conns[i].lastError;
+    }
+    std::printf("%d connections over %s, %.1f requests/s each, %.1fs\n",started,
+        options.host != NULL ? "TLS" : "the domain socket",options.rate,elapsed);
+    std::printf("%-10s %10s %8s %10s %10s %10s %10s\n","request","count","errors","p50(us)","p99(us)","p99.9(us)","max(us)");
+    for (int j = 0;j < step_total;++j) {
+        if (j < op_count) {
+            all.merge(totals[j]);
+            requests += totals[j].count() + errors[j];
+            failed += errors[j];
+        }
+        if (totals[j].count()==0 && errors[j]==0)
+            continue;
+        print_row(OP_NAMES[j],totals[j],errors[j]);
+    }
+    print_row("all",all,failed);
+    std::printf("throughput: %.0f requests/s (target %.0f)\n",requests / elapsed,started * options.rate);
+    if (failed > 0)
+        std::printf("last error: %s\n",lastError.c_str());
+    if (haveStats)
+        std::printf("daemon %d: threads %ld start, %ld peak, %ld end; RSS %ld kB start, %ld kB peak, %ld kB end\n",
+            options.daemonPid,threads[0],threads[1],threads[2],rss[0],rss[1],rss[2]);
+    else
+        std::printf("daemon: thread count and RSS are unavailable (pass -P with the daemon's pid)\n");
+    return failed == 0 ? 0 : 1;
+}
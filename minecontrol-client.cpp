@@ -3,6 +3,13 @@
 #include "minecontrol-client.h"
 #include "minecraft-controller.h"
 #include "minecraft-server.h" // gets minecontrol-authority.h
+#include "minecontrol-admission.h"
+#include "minecontrol-token.h"
+#include "minecontrol-job.h"
+#include "minecontrol-metrics.h"
+#include <cstdio>
+#include <cstring>
+#include <time.h>
 #include <unistd.h>
 #include <pwd.h>
 #ifndef __APPLE__
@@ -13,18 +20,22 @@
 using namespace rtypes;
 using namespace minecraft_controller;
 
-/*static*/ mutex controller_client::clientsMutex;
+/*static*/ uint32 controller_client::helloTimeout = 10;
+/*static*/ uint32 controller_client::slowRequestMsec = 0;
+/*static*/ mutex controller_client::clientsMutex("clients");
 /*static*/ dynamic_array<void*> controller_client::clients;
-/*static*/ size_type controller_client::CMD_COUNT_WITHOUT_LOGIN = 2;
-/*static*/ size_type controller_client::CMD_COUNT_WITH_LOGIN = 9;
-/*static*/ size_type controller_client::CMD_COUNT_WITH_PRIVILEGED_LOGIN = 1;
+/*static*/ size_type controller_client::CMD_COUNT_WITHOUT_LOGIN = 3;
+/*static*/ size_type controller_client::CMD_COUNT_WITH_LOGIN = 13;
+/*static*/ size_type controller_client::CMD_COUNT_WITH_PRIVILEGED_LOGIN = 2;
 /*static*/ const char* const controller_client::CMDNAME_WITHOUT_LOGIN[] =
 {
-    "login", "status"
+    "login", "status",
+    "resume"
 };
 /*static*/ const controller_client::command_call controller_client::CMDFUNC_WITHOUT_LOGIN[] =
 {
-    &controller_client::command_login, &controller_client::command_status
+    &controller_client::command_login, &controller_client::command_status,
+    &controller_client::command_resume
 };
 /*static*/ const char* const controller_client::CMDNAME_WITH_LOGIN[] =
 {
@@ -32,7 +43,9 @@ using namespace minecraft_controller;
     "logout", "console",
     "extend", "exec",
     "auth-ls", "server-ls",
-    "profile-ls"
+    "profile-ls", "job-watch",
+    "startup-stats", "log-query",
+    "player-stats"
 };
 /*static*/ const controller_client::command_call controller_client::CMDFUNC_WITH_LOGIN[] =
 {
@@ -40,25 +53,64 @@ using namespace minecraft_controller;
     &controller_client::command_logout, &controller_client::command_console,
     &controller_client::command_extend, &controller_client::command_exec,
     &controller_client::command_auth_ls, &controller_client::command_server_ls,
-    &controller_client::command_profile_ls
+    &controller_client::command_profile_ls, &controller_client::command_job_watch,
+    &controller_client::command_startup_stats, &controller_client::command_log_query,
+    &controller_client::command_player_stats
 };
 /*static*/ const char* const controller_client::CMDNAME_WITH_PRIVILEGED_LOGIN[] =
 {
-    "shutdown"
+    "shutdown", "stats"
 };
 /*static*/ const controller_client::command_call controller_client::CMDFUNC_WITH_PRIVILEGED_LOGIN[] =
 {
-    &controller_client::command_shutdown
+    &controller_client::command_shutdown, &controller_client::command_stats
 };
 
+/*static*/ void controller_client::register_metrics()
+{
+    // slots follow the command tables in the order message_loop searches
+    // them; the last slot counts unrecognized commands
+    const char* names[minecontrol_metrics::MAX_COMMANDS];
+    size_type count = 0;
+    for (size_type i = 0;i < CMD_COUNT_WITHOUT_LOGIN;++i)
+        names[count++] = CMDNAME_WITHOUT_LOGIN[i];
+    for (size_type i = 0;i < CMD_COUNT_WITH_LOGIN;++i)
+        names[count++] = CMDNAME_WITH_LOGIN[i];
+    for (size_type i = 0;i < CMD_COUNT_WITH_PRIVILEGED_LOGIN;++i)
+        names[count++] = CMDNAME_WITH_PRIVILEGED_LOGIN[i];
+    names[count++] = "unknown";
+    minecontrol_metrics::set_command_names(names,int(count));
+}
+/*static*/ size_type controller_client::count_clients()
+{
+    size_type count = 0;
+    clientsMutex.lock();
+    for (size_type i = 0;i < clients.size();++i)
+        if (clients[i] != NULL)
+            ++count;
+    clientsMutex.unlock();
+    return count;
+}
 /*static*/ controller_client* controller_client::accept_client(socket& ds)
 {
     str addr;
     socket* pclientsock;
+    socket_accept_condition cond;
     // accept a client; stores a dynamically allocated socket object in pnew->sock; this will
-    // be passed to the controller_client object which will later free it
-    if (ds.accept(pclientsock,addr) == socket_accepted) {
+    // be passed to the controller_client object which will later free it; connections turned
+    // away by the admission filter or dropped during the TLS handshake have already been
+    // closed so just keep accepting
+    while ((cond = ds.accept(pclientsock,addr))==socket_refused || cond==socket_handshake_failed) {
+        if (cond == socket_handshake_failed)
+            minecontrold::standardLog << "dropped remote client connection from " << addr << ": TLS handshake failed" << endline;
+        else if (ds.get_family() == socket_family_inet)
+            minecontrold::standardLog << "refused remote client connection from " << addr << ": connection limit reached" << endline;
+        else
+            minecontrold::standardLog << "refused local client connection: connection limit reached" << endline;
+    }
+    if (cond == socket_accepted) {
         controller_client* pnew = new controller_client(pclientsock);
+        pnew->peerAddress = addr;
         // send the client to a new thread for processing
         if (::pthread_create(&pnew->threadID,NULL,&controller_client::client_thread,pnew) != 0)
             throw controller_client_error();
@@ -141,6 +193,15 @@ controller_client::~controller_client()
         client->client_log(minecontrold::standardLog) << "client connection shutdown by server" << endline;
         client->sock->shutdown();
     }
+    // report how well compression did for this connection
+    socket_compression_stats stats;
+    if ( client->sock->get_compression_stats(stats) ) {
+        client->client_log(minecontrold::standardLog) << "compression: sent " << stats.plainOut << " bytes as " << stats.wireOut
+                                                      << " (" << (stats.plainOut>0 ? stats.wireOut*100/stats.plainOut : 100) << "%), received "
+                                                      << stats.wireIn << " bytes as " << stats.plainIn << endline;
+    }
+    // give back the client's connection slot
+    client_admission::release_connection(client->peerAddress,client->sock->get_family());
     // remove client reference from the list of maintained clients
     clientsMutex.lock();
     clients[client->referenceIndex] = NULL;
@@ -156,9 +217,9 @@ bool controller_client::message_loop()
     str clientName, clientVersion;
     io_device& device = connection.get_device(); // should be a reference to this->sock
     minecontrol_message inMessage, outMessage;
-    // perform greeting negotiation: the client must send HELLO (within 10 seconds) as its first message;
-    // anything else (including a malformed message) results in a shutdown
-    if ( !sock->select(10) ) { // wait 10 seconds for data to be sent from client
+    // perform greeting negotiation: the client must send HELLO (within 'helloTimeout' seconds) as its first
+    // message; anything else (including a malformed message) results in a shutdown
+    if ( !sock->select(helloTimeout) ) { // wait for data to be sent from client
         client_log(minecontrold::standardLog) << "client didn't send anything in timeout period" << endline;
         return false;
     }
@@ -167,7 +228,9 @@ bool controller_client::message_loop()
         client_log(minecontrold::standardLog) << "client didn't say HELLO" << endline;
         return false;
     }
-    // get name and version info if available
+    // get name and version info if available; also see if the client
+    // can use binary framing and/or compression
+    bool binaryFraming = false, compression = false;
     while ( inMessage.get_field_key_stream().has_input() ) {
         str k, v;
         inMessage.get_field_key_stream() >> k;
@@ -176,6 +239,14 @@ bool controller_client::message_loop()
             clientName = v;
         else if (k=="version" && clientVersion.length()==0)
             clientVersion = v;
+        else if (k == "framing") {
+            rutil_to_lower_ref(v);
+            binaryFraming = (v == minecontrol_message::FRAMING_BINARY);
+        }
+        else if (k == "compression") {
+            rutil_to_lower_ref(v);
+            compression = (v == minecontrol_message::COMPRESSION_DEFLATE);
+        }
     }
     if (clientName.length() == 0) {
         clientName = "unknown-client";
@@ -185,9 +256,30 @@ bool controller_client::message_loop()
     outMessage.assign_command("GREETINGS");
     outMessage.add_field("Name",minecontrold::get_server_name());
     outMessage.add_field("Version",minecontrold::get_server_version());
+    if (binaryFraming)
+        outMessage.add_field(minecontrol_message::FRAMING_FIELD,minecontrol_message::FRAMING_BINARY);
+    if (compression)
+        outMessage.add_field(minecontrol_message::COMPRESSION_FIELD,minecontrol_message::COMPRESSION_DEFLATE);
     connection << outMessage;
+    // GREETINGS is always sent as text; everything after it uses the negotiated framing
+    // and compression
+    if (binaryFraming) {
+        sock->set_framing(socket_framing_binary);
+        client_log(minecontrold::standardLog) << "using binary framing" << endline;
+    }
+    if (compression) {
+        if ( !sock->enable_compression() ) {
+            client_log(minecontrold::standardLog) << "couldn't initialize compression" << endline;
+            return false;
+        }
+        client_log(minecontrold::standardLog) << "using deflate compression" << endline;
+    }
+    // the trace is current for this thread while a request is handled
+    request_trace trace;
     while (threadCondition) {
         // get next message from client
+        trace.begin();
+        uint64 readBegin = monotonic_microseconds();
         connection >> inMessage;
         if (device.get_last_operation_status() == no_input) { // client disconnected
             if ( !device.is_valid_context() )
@@ -206,11 +298,19 @@ bool controller_client::message_loop()
             connection << msgbuf.get_message();
             continue;
         }
-        // process message
+        // process message; the time taken is recorded against the command's
+        // metrics slot (see register_metrics)
         bool executed = false;
+        size_type slot = CMD_COUNT_WITHOUT_LOGIN+CMD_COUNT_WITH_LOGIN+CMD_COUNT_WITH_PRIVILEGED_LOGIN;
+        uint64 begin = monotonic_microseconds(), handlerBegin = 0;
+        // the read span starts when the request began to arrive (or when the
+        // read began if the request was already buffered)
+        trace.set(request_trace::span_read,begin - (trace.get_input_time()!=0 ? trace.get_input_time() : readBegin));
         // attempt to process commands that can be executed without login
         for (size_type i = 0;i<CMD_COUNT_WITHOUT_LOGIN;i++) {
             if ( inMessage.is_command(CMDNAME_WITHOUT_LOGIN[i]) ) {
+                slot = i;
+                handlerBegin = monotonic_microseconds();
                 (this->*CMDFUNC_WITHOUT_LOGIN[i])(inMessage.get_field_key_stream(),inMessage.get_field_value_stream());
                 executed = true;
                 break;
@@ -220,6 +320,8 @@ bool controller_client::message_loop()
             // attempt to process commands that can only be executed with login status
             for (size_type i = 0;i<CMD_COUNT_WITH_LOGIN;i++) {
                 if ( inMessage.is_command(CMDNAME_WITH_LOGIN[i]) ) {
+                    slot = CMD_COUNT_WITHOUT_LOGIN + i;
+                    handlerBegin = monotonic_microseconds();
                     if (userInfo.uid < 0) {
                         prepare_error() << "Permission denied: '" << inMessage.get_command() << "' command requires authentication" << flush;
                         connection << msgbuf.get_message();
@@ -234,6 +336,8 @@ bool controller_client::message_loop()
                 // attempt to process commands that can only be executed with privileged login (root) status
                 for (size_type i = 0;i<CMD_COUNT_WITH_PRIVILEGED_LOGIN;i++) {
                     if ( inMessage.is_command(CMDNAME_WITH_PRIVILEGED_LOGIN[i]) ) {
+                        slot = CMD_COUNT_WITHOUT_LOGIN + CMD_COUNT_WITH_LOGIN + i;
+                        handlerBegin = monotonic_microseconds();
                         if (userInfo.uid != 0) {
                             prepare_error() << "Permission denied: '" << inMessage.get_command() << "' command requires privileged (root) authentication" << flush;
                             connection << msgbuf.get_message();
@@ -245,15 +349,46 @@ bool controller_client::message_loop()
                     }
                 }
                 if (!executed) {
+                    handlerBegin = monotonic_microseconds();
                     prepare_error() << "Command '" << inMessage.get_command() << "' is not recognized" << flush;
                     connection << msgbuf.get_message();
                 }
             }
         }
+        uint64 end = monotonic_microseconds();
+        if ( !trace.is_streaming() ) // a stream's duration is the session's, not a latency
+            minecontrol_metrics::observe_command(slot,end - begin);
+        finish_trace(trace,inMessage.get_command(),slot,end - handlerBegin,handlerBegin - begin);
     }
     return false;
 }
 
+void controller_client::finish_trace(request_trace& trace,const char* command,size_type slot,uint64 handler,uint64 dispatch)
+{
+    if ( trace.is_streaming() )
+        return;
+    // the handler's own time excludes what lower layers charged to the trace
+    uint64 charged = trace.get(request_trace::span_lock) + trace.get(request_trace::span_write);
+    trace.set(request_trace::span_dispatch,dispatch);
+    trace.set(request_trace::span_handler,handler > charged ? handler - charged : 0);
+    uint64 total = 0;
+    for (int i = 0;i < request_trace::span_count;++i) {
+        minecontrol_metrics::observe_span(int(slot),i,trace.get(i));
+        total += trace.get(i);
+    }
+    if (slowRequestMsec>0 && total >= uint64(slowRequestMsec)*1000) {
+        char buffer[32];
+        rstream& log = client_log(minecontrold::standardLog);
+        std::sprintf(buffer,"%.3fms",total / 1000.0);
+        log << "slow request '" << command << "': " << buffer << " (";
+        for (int i = 0;i < request_trace::span_count;++i) {
+            std::sprintf(buffer,"%.3fms",trace.get(i) / 1000.0);
+            log << (i > 0 ? ", " : "") << request_trace::span_name(i) << ' ' << buffer;
+        }
+        log << ')' << endline;
+    }
+}
+
 bool controller_client::command_login(rstream& kstream,rstream& vstream) // handles 'login' requests
 {
     if (userInfo.uid >= 0) {
@@ -261,16 +396,43 @@ bool controller_client::command_login(rstream& kstream,rstream& vstream) // hand
         connection << msgbuf.get_message();
         return false;
     }
-    str key;
-    str username, password;
+    bool wantToken = false;
+    str key, value;
+    str username, password, method;
     // read fields from message stream
     while (kstream >> key) {
+        vstream >> value;
         if (key == "username")
-            vstream >> username;
+            username = value;
         else if (key == "password")
-            vstream >> password;
+            password = value;
+        else if (key == "method") {
+            method = value;
+            rutil_to_lower_ref(method);
+        }
+        else if (key == "token") {
+            rutil_to_lower_ref(value);
+            wantToken = (value=="yes" || value=="true" || value=="1");
+        }
         // ignore anything else
     }
+    if (method == "peer")
+        return login_peer(username,wantToken);
+    else if (method.length()>0 && method!="password") {
+        prepare_error() << "Login method '" << method << "' is not supported" << flush;
+        connection << msgbuf.get_message();
+        return false;
+    }
+    // limit how often a host (or local user) can try to log in: each attempt may
+    // cost a crypt() call
+    int peerUid = -1, peerGid = -1;
+    sock->get_peer_credentials(peerUid,peerGid);
+    if ( !client_admission::allow_login(peerAddress,sock->get_family(),peerUid) ) {
+        prepare_error() << "Too many login attempts; try again later" << flush;
+        connection << msgbuf.get_message();
+        client_log(minecontrold::standardLog) << "authentication failure: login rate limit reached" << endline;
+        return false;
+    }
     // check fields
     if (username.length() == 0) {
         prepare_error() << "Required parameter 'username' missing" << flush;
@@ -317,12 +479,104 @@ bool controller_client::command_login(rstream& kstream,rstream& vstream) // hand
     userInfo.gid = pwd->pw_gid;
     userInfo.homeDirectory = pwd->pw_dir;
     userInfo.userName = username;
-    prepare_message() << "Authentication complete: logged in as '" << username << '\'' << flush;
-    connection << msgbuf.get_message();
+    send_login_success(wantToken);
     client_log(minecontrold::standardLog) << "client authenticated successfully as '" << username << '\'' << endline;
     return true;
 }
 
+bool controller_client::login_peer(const str& username,bool wantToken)
+{
+    // authenticate a local client using the credentials the kernel recorded for
+    // the peer when it connected; no password is exchanged or hashed
+    int uid, gid;
+    if ( !sock->get_peer_credentials(uid,gid) ) {
+        prepare_error() << "Peer authentication is only available on the local domain socket" << flush;
+        connection << msgbuf.get_message();
+        client_log(minecontrold::standardLog) << "authentication failure: no peer credentials" << endline;
+        return false;
+    }
+    passwd pwdbuf, *pwd;
+    char buffer[4096];
+    if (::getpwuid_r(uid,&pwdbuf,buffer,sizeof(buffer),&pwd)!=0 || pwd==NULL) {
+        prepare_error() << "Authentication failure: peer uid " << uid << " has no user account" << flush;
+        connection << msgbuf.get_message();
+        client_log(minecontrold::standardLog) << "authentication failure: peer uid " << uid << " has no user account" << endline;
+        return false;
+    }
+    // if the client named a user then it has to be the peer's user
+    if (username.length()>0 && username!=pwd->pw_name) {
+        prepare_error() << "Authentication failure: peer is not user '" << username << '\'' << flush;
+        connection << msgbuf.get_message();
+        client_log(minecontrold::standardLog) << "authentication failure: peer uid " << uid << " tried to log in as '" << username << '\'' << endline;
+        return false;
+    }
+    userInfo.uid = pwd->pw_uid;
+    userInfo.gid = pwd->pw_gid;
+    userInfo.homeDirectory = pwd->pw_dir;
+    userInfo.userName = pwd->pw_name;
+    send_login_success(wantToken);
+    client_log(minecontrold::standardLog) << "client authenticated by peer credentials as '" << userInfo.userName << '\'' << endline;
+    return true;
+}
+
+void controller_client::send_login_success(bool wantToken)
+{
+    str token;
+    uint64 expires;
+    if (wantToken && session_token::issue(userInfo,token,expires)) {
+        prepare_message();
+        msgbuf.enqueue_field_name("Token");
+        msgbuf.enqueue_field_name("Expires");
+        msgbuf << "Authentication complete: logged in as '" << userInfo.userName << '\'' << newline
+               << token << newline << expires << flush;
+    }
+    else {
+        prepare_message() << "Authentication complete: logged in as '" << userInfo.userName << '\'';
+        if (wantToken)
+            msgbuf << "; a session token could not be issued";
+        msgbuf << flush;
+    }
+    connection << msgbuf.get_message();
+}
+
+bool controller_client::command_resume(rstream& kstream,rstream& vstream)
+{
+    if (userInfo.uid >= 0) {
+        prepare_error() << "Log in status is already confirmed; please log out to log in again" << flush;
+        connection << msgbuf.get_message();
+        return false;
+    }
+    str key, value, token;
+    while (kstream >> key) {
+        vstream >> value;
+        if (key == "token")
+            token = value;
+    }
+    if (token.length() == 0) {
+        prepare_error() << "Required parameter 'token' missing" << flush;
+        connection << msgbuf.get_message();
+        return false;
+    }
+    user_info info;
+    session_token::token_result result = session_token::resume(token,info);
+    if (result != session_token::token_valid) {
+        const char* reason = "invalid token";
+        if (result == session_token::token_expired)
+            reason = "token expired";
+        else if (result == session_token::token_revoked)
+            reason = "token revoked";
+        prepare_error() << "Authentication failure: " << reason << flush;
+        connection << msgbuf.get_message();
+        client_log(minecontrold::standardLog) << "resume failure: " << reason << endline;
+        return false;
+    }
+    userInfo = info;
+    prepare_message() << "Session resumed: logged in as '" << userInfo.userName << '\'' << flush;
+    connection << msgbuf.get_message();
+    client_log(minecontrold::standardLog) << "client resumed session as '" << userInfo.userName << '\'' << endline;
+    return true;
+}
+
 bool controller_client::command_logout(rstream&,rstream&)
 {
     userInfo.uid = -1;
@@ -337,12 +591,17 @@ bool controller_client::command_logout(rstream&,rstream&)
 bool controller_client::command_start(rstream& kstream,rstream& vstream)
 {
     str key;
-    bool isNew = false; str serverName; str props;
+    bool isNew = false, async = false; str serverName; str props;
     stringstream errors;
     // attempt to read field list from message
     while (kstream >> key) {
         if (key == "isnew")
             vstream >> isNew;
+        else if (key == "async") {
+            vstream >> key;
+            rutil_to_lower_ref(key);
+            async = (key=="yes" || key=="true" || key=="1");
+        }
         else if (key == "servername")
             vstream >> serverName;
         else {
@@ -361,6 +620,30 @@ bool controller_client::command_start(rstream& kstream,rstream& vstream)
     }
     minecraft_server_info info(isNew,serverName.c_str(),userInfo);
     info.read_props(props,errors); // read and parse options
+    if (async) {
+        // start the server in the background; the client follows its progress
+        // with JOB-WATCH
+        uint32 jobid = start_job::launch(info,sock->get_accept_id());
+        if (jobid == 0) {
+            prepare_error() << "You already have " << start_job::MAX_PENDING << " start jobs pending (the limit per user); "
+                            "wait for one to finish" << flush;
+            connection << msgbuf.get_message();
+            return false;
+        }
+        client_log(minecontrold::standardLog) << "started job " << jobid << " for server '" << serverName << '\'' << endline;
+        prepare_message();
+        msgbuf.enqueue_field_name("Job");
+        msgbuf << "Starting server '" << serverName << "' as job " << jobid;
+        // the payload is a single field so put property errors on the same line
+        while ( errors.has_input() ) {
+            errors.getline(key);
+            if (key.length() > 0)
+                msgbuf << "; " << key;
+        }
+        msgbuf << newline << jobid << flush;
+        connection << msgbuf.get_message();
+        return true;
+    }
     // attempt to start the minecraft server
     server_handle* handle;
     handle = minecraft_server_manager::allocate_server();
@@ -380,6 +663,45 @@ bool controller_client::command_start(rstream& kstream,rstream& vstream)
     return true;
 }
 
+bool controller_client::command_job_watch(rstream& kstream,rstream& vstream)
+{
+    str key;
+    uint32 id = 0;
+    while (kstream >> key) {
+        if (key == "job")
+            vstream >> id;
+    }
+    std::shared_ptr<start_job> job = start_job::find(id);
+    if (job == nullptr || (job->get_uid() != userInfo.uid && userInfo.uid != 0)) {
+        prepare_error() << "No job was found with id=" << id << "; user may not have permission to watch it" << flush;
+        connection << msgbuf.get_message();
+        return false;
+    }
+    // send each event as it arrives; the last event is either 'ready' or 'failed'
+    request_trace::streaming();
+    bool more = true;
+    uint32 next = 0;
+    std::vector<start_job::event> events;
+    while (more && threadCondition) {
+        events.clear();
+        more = job->wait_events(next,events,1);
+        for (auto iter = events.begin();iter != events.end();++iter) {
+            msgbuf.begin("JOB-EVENT");
+            msgbuf.enqueue_field_name("Job");
+            msgbuf.enqueue_field_name("Event");
+            msgbuf.enqueue_field_name("Elapsed");
+            msgbuf.enqueue_field_name("Progress");
+            msgbuf.enqueue_field_name("Payload");
+            msgbuf << id << newline << iter->kind << newline << iter->elapsed << newline
+                   << iter->progress << newline << iter->payload << flush;
+            connection << msgbuf.get_message();
+            if (connection.get_device().get_last_operation_status() == bad_write)
+                return false; // the client went away
+        }
+    }
+    return true;
+}
+
 bool controller_client::command_status(rstream&,rstream&)
 {
     rstream& msg = prepare_list_message();
@@ -593,15 +915,38 @@ bool controller_client::command_auth_ls(rstream& kstream,rstream& vstream)
     return true;
 }
 
-bool controller_client::command_server_ls(rstream&,rstream&)
+bool controller_client::command_server_ls(rstream& kstream,rstream& vstream)
 {
+    str key;
+    str prefix;
+    size_type offset = 0, limit = size_type(-1);
     dynamic_array<str> servers;
 
-    minecraft_server::list_servers(servers,userInfo);
+    // Read optional prefix and paging fields from protocol message.
+    while (kstream >> key) {
+        if (key == "prefix")
+            vstream >> prefix;
+        else if (key == "offset")
+            vstream >> offset;
+        else if (key == "limit")
+            vstream >> limit;
+        else
+            continue;
+        if (!vstream.get_input_success()) {
+            prepare_error() << "Could not read " << key << " value from input stream" << flush;
+            connection << msgbuf.get_message();
+            return false;
+        }
+    }
+
+    minecraft_server::list_servers(servers,userInfo,prefix.c_str(),offset,limit);
 
     if (servers.size() == 0) {
         rstream& msg = prepare_message();
-        msg << "There are no minecraft servers available." << flush;
+        if (prefix.length() > 0 || offset > 0)
+            msg << "There are no more matching minecraft servers available." << flush;
+        else
+            msg << "There are no minecraft servers available." << flush;
     }
     else {
         rstream& msg = prepare_list_message();
@@ -615,6 +960,270 @@ bool controller_client::command_server_ls(rstream&,rstream&)
     return true;
 }
 
+bool controller_client::command_startup_stats(rstream& kstream,rstream& vstream)
+{
+    str key, profile;
+    while (kstream >> key) {
+        if (key == "profile")
+            vstream >> profile;
+    }
+    rstream& msg = prepare_list_message();
+    minecraft_startup_stats::print(msg,profile.length()>0 ? profile.c_str() : NULL);
+    msg.flush_output();
+    connection << msgbuf.get_message();
+    return true;
+}
+
+namespace
+{
+    // sends the lines of a log query in LOG-LINES messages of up to LINES_PER_MESSAGE
+    // items; each item is the local date and time the line was archived followed
+    // by the line
+    class log_query_sender : public minecraft_server_archive::query_sink
+    {
+    public:
+        log_query_sender(socket_stream& connection,minecontrol_message_buffer& msgbuf)
+            : _connection(connection), _msgbuf(msgbuf), _count(0), _failed(false) {}
+
+        virtual bool archive_line(uint64 time,int,const char* text,size_type length)
+        {
+            char line[4096+32];
+            time_t when = time_t(time);
+            tm local;
+            size_type n = ::strftime(line,sizeof(line),"%Y-%m-%d %H:%M:%S ",::localtime_r(&when,&local));
+            if (length > sizeof(line)-n-1)
+                length = sizeof(line)-n-1;
+            std::memcpy(line+n,text,length);
+            line[n+length] = 0;
+            if (_count == 0) {
+                _msgbuf.begin("LOG-LINES");
+                _msgbuf.repeat_field("Item");
+            }
+            _msgbuf << line << newline;
+            if (++_count >= LINES_PER_MESSAGE)
+                send();
+            return !_failed;
+        }
+
+        // sends the lines that haven't been sent yet; false if the client went away
+        bool send()
+        {
+            if (_count > 0) {
+                _msgbuf.flush_output();
+                _connection << _msgbuf.get_message();
+                _count = 0;
+                if (_connection.get_device().get_last_operation_status() == bad_write)
+                    _failed = true;
+            }
+            return !_failed;
+        }
+    private:
+        static const size_type LINES_PER_MESSAGE = 256;
+
+        socket_stream& _connection;
+        minecontrol_message_buffer& _msgbuf;
+        size_type _count;
+        bool _failed;
+    };
+}
+
+bool controller_client::command_log_query(rstream& kstream,rstream& vstream)
+{
+    static const size_type DEFAULT_LIMIT = 1000;
+    str key, value, serverName, directory;
+    minecraft_server_archive::query query;
+    query.limit = DEFAULT_LIMIT;
+    while (kstream >> key) {
+        if (key == "limit") {
+            vstream >> query.limit;
+            if (!vstream.get_input_success() || query.limit==0) {
+                prepare_error() << "Bad limit value specified; expected a positive integer" << flush;
+                connection << msgbuf.get_message();
+                return false;
+            }
+            continue;
+        }
+        vstream >> value;
+        if (key == "servername")
+            serverName = value;
+        else if (key == "since" || key == "until") {
+            if ( !minecraft_server_archive::parse_time(value.c_str(),key=="since" ? query.since : query.until) ) {
+                prepare_error() << "Bad " << key << " value '" << value << "'; expected YYYY-MM-DD[THH:MM[:SS]], HH:MM[:SS], -N[smhdw] or seconds since the epoch" << flush;
+                connection << msgbuf.get_message();
+                return false;
+            }
+        }
+        else if (key == "gist") {
+            if ( !minecraft_server_archive::parse_gists(value.c_str(),query.gists) ) {
+                prepare_error() << "Bad gist list '" << value << "'; expected comma-separated gist names" << flush;
+                connection << msgbuf.get_message();
+                return false;
+            }
+        }
+        else if (key == "match")
+            query.match = value;
+    }
+    if (serverName.length() == 0) {
+        prepare_error() << "No server name specified" << flush;
+        connection << msgbuf.get_message();
+        return false;
+    }
+    if ( !minecraft_server::find_server_directory(userInfo,serverName.c_str(),directory) ) {
+        prepare_error() << "No server named '" << serverName << "' was found" << flush;
+        connection << msgbuf.get_message();
+        return false;
+    }
+
+    // if the server is running, write out the lines its archive is holding so
+    // that the query sees everything up to now; the lookup also returns other
+    // users' servers (same group, or all of them for root), so match the owner
+    dynamic_array<server_handle*> servers;
+    if (minecraft_server_manager::lookup_auth_servers(userInfo,servers) == minecraft_server_manager::auth_lookup_found) {
+        for (size_type i = 0;i < servers.size();++i) {
+            minecontrol_authority* pauth = servers[i]->pserver->get_authority();
+            if (pauth!=NULL && servers[i]->pserver->get_owner_uid()==userInfo.uid
+                && servers[i]->pserver->get_internal_name()==serverName)
+                pauth->get_archive().flush();
+        }
+    }
+    if (servers.size() > 0)
+        minecraft_server_manager::attach_server(&servers[0],servers.size());
+
+    // the scan reads the files directly so it doesn't hold up the server
+    request_trace::streaming();
+    log_query_sender sender(connection,msgbuf);
+    minecraft_server_archive::query_result result;
+    if ( !minecraft_server_archive::run_query(directory,userInfo.uid,userInfo.gid,query,sender,result) ) {
+        prepare_error() << "Server '" << serverName << "' has no output archive" << flush;
+        connection << msgbuf.get_message();
+        return false;
+    }
+    if ( !sender.send() )
+        return false;
+    rstream& msg = prepare_message();
+    msg << result.matched << " lines matched";
+    if (result.truncated)
+        msg << " (stopped at the limit of " << query.limit << ')';
+    msg << "; read " << result.segmentsScanned << " of " << result.segments << " segments and "
+        << result.blocksScanned << " blocks" << flush;
+    connection << msgbuf.get_message();
+    return true;
+}
+
+bool controller_client::command_player_stats(rstream& kstream,rstream& vstream)
+{
+    static const size_type DEFAULT_BUCKET = 3600;
+    static const uint64 MAX_BUCKETS = 1000;
+    str key, value, serverName, report, player, directory;
+    uint64 since = 0, until = ::time(NULL);
+    size_type bucket = DEFAULT_BUCKET;
+    bool haveSince = false;
+    while (kstream >> key) {
+        if (key == "bucket") {
+            vstream >> bucket;
+            if (!vstream.get_input_success() || bucket==0) {
+                prepare_error() << "Bad bucket value specified; expected a positive number of seconds" << flush;
+                connection << msgbuf.get_message();
+                return false;
+            }
+            continue;
+        }
+        vstream >> value;
+        if (key == "servername")
+            serverName = value;
+        else if (key == "since" || key == "until") {
+            if ( !minecraft_server_archive::parse_time(value.c_str(),key=="since" ? since : until) ) {
+                prepare_error() << "Bad " << key << " value '" << value << "'; expected YYYY-MM-DD[THH:MM[:SS]], HH:MM[:SS], -N[smhdw] or seconds since the epoch" << flush;
+                connection << msgbuf.get_message();
+                return false;
+            }
+            if (key == "since")
+                haveSince = true;
+        }
+        else if (key == "report")
+            report = value;
+        else if (key == "player")
+            player = value;
+    }
+    if (report.length() == 0)
+        report = "playtime";
+    else if (report!="playtime" && report!="peak") {
+        prepare_error() << "Bad report '" << report << "'; expected 'playtime' or 'peak'" << flush;
+        connection << msgbuf.get_message();
+        return false;
+    }
+    if (serverName.length() == 0) {
+        prepare_error() << "No server name specified" << flush;
+        connection << msgbuf.get_message();
+        return false;
+    }
+    if ( !minecraft_server::find_server_directory(userInfo,serverName.c_str(),directory) ) {
+        prepare_error() << "No server named '" << serverName << "' was found" << flush;
+        connection << msgbuf.get_message();
+        return false;
+    }
+
+    // a running server's ledger is already in memory; otherwise read the file
+    // (only a server owned by this user can be the one in 'directory')
+    std::vector<minecraft_player_ledger::playtime> playtimes;
+    std::vector<minecraft_player_ledger::peak> peaks;
+    const minecraft_player_ledger* pledger = NULL;
+    minecraft_player_ledger* ploaded = NULL;
+    dynamic_array<server_handle*> servers;
+    if (minecraft_server_manager::lookup_auth_servers(userInfo,servers) == minecraft_server_manager::auth_lookup_found) {
+        for (size_type i = 0;i < servers.size();++i) {
+            minecontrol_authority* pauth = servers[i]->pserver->get_authority();
+            if (pauth!=NULL && servers[i]->pserver->get_owner_uid()==userInfo.uid
+                && servers[i]->pserver->get_internal_name()==serverName)
+                pledger = &pauth->get_ledger();
+        }
+    }
+    if (pledger == NULL)
+        pledger = ploaded = new minecraft_player_ledger(directory,userInfo.uid,userInfo.gid,false);
+    if (!haveSince && report=="peak")
+        since = pledger->get_first_time();
+    if (report=="peak" && until>since && (until-since)/bucket>=MAX_BUCKETS) {
+        prepare_error() << "The range covers too many buckets; use a larger bucket or a shorter range" << flush;
+        connection << msgbuf.get_message();
+        if (servers.size() > 0)
+            minecraft_server_manager::attach_server(&servers[0],servers.size());
+        delete ploaded;
+        return false;
+    }
+    if (report == "playtime")
+        pledger->get_playtime(since,until,player.length()>0 ? player.c_str() : NULL,playtimes);
+    else
+        pledger->get_peaks(since,until,bucket,peaks);
+    if (servers.size() > 0)
+        minecraft_server_manager::attach_server(&servers[0],servers.size());
+    delete ploaded;
+
+    if (playtimes.size()==0 && peaks.size()==0) {
+        prepare_message() << "No player sessions were recorded in that range" << flush;
+        connection << msgbuf.get_message();
+        return true;
+    }
+    rstream& msg = prepare_list_message();
+    for (size_type i = 0;i < playtimes.size();++i) {
+        const minecraft_player_ledger::playtime& entry = playtimes[i];
+        msg << entry.name.c_str();
+        if ( !entry.uuid.empty() )
+            msg << " (" << entry.uuid.c_str() << ')';
+        msg << ": " << entry.seconds/3600 << "h " << entry.seconds/60%60 << "m " << entry.seconds%60
+            << "s in " << entry.sessions << (entry.sessions==1 ? " session" : " sessions") << newline;
+    }
+    for (size_type i = 0;i < peaks.size();++i) {
+        char when[32];
+        time_t start = time_t(peaks[i].start);
+        tm local;
+        ::strftime(when,sizeof(when),"%Y-%m-%d %H:%M",::localtime_r(&start,&local));
+        msg << when << "  " << peaks[i].players << (peaks[i].players==1 ? " player" : " players") << newline;
+    }
+    msg.flush_output();
+    connection << msgbuf.get_message();
+    return true;
+}
+
 bool controller_client::command_profile_ls(rstream&,rstream&)
 {
     dynamic_array<str> profiles;
@@ -761,6 +1370,7 @@ bool controller_client::command_console(rstream& kstream,rstream& vstream)
     // be shared with other clients who are logged into this minecontrol server
     minecraft_server_manager::attach_server(&servers[0],servers.size());
     if (pauth != NULL) {
+        request_trace::streaming();
         client_log(minecontrold::standardLog) << "client entered console mode on server '" << serverName << "' with id=" << serverID << endline;
         res = pauth->client_console_operation(*sock);
         client_log(minecontrold::standardLog) << "client exited console mode on server '" << serverName << "' with id=" << serverID << endline;
@@ -779,3 +1389,69 @@ bool controller_client::command_shutdown(rstream&,rstream&)
     minecontrold::shutdown_minecontrold();
     return true;
 }
+
+namespace
+{
+    // formats "mean M, p50 <= A, p99 <= B" from a histogram read by read_histogram
+    void describe_histogram(char* buffer,size_t size,const uint64* slots,uint64 count)
+    {
+        const uint64 PAST = ~uint64(0);
+        uint64 p50 = minecontrol_metrics::estimate_quantile(slots,0.5);
+        uint64 p99 = minecontrol_metrics::estimate_quantile(slots,0.99);
+        uint64 last = minecontrol_metrics::BUCKET_LIMITS[minecontrol_metrics::BUCKET_COUNT-1];
+        std::snprintf(buffer,size,"mean %.3fms, p50 %s %.3fms, p99 %s %.3fms",
+            slots[minecontrol_metrics::BUCKET_COUNT+1] / 1000.0 / count,
+            p50==PAST ? ">" : "<=",(p50==PAST ? last : p50) / 1000.0,
+            p99==PAST ? ">" : "<=",(p99==PAST ? last : p99) / 1000.0);
+    }
+}
+
+bool controller_client::command_stats(rstream& kstream,rstream& vstream)
+{
+    // lists each command that has been run with its latency and the latency of
+    // each of its trace spans; percentiles are bucket limits so they are upper bounds
+    str key, command;
+    while (kstream >> key) {
+        if (key == "command")
+            vstream >> command;
+    }
+    rutil_to_lower_ref(command);
+    uint64 slots[minecontrol_metrics::BUCKET_COUNT + 2];
+    char buffer[160];
+    bool any = false;
+    rstream& msg = prepare_list_message();
+    for (int i = 0;i < minecontrol_metrics::get_command_count();++i) {
+        const char* name = minecontrol_metrics::get_command_name(i);
+        if (command.length()>0 && command!=name)
+            continue;
+        minecontrol_metrics::read_histogram(minecontrol_metrics::command_histogram(i),slots);
+        uint64 count = 0;
+        for (int b = 0;b <= minecontrol_metrics::BUCKET_COUNT;++b)
+            count += slots[b];
+        if (count == 0)
+            continue;
+        any = true;
+        describe_histogram(buffer,sizeof(buffer),slots,count);
+        msg << name << ": " << count << " requests, " << buffer << newline;
+        for (int j = 0;j < request_trace::span_count;++j) {
+            minecontrol_metrics::read_histogram(minecontrol_metrics::span_histogram(i,j),slots);
+            uint64 spanCount = 0;
+            for (int b = 0;b <= minecontrol_metrics::BUCKET_COUNT;++b)
+                spanCount += slots[b];
+            if (spanCount == 0)
+                continue;
+            describe_histogram(buffer,sizeof(buffer),slots,spanCount);
+            msg << "  " << request_trace::span_name(j) << ": " << buffer << newline;
+        }
+    }
+    if (!any)
+        msg << "No requests have been recorded" << newline;
+    if (command.length()==0 && mutex::has_stats()) {
+        // contention on the daemon's named locks
+        msg << "locks:" << newline;
+        mutex::write_stats(msg);
+    }
+    msg.flush_output();
+    connection << msgbuf.get_message();
+    return true;
+}
@@ -4,6 +4,7 @@
 #include <rlibrary/rdynarray.h>
 #include "minecontrol-protocol.h"
 #include "minecontrol-misc-types.h"
+#include "minecontrol-trace.h"
 #include "socket.h" // gets io_device
 #include "mutex.h" // gets pthread
 
@@ -23,10 +24,27 @@ namespace minecraft_controller
 
         static void shutdown_clients();
 	static void close_client_sockets();
+
+        // names the per-command latency metrics after the command tables
+        static void register_metrics();
+
+        // the number of clients that are connected
+        static rtypes::size_type count_clients();
+
+        // sets the number of seconds a new client has to send HELLO
+        static void set_hello_timeout(rtypes::uint32 seconds)
+        { helloTimeout = seconds; }
+
+        // sets the time (in milliseconds) past which a request is logged along
+        // with its trace spans; zero disables the log
+        static void set_slow_request_threshold(rtypes::uint32 msec)
+        { slowRequestMsec = msec; }
     private:
         controller_client(socket* acceptedSocket);
         ~controller_client();
 
+        static rtypes::uint32 helloTimeout;
+        static rtypes::uint32 slowRequestMsec;
         static mutex clientsMutex; // protects 'clients'
         static rtypes::dynamic_array<void*> clients; // rlibrary limitation: reduces coat-bloat
         static void* client_thread(void*);
@@ -57,6 +75,16 @@ namespace minecraft_controller
         bool command_stop(rtypes::rstream&,rtypes::rstream&);
         bool command_console(rtypes::rstream&,rtypes::rstream&);
         bool command_shutdown(rtypes::rstream&,rtypes::rstream&);
+        bool command_resume(rtypes::rstream&,rtypes::rstream&);
+        bool command_job_watch(rtypes::rstream&,rtypes::rstream&);
+        bool command_startup_stats(rtypes::rstream&,rtypes::rstream&);
+        bool command_log_query(rtypes::rstream&,rtypes::rstream&);
+        bool command_player_stats(rtypes::rstream&,rtypes::rstream&);
+        bool command_stats(rtypes::rstream&,rtypes::rstream&);
+        void finish_trace(request_trace& trace,const char* command,rtypes::size_type slot,
+            rtypes::uint64 handler,rtypes::uint64 dispatch);
+        bool login_peer(const rtypes::str& username,bool wantToken);
+        void send_login_success(bool wantToken);
 
         // helpers
         rtypes::rstream& client_log(rtypes::rstream& stream)
@@ -98,6 +126,7 @@ namespace minecraft_controller
         pthread_t threadID;
         volatile bool threadCondition;
         user_info userInfo;
+        rtypes::str peerAddress;
         rtypes::size_type referenceIndex;
     };
 }
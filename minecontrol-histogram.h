@@ -0,0 +1,113 @@
+// minecontrol-histogram.h
+#ifndef MINECONTROL_HISTOGRAM_H
+#define MINECONTROL_HISTOGRAM_H
+#include <rlibrary/rtypestypes.h>
+#include <cstring>
+
+namespace minecraft_controller
+{
+    /* latency_histogram:
+     *  log-linear buckets (16 per power of two) over non-negative values in any
+     * unit, so quantiles are within about 6% of the true value whatever the sample
+     * count; recording never allocates and histograms kept by several threads can
+     * be merged; the histogram does no locking of its own
+     */
+    class latency_histogram
+    {
+    public:
+        latency_histogram()
+        { clear(); }
+
+        void clear()
+        {
+            std::memset(_buckets,0,sizeof(_buckets));
+            _count = _sum = _max = 0;
+            _min = ~rtypes::uint64(0);
+        }
+        void add(rtypes::uint64 value)
+        {
+            ++_buckets[_bucket(value)];
+            ++_count;
+            _sum += value;
+            if (value < _min)
+                _min = value;
+            if (value > _max)
+                _max = value;
+        }
+        void merge(const latency_histogram& other)
+        {
+            for (int i = 0;i < BUCKET_COUNT;++i)
+                _buckets[i] += other._buckets[i];
+            _count += other._count;
+            _sum += other._sum;
+            if (other._min < _min)
+                _min = other._min;
+            if (other._max > _max)
+                _max = other._max;
+        }
+
+        rtypes::uint64 count() const
+        { return _count; }
+        rtypes::uint64 sum() const
+        { return _sum; }
+        rtypes::uint64 min() const // zero if empty
+        { return _count == 0 ? 0 : _min; }
+        rtypes::uint64 max() const
+        { return _max; }
+        double mean() const
+        { return _count == 0 ? 0 : double(_sum) / _count; }
+
+        // the upper limit of the bucket holding the q-th quantile (0 < q <= 1),
+        // or zero if the histogram is empty
+        rtypes::uint64 quantile(double q) const
+        {
+            if (_count == 0)
+                return 0;
+            rtypes::uint64 rank = rtypes::uint64(q*_count + 0.999999), seen = 0;
+            if (rank == 0)
+                rank = 1;
+            for (int i = 0;i < BUCKET_COUNT;++i) {
+                seen += _buckets[i];
+                if (seen >= rank) {
+                    rtypes::uint64 limit = _bucket_limit(i);
+                    return limit < _max ? limit : _max;
+                }
+            }
+            return _max;
+        }
+    private:
+        static const int SUB_BUCKETS = 16; // per power of two
+        static const int BUCKET_COUNT = SUB_BUCKETS * 48;
+
+        rtypes::uint64 _buckets[BUCKET_COUNT];
+        rtypes::uint64 _count, _sum, _min, _max;
+
+        static int _bucket(rtypes::uint64 value)
+        {
+            // values below SUB_BUCKETS get a bucket each; above that, the four bits
+            // after the leading one pick the sub-bucket
+            if (value < rtypes::uint64(SUB_BUCKETS))
+                return int(value);
+            int e = 63 - __builtin_clzll(value); // >= 4
+            int bucket = (e-3)*SUB_BUCKETS + int((value >> (e-4)) & (SUB_BUCKETS-1));
+            return bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT-1;
+        }
+        static rtypes::uint64 _bucket_limit(int bucket)
+        {
+            if (bucket < SUB_BUCKETS)
+                return rtypes::uint64(bucket);
+            int e = bucket/SUB_BUCKETS + 3;
+            return (rtypes::uint64(SUB_BUCKETS + bucket%SUB_BUCKETS + 1) << (e-4)) - 1;
+        }
+    };
+}
+
+#endif
+
+/*
+ * Local Variables:
+ * mode:c++
+ * indent-tabs-mode:nil
+ * tab-width:4
+ * End:
+ */
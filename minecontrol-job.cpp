@@ -0,0 +1,242 @@
+// minecontrol-job.cpp
+#include "minecontrol-job.h"
+#include "minecraft-controller.h"
+#include <rlibrary/rstringstream.h>
+#include <stdlib.h>
+#include <time.h>
+using namespace rtypes;
+using namespace minecraft_controller;
+
+// start_job
+
+/*static*/ mutex start_job::_jobsMtx("jobs");
+/*static*/ std::map<uint32,std::shared_ptr<start_job> > start_job::_jobs;
+/*static*/ uint32 start_job::_nextId = 1;
+/*static*/ pthread_mutex_t start_job::_launchMtx = PTHREAD_MUTEX_INITIALIZER;
+/*static*/ pthread_cond_t start_job::_launchCond = PTHREAD_COND_INITIALIZER;
+/*static*/ int start_job::_launching = 0;
+/*static*/ const int start_job::MAX_PENDING;
+
+start_job::start_job(uint32 id,const minecraft_server_info& info,uint64 clientid)
+    : _id(id), _uid(info.userInfo.uid), _clientid(clientid), _serverid(0), _info(info),
+      _start(monotonic_milliseconds()), _finishedAt(0), _nextSequence(1), _finished(false)
+{
+    if (pthread_mutex_init(&_mtx,NULL) != 0)
+        throw start_job_error();
+    if (pthread_cond_init(&_cond,NULL) != 0) {
+        pthread_mutex_destroy(&_mtx);
+        throw start_job_error();
+    }
+}
+start_job::~start_job()
+{
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_mtx);
+}
+/*static*/ uint32 start_job::launch(const minecraft_server_info& info,uint64 clientid)
+{
+    std::shared_ptr<start_job> job;
+    uint64 now = monotonic_milliseconds();
+    int pending = 0;
+    _jobsMtx.lock();
+    // forget jobs that finished a while ago and count the user's unfinished ones
+    auto iter = _jobs.begin();
+    while (iter != _jobs.end()) {
+        uint64 finishedAt;
+        pthread_mutex_lock(&iter->second->_mtx);
+        finishedAt = iter->second->_finishedAt;
+        pthread_mutex_unlock(&iter->second->_mtx);
+        if (finishedAt != 0 && now-finishedAt >= JOB_LINGER*1000)
+            iter = _jobs.erase(iter);
+        else {
+            if (finishedAt==0 && iter->second->_uid==info.userInfo.uid)
+                ++pending;
+            ++iter;
+        }
+    }
+    if (pending >= MAX_PENDING) {
+        _jobsMtx.unlock();
+        return 0;
+    }
+    job.reset(new start_job(_nextId++,info,clientid));
+    _jobs[job->_id] = job;
+    _jobsMtx.unlock();
+
+    job->_add_event("begin",info.internalName);
+
+    // the launch thread owns a reference to the job until it is done with it
+    pthread_t threadID;
+    pthread_attr_t attr;
+    std::shared_ptr<start_job>* param = new std::shared_ptr<start_job>(job);
+    pthread_mutex_lock(&_launchMtx);
+    ++_launching;
+    pthread_mutex_unlock(&_launchMtx);
+    if (pthread_attr_init(&attr) != 0 || pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED) != 0
+        || pthread_create(&threadID,&attr,&start_job::_launch_thread,param) != 0)
+    {
+        delete param;
+        pthread_mutex_lock(&_launchMtx);
+        --_launching;
+        pthread_mutex_unlock(&_launchMtx);
+        throw start_job_error();
+    }
+    pthread_attr_destroy(&attr);
+    return job->_id;
+}
+/*static*/ std::shared_ptr<start_job> start_job::find(uint32 id)
+{
+    std::shared_ptr<start_job> job;
+    _jobsMtx.lock();
+    auto iter = _jobs.find(id);
+    if (iter != _jobs.end())
+        job = iter->second;
+    _jobsMtx.unlock();
+    return job;
+}
+/*static*/ void start_job::wait_launches()
+{
+    pthread_mutex_lock(&_launchMtx);
+    while (_launching > 0)
+        pthread_cond_wait(&_launchCond,&_launchMtx);
+    pthread_mutex_unlock(&_launchMtx);
+}
+bool start_job::wait_events(uint32& next,std::vector<event>& out,int timeout)
+{
+    bool more;
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME,&deadline);
+    deadline.tv_sec += timeout;
+    pthread_mutex_lock(&_mtx);
+    while (!_finished && next >= _nextSequence) {
+        if (pthread_cond_timedwait(&_cond,&_mtx,&deadline) != 0)
+            break;
+    }
+    // events older than the queue were dropped; the watcher just skips them
+    for (auto iter = _events.begin();iter != _events.end();++iter) {
+        if (iter->sequence >= next)
+            out.push_back(*iter);
+    }
+    if (next < _nextSequence)
+        next = _nextSequence;
+    more = !_finished;
+    pthread_mutex_unlock(&_mtx);
+    return more;
+}
+void start_job::startup_line(const char*,const minecraft_server_message* message)
+{
+    if (message == NULL || !message->good())
+        return;
+    switch (message->get_gist()) {
+    case gist_server_start:
+        _add_event("version",message->get_token(0));
+        break;
+    case gist_server_start_bind:
+        _add_event("bind",message->get_token(0));
+        break;
+    case gist_server_prepare_spawn:
+        // token looks like "42%"
+        _add_event("progress",message->get_payload(),atoi(message->get_token(0).c_str()));
+        break;
+    case gist_server_ready:
+        // startup_finished() reports the ready event
+        break;
+    default:
+        _add_event("log",message->get_payload());
+        break;
+    }
+}
+void start_job::startup_finished(bool ready)
+{
+    stringstream ss;
+    uint32 serverid;
+    uint64 elapsed = monotonic_milliseconds() - _start;
+    pthread_mutex_lock(&_mtx);
+    serverid = _serverid;
+    pthread_mutex_unlock(&_mtx);
+    if (ready) {
+        ss << "server ready in " << elapsed/1000 << '.' << (elapsed%1000)/100 << 's';
+        _finish("ready",ss.get_device());
+    }
+    else
+        _finish("failed","server process exited before it was ready");
+    minecontrold::standardLog << '{' << _clientid << "} " << (ready ? "server ready after " : "server exited before ready after ")
+                              << elapsed << "ms {" << serverid << '}' << endline;
+}
+/*static*/ void* start_job::_launch_thread(void* pparam)
+{
+    std::shared_ptr<start_job> job;
+    std::shared_ptr<start_job>* param = reinterpret_cast<std::shared_ptr<start_job>*>(pparam);
+    job.swap(*param);
+    delete param;
+
+    // do what a synchronous START does but report the outcome as job events; the
+    // authority only holds on to the job while the server is starting up
+    server_handle* handle;
+    handle = minecraft_server_manager::allocate_server();
+    handle->set_clientid(job->_clientid);
+    job->_info.startupListener = job;
+    bool launched = true;
+    auto cond = minecraft_server::mcraft_start_failure_unknown;
+    try {
+        cond = handle->pserver->begin(job->_info);
+    } catch (...) {
+        // nothing above this thread would catch it; report it to the watchers
+        // instead of taking the daemon down
+        launched = false;
+    }
+    job->_info.startupListener.reset();
+    stringstream ss;
+    if (!launched) {
+        minecontrold::standardLog << '{' << job->_clientid << "} job " << job->_id << ": server launch failed" << endline;
+        job->_finish("failed","the server could not be launched");
+    }
+    else {
+        minecontrold::standardLog << '{' << job->_clientid << "} " << cond << " {" << handle->pserver->get_internal_id() << '}' << endline;
+        ss << cond;
+        if (cond == minecraft_server::mcraft_start_success) {
+            uint32 serverid = handle->pserver->get_internal_id();
+            pthread_mutex_lock(&job->_mtx);
+            job->_serverid = serverid;
+            pthread_mutex_unlock(&job->_mtx);
+            ss << " (server id " << serverid << ')';
+            job->_add_event("started",ss.get_device());
+        }
+        else
+            job->_finish("failed",ss.get_device());
+    }
+    minecraft_server_manager::attach_server(handle);
+
+    pthread_mutex_lock(&_launchMtx);
+    if (--_launching == 0)
+        pthread_cond_broadcast(&_launchCond);
+    pthread_mutex_unlock(&_launchMtx);
+    return NULL;
+}
+void start_job::_add_event(const char* kind,const str& payload,int progress)
+{
+    event ev;
+    ev.kind = kind;
+    ev.payload = payload;
+    ev.progress = progress;
+    ev.elapsed = monotonic_milliseconds() - _start;
+    pthread_mutex_lock(&_mtx);
+    if (!_finished) {
+        ev.sequence = _nextSequence++;
+        _events.push_back(ev);
+        if (_events.size() > MAX_EVENTS)
+            _events.pop_front();
+        pthread_cond_broadcast(&_cond);
+    }
+    pthread_mutex_unlock(&_mtx);
+}
+void start_job::_finish(const char* kind,const str& payload)
+{
+    _add_event(kind,payload);
+    pthread_mutex_lock(&_mtx);
+    if (!_finished) {
+        _finished = true;
+        _finishedAt = monotonic_milliseconds();
+        pthread_cond_broadcast(&_cond);
+    }
+    pthread_mutex_unlock(&_mtx);
+}
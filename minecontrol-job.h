@@ -0,0 +1,110 @@
+// minecontrol-job.h
+#ifndef MINECONTROL_JOB_H
+#define MINECONTROL_JOB_H
+#include "minecraft-server.h"
+#include "mutex.h"
+#include <pthread.h>
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace minecraft_controller
+{
+    class start_job_error { };
+
+    /* start_job:
+     *  an asynchronous START; the server is started on a thread of its own so the
+     * client connection is free at once, and the lines the server prints while it
+     * starts up are turned into events that any number of clients may watch until
+     * the server reports that it is ready (or fails)
+     */
+    class start_job : public minecraft_startup_listener,
+                      public std::enable_shared_from_this<start_job>
+    {
+    public:
+        struct event
+        {
+            rtypes::uint32 sequence;
+            const char* kind; // begin, started, version, bind, progress, log, ready or failed
+            rtypes::str payload;
+            int progress; // spawn area percentage or -1
+            rtypes::uint64 elapsed; // milliseconds since the job was launched
+        };
+
+        // starts the server described by 'info' in the background and returns
+        // the id of the new job; 'clientid' is used for logging; returns zero
+        // without starting anything if the user already has MAX_PENDING jobs
+        // that haven't finished
+        static rtypes::uint32 launch(const minecraft_server_info& info,rtypes::uint64 clientid);
+
+        static const int MAX_PENDING = 4; // unfinished jobs allowed per user
+
+        // finds a job by id; finished jobs are kept for a while so a late watcher
+        // still sees how the job ended
+        static std::shared_ptr<start_job> find(rtypes::uint32 id);
+
+        // blocks until no job is still running minecraft_server::begin; called
+        // before the server manager is shut down
+        static void wait_launches();
+
+        ~start_job();
+
+        rtypes::uint32 get_id() const
+        { return _id; }
+        int get_uid() const
+        { return _uid; }
+
+        // appends the events with sequence numbers at or after 'next' to 'out' and
+        // advances 'next'; waits up to 'timeout' seconds for an event to arrive;
+        // returns false once the job is finished and its last event was delivered
+        bool wait_events(rtypes::uint32& next,std::vector<event>& out,int timeout);
+
+        // minecraft_startup_listener
+        virtual void startup_line(const char* line,const minecraft_server_message* message);
+        virtual void startup_finished(bool ready);
+    private:
+        start_job(rtypes::uint32 id,const minecraft_server_info& info,rtypes::uint64 clientid);
+        start_job(const start_job&);
+        start_job& operator =(const start_job&);
+
+        static const rtypes::size_type MAX_EVENTS = 256; // oldest events are dropped past this
+        static const rtypes::uint64 JOB_LINGER = 600; // seconds a finished job is kept
+
+        static mutex _jobsMtx; // protects the registry
+        static std::map<rtypes::uint32,std::shared_ptr<start_job> > _jobs;
+        static rtypes::uint32 _nextId;
+        static pthread_mutex_t _launchMtx;
+        static pthread_cond_t _launchCond;
+        static int _launching;
+
+        static void* _launch_thread(void*);
+
+        void _add_event(const char* kind,const rtypes::str& payload,int progress = -1);
+        void _finish(const char* kind,const rtypes::str& payload);
+
+        rtypes::uint32 _id;
+        int _uid;
+        rtypes::uint64 _clientid;
+        rtypes::uint32 _serverid; // guarded by _mtx
+        minecraft_server_info _info;
+        rtypes::uint64 _start;
+        rtypes::uint64 _finishedAt; // monotonic milliseconds; zero while running
+
+        pthread_mutex_t _mtx; // protects the event queue and state
+        pthread_cond_t _cond;
+        std::deque<event> _events;
+        rtypes::uint32 _nextSequence;
+        bool _finished;
+    };
+}
+
+#endif
+
+/*
+ * Local Variables:
+ * mode:c++
+ * indent-tabs-mode:nil
+ * tab-width:4
+ * End:
+ */
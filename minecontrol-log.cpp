@@ -0,0 +1,179 @@
+// minecontrol-log.cpp
+#include "minecontrol-log.h"
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+using namespace rtypes;
+using namespace minecraft_controller;
+
+// log_queue
+
+/*static*/ std::atomic<log_queue::_record*> log_queue::_head(nullptr);
+/*static*/ std::atomic<size_type> log_queue::_queued(0);
+/*static*/ std::atomic<uint64> log_queue::_dropped(0);
+/*static*/ std::atomic<uint64> log_queue::_droppedTotal(0);
+/*static*/ std::atomic<bool> log_queue::_running(false);
+/*static*/ volatile bool log_queue::_stopping = false;
+/*static*/ size_type log_queue::_limit = log_queue::DEFAULT_LIMIT;
+/*static*/ int log_queue::_eventFd = -1;
+/*static*/ pthread_t log_queue::_threadID;
+/*static*/ void log_queue::start()
+{
+    if ( _running.load() )
+        return;
+    // the eventfd is kept for the life of the process: a thread may still
+    // signal it after stop(), which must not hit a reused descriptor
+    if (_eventFd == -1 && (_eventFd = ::eventfd(0,EFD_CLOEXEC)) == -1)
+        throw log_queue_error();
+    _stopping = false;
+    _running.store(true);
+    if (::pthread_create(&_threadID,NULL,&log_queue::_writer_thread,NULL) != 0) {
+        _running.store(false);
+        throw log_queue_error();
+    }
+}
+/*static*/ void log_queue::stop()
+{
+    if ( !_running.load() )
+        return;
+    // new lines are written synchronously from here on
+    uint64 one = 1;
+    _running.store(false);
+    _stopping = true;
+    if (::write(_eventFd,&one,sizeof(one)) == -1) {
+        // the writer can't be woken; it will find the stop flag on its next wake-up
+    }
+    ::pthread_join(_threadID,NULL);
+    // a thread that saw the writer running just before it stopped may have
+    // queued one more line
+    _drain();
+}
+/*static*/ void log_queue::write(const char* prefix,size_type prefixLength,const char* text,size_type length)
+{
+    if ( !_running.load(std::memory_order_acquire) ) {
+        char buffer[4096];
+        if (prefixLength+length <= sizeof(buffer)) {
+            std::memcpy(buffer,prefix,prefixLength);
+            std::memcpy(buffer+prefixLength,text,length);
+            _write_all(buffer,prefixLength+length);
+        }
+        else {
+            _write_all(prefix,prefixLength);
+            _write_all(text,length);
+        }
+        return;
+    }
+
+    // bounded loss: a stalled disk must not stall (or exhaust) the daemon
+    size_type total = prefixLength + length;
+    if (_queued.load(std::memory_order_relaxed)+total > _limit) {
+        _dropped.fetch_add(1,std::memory_order_relaxed);
+        _droppedTotal.fetch_add(1,std::memory_order_relaxed);
+        return;
+    }
+    _record* rec = reinterpret_cast<_record*>(std::malloc(offsetof(_record,text) + total));
+    if (rec == nullptr) {
+        _dropped.fetch_add(1,std::memory_order_relaxed);
+        _droppedTotal.fetch_add(1,std::memory_order_relaxed);
+        return;
+    }
+    rec->length = total;
+    std::memcpy(rec->text,prefix,prefixLength);
+    std::memcpy(rec->text+prefixLength,text,length);
+    _queued.fetch_add(total,std::memory_order_relaxed);
+    rec->next = _head.load(std::memory_order_relaxed);
+    while ( !_head.compare_exchange_weak(rec->next,rec,std::memory_order_release,std::memory_order_relaxed) )
+        ;
+    // only the line that makes the queue non-empty has to wake the writer
+    if (rec->next == nullptr) {
+        uint64 one = 1;
+        if (::write(_eventFd,&one,sizeof(one)) == -1) {
+            // the counter can only overflow if the writer is gone
+        }
+    }
+}
+/*static*/ void* log_queue::_writer_thread(void*)
+{
+    while (true) {
+        uint64 count;
+        if (::read(_eventFd,&count,sizeof(count))==-1 && errno!=EINTR)
+            break;
+        _drain();
+        if (_stopping)
+            break;
+    }
+    return NULL;
+}
+/*static*/ void log_queue::_drain()
+{
+    // take every queued line at once; the stack holds them newest first
+    _record* list = _head.exchange(nullptr,std::memory_order_acquire);
+    _record* ordered = nullptr;
+    while (list != nullptr) {
+        _record* next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+    }
+
+    static const int BATCH = 64;
+    iovec iov[BATCH];
+    _record* batch[BATCH];
+    while (ordered != nullptr) {
+        int n = 0;
+        size_type bytes = 0;
+        for (;ordered!=nullptr && n<BATCH;ordered = ordered->next,++n) {
+            batch[n] = ordered;
+            iov[n].iov_base = ordered->text;
+            iov[n].iov_len = ordered->length;
+            bytes += ordered->length;
+        }
+        // write the batch, picking up after short writes
+        int first = 0;
+        while (first < n) {
+            ssize_t written = ::writev(STDOUT_FILENO,iov+first,n-first);
+            if (written == -1) {
+                if (errno == EINTR)
+                    continue;
+                break; // nowhere to log to; drop the batch
+            }
+            while (first<n && size_type(written)>=iov[first].iov_len) {
+                written -= iov[first].iov_len;
+                ++first;
+            }
+            if (first < n) {
+                iov[first].iov_base = reinterpret_cast<char*>(iov[first].iov_base) + written;
+                iov[first].iov_len -= written;
+            }
+        }
+        for (int i = 0;i < n;++i)
+            std::free(batch[i]);
+        _queued.fetch_sub(bytes,std::memory_order_relaxed);
+    }
+
+    uint64 dropped = _dropped.exchange(0,std::memory_order_relaxed);
+    if (dropped > 0) {
+        char notice[96];
+        int len = std::snprintf(notice,sizeof(notice),"[log: %llu lines were dropped while the log was not keeping up]\n",
+            (unsigned long long)dropped);
+        _write_all(notice,size_type(len));
+    }
+}
+/*static*/ void log_queue::_write_all(const char* data,size_type length)
+{
+    while (length > 0) {
+        ssize_t n = ::write(STDOUT_FILENO,data,length);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        data += n;
+        length -= n;
+    }
+}
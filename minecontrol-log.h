@@ -0,0 +1,71 @@
+// minecontrol-log.h
+#ifndef MINECONTROL_LOG_H
+#define MINECONTROL_LOG_H
+#include <rlibrary/rtypestypes.h>
+#include <pthread.h>
+#include <atomic>
+
+namespace minecraft_controller
+{
+    class log_queue_error { };
+
+    /* log_queue:
+     *  static class that takes finished log lines from any thread and writes them
+     * to standard output from a background thread; lines are pushed onto a
+     * lock-free stack that the writer empties all at once, so a thread that logs
+     * never waits on another thread or on the disk, and the writer turns whatever
+     * piled up into one writev(2); if the disk stalls and more than the queue limit
+     * is waiting, new lines are dropped (and counted) rather than letting memory
+     * grow or blocking the daemon, and the writer notes the loss once it catches up
+     */
+    class log_queue
+    {
+    public:
+        // starts/stops the writer thread; before start and after stop lines are
+        // written synchronously by the thread that logs them
+        static void start();
+        static void stop();
+
+        // queues a line made of a prefix and the text (which should end with a newline)
+        static void write(const char* prefix,rtypes::size_type prefixLength,const char* text,rtypes::size_type length);
+
+        // the most bytes that may wait for the writer before lines are dropped
+        static void set_limit(rtypes::size_type bytes)
+        { _limit = bytes; }
+        static rtypes::uint64 get_dropped_total()
+        { return _droppedTotal.load(std::memory_order_relaxed); }
+
+        static const rtypes::size_type DEFAULT_LIMIT = 4 << 20;
+    private:
+        struct _record
+        {
+            _record* next;
+            rtypes::size_type length;
+            char text[1];
+        };
+
+        static std::atomic<_record*> _head; // most recent line first
+        static std::atomic<rtypes::size_type> _queued; // bytes waiting
+        static std::atomic<rtypes::uint64> _dropped; // dropped since the last notice
+        static std::atomic<rtypes::uint64> _droppedTotal;
+        static std::atomic<bool> _running;
+        static volatile bool _stopping;
+        static rtypes::size_type _limit;
+        static int _eventFd; // wakes the writer when the queue stops being empty
+        static pthread_t _threadID;
+
+        static void* _writer_thread(void*);
+        static void _drain();
+        static void _write_all(const char* data,rtypes::size_type length);
+    };
+}
+
+#endif
+
+/*
+ * Local Variables:
+ * mode:c++
+ * indent-tabs-mode:nil
+ * tab-width:4
+ * End:
+ */
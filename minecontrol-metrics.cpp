@@ -0,0 +1,350 @@
+// minecontrol-metrics.cpp
+#include "minecontrol-metrics.h"
+#include "minecontrol-log.h"
+#include "minecontrol-client.h"
+#include "minecraft-server.h"
+#include "minecraft-controller.h"
+#include <rlibrary/rstringstream.h>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <poll.h>
+using namespace rtypes;
+using namespace minecraft_controller;
+
+namespace
+{
+    void write_seconds(rstream& stream,uint64 usec)
+    {
+        char buffer[48];
+        std::sprintf(buffer,"%llu.%06llu",(unsigned long long)(usec/1000000),(unsigned long long)(usec%1000000));
+        stream << buffer;
+    }
+
+    bool send_all(int fd,const char* data,size_t length)
+    {
+        while (length > 0) {
+            ssize_t n = ::send(fd,data,length,MSG_NOSIGNAL);
+            if (n <= 0)
+                return false;
+            data += n;
+            length -= n;
+        }
+        return true;
+    }
+}
+
+// minecontrol_metrics
+
+/*static*/ const uint64 minecontrol_metrics::BUCKET_LIMITS[BUCKET_COUNT] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000
+};
+/*static*/ std::atomic<minecontrol_metrics::_shard*> minecontrol_metrics::_shards(nullptr);
+/*static*/ minecontrol_metrics::_shard* minecontrol_metrics::_freeShards = nullptr;
+/*static*/ pthread_mutex_t minecontrol_metrics::_freeMtx = PTHREAD_MUTEX_INITIALIZER;
+/*static*/ const char* minecontrol_metrics::_commandNames[MAX_COMMANDS];
+/*static*/ int minecontrol_metrics::_commandCount = 0;
+/*static*/ int minecontrol_metrics::_listenFd = -1;
+/*static*/ pthread_t minecontrol_metrics::_threadID;
+/*static*/ volatile bool minecontrol_metrics::_threadCondition = false;
+/*static*/ void minecontrol_metrics::set_command_names(const char* const* names,int count)
+{
+    if (count > MAX_COMMANDS)
+        count = MAX_COMMANDS;
+    for (int i = 0;i < count;++i)
+        _commandNames[i] = names[i];
+    _commandCount = count;
+}
+/*static*/ void minecontrol_metrics::observe(int hist,uint64 usec)
+{
+    if (hist < 0 || hist >= HISTOGRAM_COUNT)
+        return;
+    int bucket = 0;
+    while (bucket < BUCKET_COUNT && usec > BUCKET_LIMITS[bucket])
+        ++bucket;
+    // the calling thread is the only writer of its shard, so a relaxed load
+    // and store is enough; the scraper may see a sample half recorded
+    std::atomic<uint64>* slots = _local_shard()->slots + hist*HISTOGRAM_SLOTS;
+    slots[bucket].store(slots[bucket].load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+    slots[BUCKET_COUNT+1].store(slots[BUCKET_COUNT+1].load(std::memory_order_relaxed) + usec,std::memory_order_relaxed);
+}
+/*static*/ void minecontrol_metrics::write(rstream& stream)
+{
+    stream << "# HELP minecontrol_clients Clients connected to the daemon\n"
+           << "# TYPE minecontrol_clients gauge\n"
+           << "minecontrol_clients " << controller_client::count_clients() << newline;
+
+    // sum the shards; the list only ever grows so it may be walked without a lock
+    uint64 totals[HISTOGRAM_COUNT * HISTOGRAM_SLOTS];
+    std::memset(totals,0,sizeof(totals));
+    for (_shard* shard = _shards.load(std::memory_order_acquire);shard != nullptr;shard = shard->next)
+        for (int i = 0;i < HISTOGRAM_COUNT*HISTOGRAM_SLOTS;++i)
+            totals[i] += shard->slots[i].load(std::memory_order_relaxed);
+
+    stream << "# HELP minecontrol_command_duration_seconds Time taken to handle a client command\n"
+           << "# TYPE minecontrol_command_duration_seconds histogram\n";
+    for (int i = 0;i < _commandCount;++i) {
+        stringstream labels;
+        labels << "command=\"";
+        write_label(labels,_commandNames[i]);
+        labels << '"';
+        labels.flush_output();
+        const uint64* slots = totals + (hist_command_first+i)*HISTOGRAM_SLOTS;
+        write_histogram(stream,"minecontrol_command_duration_seconds",labels.get_device().c_str(),slots,slots[BUCKET_COUNT+1]);
+    }
+    stream << "# HELP minecontrol_command_span_seconds Time taken by each stage of a client command\n"
+           << "# TYPE minecontrol_command_span_seconds histogram\n";
+    for (int i = 0;i < _commandCount;++i) {
+        for (int j = 0;j < request_trace::span_count;++j) {
+            stringstream labels;
+            labels << "command=\"";
+            write_label(labels,_commandNames[i]);
+            labels << "\",span=\"" << request_trace::span_name(j) << '"';
+            labels.flush_output();
+            const uint64* slots = totals + span_histogram(i,j)*HISTOGRAM_SLOTS;
+            write_histogram(stream,"minecontrol_command_span_seconds",labels.get_device().c_str(),slots,slots[BUCKET_COUNT+1]);
+        }
+    }
+    stream << "# HELP minecontrol_authority_spawn_seconds Time taken to start an authority program\n"
+           << "# TYPE minecontrol_authority_spawn_seconds histogram\n";
+    write_histogram(stream,"minecontrol_authority_spawn_seconds","",totals + hist_authority_spawn*HISTOGRAM_SLOTS,
+        totals[hist_authority_spawn*HISTOGRAM_SLOTS + BUCKET_COUNT+1]);
+    stream << "# HELP minecontrol_manager_lock_hold_seconds Time the server manager lock is held\n"
+           << "# TYPE minecontrol_manager_lock_hold_seconds histogram\n";
+    write_histogram(stream,"minecontrol_manager_lock_hold_seconds","",totals + hist_manager_lock_hold*HISTOGRAM_SLOTS,
+        totals[hist_manager_lock_hold*HISTOGRAM_SLOTS + BUCKET_COUNT+1]);
+    stream << "# HELP minecontrol_console_fanout_seconds Time taken to write a server line to its console clients\n"
+           << "# TYPE minecontrol_console_fanout_seconds histogram\n";
+    write_histogram(stream,"minecontrol_console_fanout_seconds","",totals + hist_console_fanout*HISTOGRAM_SLOTS,
+        totals[hist_console_fanout*HISTOGRAM_SLOTS + BUCKET_COUNT+1]);
+    stream << "# HELP minecontrol_line_parse_seconds Time taken to parse a server line\n"
+           << "# TYPE minecontrol_line_parse_seconds histogram\n";
+    write_histogram(stream,"minecontrol_line_parse_seconds","",totals + hist_line_parse*HISTOGRAM_SLOTS,
+        totals[hist_line_parse*HISTOGRAM_SLOTS + BUCKET_COUNT+1]);
+
+    stream << "# HELP minecontrol_log_dropped_total Log lines dropped because the log writer fell behind\n"
+           << "# TYPE minecontrol_log_dropped_total counter\n"
+           << "minecontrol_log_dropped_total " << log_queue::get_dropped_total() << newline;
+
+    minecraft_server_manager::write_metrics(stream);
+}
+/*static*/ void minecontrol_metrics::read_histogram(int hist,uint64* slots)
+{
+    std::memset(slots,0,sizeof(uint64)*HISTOGRAM_SLOTS);
+    if (hist < 0 || hist >= HISTOGRAM_COUNT)
+        return;
+    for (_shard* shard = _shards.load(std::memory_order_acquire);shard != nullptr;shard = shard->next)
+        for (int i = 0;i < HISTOGRAM_SLOTS;++i)
+            slots[i] += shard->slots[hist*HISTOGRAM_SLOTS + i].load(std::memory_order_relaxed);
+}
+/*static*/ uint64 minecontrol_metrics::estimate_quantile(const uint64* slots,double q)
+{
+    uint64 count = 0, seen = 0;
+    for (int i = 0;i <= BUCKET_COUNT;++i)
+        count += slots[i];
+    if (count == 0)
+        return 0;
+    uint64 rank = uint64(q * count + 0.5);
+    if (rank == 0)
+        rank = 1;
+    for (int i = 0;i < BUCKET_COUNT;++i) {
+        seen += slots[i];
+        if (seen >= rank)
+            return BUCKET_LIMITS[i];
+    }
+    return ~uint64(0);
+}
+/*static*/ void minecontrol_metrics::write_histogram(rstream& stream,const char* name,const char* labels,
+    const uint64* buckets,uint64 sumUsec)
+{
+    const char* sep = (*labels != 0) ? "," : "";
+    uint64 cumulative = 0;
+    for (int i = 0;i < BUCKET_COUNT;++i) {
+        cumulative += buckets[i];
+        stream << name << "_bucket{" << labels << sep << "le=\"";
+        write_seconds(stream,BUCKET_LIMITS[i]);
+        stream << "\"} " << cumulative << newline;
+    }
+    cumulative += buckets[BUCKET_COUNT];
+    stream << name << "_bucket{" << labels << sep << "le=\"+Inf\"} " << cumulative << newline;
+    stream << name << "_sum";
+    if (*labels != 0)
+        stream << '{' << labels << '}';
+    stream << ' ';
+    write_seconds(stream,sumUsec);
+    stream << newline << name << "_count";
+    if (*labels != 0)
+        stream << '{' << labels << '}';
+    stream << ' ' << cumulative << newline;
+}
+/*static*/ void minecontrol_metrics::write_label(rstream& stream,const char* value)
+{
+    for (;*value;++value) {
+        if (*value == '\\')
+            stream << "\\\\";
+        else if (*value == '"')
+            stream << "\\\"";
+        else if (*value == '\n')
+            stream << "\\n";
+        else
+            stream << *value;
+    }
+}
+/*static*/ bool minecontrol_metrics::start_server(const char* endpoint)
+{
+    int fd;
+    char* end;
+    unsigned long port = std::strtoul(endpoint,&end,10);
+    if (*endpoint != 0 && *end == 0) {
+        // a port number: only listen on the loopback interface
+        sockaddr_in addr;
+        int on = 1;
+        if (port == 0 || port > 65535)
+            return false;
+        std::memset(&addr,0,sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = ::socket(AF_INET,SOCK_STREAM | SOCK_CLOEXEC,0);
+        if (fd == -1)
+            return false;
+        ::setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+        if (::bind(fd,reinterpret_cast<sockaddr*>(&addr),sizeof(addr)) == -1) {
+            ::close(fd);
+            return false;
+        }
+    }
+    else {
+        // a domain socket; '@' names an abstract socket like the daemon's own
+        sockaddr_un addr;
+        size_t len = std::strlen(endpoint);
+        if (len == 0 || len >= sizeof(addr.sun_path))
+            return false;
+        std::memset(&addr,0,sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path,endpoint,len);
+        if (endpoint[0] == '@')
+            addr.sun_path[0] = 0;
+        else
+            ::unlink(endpoint); // left over from a previous run
+        fd = ::socket(AF_UNIX,SOCK_STREAM | SOCK_CLOEXEC,0);
+        if (fd == -1)
+            return false;
+        if (::bind(fd,reinterpret_cast<sockaddr*>(&addr),socklen_t(offsetof(sockaddr_un,sun_path) + len)) == -1) {
+            ::close(fd);
+            return false;
+        }
+    }
+    if (::listen(fd,8) == -1) {
+        ::close(fd);
+        return false;
+    }
+    _listenFd = fd;
+    _threadCondition = true;
+    if (pthread_create(&_threadID,NULL,&minecontrol_metrics::_server_thread,NULL) != 0) {
+        _threadCondition = false;
+        ::close(fd);
+        _listenFd = -1;
+        return false;
+    }
+    return true;
+}
+/*static*/ void minecontrol_metrics::stop_server()
+{
+    if (_listenFd == -1)
+        return;
+    _threadCondition = false;
+    pthread_join(_threadID,NULL);
+    ::close(_listenFd);
+    _listenFd = -1;
+}
+minecontrol_metrics::_shard_owner::~_shard_owner()
+{
+    // keep the counts: the next thread to start takes over this shard
+    if (shard != nullptr) {
+        pthread_mutex_lock(&_freeMtx);
+        shard->nextFree = _freeShards;
+        _freeShards = shard;
+        pthread_mutex_unlock(&_freeMtx);
+    }
+}
+/*static*/ minecontrol_metrics::_shard* minecontrol_metrics::_local_shard()
+{
+    static thread_local _shard_owner owner;
+    if (owner.shard == nullptr) {
+        pthread_mutex_lock(&_freeMtx);
+        owner.shard = _freeShards;
+        if (owner.shard != nullptr)
+            _freeShards = owner.shard->nextFree;
+        pthread_mutex_unlock(&_freeMtx);
+        if (owner.shard == nullptr) {
+            _shard* shard = new _shard;
+            for (int i = 0;i < HISTOGRAM_COUNT*HISTOGRAM_SLOTS;++i)
+                shard->slots[i].store(0,std::memory_order_relaxed);
+            shard->nextFree = nullptr;
+            shard->next = _shards.load(std::memory_order_relaxed);
+            while ( !_shards.compare_exchange_weak(shard->next,shard,std::memory_order_release,std::memory_order_relaxed) )
+                ;
+            owner.shard = shard;
+        }
+    }
+    return owner.shard;
+}
+/*static*/ void* minecontrol_metrics::_server_thread(void*)
+{
+    while (_threadCondition) {
+        pollfd pfd;
+        pfd.fd = _listenFd;
+        pfd.events = POLLIN;
+        // wake up every second to check whether to quit
+        if (::poll(&pfd,1,1000) <= 0)
+            continue;
+        int client = ::accept4(_listenFd,NULL,NULL,SOCK_CLOEXEC);
+        if (client == -1)
+            continue;
+
+        // read the request head; any request is answered with the metrics, but
+        // give a slow client only a second to send it
+        char request[1024];
+        size_t got = 0;
+        pfd.fd = client;
+        while (got < sizeof(request)-1 && ::poll(&pfd,1,1000) > 0) {
+            ssize_t n = ::recv(client,request+got,sizeof(request)-1-got,0);
+            if (n <= 0)
+                break;
+            got += n;
+            request[got] = 0;
+            if (std::strstr(request,"\r\n\r\n") != NULL || std::strstr(request,"\n\n") != NULL)
+                break;
+        }
+        request[got] = 0;
+
+        stringstream body;
+        const char* status;
+        if (std::strncmp(request,"GET ",4) == 0) {
+            status = "200 OK";
+            write(body);
+        }
+        else {
+            status = "405 Method Not Allowed";
+            body << "only GET is supported\n";
+        }
+        body.flush_output();
+        const str& text = body.get_device();
+        char head[256];
+        std::sprintf(head,"HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %llu\r\nConnection: close\r\n\r\n",
+            status,(unsigned long long)text.length());
+        if ( send_all(client,head,std::strlen(head)) )
+            send_all(client,text.c_str(),text.length());
+        ::close(client);
+    }
+    return NULL;
+}
@@ -0,0 +1,121 @@
+// minecontrol-metrics.h
+#ifndef MINECONTROL_METRICS_H
+#define MINECONTROL_METRICS_H
+#include "minecontrol-trace.h"
+#include <rlibrary/rstream.h>
+#include <pthread.h>
+#include <atomic>
+
+namespace minecraft_controller
+{
+    /* minecontrol_metrics:
+     *  process metrics in the Prometheus text format; counters and histograms are
+     * kept in per-thread shards that only their own thread writes (with plain
+     * relaxed stores, no locked instructions) and that are summed when the metrics
+     * are scraped; a shard outlives its thread and is handed to the next new thread
+     * so its counts are never lost
+     */
+    class minecontrol_metrics
+    {
+    public:
+        static const int MAX_COMMANDS = 32;
+
+        enum histogram
+        {
+            hist_authority_spawn, // time for run_auth_process to start a program (up to the fork)
+            hist_manager_lock_hold, // time the server manager's lock is held
+            hist_console_fanout, // time to write a server line to its console clients
+            hist_line_parse, // time to parse a server line into a minecraft_server_message
+            hist_command_first // per-command latencies from message_loop follow, then
+                               // each command's request_trace spans
+        };
+
+        // names the command latency histograms; called once before any clients connect
+        static void set_command_names(const char* const* names,int count);
+
+        // records a value (in microseconds) on the calling thread's shard
+        static void observe(int hist,rtypes::uint64 usec);
+        static void observe_command(int command,rtypes::uint64 usec)
+        { observe(command_histogram(command),usec); }
+        static void observe_span(int command,int span,rtypes::uint64 usec)
+        { observe(span_histogram(command,span),usec); }
+
+        static int command_histogram(int command)
+        { return hist_command_first + command; }
+        static int span_histogram(int command,int span)
+        { return hist_command_first + MAX_COMMANDS + command*request_trace::span_count + span; }
+        static int get_command_count()
+        { return _commandCount; }
+        static const char* get_command_name(int command)
+        { return _commandNames[command]; }
+
+        // sums a histogram over every thread's shard into 'slots': BUCKET_COUNT+1
+        // (non-cumulative) counts followed by the sum in microseconds
+        static void read_histogram(int hist,rtypes::uint64* slots);
+
+        // the limit of the bucket that holds the q-th quantile of a histogram read
+        // by read_histogram; zero if it is empty and ~0 if past the last limit
+        static rtypes::uint64 estimate_quantile(const rtypes::uint64* slots,double q);
+
+        // writes every metric in the Prometheus text format
+        static void write(rtypes::rstream& stream);
+
+        // writes the samples of a histogram family; 'buckets' holds BUCKET_COUNT+1
+        // (non-cumulative) counts, the last one for values past every limit, and
+        // 'labels' is empty or a label list without braces
+        static void write_histogram(rtypes::rstream& stream,const char* name,const char* labels,
+            const rtypes::uint64* buckets,rtypes::uint64 sumUsec);
+
+        // writes a label value with Prometheus escaping
+        static void write_label(rtypes::rstream& stream,const char* value);
+
+        // starts/stops the thread that serves the metrics over HTTP on the specified
+        // local endpoint: a port number (bound to the loopback address) or a domain
+        // socket path (prefix '@' for the abstract namespace)
+        static bool start_server(const char* endpoint);
+        static void stop_server();
+
+        static const int BUCKET_COUNT = 16; // plus the implicit +Inf bucket
+        static const rtypes::uint64 BUCKET_LIMITS[BUCKET_COUNT]; // microseconds
+    private:
+        static const int HISTOGRAM_COUNT = hist_command_first + MAX_COMMANDS*(1 + request_trace::span_count);
+        static const int HISTOGRAM_SLOTS = BUCKET_COUNT + 2; // buckets, +Inf, sum
+
+        struct _shard
+        {
+            std::atomic<rtypes::uint64> slots[HISTOGRAM_COUNT * HISTOGRAM_SLOTS];
+            _shard* next; // all shards ever made, for the scraper
+            _shard* nextFree;
+        };
+
+        struct _shard_owner // releases the thread's shard when the thread exits
+        {
+            _shard_owner() : shard(nullptr) {}
+            ~_shard_owner();
+
+            _shard* shard;
+        };
+
+        static std::atomic<_shard*> _shards;
+        static _shard* _freeShards;
+        static pthread_mutex_t _freeMtx;
+        static const char* _commandNames[MAX_COMMANDS];
+        static int _commandCount;
+        static int _listenFd;
+        static pthread_t _threadID;
+        static volatile bool _threadCondition;
+
+        static _shard* _local_shard();
+        static void* _server_thread(void*);
+    };
+}
+
+#endif
+
+/*
+ * Local Variables:
+ * mode:c++
+ * indent-tabs-mode:nil
+ * tab-width:4
+ * End:
+ */
@@ -2,6 +2,7 @@
 #ifndef MINECONTROL_MISC_TYPES_H
 #define MINECONTROL_MISC_TYPES_H
 #include <rlibrary/rstring.h>
+#include <time.h>
 
 namespace minecraft_controller
 {
@@ -13,6 +14,22 @@ namespace minecraft_controller
         rtypes::str homeDirectory;
         int uid, gid;
     };
+
+    // milliseconds on the monotonic clock; used to time events across threads
+    inline rtypes::uint64 monotonic_milliseconds()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC,&ts);
+        return rtypes::uint64(ts.tv_sec)*1000 + ts.tv_nsec/1000000;
+    }
+
+    // microseconds on the same clock; used for request latencies and traces
+    inline rtypes::uint64 monotonic_microseconds()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC,&ts);
+        return rtypes::uint64(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+    }
 }
 
 #endif
@@ -1,21 +1,76 @@
 // minecontrol-protocol.cpp
 #include "minecontrol-protocol.h"
 #include <cstring>
+#include <cstdio>
 #include <rlibrary/rutility.h>
 using namespace rtypes;
 using namespace minecraft_controller;
 
+namespace
+{
+    // helpers for encoding/decoding integers in network byte order
+    void put_uint(str& s,uint64 value,size_type bytes)
+    {
+        while (bytes > 0) {
+            --bytes;
+            s.push_back( char((value >> (bytes*8)) & 0xff) );
+        }
+    }
+    bool get_uint(const str& s,size_type& iter,uint64& value,size_type bytes)
+    {
+        if (iter+bytes > s.length())
+            return false;
+        value = 0;
+        while (bytes > 0) {
+            value = (value << 8) | static_cast<unsigned char>(s[iter++]);
+            --bytes;
+        }
+        return true;
+    }
+    bool get_bytes(const str& s,size_type& iter,str& out,size_type length)
+    {
+        if (iter+length > s.length())
+            return false;
+        out.clear();
+        while (length > 0) {
+            out.push_back(s[iter++]);
+            --length;
+        }
+        return true;
+    }
+    // determines if 'value' is a canonical decimal integer that can be encoded
+    // as an integer field and decoded back to the exact same string
+    bool is_integer_value(const str& value,uint64& result)
+    {
+        if (value.length()==0 || value.length()>19 || (value[0]=='0' && value.length()>1))
+            return false;
+        result = 0;
+        for (size_type i = 0;i < value.length();++i) {
+            if (value[i]<'0' || value[i]>'9')
+                return false;
+            result = result*10 + (value[i]-'0');
+        }
+        return true;
+    }
+}
+
 // minecraft_controller::minecontrol_message
 
 /*static*/ const char* const minecontrol_message::MINECONTROL_PROTO_HEADER = "MINECONTROL-PROTOCOL";
+/*static*/ const char* const minecontrol_message::FRAMING_FIELD = "Framing";
+/*static*/ const char* const minecontrol_message::FRAMING_BINARY = "binary";
+/*static*/ const char* const minecontrol_message::COMPRESSION_FIELD = "Compression";
+/*static*/ const char* const minecontrol_message::COMPRESSION_DEFLATE = "deflate";
+/*static*/ const char minecontrol_message::FIELD_DELIMITER = '\x1e'; // ASCII record separator
+/*static*/ const byte minecontrol_message::BINARY_VERSION = 1;
 minecontrol_message::minecontrol_message()
     : _state(false)
 {
     // set up const rstreams to handle fields and values
     _fieldKeys.delimit_whitespace(false);
-    _fieldKeys.add_extra_delimiter('\n');
+    _fieldKeys.add_extra_delimiter(FIELD_DELIMITER);
     _fieldValues.delimit_whitespace(false);
-    _fieldValues.add_extra_delimiter('\n');
+    _fieldValues.add_extra_delimiter(FIELD_DELIMITER);
     _fieldKeys.assign(_fields);
     _fieldValues.assign(_values);
 }
@@ -26,9 +81,9 @@ minecontrol_message::minecontrol_message(const char* command)
     _command = command;
     // set up const rstreams to handle fields and values
     _fieldKeys.delimit_whitespace(false);
-    _fieldKeys.add_extra_delimiter('\n');
+    _fieldKeys.add_extra_delimiter(FIELD_DELIMITER);
     _fieldValues.delimit_whitespace(false);
-    _fieldValues.add_extra_delimiter('\n');
+    _fieldValues.add_extra_delimiter(FIELD_DELIMITER);
     _fieldKeys.assign(_fields);
     _fieldValues.assign(_values);
 }
@@ -40,9 +95,13 @@ void minecontrol_message::assign_command(const char* command)
 void minecontrol_message::add_field(const char* field,const char* value)
 {
     _fields += field;
-    _fields.push_back('\n'); // delimit the field name
-    _values += value;
-    _values.push_back('\n'); // delimit the value
+    _fields.push_back(FIELD_DELIMITER); // delimit the field name
+    while (*value) {
+        if (*value != FIELD_DELIMITER)
+            _values.push_back(*value);
+        ++value;
+    }
+    _values.push_back(FIELD_DELIMITER); // delimit the value
 }
 void minecontrol_message::reset_fields()
 {
@@ -89,6 +148,81 @@ void minecontrol_message::write_protocol_message(socket& output)
     rutil_strip_whitespace_ref(line);
     stream.set_input_success(line.length() > 0);
 }
+void minecontrol_message::_encodeBinary(str& payload) const
+{
+    uint16 count = 0;
+    size_type i, j, countIter;
+    payload.clear();
+    payload.push_back( char(BINARY_VERSION) );
+    put_uint(payload,_command.length(),2);
+    payload += _command;
+    countIter = payload.length();
+    put_uint(payload,0,2); // placeholder for field count
+    i = 0, j = 0;
+    while (i<_fields.length() && j<_values.length()) {
+        uint64 n;
+        str k, v;
+        while (i<_fields.length() && _fields[i]!=FIELD_DELIMITER)
+            k.push_back(_fields[i++]);
+        while (j<_values.length() && _values[j]!=FIELD_DELIMITER)
+            v.push_back(_values[j++]);
+        ++i, ++j;
+        if ( is_integer_value(v,n) ) {
+            payload.push_back( char(_field_integer) );
+            put_uint(payload,k.length(),2);
+            payload += k;
+            put_uint(payload,n,8);
+        }
+        else {
+            payload.push_back( char(_field_string) );
+            put_uint(payload,k.length(),2);
+            payload += k;
+            put_uint(payload,v.length(),4);
+            payload += v;
+        }
+        ++count;
+    }
+    payload[countIter] = char(count >> 8);
+    payload[countIter+1] = char(count & 0xff);
+}
+bool minecontrol_message::_decodeBinary(const str& payload)
+{
+    uint64 n, count;
+    size_type iter = 0;
+    reset_fields();
+    if (!get_uint(payload,iter,n,1) || n!=BINARY_VERSION)
+        return false;
+    if (!get_uint(payload,iter,n,2) || !get_bytes(payload,iter,_command,n))
+        return false;
+    if ( !get_uint(payload,iter,count,2) )
+        return false;
+    while (count > 0) {
+        uint64 type;
+        str k, v;
+        if (!get_uint(payload,iter,type,1) || !get_uint(payload,iter,n,2) || !get_bytes(payload,iter,k,n))
+            return false;
+        if (type == _field_integer) {
+            char buf[24];
+            if ( !get_uint(payload,iter,n,8) )
+                return false;
+            sprintf(buf,"%llu",static_cast<unsigned long long>(n));
+            v = buf;
+        }
+        else if (type == _field_string) {
+            if (!get_uint(payload,iter,n,4) || !get_bytes(payload,iter,v,n))
+                return false;
+        }
+        else // unknown field type
+            return false;
+        add_field(k.c_str(),v.c_str());
+        --count;
+    }
+    _header = MINECONTROL_PROTO_HEADER;
+    // normalize the command line and all fields to lower case
+    rutil_to_lower_ref(_command);
+    rutil_to_lower_ref(_fields);
+    return true;
+}
 
 rstream& minecraft_controller::operator >>(rstream& stream,minecontrol_message& msg)
 {
@@ -160,6 +294,10 @@ rstream& minecraft_controller::operator <<(rstream& stream,const minecontrol_mes
         msg._fieldValues >> s;
         if ( !msg._fieldValues.get_input_success() )
             break;
+        // CR and LF cannot be represented in a text-framed value
+        for (size_type i = 0;i < s.length();++i)
+            if (s[i]=='\r' || s[i]=='\n')
+                s[i] = ' ';
         stream << s << CRLF;
     }
     // be nice and reset the iterators
@@ -169,6 +307,31 @@ rstream& minecraft_controller::operator <<(rstream& stream,const minecontrol_mes
     return stream << CRLF << flush;
 }
 
+socket_stream& minecraft_controller::operator >>(socket_stream& stream,minecontrol_message& msg)
+{
+    if (stream.get_device().get_framing() == socket_framing_binary) {
+        str payload;
+        msg._state = stream.read_frame(payload) && msg._decodeBinary(payload);
+        if ( !msg._state )
+            msg._command.clear();
+        return stream;
+    }
+    static_cast<rstream&>(stream) >> msg;
+    return stream;
+}
+
+socket_stream& minecraft_controller::operator <<(socket_stream& stream,const minecontrol_message& msg)
+{
+    if (stream.get_device().get_framing() == socket_framing_binary) {
+        str payload;
+        msg._encodeBinary(payload);
+        stream.write_frame(payload);
+        return stream;
+    }
+    static_cast<rstream&>(stream) << msg;
+    return stream;
+}
+
 minecontrol_message_buffer::minecontrol_message_buffer()
     : _repeatField(NULL)
 {
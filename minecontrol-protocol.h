@@ -12,12 +12,17 @@ namespace minecraft_controller
     /* minecontrol_message:
      *  represents a message used in implementing the simple
      * minecontrol communications protocol; every command name
-     * and field, value pair are normalized to lower case
+     * and field, value pair are normalized to lower case; field
+     * values may contain any character except NUL and the ASCII
+     * record separator (0x1e), though CR and LF can only be
+     * transmitted intact under binary framing
      */
     class minecontrol_message
     {
         friend rtypes::rstream& operator >>(rtypes::rstream&,minecontrol_message&);
         friend rtypes::rstream& operator <<(rtypes::rstream&,const minecontrol_message&);
+        friend socket_stream& operator >>(socket_stream&,minecontrol_message&);
+        friend socket_stream& operator <<(socket_stream&,const minecontrol_message&);
     public:
         minecontrol_message();
         minecontrol_message(const char* command);
@@ -50,10 +55,29 @@ namespace minecraft_controller
 
         void read_protocol_message(socket& input);
         void write_protocol_message(socket& output);
+
+        // the field name used in HELLO and GREETINGS to negotiate framing
+        static const char* const FRAMING_FIELD;
+        static const char* const FRAMING_BINARY;
+
+        // the field name used in HELLO and GREETINGS to negotiate compression
+        static const char* const COMPRESSION_FIELD;
+        static const char* const COMPRESSION_DEFLATE;
     private:
         static const char* const MINECONTROL_PROTO_HEADER;
+        static const char FIELD_DELIMITER;
+        static const rtypes::byte BINARY_VERSION;
+
+        // binary frame field types
+        enum _field_type
+        {
+            _field_string = 0, // uint32 length followed by bytes
+            _field_integer = 1 // unsigned 64-bit integer in network byte order
+        };
 
         static void _readProtocolLine(rtypes::rstream& stream,rtypes::str& line);
+        void _encodeBinary(rtypes::str& payload) const;
+        bool _decodeBinary(const rtypes::str& payload);
 
         bool _state;
         rtypes::str _header;
@@ -66,6 +90,11 @@ namespace minecraft_controller
     rtypes::rstream& operator >>(rtypes::rstream&,minecontrol_message&);
     rtypes::rstream& operator <<(rtypes::rstream&,const minecontrol_message&);
 
+    /* these overloads honor the framing negotiated on the stream's socket; they
+       fall back to the text format when the socket uses text framing */
+    socket_stream& operator >>(socket_stream&,minecontrol_message&);
+    socket_stream& operator <<(socket_stream&,const minecontrol_message&);
+
     /* minecontrol_message_buffer
      *  simplifies the creation of minecontrol messages by providing
      * a local buffer for field values; maintains a queue of desired
@@ -0,0 +1,197 @@
+// minecontrol-token.cpp
+#include "minecontrol-token.h"
+#include <rlibrary/rutility.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pwd.h>
+#ifndef __APPLE__
+#include <shadow.h>
+#endif
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+using namespace rtypes;
+using namespace minecraft_controller;
+
+static const char* const PASSWD_FILE = "/etc/passwd";
+static const char* const SHADOW_FILE = "/etc/shadow";
+static const char* const TOKEN_PREFIX = "mct1.";
+
+static void hex_encode(const unsigned char* data,size_type length,str& out)
+{
+    static const char* const DIGITS = "0123456789abcdef";
+    for (size_type i = 0;i < length;++i) {
+        out.push_back(DIGITS[data[i] >> 4]);
+        out.push_back(DIGITS[data[i] & 0x0f]);
+    }
+}
+static bool hex_decode(const char* text,size_type length,str& out)
+{
+    if (length%2 != 0)
+        return false;
+    out.clear();
+    for (size_type i = 0;i < length;i += 2) {
+        int hi, lo;
+        char c = text[i], d = text[i+1];
+        hi = c>='0'&&c<='9' ? c-'0' : (c>='a'&&c<='f' ? c-'a'+10 : -1);
+        lo = d>='0'&&d<='9' ? d-'0' : (d>='a'&&d<='f' ? d-'a'+10 : -1);
+        if (hi<0 || lo<0)
+            return false;
+        out.push_back( char((hi << 4) | lo) );
+    }
+    return true;
+}
+static uint64 stat_stamp(const char* path)
+{
+    struct stat st;
+    if (::stat(path,&st) != 0)
+        return 0;
+#ifdef __APPLE__
+    return uint64(st.st_mtimespec.tv_sec)*1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    return uint64(st.st_mtim.tv_sec)*1000000000 + st.st_mtim.tv_nsec;
+#endif
+}
+
+// minecraft_controller::session_token
+
+/*static*/ unsigned char session_token::_key[session_token::KEY_SIZE];
+/*static*/ bool session_token::_keyReady = false;
+/*static*/ uint32 session_token::_lifetime = 3600;
+/*static*/ void session_token::initialize()
+{
+    if (RAND_bytes(_key,KEY_SIZE) != 1)
+        throw session_token_error();
+    _keyReady = true;
+}
+/*static*/ bool session_token::issue(const user_info& user,str& token,uint64& expires)
+{
+    str digest, payload, mac;
+    uint64 passwdStamp, shadowStamp;
+    if (!_keyReady || _lifetime==0 || user.uid<0)
+        return false;
+    // take the file stamps before reading the entry so that a change made
+    // in between is caught by the next 'resume'
+    _fileStamps(passwdStamp,shadowStamp);
+    if ( !_entryDigest(user.uid,digest) )
+        return false;
+    expires = uint64(::time(NULL)) + _lifetime;
+    // payload: uid:gid:expires:passwd-stamp:shadow-stamp:entry-digest:user-name:home
+    char buf[128];
+    sprintf(buf,"%d:%d:%llu:%llu:%llu:",user.uid,user.gid,(unsigned long long)expires,
+        (unsigned long long)passwdStamp,(unsigned long long)shadowStamp);
+    payload = buf;
+    payload += digest;
+    payload.push_back(':');
+    payload += user.userName;
+    payload.push_back(':');
+    payload += user.homeDirectory;
+    _sign(payload,mac);
+    token = TOKEN_PREFIX;
+    hex_encode(reinterpret_cast<const unsigned char*>(payload.c_str()),payload.length(),token);
+    token.push_back('.');
+    token += mac;
+    return true;
+}
+/*static*/ session_token::token_result session_token::resume(const str& token,user_info& user)
+{
+    size_type prefixLength = rutil_strlen(TOKEN_PREFIX), dot;
+    str payload, mac, expected;
+    if (!_keyReady || token.length()<=prefixLength || !rutil_strncmp(token.c_str(),TOKEN_PREFIX,prefixLength))
+        return token_malformed;
+    dot = prefixLength;
+    while (dot<token.length() && token[dot]!='.')
+        ++dot;
+    if (dot >= token.length())
+        return token_malformed;
+    if ( !hex_decode(token.c_str()+prefixLength,dot-prefixLength,payload) )
+        return token_malformed;
+    for (size_type i = dot+1;i < token.length();++i)
+        mac.push_back(token[i]);
+    // check the signature in constant time before trusting anything in the payload
+    _sign(payload,expected);
+    if (mac.length()!=expected.length() || CRYPTO_memcmp(mac.c_str(),expected.c_str(),mac.length())!=0)
+        return token_bad_signature;
+    // split the payload: the first six fields are fixed; the home directory is
+    // last so it may contain anything
+    str fields[8];
+    size_type f = 0;
+    for (size_type i = 0;i < payload.length();++i) {
+        if (payload[i]==':' && f<7)
+            ++f;
+        else
+            fields[f].push_back(payload[i]);
+    }
+    if (f != 7)
+        return token_malformed;
+    uint64 expires = strtoull(fields[2].c_str(),NULL,10);
+    if (uint64(::time(NULL)) >= expires)
+        return token_expired;
+    // the account files haven't changed since the token was issued so the entry
+    // can't have changed either; otherwise look the entry up again and compare
+    uint64 passwdStamp, shadowStamp;
+    _fileStamps(passwdStamp,shadowStamp);
+    if (passwdStamp!=strtoull(fields[3].c_str(),NULL,10) || shadowStamp!=strtoull(fields[4].c_str(),NULL,10)) {
+        str digest;
+        if (!_entryDigest(atoi(fields[0].c_str()),digest) || digest!=fields[5])
+            return token_revoked;
+    }
+    user.uid = atoi(fields[0].c_str());
+    user.gid = atoi(fields[1].c_str());
+    user.userName = fields[6];
+    user.homeDirectory = fields[7];
+    return token_valid;
+}
+/*static*/ bool session_token::_entryDigest(int uid,str& digest)
+{
+    // hash everything in the user's password and shadow entries that matters for
+    // authentication; any change to them changes the digest
+    passwd pwdbuf, *pwd;
+    char buffer[4096];
+    if (::getpwuid_r(uid,&pwdbuf,buffer,sizeof(buffer),&pwd)!=0 || pwd==NULL)
+        return false;
+    str material;
+    char num[64];
+    sprintf(num,"%d:%d:",int(pwd->pw_uid),int(pwd->pw_gid));
+    material = num;
+    material += pwd->pw_name;
+    material.push_back(':');
+    material += pwd->pw_passwd;
+    material.push_back(':');
+    material += pwd->pw_dir;
+    material.push_back(':');
+    material += pwd->pw_shell;
+#ifndef __APPLE__
+    spwd spbuf, *sp;
+    char spbuffer[4096];
+    if (::getspnam_r(pwd->pw_name,&spbuf,spbuffer,sizeof(spbuffer),&sp)==0 && sp!=NULL) {
+        sprintf(num,":%ld:%ld:",long(sp->sp_lstchg),long(sp->sp_expire));
+        material += num;
+        material += sp->sp_pwdp;
+    }
+#endif
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int mdlen;
+    if (EVP_Digest(material.c_str(),material.length(),md,&mdlen,EVP_sha256(),NULL) != 1)
+        return false;
+    digest.clear();
+    hex_encode(md,mdlen,digest);
+    return true;
+}
+/*static*/ void session_token::_fileStamps(uint64& passwdStamp,uint64& shadowStamp)
+{
+    passwdStamp = stat_stamp(PASSWD_FILE);
+    shadowStamp = stat_stamp(SHADOW_FILE);
+}
+/*static*/ void session_token::_sign(const str& payload,str& mac)
+{
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int mdlen = 0;
+    HMAC(EVP_sha256(),_key,KEY_SIZE,reinterpret_cast<const unsigned char*>(payload.c_str()),payload.length(),md,&mdlen);
+    mac.clear();
+    hex_encode(md,mdlen,mac);
+}
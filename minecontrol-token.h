@@ -0,0 +1,65 @@
+// minecontrol-token.h
+#ifndef MINECONTROL_TOKEN_H
+#define MINECONTROL_TOKEN_H
+#include "minecontrol-misc-types.h"
+#include <rlibrary/rstring.h>
+
+namespace minecraft_controller
+{
+    class session_token_error { };
+
+    /* session_token:
+     *  static class that issues and checks HMAC-signed session tokens; a
+     * token lets a new connection restore an authenticated session with the
+     * 'resume' command instead of repeating a password login; tokens are
+     * signed with a random key that only lives as long as the process
+     */
+    class session_token
+    {
+    public:
+        enum token_result
+        {
+            token_valid, // the token was accepted
+            token_malformed, // the token could not be decoded
+            token_bad_signature, // the token was not issued by this process or was altered
+            token_expired, // the token's lifetime has elapsed
+            token_revoked // the user's password or shadow entry changed since the token was issued
+        };
+
+        // generates the signing key; must be called once before any tokens are issued
+        static void initialize();
+
+        // the lifetime of new tokens in seconds; zero disables tokens
+        static void set_lifetime(rtypes::uint32 seconds)
+        { _lifetime = seconds; }
+        static rtypes::uint32 get_lifetime()
+        { return _lifetime; }
+
+        // creates a token for an authenticated user; 'expires' receives the expiration
+        // time (seconds since the epoch); false is returned if tokens are disabled or
+        // the user's account entry could not be read
+        static bool issue(const user_info& user,rtypes::str& token,rtypes::uint64& expires);
+
+        // checks a token and, if it is valid, fills out 'user'
+        static token_result resume(const rtypes::str& token,user_info& user);
+    private:
+        static const rtypes::size_type KEY_SIZE = 32;
+        static unsigned char _key[KEY_SIZE];
+        static bool _keyReady;
+        static rtypes::uint32 _lifetime;
+
+        static bool _entryDigest(int uid,rtypes::str& digest);
+        static void _fileStamps(rtypes::uint64& passwdStamp,rtypes::uint64& shadowStamp);
+        static void _sign(const rtypes::str& payload,rtypes::str& mac);
+    };
+}
+
+#endif
+
+/*
+ * Local Variables:
+ * mode:c++
+ * indent-tabs-mode:nil
+ * tab-width:4
+ * End:
+ */
@@ -0,0 +1,112 @@
+// minecontrol-trace.h
+#ifndef MINECONTROL_TRACE_H
+#define MINECONTROL_TRACE_H
+#include "minecontrol-misc-types.h"
+
+namespace minecraft_controller
+{
+    /* request_trace:
+     *  splits the time spent on one client request into spans; message_loop keeps
+     * a trace on its stack and makes it current for its thread so that lower layers
+     * (socket IO, the server manager's lock) can charge their time to the request
+     * without being handed the trace; when no trace is current (other threads, the
+     * client programs) the static hooks do nothing but test a thread-local pointer
+     */
+    class request_trace
+    {
+    public:
+        enum span
+        {
+            span_read, // reading and parsing the request from when its first bytes arrived
+            span_dispatch, // finding the command's handler and checking the login
+            span_lock, // waiting for the server manager's lock
+            span_handler, // the handler itself, less lock waits and writes
+            span_write, // writing to the client's socket
+            span_count
+        };
+
+        static const char* span_name(int s)
+        {
+            static const char* const NAMES[span_count] = {
+                "read", "dispatch", "lock", "handler", "write"
+            };
+            return (s >= 0 && s < span_count) ? NAMES[s] : "unknown";
+        }
+
+        request_trace()
+        { _reset(); }
+        ~request_trace()
+        {
+            if (_current() == this)
+                _current() = nullptr;
+        }
+
+        // resets the spans and makes this the thread's current trace
+        void begin()
+        {
+            _reset();
+            _current() = this;
+        }
+
+        rtypes::uint64 get(int s) const
+        { return _spans[s]; }
+        void set(int s,rtypes::uint64 usec)
+        { _spans[s] = usec; }
+        rtypes::uint64 get_input_time() const // zero if the request was already buffered
+        { return _inputAt; }
+        bool is_streaming() const
+        { return _streaming; }
+
+        // hooks for lower layers; they apply to the calling thread's current trace
+        static bool active()
+        { return _current() != nullptr; }
+        static void charge(span s,rtypes::uint64 usec)
+        {
+            request_trace* trace = _current();
+            if (trace != nullptr)
+                trace->_spans[s] += usec;
+        }
+        static void input_arrived()
+        {
+            request_trace* trace = _current();
+            if (trace!=nullptr && trace->_inputAt==0)
+                trace->_inputAt = monotonic_microseconds();
+        }
+        // the request became a long-lived stream (e.g. console mode); neither
+        // its spans nor its duration say anything about request latency so they
+        // are not recorded
+        static void streaming()
+        {
+            request_trace* trace = _current();
+            if (trace != nullptr)
+                trace->_streaming = true;
+        }
+    private:
+        rtypes::uint64 _spans[span_count];
+        rtypes::uint64 _inputAt;
+        bool _streaming;
+
+        void _reset()
+        {
+            for (int i = 0;i < span_count;++i)
+                _spans[i] = 0;
+            _inputAt = 0;
+            _streaming = false;
+        }
+        static request_trace*& _current()
+        {
+            static thread_local request_trace* current = nullptr;
+            return current;
+        }
+    };
+}
+
+#endif
+
+/*
+ * Local Variables:
+ * mode:c++
+ * indent-tabs-mode:nil
+ * tab-width:4
+ * End:
+ */
@@ -0,0 +1,59 @@
+// minecontrol-user-fs.h
+#ifndef MINECONTROL_USER_FS_H
+#define MINECONTROL_USER_FS_H
+#include <sys/types.h>
+#ifdef __APPLE__
+#include <sys/kauth.h>
+#include <pthread.h>
+#else
+#include <sys/fsuid.h>
+#endif
+
+namespace minecraft_controller
+{
+    // while this exists the calling thread opens and creates files with a user's
+    // file system UID and GID rather than root's (Linux keeps these per thread;
+    // on macOS the thread takes on the user's credentials outright), so the user's
+    // permissions apply and new files already belong to the user; supplementary
+    // groups are not changed, so callers that read a user's files should still
+    // check who owns them
+    class user_fs_scope
+    {
+    public:
+        user_fs_scope(int uid,int gid)
+        {
+#ifdef __APPLE__
+            _uid = _gid = 0;
+            ::pthread_setugid_np(uid,gid);
+#else
+            // the GID first: changing the UID away from root drops the privilege
+            _gid = ::setfsgid(gid);
+            _uid = ::setfsuid(uid);
+#endif
+        }
+        ~user_fs_scope()
+        {
+#ifdef __APPLE__
+            ::pthread_setugid_np(KAUTH_UID_NONE,KAUTH_GID_NONE);
+#else
+            ::setfsuid(_uid);
+            ::setfsgid(_gid);
+#endif
+        }
+    private:
+        user_fs_scope(const user_fs_scope&);
+        user_fs_scope& operator =(const user_fs_scope&);
+
+        int _uid, _gid;
+    };
+}
+
+#endif
+
+/*
+ * Local Variables:
+ * mode:c++
+ * indent-tabs-mode:nil
+ * tab-width:4
+ * End:
+ */
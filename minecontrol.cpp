@@ -1,18 +1,23 @@
 // minecontrol.cpp - minecraft-controller client application
 #include "minecontrol-protocol.h"
+#include "minecontrol-misc-types.h"
 #include "domain-socket.h"
 #include "net-socket.h"
 #include "mutex.h"
+#include <rlibrary/rdynarray.h>
 #include <rlibrary/rlist.h>
 #include <rlibrary/rstdio.h> // gets io_device
 #include <rlibrary/rstringstream.h>
 #include <rlibrary/rutility.h>
 #include <functional>
+#include <cstdio>
+#include <cstring>
 #include <unistd.h>
 #include <pthread.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <termios.h>
+#include <pwd.h>
 #include <ncurses.h>
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -35,6 +40,10 @@ static const char* const CLIENT_NAME = "minecontrol-standard";
 static const char* const PROGRAM_VERSION = PACKAGE_VERSION;
 static const char PROMPT_MAIN = '#';
 static const char PROMPT_CONSOLE = '$';
+static bool OFFER_BINARY_FRAMING = true;
+static bool OFFER_COMPRESSION = false;
+static const char* BATCH_SCRIPT = nullptr; // path of the batch script ("-" is stdin) or null when interactive
+static const size_type BATCH_WINDOW = 16; // most batch requests sent ahead of their responses
 
 // session_state structure: stores connection information
 struct session_state
@@ -61,6 +70,20 @@ struct session_state
     // session alive control
     bool sessionControl;
 
+    // batch mode: the script line being run and the requests whose responses
+    // haven't been read yet, oldest first
+    struct batch_entry
+    {
+        size_type line;
+        str command;
+    };
+    size_type batchLine;
+    str batchCommand;
+    batch_entry pending[BATCH_WINDOW];
+    size_type pendingHead, pendingCount;
+    size_type batchWindow; // 1 unless the server can take pipelined requests
+    size_type batchFailures;
+
     // mutex for cross-thread safety and control
     // variable for cross-thread sync
     mutex mtx;
@@ -72,6 +95,10 @@ session_state::session_state()
     paddress = NULL;
     sessionControl = true;
     control = true;
+    batchLine = 0;
+    pendingHead = pendingCount = 0;
+    batchWindow = 1;
+    batchFailures = 0;
 }
 session_state::~session_state()
 {
@@ -89,19 +116,35 @@ static bool check_long_option(const char* option,int& exitCode);
 static bool check_short_option(const char* option,const char* argument,int& exitCode);
 static void term_echo(bool onState);
 static bool check_status(io_device& device);
-static bool request_response_sequence(session_state& session);
-static bool print_response(minecontrol_message& response);
+static bool request_response_sequence(session_state& session,str* job = nullptr);
+static bool print_response(minecontrol_message& response,str* job = nullptr);
 static void insert_field_expression(minecontrol_message_buffer& msgbuf,const str& expression);
 static bool read_next_response_field(minecontrol_message& response,str& key,str& value);
+static bool prompt(const char* text,str& value,bool wholeLine = false);
+static bool run_command(const str& command,session_state& session);
+
+// batch mode
+static int run_batch(session_state& session,const char* script);
+static void batch_send(session_state& session);
+static bool batch_collect(session_state& session);
+static void batch_error(session_state& session,const char* message);
+static void json_string(rstream& stream,const char* value);
+static int utf8_sequence(const unsigned char* p);
 
 // commands
 static bool hello_exchange(session_state& session);
+static bool login_peer(session_state& session,const str& username);
 static void login(session_state& session); // these commands provide an interactive mode for input
 static void logout(session_state& session);
 static void start(session_state& session);
 static void extend(session_state& session);
 static void exec(session_state& session);
 static void auth_ls(session_state& session);
+static void server_ls(session_state& session);
+static void log_query(session_state& session);
+static void player_stats(session_state& session);
+static void job_watch(session_state& session);
+static void watch_job(session_state& session,const str& job);
 static void console(session_state& session);
 static void stop(session_state& session);
 static void any_command(const generic_string& command,session_state& session); // these commands do not provide an interactive mode
@@ -190,6 +233,10 @@ int main(int argc,const char* argv[])
         return 1;
     }
 
+    // in batch mode the script's responses are the only output
+    if (BATCH_SCRIPT != nullptr)
+        return run_batch(session,BATCH_SCRIPT);
+
     // greetings were received; connection is up
     stdConsole << "Connection established: client '"
                << PROGRAM_NAME << '-' << PROGRAM_VERSION << "' ---> server '"
@@ -223,74 +270,350 @@ int main(int argc,const char* argv[])
         session.inputStream >> command;
         rutil_to_lower_ref(command);
 
-        if (command == "login")
-            login(session);
-        else if (command == "logout")
-            logout(session);
-        else if (command == "start")
-            start(session);
-        else if (command == "extend")
-            extend(session);
-        else if (command == "exec")
-            exec(session);
-        else if (command == "auth-ls")
-            auth_ls(session);
-        else if (command == "console") {
-            // list<str> history;
-            // for (HIST_ENTRY** ent = history_list();*ent != nullptr;++ent) {
-            //     history.push_back((*ent)->line);
-            // }
-            // clear_history();
-
-            auto save_rl_catch_signals = rl_catch_signals;
-            auto save_rl_catch_sigwinch = rl_catch_sigwinch;
-            auto save_rl_deprep_term_function = rl_deprep_term_function;
-            auto save_rl_prep_term_function = rl_prep_term_function;
-            auto save_rl_change_environment = rl_change_environment;
-
-            // rl_replace_line("",0);
-            // rl_reset_line_state();
-            // rl_cleanup_after_signal();
-
-            rl_catch_signals = false;
-            rl_catch_sigwinch = false;
-            rl_deprep_term_function = nullptr;
-            rl_prep_term_function = nullptr;
-            rl_change_environment = false;
-
-            console(session);
-            clear_history();
-
-            rl_catch_signals = save_rl_catch_signals;
-            rl_catch_sigwinch = save_rl_catch_sigwinch;
-            rl_deprep_term_function = save_rl_deprep_term_function;
-            rl_prep_term_function = save_rl_prep_term_function;
-            rl_change_environment = save_rl_change_environment;
-
-            rl_replace_line("",0);
-            rl_reset_line_state();
-
-            // for (list<str>::iterator it = history.begin();it != history.end();++it) {
-            //     add_history(it->c_str());
-            // }
-        }
-        else if (command == "stop")
-            stop(session);
-        else if (command == "quit")
+        if ( !run_command(command,session) )
             break;
-        else
-            any_command(command,session);
     };
 
     return 0;
 }
 
+bool run_command(const str& command,session_state& session)
+{
+    if (command == "login")
+        login(session);
+    else if (command == "logout")
+        logout(session);
+    else if (command == "start")
+        start(session);
+    else if (command == "extend")
+        extend(session);
+    else if (command == "exec")
+        exec(session);
+    else if (command == "auth-ls")
+        auth_ls(session);
+    else if (command == "server-ls")
+        server_ls(session);
+    else if (command == "log-query")
+        log_query(session);
+    else if (command == "player-stats")
+        player_stats(session);
+    else if (command == "job-watch")
+        job_watch(session);
+    else if (command=="console" && BATCH_SCRIPT!=nullptr)
+        batch_error(session,"console mode isn't available in batch mode");
+    else if (command == "console") {
+        // list<str> history;
+        // for (HIST_ENTRY** ent = history_list();*ent != nullptr;++ent) {
+        //     history.push_back((*ent)->line);
+        // }
+        // clear_history();
+
+        auto save_rl_catch_signals = rl_catch_signals;
+        auto save_rl_catch_sigwinch = rl_catch_sigwinch;
+        auto save_rl_deprep_term_function = rl_deprep_term_function;
+        auto save_rl_prep_term_function = rl_prep_term_function;
+        auto save_rl_change_environment = rl_change_environment;
+
+        // rl_replace_line("",0);
+        // rl_reset_line_state();
+        // rl_cleanup_after_signal();
+
+        rl_catch_signals = false;
+        rl_catch_sigwinch = false;
+        rl_deprep_term_function = nullptr;
+        rl_prep_term_function = nullptr;
+        rl_change_environment = false;
+
+        console(session);
+        clear_history();
+
+        rl_catch_signals = save_rl_catch_signals;
+        rl_catch_sigwinch = save_rl_catch_sigwinch;
+        rl_deprep_term_function = save_rl_deprep_term_function;
+        rl_prep_term_function = save_rl_prep_term_function;
+        rl_change_environment = save_rl_change_environment;
+
+        rl_replace_line("",0);
+        rl_reset_line_state();
+
+        // for (list<str>::iterator it = history.begin();it != history.end();++it) {
+        //     add_history(it->c_str());
+        // }
+    }
+    else if (command == "stop")
+        stop(session);
+    else if (command == "quit")
+        return false;
+    else
+        any_command(command,session);
+    return true;
+}
+
+int run_batch(session_state& session,const char* script)
+{
+    // requests are only sent ahead of their responses over binary framing: each
+    // request is a single frame that the server reads exactly, so nothing of the
+    // next one is read along with it; older servers get one request at a time
+    if (session.psocket->get_framing() == socket_framing_binary)
+        session.batchWindow = BATCH_WINDOW;
+
+    FILE* input = std::strcmp(script,"-")==0 ? stdin : std::fopen(script,"r");
+    if (input == nullptr) {
+        errConsole << PROGRAM_NAME << ": couldn't open batch script '" << script << "'" << endline;
+        return 1;
+    }
+    char* line = nullptr;
+    size_t capacity = 0;
+    ssize_t length;
+    while (session.sessionControl && (length = ::getline(&line,&capacity,input)) != -1) {
+        ++session.batchLine;
+        while (length>0 && (line[length-1]=='\n' || line[length-1]=='\r'))
+            line[--length] = 0;
+        session.inputStream.clear();
+        session.inputStream.get_device() = line;
+        session.inputStream >> session.batchCommand;
+        // blank lines and comments
+        if (session.batchCommand.length()==0 || session.batchCommand[0]=='#')
+            continue;
+        rutil_to_lower_ref(session.batchCommand);
+        if ( !run_command(session.batchCommand,session) )
+            break;
+    }
+    std::free(line);
+    if (input != stdin)
+        std::fclose(input);
+
+    // read what is still outstanding
+    while (session.pendingCount>0 && batch_collect(session))
+        ;
+    if ( !session.sessionControl ) {
+        errConsole << PROGRAM_NAME << ": the connection was lost before the script finished" << endline;
+        return 2;
+    }
+    return session.batchFailures>0 ? 1 : 0;
+}
+
+void batch_send(session_state& session)
+{
+    if ( !session.sessionControl )
+        return;
+    session_state::batch_entry& entry = session.pending[(session.pendingHead + session.pendingCount) % BATCH_WINDOW];
+    entry.line = session.batchLine;
+    entry.command = session.batchCommand;
+    ++session.pendingCount;
+    session.connectStream << session.request.get_message();
+    // an asynchronous start is followed to its end with JOB-WATCH, so nothing
+    // may be sent behind it
+    size_type window = session.batchCommand=="start" ? 1 : session.batchWindow;
+    while (session.pendingCount >= window)
+        if ( !batch_collect(session) )
+            return;
+}
+
+bool batch_collect(session_state& session)
+{
+    // reads the response to the oldest outstanding request and prints it as a
+    // JSON object; LOG-LINES and JOB-EVENT messages are gathered until the
+    // message that ends the request; a START that returns a job is followed
+    // until the job ends and its events are reported with it
+    session_state::batch_entry& entry = session.pending[session.pendingHead];
+    stringstream object, items, events;
+    size_type itemCount = 0, eventCount = 0;
+    bool ok = false, following = false;
+    str key, value, response, job, error;
+    object << "{\"line\":" << entry.line << ",\"command\":";
+    json_string(object,entry.command.c_str());
+    while (true) {
+        session.connectStream >> session.response;
+        auto condition = session.connectStream.get_device().get_last_operation_status();
+        if (condition==no_input || condition==bad_read) {
+            session.sessionControl = false;
+            // this request and any sent after it have no answer
+            while (session.pendingCount > 0) {
+                session_state::batch_entry& lost = session.pending[session.pendingHead];
+                stdConsole << "{\"line\":" << lost.line << ",\"command\":";
+                json_string(stdConsole,lost.command.c_str());
+                stdConsole << ",\"ok\":false,\"error\":\"the connection was lost\"}" << endline;
+                session.pendingHead = (session.pendingHead + 1) % BATCH_WINDOW;
+                --session.pendingCount;
+                ++session.batchFailures;
+            }
+            return false;
+        }
+        response = session.response.get_command();
+        rutil_to_lower_ref(response);
+        if (response == "log-lines") {
+            while ( read_next_response_field(session.response,key,value) ) {
+                if (key == "item") {
+                    items << (itemCount++ > 0 ? "," : "");
+                    json_string(items,value.c_str());
+                }
+            }
+            continue;
+        }
+        if (response == "job-event") {
+            str event;
+            size_type fieldCount = 0;
+            events << (eventCount++ > 0 ? ",{" : "{");
+            while ( read_next_response_field(session.response,key,value) ) {
+                events << (fieldCount++ > 0 ? "," : "");
+                json_string(events,key.c_str());
+                events << ':';
+                json_string(events,value.c_str());
+                if (key == "event")
+                    event = value;
+            }
+            events << '}';
+            if (event!="ready" && event!="failed")
+                continue;
+            ok = (event == "ready");
+            break;
+        }
+
+        // the job being followed couldn't be watched
+        if (following) {
+            while ( read_next_response_field(session.response,key,value) )
+                if (key == "payload")
+                    error = value;
+            ok = false;
+            break;
+        }
+
+        // any other message ends the request
+        size_type fieldCount = 0;
+        stringstream fields;
+        ok = (response=="message" || response=="list-message");
+        while ( read_next_response_field(session.response,key,value) ) {
+            if (key == "item") {
+                items << (itemCount++ > 0 ? "," : "");
+                json_string(items,value.c_str());
+            }
+            else {
+                fields << (fieldCount++ > 0 ? "," : "");
+                json_string(fields,key.c_str());
+                fields << ':';
+                json_string(fields,value.c_str());
+                if (key == "job")
+                    job = value;
+            }
+        }
+        object << ",\"fields\":{" << fields.get_device() << '}';
+        if (ok && job.length()>0 && entry.command=="start" && session.pendingCount==1) {
+            session.request.begin("JOB-WATCH");
+            session.request.enqueue_field_name("Job");
+            session.request << job << flush;
+            session.connectStream << session.request.get_message();
+            following = true;
+            continue;
+        }
+        break;
+    }
+    object << ",\"ok\":" << (ok ? "true" : "false") << ",\"response\":";
+    json_string(object,response.c_str());
+    if (error.length() > 0) {
+        object << ",\"error\":";
+        json_string(object,error.c_str());
+    }
+    if (itemCount > 0)
+        object << ",\"items\":[" << items.get_device() << ']';
+    if (eventCount > 0)
+        object << ",\"events\":[" << events.get_device() << ']';
+    object << '}';
+    stdConsole << object.get_device() << endline;
+
+    if (!ok)
+        ++session.batchFailures;
+    session.pendingHead = (session.pendingHead + 1) % BATCH_WINDOW;
+    --session.pendingCount;
+    return true;
+}
+
+void batch_error(session_state& session,const char* message)
+{
+    // keep the output in script order
+    while (session.pendingCount>0 && batch_collect(session))
+        ;
+    stdConsole << "{\"line\":" << session.batchLine << ",\"command\":";
+    json_string(stdConsole,session.batchCommand.c_str());
+    stdConsole << ",\"ok\":false,\"error\":";
+    json_string(stdConsole,message);
+    stdConsole << '}' << endline;
+    ++session.batchFailures;
+}
+
+// the length of the well-formed UTF-8 sequence at 'p' or zero if it isn't one
+int utf8_sequence(const unsigned char* p)
+{
+    int length;
+    unsigned char low = 0x80, high = 0xbf; // range of the second byte
+    if (p[0] < 0x80)
+        return 1;
+    if (p[0]>=0xc2 && p[0]<=0xdf)
+        length = 2;
+    else if (p[0]>=0xe0 && p[0]<=0xef) {
+        length = 3;
+        if (p[0] == 0xe0)
+            low = 0xa0; // overlong
+        else if (p[0] == 0xed)
+            high = 0x9f; // surrogates
+    }
+    else if (p[0]>=0xf0 && p[0]<=0xf4) {
+        length = 4;
+        if (p[0] == 0xf0)
+            low = 0x90; // overlong
+        else if (p[0] == 0xf4)
+            high = 0x8f; // past U+10FFFF
+    }
+    else
+        return 0;
+    if (p[1]<low || p[1]>high)
+        return 0;
+    for (int i = 2;i < length;++i)
+        if (p[i]<0x80 || p[i]>0xbf)
+            return 0;
+    return length;
+}
+
+void json_string(rstream& stream,const char* value)
+{
+    // JSON text must be UTF-8; bytes that don't form a valid sequence (a log
+    // line in another encoding, say) become U+FFFD
+    stream << '"';
+    for (const char* p = value;*p;++p) {
+        unsigned char c = *p;
+        if (c >= 0x80) {
+            int length = utf8_sequence(reinterpret_cast<const unsigned char*>(p));
+            if (length == 0)
+                stream << "\\ufffd";
+            else {
+                for (int i = 0;i < length;++i)
+                    stream << p[i];
+                p += length-1;
+            }
+        }
+        else if (c=='"' || c=='\\')
+            stream << '\\' << char(c);
+        else if (c == '\n')
+            stream << "\\n";
+        else if (c == '\t')
+            stream << "\\t";
+        else if (c < 0x20) {
+            char escape[8];
+            snprintf(escape,sizeof(escape),"\\u%04x",c);
+            stream << escape;
+        }
+        else
+            stream << char(c);
+    }
+    stream << '"';
+}
+
 bool check_long_option(const char* option,int& exitCode)
 {
     exitCode = 0;
     if ( rutil_strcmp(option,"help") ) {
         stdConsole << "usage: " << PROGRAM_NAME <<
-" [remote-host] [-p port|path] [--version] [--help]\n\
+" [remote-host] [-p port|path] [--text-framing] [--compress] [--batch[=script]] [--version] [--help]\n\
 \n\
 The following commands can be run interactively:\n\
  login - authenticate with minecontrol server\n\
@@ -299,10 +622,19 @@ The following commands can be run interactively:\n\
  stop - terminate remote Minecraft server\n\
  extend - extend time limit for Minecraft server\n\
  exec - run authority program\n\
+ server-ls - list Minecraft servers\n\
+ job-watch - follow the progress of an asynchronous start\n\
+ startup-stats - show server start-up latencies by profile\n\
+ log-query - search a Minecraft server's archived output\n\
+ player-stats - report playtime or peak player counts for a server\n\
  console - enter Minecraft server console mode\n\
  shutdown - terminate remote minecontrol server\n\
+ stats - show per-command request latencies (root only)\n\
  quit - exit this program\n\
 \n\
+With --batch, the commands are read from the script (or standard input) and each\n\
+response is printed as a line of JSON.\n\
+\n\
 Run 'man minecontrol(1)' for more information.\n\
 Report bugs to Roger Gee <rpg11a@acu.edu>" << endline;
         return false;
@@ -311,6 +643,19 @@ Report bugs to Roger Gee <rpg11a@acu.edu>" << endline;
         stdConsole << PROGRAM_NAME << " version " << PROGRAM_VERSION << newline;
         return false;
     }
+    else if ( rutil_strcmp(option,"text-framing") ) {
+        // don't offer binary framing to the server
+        OFFER_BINARY_FRAMING = false;
+    }
+    else if ( rutil_strcmp(option,"compress") ) {
+        // ask the server to compress the connection
+        OFFER_COMPRESSION = true;
+    }
+    else if (rutil_strcmp(option,"batch") || std::strncmp(option,"batch=",6)==0) {
+        // run the commands in a script (standard input by default) and report
+        // each response as a line of JSON
+        BATCH_SCRIPT = option[5]=='=' && option[6]!=0 ? option+6 : "-";
+    }
     else {
         errConsole << PROGRAM_NAME << ": error: unrecognized option '" << option << "'\n";
         exitCode = 1;
@@ -373,8 +718,13 @@ bool check_status(io_device& device)
     return true;
 }
 
-bool request_response_sequence(session_state& session)
+bool request_response_sequence(session_state& session,str* job)
 {
+    // in batch mode the response is reported when it arrives
+    if (BATCH_SCRIPT != nullptr) {
+        batch_send(session);
+        return true;
+    }
     // make the request
     session.connectStream << session.request.get_message();
     // read the response
@@ -384,19 +734,22 @@ bool request_response_sequence(session_state& session)
         session.sessionControl = false;
         return false;
     }
-    return print_response(session.response);
+    return print_response(session.response,job);
 }
 
-bool print_response(minecontrol_message& response)
+bool print_response(minecontrol_message& response,str* job)
 {
     str key;
     if ( rutil_strcmp(response.get_command(),"message") ) {
+        str value;
         while (response.get_field_key_stream() >> key) {
-            if (key == "payload") {
-                response.get_field_value_stream() >> key;
-                stdConsole << key << newline;
-                break;
-            }
+            response.get_field_value_stream() >> value;
+            if (key == "payload")
+                stdConsole << value << newline;
+            else if (key == "token") // session token issued by LOGIN; see RESUME
+                stdConsole << "session token: " << value << newline;
+            else if (key == "job" && job != nullptr) // START with Async=yes
+                *job = value;
         }
         stdConsole << '[' << PROGRAM_NAME << ": server responded with SUCCESS message]" << endline;
         return true;
@@ -479,6 +832,19 @@ bool read_next_response_field(minecontrol_message& response,str& key,str& value)
     return false;
 }
 
+bool prompt(const char* text,str& value,bool wholeLine)
+{
+    // there is no one to ask in batch mode; the server rejects the missing value
+    if (BATCH_SCRIPT != nullptr)
+        return false;
+    stdConsole << text;
+    if (wholeLine)
+        stdConsole.getline(value);
+    else
+        stdConsole >> value;
+    return true;
+}
+
 bool hello_exchange(session_state& session)
 {
     str key;
@@ -486,25 +852,91 @@ bool hello_exchange(session_state& session)
     minecontrol_message req("HELLO");
     req.add_field("Name",CLIENT_NAME);
     req.add_field("Version",PROGRAM_VERSION);
+    if (OFFER_BINARY_FRAMING)
+        req.add_field(minecontrol_message::FRAMING_FIELD,minecontrol_message::FRAMING_BINARY);
+    if (OFFER_COMPRESSION)
+        req.add_field(minecontrol_message::COMPRESSION_FIELD,minecontrol_message::COMPRESSION_DEFLATE);
     session.connectStream << req;
     session.connectStream >> res;
     if (!res.good() || !rutil_strcmp(res.get_command(),"greetings"))
         return false;
     while (res.get_field_key_stream() >> key) {
+        str value;
+        res.get_field_value_stream() >> value;
         if (key == "name")
-            res.get_field_value_stream() >> session.serverName;
+            session.serverName = value;
         else if (key == "version")
-            res.get_field_value_stream() >> session.serverVersion;
+            session.serverVersion = value;
+        else if (key=="framing" && OFFER_BINARY_FRAMING) {
+            // the server accepted binary framing; older servers just omit the field
+            rutil_to_lower_ref(value);
+            if (value == minecontrol_message::FRAMING_BINARY)
+                session.psocket->set_framing(socket_framing_binary);
+        }
+        else if (key=="compression" && OFFER_COMPRESSION) {
+            rutil_to_lower_ref(value);
+            if (value==minecontrol_message::COMPRESSION_DEFLATE && !session.psocket->enable_compression())
+                return false;
+        }
     }
     return session.serverName.length()>0 && session.serverVersion.length()>0;
 }
 
+bool login_peer(session_state& session,const str& username)
+{
+    // ask the server to authenticate us by our process credentials; this only
+    // works on the local domain socket and doesn't require a password
+    session.request.begin("LOGIN");
+    session.request.enqueue_field_name("Method");
+    if (username.length() > 0)
+        session.request.enqueue_field_name("Username");
+    session.request << "peer" << newline << username << flush;
+    session.connectStream << session.request.get_message();
+    session.connectStream >> session.response;
+    if ( !check_status(session.connectStream.get_device()) ) {
+        session.sessionControl = false;
+        return false;
+    }
+    // if the server refused (e.g. it's an older server) then say nothing and
+    // let the caller fall back to a password login
+    if ( !rutil_strcmp(session.response.get_command(),"message") )
+        return false;
+    print_response(session.response);
+    return true;
+}
+
 void login(session_state& session)
 {
     str username, password;
     minecontrol_message response;
     // try to read username from original command line
     session.inputStream >> username;
+    // local clients logging in as themselves don't need a password
+    if (session.psocket->get_family() == socket_family_unix) {
+        passwd* pwd = getpwuid( getuid() );
+        if (pwd!=NULL && (username.length()==0 || username==pwd->pw_name)) {
+            if (BATCH_SCRIPT != nullptr) {
+                // there is no fallback to a password without someone to type it
+                session.request.begin("LOGIN");
+                session.request.enqueue_field_name("Method");
+                session.request.enqueue_field_name("Username");
+                session.request << "peer" << newline << pwd->pw_name << flush;
+                batch_send(session);
+                return;
+            }
+            if ( login_peer(session,pwd->pw_name) ) {
+                session.username = pwd->pw_name;
+                return;
+            }
+            if ( !session.sessionControl )
+                return;
+            username = pwd->pw_name;
+        }
+    }
+    if (BATCH_SCRIPT != nullptr) {
+        batch_error(session,"a password login needs a terminal; log in as yourself over the local socket or use 'resume Token=...'");
+        return;
+    }
     if (username.length() == 0) {
         stdConsole << "login: ";
         stdConsole >> username;
@@ -547,11 +979,8 @@ void start(session_state& session)
             if (props[i] == '\\')
                 props[i] = '\n';
     }
-    else {
-        stdConsole << "Enter server name: ";
-        stdConsole >> name;
-        stdConsole << "Is this a new server? ";
-        stdConsole >> s;
+    else if ( prompt("Enter server name: ",name) ) {
+        prompt("Is this a new server? ",s);
         rutil_to_lower_ref(s);
         modifier = (s=="y" || s=="yes");
         stdConsole << "Enter server properties:\n";
@@ -573,6 +1002,96 @@ void start(session_state& session)
     session.request << name << newline << modifier << newline;
     insert_field_expression(session.request,props);
     session.request << flush;
+    // an asynchronous start replies with a job id; follow it until the server is ready
+    str job;
+    if (request_response_sequence(session,&job) && job.length() > 0)
+        watch_job(session,job);
+}
+void job_watch(session_state& session)
+{
+    str job;
+    if ( !(session.inputStream >> job) ) {
+        prompt("Enter job id: ",job);
+    }
+    watch_job(session,job);
+}
+void watch_job(session_state& session,const str& job)
+{
+    session.request.begin("JOB-WATCH");
+    session.request.enqueue_field_name("Job");
+    session.request << job << flush;
+    if (BATCH_SCRIPT != nullptr) {
+        batch_send(session);
+        return;
+    }
+    session.connectStream << session.request.get_message();
+    // the server sends a JOB-EVENT message for each startup event until the
+    // job's last event (either 'ready' or 'failed')
+    while (true) {
+        str key, value, event, payload, elapsed, progress;
+        session.connectStream >> session.response;
+        if ( !check_status(session.connectStream.get_device()) ) {
+            session.sessionControl = false;
+            return;
+        }
+        if ( !rutil_strcmp(session.response.get_command(),"job-event") ) {
+            print_response(session.response);
+            return;
+        }
+        while (session.response.get_field_key_stream() >> key) {
+            session.response.get_field_value_stream() >> value;
+            if (key == "event")
+                event = value;
+            else if (key == "payload")
+                payload = value;
+            else if (key == "elapsed")
+                elapsed = value;
+            else if (key == "progress")
+                progress = value;
+        }
+        if (event == "progress")
+            stdConsole << "[+" << elapsed << "ms] preparing spawn area: " << progress << '%' << endline;
+        else if (event == "failed") {
+            errConsole << "[+" << elapsed << "ms] " << payload << newline;
+            errConsole << '[' << PROGRAM_NAME << ": job " << job << " failed]" << endline;
+            return;
+        }
+        else
+            stdConsole << "[+" << elapsed << "ms] " << event << ": " << payload << endline;
+        if (event == "ready") {
+            stdConsole << '[' << PROGRAM_NAME << ": job " << job << " finished; the server is ready]" << endline;
+            return;
+        }
+    }
+}
+void server_ls(session_state& session)
+{
+    str token, prefix, offset, limit;
+
+    // server-ls [prefix] [-o offset] [-n limit]
+    while (session.inputStream >> token) {
+        if (token == "-o")
+            session.inputStream >> offset;
+        else if (token == "-n")
+            session.inputStream >> limit;
+        else
+            prefix = token;
+    }
+    session.request.begin("SERVER-LS");
+    if (prefix.length() != 0) {
+        session.request.enqueue_field_name("Prefix");
+        session.request << prefix << newline;
+    }
+    if (offset.length() != 0) {
+        session.request.enqueue_field_name("Offset");
+        session.request << offset << newline;
+    }
+    if (limit.length() != 0) {
+        session.request.enqueue_field_name("Limit");
+        session.request << limit << newline;
+    }
+    session.request << flush;
+
     request_response_sequence(session);
 }
 
@@ -581,12 +1100,10 @@ void extend(session_state& session)
     str tokA, tokB;
     session.inputStream >> tokA >> tokB;
     if (tokA.length() == 0) {
-        stdConsole << "Enter ID of running server: ";
-        stdConsole >> tokA;
+        prompt("Enter ID of running server: ",tokA);
     }
     if (tokB.length() == 0) {
-        stdConsole << "Enter time to extend (hours): ";
-        stdConsole >> tokB;
+        prompt("Enter time to extend (hours): ",tokB);
     }
     session.request.begin("EXTEND");
     session.request.enqueue_field_name("ServerID");
@@ -600,8 +1117,7 @@ void exec(session_state& session)
     str tokA, tokB;
     session.inputStream >> tokA;
     if (tokA.length() == 0) {
-        stdConsole << "Enter ID of running server: ";
-        stdConsole >> tokA;
+        prompt("Enter ID of running server: ",tokA);
     }
     while ( session.inputStream.has_input() ) {
         str item;
@@ -614,8 +1130,7 @@ void exec(session_state& session)
             tokB += item;
     }
     if (tokB.length() == 0) {
-        stdConsole << "Enter command: ";
-        stdConsole.getline(tokB);
+        prompt("Enter command: ",tokB,true);
     }
     session.request.begin("EXEC");
     session.request.enqueue_field_name("ServerID");
@@ -624,6 +1139,101 @@ void exec(session_state& session)
     request_response_sequence(session);
 }
 
+void log_query(session_state& session)
+{
+    static const char* const FIELDS[] = { "Since", "Until", "Gist", "Match", "Limit" };
+    static const char* const FLAGS[] = { "-s", "-u", "-g", "-m", "-n" };
+    str token, name, values[5];
+
+    // log-query server-name [-s since] [-u until] [-g gist,...] [-m text] [-n limit]
+    while (session.inputStream >> token) {
+        int i = 0;
+        while (i<5 && token!=FLAGS[i])
+            ++i;
+        if (i < 5)
+            session.inputStream >> values[i];
+        else
+            name = token;
+    }
+    if (name.length() == 0) {
+        prompt("Enter server name: ",name);
+    }
+    session.request.begin("LOG-QUERY");
+    session.request.enqueue_field_name("ServerName");
+    session.request << name << newline;
+    for (int i = 0;i < 5;++i) {
+        if (values[i].length() != 0) {
+            session.request.enqueue_field_name(FIELDS[i]);
+            session.request << values[i] << newline;
+        }
+    }
+    session.request << flush;
+    if (BATCH_SCRIPT != nullptr) {
+        batch_send(session);
+        return;
+    }
+    session.connectStream << session.request.get_message();
+
+    // the server sends LOG-LINES messages until it reports the outcome
+    while (true) {
+        str key;
+        session.connectStream >> session.response;
+        if ( !check_status(session.connectStream.get_device()) ) {
+            session.sessionControl = false;
+            return;
+        }
+        if ( !rutil_strcmp(session.response.get_command(),"log-lines") ) {
+            print_response(session.response);
+            return;
+        }
+        while (session.response.get_field_key_stream() >> key) {
+            if (key == "item") {
+                session.response.get_field_value_stream() >> key;
+                stdConsole << key << newline;
+            }
+        }
+        stdConsole.flush_output();
+    }
+}
+
+void player_stats(session_state& session)
+{
+    static const char* const FIELDS[] = { "Since", "Until", "Player", "Bucket" };
+    static const char* const FLAGS[] = { "-s", "-u", "-p", "-b" };
+    str token, name, report, values[4];
+
+    // player-stats server-name [playtime|peak] [-s since] [-u until] [-p player] [-b seconds]
+    while (session.inputStream >> token) {
+        int i = 0;
+        while (i<4 && token!=FLAGS[i])
+            ++i;
+        if (i < 4)
+            session.inputStream >> values[i];
+        else if (token=="playtime" || token=="peak")
+            report = token;
+        else
+            name = token;
+    }
+    if (name.length() == 0) {
+        prompt("Enter server name: ",name);
+    }
+    session.request.begin("PLAYER-STATS");
+    session.request.enqueue_field_name("ServerName");
+    session.request << name << newline;
+    if (report.length() != 0) {
+        session.request.enqueue_field_name("Report");
+        session.request << report << newline;
+    }
+    for (int i = 0;i < 4;++i) {
+        if (values[i].length() != 0) {
+            session.request.enqueue_field_name(FIELDS[i]);
+            session.request << values[i] << newline;
+        }
+    }
+    session.request << flush;
+    request_response_sequence(session);
+}
+
 void auth_ls(session_state& session)
 {
     str filter;
@@ -638,8 +1248,68 @@ void auth_ls(session_state& session)
     request_response_sequence(session);
 }
 
+// console_ring: holds console lines between the thread that reads them and the
+// thread that draws them; when it is full the oldest lines are overwritten
+// since a burst that large scrolls past before it could be drawn anyway
+struct console_ring
+{
+    console_ring();
+
+    void push(const str& line);
+    // copies the lines that haven't been drawn (at most 'most' of the newest ones)
+    // into 'out', oldest first; returns the number of lines passed over
+    size_type take(dynamic_array<str>& out,size_type most);
+
+    static const size_type CAPACITY = 4096;
+
+    mutex mtx;
+    str lines[CAPACITY];
+    size_type head, count; // 'head' is the oldest line
+    size_type overwritten;
+};
+console_ring::console_ring()
+{
+    head = 0;
+    count = 0;
+    overwritten = 0;
+}
+void console_ring::push(const str& line)
+{
+    mtx.lock();
+    if (count == CAPACITY) {
+        head = (head + 1) % CAPACITY;
+        --count;
+        ++overwritten;
+    }
+    lines[(head + count) % CAPACITY] = line;
+    ++count;
+    mtx.unlock();
+}
+size_type console_ring::take(dynamic_array<str>& out,size_type most)
+{
+    size_type skipped;
+    mtx.lock();
+    skipped = overwritten;
+    overwritten = 0;
+    if (count > most) {
+        skipped += count - most;
+        head = (head + count - most) % CAPACITY;
+        count = most;
+    }
+    while (count > 0) {
+        out.push_back(lines[head]);
+        head = (head + 1) % CAPACITY;
+        --count;
+    }
+    mtx.unlock();
+    return skipped;
+}
+
 void console(session_state& session)
 {
+    // the message window is redrawn at most this often no matter how fast
+    // lines arrive, so a burst of output can't starve the input line
+    static const int FRAME_MSEC = 33;
     bool good;
     str key, value;
     pthread_t tid;
@@ -652,8 +1322,7 @@ void console(session_state& session)
     // get server id from user; first see if they specified it on the cmdline
     session.inputStream >> key;
     if (key.length() == 0) {
-        stdConsole << "Enter ID of running server: ";
-        stdConsole >> key;
+        prompt("Enter ID of running server: ",key);
     }
 
     // negotiate with the server for console mode
@@ -698,10 +1367,10 @@ void console(session_state& session)
     nonl();
     intrflush(nullptr,false);
 
-    // Set up console messages thread.
-    std::function<void()> console_thread_functor = [&session,&winMessages]() {
-        static const int BUFFER_MAX = 1024;
-
+    // Set up console messages thread. It only queues lines; the input loop below
+    // draws them so that every ncurses call happens on one thread.
+    console_ring ring;
+    std::function<void()> console_thread_functor = [&session,&ring]() {
         bool done = false;
         str key, value;
         minecontrol_message serverMessage;
@@ -723,15 +1392,8 @@ void console(session_state& session)
                         break;
                     }
 
-                    if (key=="payload" && value.length()>0) {
-                        session.mtx.lock();
-                        wscrl(winMessages,-1);
-                        wmove(winMessages,0,0);
-                        waddstr(winMessages,value.c_str());
-                        wrefresh(winMessages);
-                        session.mtx.unlock();
-                        console_rl_redisplay_callback();
-                    }
+                    if (key=="payload" && value.length()>0)
+                        ring.push(value);
                 }
             }
         }
@@ -744,27 +1406,22 @@ void console(session_state& session)
         &console_output_thread,
         &console_thread_functor);
 
-    // get user command input; quit with 'quit'/'exit' command; use the session.mtx
-    // mutex to synchronize access to the connect stream and the ncurses library calls
+    // get user command input; quit with 'quit'/'exit' command
     str cache;
     bool doCache = false; // cache commands to send as a batch later on
     minecontrol_message request("CONSOLE-COMMAND");
-    static const int BUFFER_MAX = 1024;
-    char buffer[BUFFER_MAX];
 
     // Create display function for readline to write to the command window.
-    consoleRlRedisplayFunctor = [&winCommand,&session](void) {
-        session.mtx.lock();
+    consoleRlRedisplayFunctor = [&winCommand](void) {
         werase(winCommand);
         mvwprintw(winCommand,0,0,"%s%s",rl_display_prompt,rl_line_buffer);
         wmove(winCommand,0,rutil_strlen(rl_display_prompt) + rl_point);
         wrefresh(winCommand);
-        session.mtx.unlock();
     };
     rl_redisplay_function = &console_rl_redisplay_callback;
 
     // Create a handler for when readline sends us a line.
-    consoleRlLineFunctor = [&request,&session,&doCache,&cache,&winMessages](char* line) {
+    consoleRlLineFunctor = [&request,&session,&doCache,&cache,&ring](char* line) {
         if (line == nullptr) {
             return;
         }
@@ -775,12 +1432,7 @@ void console(session_state& session)
 
         if ( rutil_strcmp(line,"cache") ) {
             doCache = true;
-            session.mtx.lock();
-            wscrl(winMessages,-1);
-            wmove(winMessages,0,0);
-            waddstr(winMessages,"<<== (minecontrol client) Command cache is enabled; type 'release' to flush and disable");
-            wrefresh(winMessages);
-            session.mtx.unlock();
+            ring.push("<<== (minecontrol client) Command cache is enabled; type 'release' to flush and disable");
         }
         else if ( rutil_strcmp(line,"release") ) {
             size_type i;
@@ -796,12 +1448,7 @@ void console(session_state& session)
             session.connectStream << request;
             request.reset_fields();
             cache.clear();
-            session.mtx.lock();
-            wscrl(winMessages,-1);
-            wmove(winMessages,0,0);
-            waddstr(winMessages,"<<== (minecontrol client) Command cache has been flushed and disabled");
-            wrefresh(winMessages);
-            session.mtx.unlock();
+            ring.push("<<== (minecontrol client) Command cache has been flushed and disabled");
         }
         else if (rutil_strcmp(line,"quit") || rutil_strcmp(line,"exit")) {
             session.control = false;
@@ -818,6 +1465,40 @@ void console(session_state& session)
     };
     rl_callback_handler_install("ServerConsole> ",&console_rl_line_callback);
 
+    // Draws the lines queued since the last frame. Only as many lines as the
+    // window holds are drawn; older ones would scroll away before anyone saw them.
+    dynamic_array<str> pending;
+    uint64 lastFrame = 0;
+    auto render_frame = [&winMessages,&ring,&pending,&lastFrame]() {
+        char note[96];
+        size_type skipped;
+        size_type rows = getmaxy(winMessages);
+
+        lastFrame = monotonic_milliseconds();
+        pending.clear();
+        skipped = ring.take(pending,rows > 1 ? rows - 1 : 1);
+        if (skipped == 0 && pending.size() == 0)
+            return;
+        if (skipped > 0) {
+            snprintf(note,sizeof(note),"<<== (minecontrol client) %llu lines skipped",(unsigned long long)skipped);
+            wscrl(winMessages,-1);
+            wmove(winMessages,0,0);
+            waddstr(winMessages,note);
+        }
+        for (size_type i = 0;i < pending.size();++i) {
+            wscrl(winMessages,-1);
+            wmove(winMessages,0,0);
+            waddstr(winMessages,pending[i].c_str());
+        }
+        // one terminal update per frame: the messages and then the input line
+        // (which leaves the cursor where the user is typing)
+        wnoutrefresh(winMessages);
+        console_rl_redisplay_callback();
+    };
+
+    // wake at least once a frame so that queued lines are drawn (and a closed
+    // console is noticed) even when the user isn't typing
+    wtimeout(winCommand,FRAME_MSEC);
     console_rl_redisplay_callback();
     session.control = true;
     while (session.control) {
@@ -826,10 +1507,12 @@ void console(session_state& session)
         if (ch == KEY_F(1)) {
             session.control = false;
         }
-        else {
+        else if (ch != chtype(ERR)) {
             rl_stuff_char(ch);
             rl_callback_read_char();
         }
+        if (monotonic_milliseconds() - lastFrame >= uint64(FRAME_MSEC))
+            render_frame();
     }
 
     session.request.begin("CONSOLE-QUIT");
@@ -854,8 +1537,7 @@ void stop(session_state& session)
     str tok, authTok;
     session.inputStream >> tok;
     if (tok.length() == 0) {
-        stdConsole << "Enter ID of running server: ";
-        stdConsole >> tok;
+        prompt("Enter ID of running server: ",tok);
     }
     i = 0;
     while (i<tok.length() && tok[i]!=':')
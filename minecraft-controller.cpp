@@ -1,6 +1,12 @@
 // minecraft-controller.cpp
 #include "minecraft-server.h"
 #include "minecontrol-client.h"
+#include "minecontrol-admission.h"
+#include "minecontrol-token.h"
+#include "minecontrol-job.h"
+#include "minecontrol-metrics.h"
+#include "minecontrol-log.h"
+#include "minecontrol-authority.h"
 #include "minecraft-controller.h"
 #include "domain-socket.h"
 #include "net-socket.h"
@@ -39,12 +45,28 @@ static const char* const SERVICE_PORT = "44446";
 static constexpr char OPTION_VERSION = 'v';
 static constexpr char OPTION_HELP = 'h';
 static constexpr char OPTION_NODAEMON = 'n';
+static constexpr char OPTION_MAX_CLIENTS = 'c';
+static constexpr char OPTION_MAX_CLIENTS_PER_HOST = 'C';
+static constexpr char OPTION_CONNECT_RATE = 'r';
+static constexpr char OPTION_LOGIN_RATE = 'l';
+static constexpr char OPTION_HELLO_TIMEOUT = 't';
+static constexpr char OPTION_TOKEN_LIFETIME = 'T';
+static constexpr char OPTION_METRICS = 'm';
+static constexpr char OPTION_SLOW_REQUEST = 's';
 
 static const char* const SHORT_OPTS = "";
 static const struct option LONG_OPTS[] = {
     { "version", no_argument, nullptr, OPTION_VERSION },
     { "help", no_argument, nullptr, OPTION_HELP },
     { "no-daemon", no_argument, nullptr, OPTION_NODAEMON },
+    { "max-clients", required_argument, nullptr, OPTION_MAX_CLIENTS },
+    { "max-clients-per-host", required_argument, nullptr, OPTION_MAX_CLIENTS_PER_HOST },
+    { "connect-rate", required_argument, nullptr, OPTION_CONNECT_RATE },
+    { "login-rate", required_argument, nullptr, OPTION_LOGIN_RATE },
+    { "hello-timeout", required_argument, nullptr, OPTION_HELLO_TIMEOUT },
+    { "token-lifetime", required_argument, nullptr, OPTION_TOKEN_LIFETIME },
+    { "metrics", required_argument, nullptr, OPTION_METRICS },
+    { "slow-request", required_argument, nullptr, OPTION_SLOW_REQUEST },
     { 0, 0, 0, 0 }
 };
 
@@ -65,12 +87,14 @@ static void create_server_sockets(); // creates server sockets
 static void local_operation(); // accepts local connections; manages the thread that runs remote_operation
 static void* remote_operation(void*); // started on a new thread by local_operation; accepts remote connections
 static void fatal_error(const char* message); // exits the calling process after showing error message on STDERR
+static uint32 numeric_option(const char* name,const char* argument); // parses a non-negative integer option argument
 
 int main(int argc,char** argv)
 {
     bool version = false;
     bool help = false;
     bool nodaemon = false;
+    const char* metricsEndpoint = nullptr;
 
     while (true) {
         int optionIndex;
@@ -90,6 +114,32 @@ int main(int argc,char** argv)
         case 'n':
             nodaemon = true;
             break;
+        case OPTION_MAX_CLIENTS:
+            client_admission::set_max_clients(numeric_option("max-clients",optarg));
+            break;
+        case OPTION_MAX_CLIENTS_PER_HOST:
+            client_admission::set_max_clients_per_host(numeric_option("max-clients-per-host",optarg));
+            break;
+        case OPTION_CONNECT_RATE:
+            client_admission::set_connect_rate(numeric_option("connect-rate",optarg));
+            break;
+        case OPTION_LOGIN_RATE:
+            client_admission::set_login_rate(numeric_option("login-rate",optarg));
+            break;
+        case OPTION_HELLO_TIMEOUT:
+            controller_client::set_hello_timeout(numeric_option("hello-timeout",optarg));
+            break;
+        case OPTION_TOKEN_LIFETIME:
+            session_token::set_lifetime(numeric_option("token-lifetime",optarg));
+            break;
+        case OPTION_METRICS:
+            metricsEndpoint = optarg;
+            break;
+        case OPTION_SLOW_REQUEST:
+            controller_client::set_slow_request_threshold(numeric_option("slow-request",optarg));
+            break;
+        case '?':
+            exit(EXIT_FAILURE);
         }
     }
 
@@ -123,13 +173,26 @@ int main(int argc,char** argv)
     SSL_load_error_strings();
     OpenSSL_add_all_algorithms();
 
+    // create the key used to sign session tokens
+    session_token::initialize();
+
     // attempt to bind server sockets
     create_server_sockets();
 
+    // serve metrics if requested
+    controller_client::register_metrics();
+    if (metricsEndpoint != nullptr && !minecontrol_metrics::start_server(metricsEndpoint))
+        fatal_error("cannot bind metrics endpoint");
+
+    // log from a background writer from now on (threads must not be started
+    // before daemonize forks)
+    log_queue::start();
+
     // log process start
     minecontrold::standardLog << "process started" << endline;
 
     // perform startup operations
+    authority_program_index::start_watcher();
     minecraft_server_manager::startup_server_manager();
 
     // begin local server operation
@@ -137,10 +200,27 @@ int main(int argc,char** argv)
 
     // perform shutdown operations
     controller_client::shutdown_clients();
+    start_job::wait_launches();
     minecraft_server_manager::shutdown_server_manager();
+    authority_program_index::stop_watcher();
+    minecontrol_metrics::stop_server();
+
+    // report lock contention (only when built with MINECONTROL_MUTEX_STATS)
+    if ( mutex::has_stats() ) {
+        str line;
+        stringstream stats;
+        mutex::write_stats(stats);
+        stats.flush_output();
+        while ( stats.has_input() ) {
+            stats.getline(line);
+            if (line.length() > 0)
+                minecontrold::standardLog << "lock " << line << endline;
+        }
+    }
 
     // log process completion
     minecontrold::standardLog << "process complete" << endline;
+    log_queue::stop();
 
     return 0;
 }
@@ -165,6 +245,15 @@ void print_help()
         "  --version    Print version information\n"
         "  --help       Print this message\n"
         "  --no-daemon  Do not become a daemon\n"
+        "  --max-clients=N           Accept at most N clients at once (default 64)\n"
+        "  --max-clients-per-host=N  Accept at most N clients at once from one remote host (default 8)\n"
+        "  --connect-rate=N          Allow N new connections per minute from one remote host (default 30)\n"
+        "  --login-rate=N            Allow N login attempts per minute from one host (default 10)\n"
+        "  --hello-timeout=SECONDS   Time a new client has to send HELLO (default 10)\n"
+        "  --token-lifetime=SECONDS  Lifetime of session tokens issued by LOGIN (default 3600)\n"
+        "  --metrics=PORT|PATH       Serve Prometheus metrics on a loopback port or domain socket\n"
+        "  --slow-request=MSEC       Log requests that take longer than MSEC with their trace spans\n"
+        "  (a limit of zero disables it)\n"
         "\n"
         "See man minecontrold(1) for more notes.\n"
         "Report bugs (kindly!) to Roger Gee <rpg11a@acu.edu>.\n";
@@ -278,6 +367,10 @@ void create_server_sockets()
     // attempt to bind the network socket server
     if ( !remote.bind(networkAddress) )
         fatal_error("cannot bind network socket server to address");
+
+    // check connection limits as soon as connections are accepted
+    local.set_admission_filter(&client_admission::admit_connection,&client_admission::release_connection);
+    remote.set_admission_filter(&client_admission::admit_connection,&client_admission::release_connection);
 }
 
 void local_operation()
@@ -313,28 +406,54 @@ void fatal_error(const char* message)
     _exit(1);
 }
 
+uint32 numeric_option(const char* name,const char* argument)
+{
+    char* end;
+    unsigned long value = strtoul(argument,&end,10);
+    if (*argument==0 || *end!=0 || argument[0]=='-') {
+        errConsole << minecontrold::get_server_name() << ": option '--" << name << "' expects a non-negative integer" << endline;
+        exit(EXIT_FAILURE);
+    }
+    return static_cast<uint32>(value);
+}
+
 // minecraft_controller::minecraft_controller_log_stream
 minecraft_controller_log_stream::minecraft_controller_log_stream()
 {
 }
+namespace
+{
+    // the line prefix only changes once a second, so each thread formats it
+    // once a second and reuses it
+    struct log_prefix
+    {
+        time_t second;
+        size_t length;
+        char text[96];
+    };
+    thread_local log_prefix cachedPrefix;
+}
 void minecraft_controller_log_stream::_outDevice()
 {
-    char sbuffer[40];
-    time_t tp;
-    tm tmval;
-    ::time(&tp);
-    ::strftime(sbuffer,40,"%a %b %d %H:%M:%S",localtime_r(&tp,&tmval));
-    // send our local buffer to the standard console
-    // add name and process id
-    stdConsole << '[' << sbuffer << "] " << minecontrold::get_server_name()
-               << '[' << ::getpid() << "]: ";
-    stdConsole.place(*this);
-    stdConsole.flush_output();
+    if ( _bufOut.is_empty() )
+        return;
+    time_t tp = ::time(NULL);
+    if (tp != cachedPrefix.second || cachedPrefix.length == 0) {
+        char sbuffer[40];
+        tm tmval;
+        ::strftime(sbuffer,40,"%a %b %d %H:%M:%S",localtime_r(&tp,&tmval));
+        // add name and process id
+        int n = ::snprintf(cachedPrefix.text,sizeof(cachedPrefix.text),"[%s] %s[%d]: ",
+            sbuffer,minecontrold::get_server_name(),int(::getpid()));
+        cachedPrefix.length = (n > 0 && size_t(n) < sizeof(cachedPrefix.text)) ? size_t(n) : 0;
+        cachedPrefix.second = tp;
+    }
+    log_queue::write(cachedPrefix.text,cachedPrefix.length,&_bufOut.peek(),_bufOut.size());
     _bufOut.clear();
 }
 
 // minecraft-controller::minecontrold
-/*static*/ minecraft_controller_log_stream minecontrold::standardLog;
+/*static*/ thread_local minecraft_controller_log_stream minecontrold::standardLog;
 /*static*/ const char* minecontrold::SERVER_NAME = "minecontrold";
 /*static*/ const char* minecontrold::SERVER_VERSION = PACKAGE_VERSION;
 void minecontrold::shutdown_minecontrold()
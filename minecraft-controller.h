@@ -26,7 +26,9 @@ namespace minecraft_controller
         static void shutdown_minecontrold(); // shutdown the minecontrold server; this should terminate the process
         static void close_global_fds(); // close all global file descriptors in use by the process (except standard descriptors)
 
-        static minecraft_controller_log_stream standardLog;
+        // each thread has its own log stream so that threads don't share (or
+        // wait on) a buffer; finished lines go to the log_queue
+        static thread_local minecraft_controller_log_stream standardLog;
     private:
         static const char* SERVER_NAME;
         static const char* SERVER_VERSION;
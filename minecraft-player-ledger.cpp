@@ -0,0 +1,334 @@
+// minecraft-player-ledger.cpp
+#include "minecraft-player-ledger.h"
+#include "minecraft-controller.h"
+#include "minecontrol-user-fs.h"
+#include <algorithm>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+using namespace rtypes;
+using namespace minecraft_controller;
+
+namespace
+{
+    // the longest name and UUID kept for a player; both fit easily
+    const size_t MAX_FIELD = 100;
+
+    bool peak_event_less(const std::pair<uint64,int>& a,const std::pair<uint64,int>& b)
+    {
+        // at the same second a player leaving goes before one joining
+        return a.first < b.first || (a.first == b.first && a.second < b.second);
+    }
+
+    bool playtime_more(const minecraft_player_ledger::playtime& a,const minecraft_player_ledger::playtime& b)
+    {
+        return a.seconds > b.seconds || (a.seconds == b.seconds && a.name < b.name);
+    }
+}
+
+// minecraft_controller::minecraft_player_ledger
+
+/*static*/ const char* const minecraft_player_ledger::LEDGER_FILE = "player-ledger";
+minecraft_player_ledger::minecraft_player_ledger(const str& serverDirectory,int uid,int gid,bool writable)
+    : _mtx("player-ledger")
+{
+    _firstTime = _lastTime = 0;
+    _fd = -1;
+    std::string path = serverDirectory.c_str();
+    path += '/';
+    path += LEDGER_FILE;
+    // the server directory belongs to the user, so open the file as the user and
+    // refuse anything but a regular file of theirs (not a link to someone else's
+    // file, nor a FIFO that would block the open)
+    int fd;
+    struct stat st;
+    {
+        user_fs_scope scope(uid,gid);
+        fd = ::open(path.c_str(),(writable ? O_RDWR|O_CREAT|O_APPEND : O_RDONLY)|O_NOFOLLOW|O_NONBLOCK|O_NOCTTY|O_CLOEXEC,
+            S_IRUSR|S_IWUSR|S_IRGRP);
+    }
+    if (fd == -1) {
+        if (writable)
+            minecontrold::standardLog << "couldn't open player ledger " << path.c_str() << ": " << strerror(errno) << endline;
+        return;
+    }
+    if (::fstat(fd,&st)==-1 || !S_ISREG(st.st_mode) || (uid!=-1 && int(st.st_uid)!=uid)) {
+        minecontrold::standardLog << "refusing player ledger " << path.c_str() << ": not a regular file owned by the server's user" << endline;
+        ::close(fd);
+        return;
+    }
+
+    // read the whole file; records are small so even years of sessions take
+    // only a few megabytes
+    std::vector<char> data;
+    size_t size = 0;
+    if (st.st_size > 0) {
+        data.resize(st.st_size);
+        while (size < data.size()) {
+            ssize_t n = ::pread(fd,&data[size],data.size()-size,size);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            size += n;
+        }
+    }
+    size_t offset = 0;
+    while (offset+sizeof(_record) <= size) {
+        _record rec;
+        std::memcpy(&rec,&data[offset],sizeof(_record));
+        if (offset+sizeof(_record)+rec.length > size)
+            break;
+        _apply(rec,&data[offset+sizeof(_record)]);
+        offset += sizeof(_record) + rec.length;
+    }
+
+    if ( !writable ) {
+        ::close(fd);
+        // the server isn't running, so anyone still online left when it stopped
+        _close_online(_lastTime);
+        return;
+    }
+    // drop a record that was cut short so that new records line up
+    if (offset<size && ::ftruncate(fd,offset)==-1)
+        minecontrold::standardLog << "couldn't truncate player ledger " << path.c_str() << ": " << strerror(errno) << endline;
+    _fd = fd;
+    // players still online in the file were online when the server or minecontrold
+    // last stopped without saying so; the last thing recorded is the best guess
+    // at when they left
+    if ( !_online.empty() ) {
+        _record rec;
+        std::memset(&rec,0,sizeof(_record));
+        rec.time = _lastTime;
+        rec.kind = _record_reset;
+        _append(rec);
+        _apply(rec,NULL);
+    }
+}
+minecraft_player_ledger::~minecraft_player_ledger()
+{
+    if (_fd != -1)
+        ::close(_fd);
+}
+void minecraft_player_ledger::player_id(uint64 time,const char* name,const char* uuid)
+{
+    _mtx.lock();
+    _lookup(time,name,uuid);
+    _mtx.unlock();
+}
+void minecraft_player_ledger::join(uint64 time,const char* name)
+{
+    _record rec;
+    std::memset(&rec,0,sizeof(_record));
+    _mtx.lock();
+    rec.time = time;
+    rec.player = _lookup(time,name,"");
+    rec.kind = _record_join;
+    _append(rec);
+    _apply(rec,NULL);
+    _mtx.unlock();
+}
+void minecraft_player_ledger::leave(uint64 time,const char* name)
+{
+    _record rec;
+    std::memset(&rec,0,sizeof(_record));
+    _mtx.lock();
+    // a player who lost connection also 'left the game'; only the first counts
+    auto iter = _byName.find(name);
+    if (iter!=_byName.end() && std::find(_online.begin(),_online.end(),iter->second)!=_online.end()) {
+        rec.time = time;
+        rec.player = iter->second;
+        rec.kind = _record_leave;
+        _append(rec);
+        _apply(rec,NULL);
+    }
+    _mtx.unlock();
+}
+void minecraft_player_ledger::reset(uint64 time)
+{
+    _record rec;
+    std::memset(&rec,0,sizeof(_record));
+    _mtx.lock();
+    if ( !_online.empty() ) {
+        rec.time = time;
+        rec.kind = _record_reset;
+        _append(rec);
+        _apply(rec,NULL);
+    }
+    _mtx.unlock();
+}
+void minecraft_player_ledger::get_playtime(uint64 since,uint64 until,const char* player,std::vector<playtime>& out) const
+{
+    _mtx.lock();
+    for (size_type i = 0;i < _players.size();++i) {
+        const _player& p = _players[i];
+        if (player!=NULL && p.name!=player)
+            continue;
+        // a player's sessions don't overlap so their leave times are in order too
+        auto iter = std::partition_point(p.sessions.begin(),p.sessions.end(),
+            [this,since](const _session& s) { return _leave_time(s) <= since; });
+        playtime entry;
+        entry.seconds = 0;
+        entry.sessions = 0;
+        for (;iter!=p.sessions.end() && iter->join<until;++iter) {
+            uint64 from = std::max(iter->join,since);
+            uint64 to = std::min(_leave_time(*iter),until);
+            if (to > from)
+                entry.seconds += to - from;
+            ++entry.sessions;
+        }
+        if (entry.sessions > 0) {
+            entry.name = p.name;
+            entry.uuid = p.uuid;
+            out.push_back(entry);
+        }
+    }
+    _mtx.unlock();
+    std::sort(out.begin(),out.end(),playtime_more);
+}
+void minecraft_player_ledger::get_peaks(uint64 since,uint64 until,uint64 bucket,std::vector<peak>& out) const
+{
+    if (bucket==0 || since>=until)
+        return;
+    // collect the joins and leaves in the range and sweep through them in order
+    std::vector<std::pair<uint64,int> > events;
+    _mtx.lock();
+    for (size_type i = 0;i < _players.size();++i) {
+        const _player& p = _players[i];
+        auto iter = std::partition_point(p.sessions.begin(),p.sessions.end(),
+            [this,since](const _session& s) { return _leave_time(s) <= since; });
+        for (;iter!=p.sessions.end() && iter->join<until;++iter) {
+            events.push_back(std::make_pair(std::max(iter->join,since),1));
+            uint64 leave = _leave_time(*iter);
+            if (leave < until)
+                events.push_back(std::make_pair(leave,-1));
+        }
+    }
+    _mtx.unlock();
+    std::sort(events.begin(),events.end(),peak_event_less);
+
+    uint32 online = 0;
+    size_type next = 0;
+    for (uint64 start = since - since%bucket;start < until;start += bucket) {
+        peak entry;
+        entry.start = start;
+        entry.players = online;
+        while (next<events.size() && events[next].first<start+bucket) {
+            online += events[next].second;
+            entry.players = std::max(entry.players,online);
+            ++next;
+        }
+        out.push_back(entry);
+    }
+}
+uint64 minecraft_player_ledger::get_first_time() const
+{
+    _mtx.lock();
+    uint64 result = _firstTime;
+    _mtx.unlock();
+    return result;
+}
+uint64 minecraft_player_ledger::get_last_time() const
+{
+    _mtx.lock();
+    uint64 result = _lastTime;
+    _mtx.unlock();
+    return result;
+}
+uint32 minecraft_player_ledger::_lookup(uint64 time,const char* name,const char* uuid)
+{
+    auto iter = _byName.find(name);
+    if (iter!=_byName.end() && (*uuid==0 || _players[iter->second].uuid==uuid))
+        return iter->second;
+
+    // a new player, or a player whose UUID we now know (or that changed)
+    char data[2*MAX_FIELD + 1];
+    size_t nameLength = std::min(std::strlen(name),MAX_FIELD);
+    size_t uuidLength = std::min(std::strlen(uuid),MAX_FIELD);
+    std::memcpy(data,name,nameLength);
+    data[nameLength] = 0;
+    std::memcpy(data+nameLength+1,uuid,uuidLength);
+    _record rec;
+    std::memset(&rec,0,sizeof(_record));
+    rec.time = time;
+    rec.player = iter!=_byName.end() ? iter->second : uint32(_players.size());
+    rec.kind = _record_player;
+    rec.length = byte(nameLength + 1 + uuidLength);
+    _append(rec,data);
+    _apply(rec,data);
+    return rec.player;
+}
+void minecraft_player_ledger::_apply(const _record& rec,const char* data)
+{
+    if (_firstTime == 0)
+        _firstTime = rec.time;
+    _lastTime = std::max(_lastTime,rec.time);
+    if (rec.kind == _record_player) {
+        if (rec.player > _players.size() || rec.length == 0)
+            return;
+        if (rec.player == _players.size())
+            _players.push_back(_player());
+        _player& p = _players[rec.player];
+        const char* end = data + rec.length;
+        const char* nul = std::find(data,end,'\0');
+        p.name.assign(data,nul);
+        p.uuid.assign(nul==end ? end : nul+1,end);
+        _byName[p.name] = rec.player;
+    }
+    else if (rec.kind == _record_join) {
+        if (rec.player >= _players.size())
+            return;
+        _player& p = _players[rec.player];
+        auto iter = std::find(_online.begin(),_online.end(),rec.player);
+        if (iter != _online.end())
+            p.sessions.back().leave = rec.time; // we missed the player leaving
+        else
+            _online.push_back(rec.player);
+        _session s;
+        // if the clock was set back the session starts when the last one ended
+        s.join = p.sessions.empty() ? rec.time : std::max(rec.time,p.sessions.back().leave);
+        s.leave = OPEN;
+        p.sessions.push_back(s);
+    }
+    else if (rec.kind == _record_leave) {
+        auto iter = std::find(_online.begin(),_online.end(),rec.player);
+        if (iter == _online.end())
+            return;
+        _session& s = _players[rec.player].sessions.back();
+        s.leave = std::max(s.join,rec.time);
+        _online.erase(iter);
+    }
+    else if (rec.kind == _record_reset)
+        _close_online(rec.time);
+}
+void minecraft_player_ledger::_append(const _record& rec,const char* data)
+{
+    if (_fd == -1)
+        return;
+    // one write per record so that a record is never split between writers
+    char buffer[sizeof(_record) + 256];
+    std::memcpy(buffer,&rec,sizeof(_record));
+    if (rec.length > 0)
+        std::memcpy(buffer+sizeof(_record),data,rec.length);
+    if (::write(_fd,buffer,sizeof(_record)+rec.length) != ssize_t(sizeof(_record)+rec.length))
+        minecontrold::standardLog << "couldn't write to player ledger: " << strerror(errno) << endline;
+}
+void minecraft_player_ledger::_close_online(uint64 time)
+{
+    for (size_type i = 0;i < _online.size();++i) {
+        _session& s = _players[_online[i]].sessions.back();
+        s.leave = std::max(s.join,time);
+    }
+    _online.clear();
+}
+uint64 minecraft_player_ledger::_leave_time(const _session& session) const
+{
+    if (session.leave != OPEN)
+        return session.leave;
+    // still online
+    return std::max(uint64(::time(NULL)),session.join);
+}
@@ -0,0 +1,117 @@
+// minecraft-player-ledger.h
+#ifndef MINECRAFT_PLAYER_LEDGER_H
+#define MINECRAFT_PLAYER_LEDGER_H
+#include "mutex.h"
+#include <rlibrary/rtypestypes.h>
+#include <rlibrary/rstring.h>
+#include <string>
+#include <vector>
+#include <map>
+
+namespace minecraft_controller
+{
+    /* records when each player joined and left a server; the ledger is an append-only
+       file of small binary records (a player's name and UUID once, then one record per
+       join or leave) that is read into memory when the server starts, where each
+       player's sessions are kept in time order so that playtime and concurrency
+       questions are answered by binary search rather than by rereading the file or the
+       server's logs */
+    class minecraft_player_ledger
+    {
+    public:
+        struct playtime
+        {
+            std::string name, uuid;
+            rtypes::uint64 seconds;
+            rtypes::uint32 sessions; // sessions that overlap the range
+        };
+
+        struct peak
+        {
+            rtypes::uint64 start; // of the bucket
+            rtypes::uint32 players; // most players online at once during the bucket
+        };
+
+        // reads the ledger of the server in 'serverDirectory'; a writable ledger
+        // (there is one for each running server) appends every event it is told
+        // about to the file; the file is opened (or created) with the owner's
+        // file system credentials and ignored unless it is a regular file that
+        // the owner owns
+        minecraft_player_ledger(const rtypes::str& serverDirectory,int uid,int gid,bool writable);
+        ~minecraft_player_ledger();
+
+        // the events of the running server; called by the authority's processing
+        // thread; a player's sessions are keyed by name
+        void player_id(rtypes::uint64 time,const char* name,const char* uuid);
+        void join(rtypes::uint64 time,const char* name);
+        void leave(rtypes::uint64 time,const char* name);
+        void reset(rtypes::uint64 time); // the server stopped: everyone left
+
+        // gets each player's time online during [since,until), most time first;
+        // 'player' (if not NULL) names the only player to report
+        void get_playtime(rtypes::uint64 since,rtypes::uint64 until,const char* player,std::vector<playtime>& out) const;
+
+        // gets the most players online at once in each 'bucket' seconds of
+        // [since,until); buckets start at multiples of 'bucket' since the epoch
+        void get_peaks(rtypes::uint64 since,rtypes::uint64 until,rtypes::uint64 bucket,std::vector<peak>& out) const;
+
+        // the first and last times recorded in the ledger (zero if it is empty)
+        rtypes::uint64 get_first_time() const;
+        rtypes::uint64 get_last_time() const;
+
+        static const char* const LEDGER_FILE;
+    private:
+        enum _record_kind
+        {
+            _record_player, // followed by 'length' bytes: the name, a NUL and the UUID
+            _record_join,
+            _record_leave,
+            _record_reset // every player still online left
+        };
+
+        struct _record
+        {
+            rtypes::uint64 time;
+            rtypes::uint32 player;
+            rtypes::byte kind;
+            rtypes::byte length;
+            rtypes::uint16 reserved;
+        };
+
+        struct _session
+        {
+            rtypes::uint64 join, leave; // 'leave' is OPEN while the player is online
+        };
+
+        struct _player
+        {
+            std::string name, uuid;
+            std::vector<_session> sessions; // in time order; they never overlap
+        };
+
+        static const rtypes::uint64 OPEN = ~rtypes::uint64(0);
+
+        mutable mutex _mtx;
+        std::vector<_player> _players; // by player number
+        std::map<std::string,rtypes::uint32> _byName;
+        std::vector<rtypes::uint32> _online; // player numbers
+        rtypes::uint64 _firstTime, _lastTime;
+        int _fd; // -1 if not writable
+
+        rtypes::uint32 _lookup(rtypes::uint64 time,const char* name,const char* uuid);
+        void _apply(const _record& rec,const char* data);
+        void _append(const _record& rec,const char* data = NULL);
+        void _close_online(rtypes::uint64 time);
+        rtypes::uint64 _leave_time(const _session& session) const;
+    };
+}
+
+#endif
+
+/*
+ * Local Variables:
+ * mode:c++
+ * indent-tabs-mode:nil
+ * tab-width:4
+ * End:
+ */
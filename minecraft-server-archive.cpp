@@ -0,0 +1,519 @@
+// minecraft-server-archive.cpp
+#include "minecraft-server-archive.h"
+#include "minecontrol-authority.h" // gets minecraft_server_message
+#include "minecraft-controller.h"
+#include "minecontrol-user-fs.h"
+#include <algorithm>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <zlib.h>
+using namespace rtypes;
+using namespace minecraft_controller;
+
+namespace
+{
+    // the gist stored for lines that aren't in the regular server format
+    const int IRREGULAR_GIST = gist_count;
+    static_assert(gist_count < 32,"gist masks are 32 bits");
+
+    // each record in a block is the time (uint64), the gist (one byte) and the
+    // length of the text (uint16), in host byte order, followed by the text
+    const size_t RECORD_HEADER = 11;
+
+    struct segment_file
+    {
+        uint32 sequence;
+        uint64 start; // time of the first line
+        std::string base; // name without the extension
+
+        bool operator <(const segment_file& other) const
+        { return sequence < other.sequence; }
+    };
+
+    // opens the archive directory or a file in it; a symbolic link, anything that
+    // isn't a directory or regular file (like a FIFO, which would block) or
+    // anything the user doesn't own is refused
+    int open_owned(int directoryFd,const char* name,int flags,int uid,struct stat& st)
+    {
+        int fd = ::openat(directoryFd,name,flags|O_NOFOLLOW|O_NONBLOCK|O_NOCTTY|O_CLOEXEC,S_IRUSR|S_IWUSR|S_IRGRP);
+        if (fd == -1)
+            return -1;
+        bool directory = (flags & O_DIRECTORY) != 0;
+        if (::fstat(fd,&st)==-1 || (directory ? !S_ISDIR(st.st_mode) : !S_ISREG(st.st_mode))
+            || (uid!=-1 && int(st.st_uid)!=uid))
+        {
+            ::close(fd);
+            errno = EPERM;
+            return -1;
+        }
+        return fd;
+    }
+
+    // lists the segments in the archive directory, oldest first
+    void list_segments(int directoryFd,std::vector<segment_file>& segments)
+    {
+        // the DIR gets a descriptor of its own that shares the directory
+        int fd = ::dup(directoryFd);
+        DIR* dir = fd==-1 ? NULL : ::fdopendir(fd);
+        if (dir == NULL) {
+            if (fd != -1)
+                ::close(fd);
+            return;
+        }
+        ::rewinddir(dir);
+        dirent* entry;
+        while ((entry = ::readdir(dir)) != NULL) {
+            unsigned int sequence;
+            unsigned long long start;
+            int n = 0;
+            if (std::sscanf(entry->d_name,"%u-%llu.seg%n",&sequence,&start,&n)==2 && n>0 && entry->d_name[n]==0) {
+                segment_file segment;
+                segment.sequence = sequence;
+                segment.start = start;
+                segment.base.assign(entry->d_name,n-4);
+                segments.push_back(segment);
+            }
+        }
+        ::closedir(dir);
+        std::sort(segments.begin(),segments.end());
+    }
+
+    bool write_all(int fd,const void* data,size_t length)
+    {
+        const char* p = reinterpret_cast<const char*>(data);
+        while (length > 0) {
+            ssize_t n = ::write(fd,p,length);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            p += n;
+            length -= n;
+        }
+        return true;
+    }
+
+    bool read_at(int fd,void* data,size_t length,off_t offset)
+    {
+        char* p = reinterpret_cast<char*>(data);
+        while (length > 0) {
+            ssize_t n = ::pread(fd,p,length,offset);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            p += n;
+            length -= n;
+            offset += n;
+        }
+        return true;
+    }
+
+    // reads "HH:MM[:SS]" and advances 'p' past it
+    bool read_clock(const char*& p,int& hour,int& minute,int& second)
+    {
+        int n = 0;
+        second = 0;
+        if (std::sscanf(p,"%2d:%2d%n",&hour,&minute,&n) < 2 || n == 0)
+            return false;
+        p += n;
+        if (*p == ':') {
+            n = 0;
+            if (std::sscanf(p+1,"%2d%n",&second,&n) < 1 || n == 0)
+                return false;
+            p += n + 1;
+        }
+        return hour>=0 && hour<24 && minute>=0 && minute<60 && second>=0 && second<=60;
+    }
+}
+
+// minecraft_controller::minecraft_server_archive
+
+/*static*/ const char* const minecraft_server_archive::ARCHIVE_DIRECTORY = "archive";
+minecraft_server_archive::query::query()
+    : since(0), until(uint64(-1)), gists(0), limit(size_type(-1))
+{
+}
+minecraft_server_archive::query_result::query_result()
+    : segments(0), segmentsScanned(0), blocksScanned(0), matched(0), truncated(false)
+{
+}
+minecraft_server_archive::minecraft_server_archive(const str& serverDirectory,int uid,int gid)
+    : _mtx("server-archive"), _directory(serverDirectory.c_str()), _uid(uid), _gid(gid)
+{
+    _enabled = true;
+    _segmentFd = _indexFd = -1;
+    _sequence = 0;
+    _segmentStart = _segmentBytes = _segmentOffset = 0;
+    std::memset(&_pending,0,sizeof(_index_entry));
+    _directory += '/';
+    _directory += ARCHIVE_DIRECTORY;
+    _directoryFd = -1;
+
+    // the server directory belongs to the user, so work in it as the user: a
+    // planted link can't make us create or open anything the user couldn't
+    struct stat st;
+    {
+        user_fs_scope scope(_uid,_gid);
+        if (::mkdir(_directory.c_str(),S_IRWXU|S_IRGRP|S_IXGRP)==-1 && errno!=EEXIST) {
+            minecontrold::standardLog << "couldn't create archive directory " << _directory.c_str() << ": " << strerror(errno) << endline;
+            _enabled = false;
+            return;
+        }
+        _directoryFd = open_owned(AT_FDCWD,_directory.c_str(),O_RDONLY|O_DIRECTORY,_uid,st);
+    }
+    if (_directoryFd == -1) {
+        minecontrold::standardLog << "couldn't open archive directory " << _directory.c_str() << ": " << strerror(errno) << endline;
+        _enabled = false;
+        return;
+    }
+
+    // continue numbering after the segments that are already there; every run
+    // of the server starts a segment of its own
+    std::vector<segment_file> segments;
+    list_segments(_directoryFd,segments);
+    if (segments.size() > 0)
+        _sequence = segments.back().sequence;
+}
+minecraft_server_archive::~minecraft_server_archive()
+{
+    _write_block();
+    _close_segment();
+    if (_directoryFd != -1)
+        ::close(_directoryFd);
+}
+void minecraft_server_archive::append(uint64 time,int gist,const char* line,size_type length)
+{
+    if (!_enabled)
+        return;
+    if (gist<0 || gist>=gist_count)
+        gist = IRREGULAR_GIST;
+    if (length > 0xffff)
+        length = 0xffff;
+
+    _mtx.lock();
+    // a quiet server's lines shouldn't wait in memory for long
+    if (_block.size()>0 && time>=_pending.firstTime+BLOCK_AGE)
+        _write_block();
+    if (_segmentFd!=-1 && (_segmentBytes>=SEGMENT_SIZE || time>=_segmentStart+SEGMENT_AGE)) {
+        _write_block();
+        _close_segment();
+    }
+    if (_segmentFd==-1 && !_open_segment(time)) {
+        _mtx.unlock();
+        return;
+    }
+
+    if (_block.size() == 0) {
+        _pending.firstTime = _pending.lastTime = time;
+        _pending.gists = 0;
+        _pending.lines = 0;
+    }
+    else {
+        // the wall clock may have been set back
+        _pending.firstTime = std::min(_pending.firstTime,time);
+        _pending.lastTime = std::max(_pending.lastTime,time);
+    }
+    _pending.gists |= uint32(1) << gist;
+    ++_pending.lines;
+    char header[RECORD_HEADER];
+    uint16 textLength = uint16(length);
+    std::memcpy(header,&time,8);
+    header[8] = char(gist);
+    std::memcpy(header+9,&textLength,2);
+    _block.append(header,RECORD_HEADER);
+    _block.append(line,length);
+    if (_block.size() >= BLOCK_SIZE)
+        _write_block();
+    _mtx.unlock();
+}
+void minecraft_server_archive::flush()
+{
+    _mtx.lock();
+    _write_block();
+    _mtx.unlock();
+}
+bool minecraft_server_archive::_open_segment(uint64 time)
+{
+    struct stat st;
+    char name[48];
+    std::snprintf(name,sizeof(name),"%08u-%llu",++_sequence,(unsigned long long)time);
+    std::string base = name;
+    {
+        user_fs_scope scope(_uid,_gid);
+        _remove_old_segments();
+        _segmentFd = open_owned(_directoryFd,(base + ".seg").c_str(),O_WRONLY|O_CREAT|O_EXCL|O_APPEND,_uid,st);
+        if (_segmentFd != -1)
+            _indexFd = open_owned(_directoryFd,(base + ".idx").c_str(),O_WRONLY|O_CREAT|O_EXCL|O_APPEND,_uid,st);
+    }
+    if (_segmentFd==-1 || _indexFd==-1) {
+        // don't retry (and log) for every line
+        minecontrold::standardLog << "couldn't create archive segment " << _directory.c_str() << '/' << name << ": " << strerror(errno)
+                                  << "; archiving is disabled for this server" << endline;
+        _close_segment();
+        _enabled = false;
+        return false;
+    }
+    _segmentStart = time;
+    _segmentBytes = 0;
+    _segmentOffset = 0;
+    return true;
+}
+void minecraft_server_archive::_remove_old_segments()
+{
+    // the oldest segments go first, until the archive (not counting the segment
+    // about to start) fits under the limit
+    std::vector<segment_file> segments;
+    std::vector<uint64> sizes;
+    uint64 total = 0;
+    list_segments(_directoryFd,segments);
+    for (size_type i = 0;i < segments.size();++i) {
+        struct stat st;
+        uint64 size = 0;
+        if (::fstatat(_directoryFd,(segments[i].base + ".seg").c_str(),&st,AT_SYMLINK_NOFOLLOW) == 0)
+            size += st.st_size;
+        if (::fstatat(_directoryFd,(segments[i].base + ".idx").c_str(),&st,AT_SYMLINK_NOFOLLOW) == 0)
+            size += st.st_size;
+        sizes.push_back(size);
+        total += size;
+    }
+    size_type removed = 0;
+    while (total>ARCHIVE_LIMIT && removed<segments.size()) {
+        ::unlinkat(_directoryFd,(segments[removed].base + ".seg").c_str(),0);
+        ::unlinkat(_directoryFd,(segments[removed].base + ".idx").c_str(),0);
+        total -= sizes[removed];
+        ++removed;
+    }
+    if (removed > 0)
+        minecontrold::standardLog << "removed " << removed << " old segments from archive " << _directory.c_str() << endline;
+}
+void minecraft_server_archive::_close_segment()
+{
+    if (_segmentFd != -1) {
+        ::close(_segmentFd);
+        _segmentFd = -1;
+    }
+    if (_indexFd != -1) {
+        ::close(_indexFd);
+        _indexFd = -1;
+    }
+}
+void minecraft_server_archive::_write_block()
+{
+    if (_block.size()==0 || _segmentFd==-1)
+        return;
+    // favor speed: this runs on the thread that reads the server's output, and
+    // log text compresses well even at the fastest level
+    uLongf length = ::compressBound(_block.size());
+    std::vector<Bytef> compressed(length);
+    if (::compress2(&compressed[0],&length,reinterpret_cast<const Bytef*>(_block.data()),_block.size(),Z_BEST_SPEED) == Z_OK) {
+        _pending.offset = _segmentOffset;
+        _pending.compressedLength = uint32(length);
+        _pending.rawLength = uint32(_block.size());
+        // the block goes first: a reader trusts an index entry only if its block is complete
+        if (!write_all(_segmentFd,&compressed[0],length) || !write_all(_indexFd,&_pending,sizeof(_index_entry))) {
+            minecontrold::standardLog << "couldn't write to archive " << _directory.c_str() << ": " << strerror(errno) << endline;
+            // the next line starts a new segment since this one's size is unknown
+            _close_segment();
+        }
+        else
+            _segmentOffset += length;
+    }
+    _segmentBytes += _block.size();
+    _block.clear();
+}
+/*static*/ bool minecraft_server_archive::run_query(const str& serverDirectory,int uid,int gid,const query& q,query_sink& sink,query_result& result)
+{
+    std::string directory = serverDirectory.c_str();
+    directory += '/';
+    directory += ARCHIVE_DIRECTORY;
+    // read only what the user could read, and only files that are theirs, so
+    // that links in the archive can't expose another user's files
+    user_fs_scope scope(uid,gid);
+    struct stat st;
+    int directoryFd = open_owned(AT_FDCWD,directory.c_str(),O_RDONLY|O_DIRECTORY,uid,st);
+    if (directoryFd == -1)
+        return false;
+    std::vector<segment_file> segments;
+    list_segments(directoryFd,segments);
+    result.segments = segments.size();
+
+    std::vector<_index_entry> index;
+    std::vector<Bytef> compressed;
+    std::vector<char> raw;
+    size_type matchLength = q.match.length();
+    const char* match = q.match.c_str();
+    for (size_type i = 0;i < segments.size();++i) {
+        // a segment holds the lines from its start until the next segment's start
+        if (segments[i].start >= q.until || (i+1<segments.size() && segments[i+1].start<q.since))
+            continue;
+
+        struct stat indexStat, segmentStat;
+        int indexFd = open_owned(directoryFd,(segments[i].base + ".idx").c_str(),O_RDONLY,uid,indexStat);
+        if (indexFd == -1)
+            continue;
+        int segmentFd = open_owned(directoryFd,(segments[i].base + ".seg").c_str(),O_RDONLY,uid,segmentStat);
+        if (segmentFd == -1) {
+            ::close(indexFd);
+            continue;
+        }
+        // a partial entry at the end was being written when we looked
+        index.resize(indexStat.st_size / sizeof(_index_entry));
+        if (index.size()>0 && !read_at(indexFd,&index[0],index.size()*sizeof(_index_entry),0))
+            index.clear();
+        ::close(indexFd);
+        ++result.segmentsScanned;
+
+        for (size_type j = 0;j < index.size();++j) {
+            const _index_entry& block = index[j];
+            if (block.lastTime<q.since || block.firstTime>=q.until || (q.gists!=0 && (block.gists&q.gists)==0))
+                continue;
+            if (block.offset+block.compressedLength > uint64(segmentStat.st_size) || block.rawLength > 2*BLOCK_SIZE)
+                continue;
+            compressed.resize(block.compressedLength);
+            raw.resize(block.rawLength);
+            uLongf rawLength = block.rawLength;
+            if (block.compressedLength==0 || block.rawLength==0
+                || !read_at(segmentFd,&compressed[0],block.compressedLength,block.offset)
+                || ::uncompress(reinterpret_cast<Bytef*>(&raw[0]),&rawLength,&compressed[0],block.compressedLength)!=Z_OK)
+            {
+                continue;
+            }
+            ++result.blocksScanned;
+
+            const char* p = &raw[0];
+            const char* end = p + rawLength;
+            while (size_type(end-p) >= RECORD_HEADER) {
+                uint64 time;
+                uint16 length;
+                std::memcpy(&time,p,8);
+                int gist = (unsigned char)p[8];
+                std::memcpy(&length,p+9,2);
+                const char* text = p + RECORD_HEADER;
+                if (size_type(end-text) < length)
+                    break;
+                p = text + length;
+                if (time<q.since || time>=q.until || (q.gists!=0 && (q.gists & (uint32(1)<<gist))==0))
+                    continue;
+                if (matchLength>0 && std::search(text,text+length,match,match+matchLength)==text+length)
+                    continue;
+                ++result.matched;
+                if (!sink.archive_line(time,gist,text,length) || result.matched>=q.limit) {
+                    result.truncated = result.matched >= q.limit;
+                    ::close(segmentFd);
+                    ::close(directoryFd);
+                    return true;
+                }
+            }
+        }
+        ::close(segmentFd);
+    }
+    ::close(directoryFd);
+    return true;
+}
+/*static*/ bool minecraft_server_archive::parse_time(const char* text,uint64& out)
+{
+    int year, month, day, hour = 0, minute = 0, second = 0, n = 0;
+    bool timeOfDay = false;
+    time_t now = ::time(NULL);
+    tm when;
+
+    // seconds since the epoch
+    if (*text!=0 && text[std::strspn(text,"0123456789")]==0) {
+        out = std::strtoull(text,NULL,10);
+        return true;
+    }
+
+    // a time before now, e.g. "-7d"
+    if (*text == '-') {
+        static const char UNITS[] = "smhdw";
+        static const uint64 SECONDS[] = { 1, 60, 3600, 86400, 604800 };
+        unsigned long long amount;
+        if (std::sscanf(text+1,"%llu%n",&amount,&n) < 1 || n == 0)
+            return false;
+        const char* unit = text[n+1]==0 ? UNITS : std::strchr(UNITS,text[n+1]);
+        if (unit==NULL || *unit==0 || (text[n+1]!=0 && text[n+2]!=0))
+            return false;
+        amount *= SECONDS[unit-UNITS];
+        out = uint64(now) > amount ? uint64(now) - amount : 0;
+        return true;
+    }
+
+    const char* p = text;
+    if (std::sscanf(text,"%4d-%2d-%2d%n",&year,&month,&day,&n)==3 && n>0) {
+        p += n;
+        if (*p=='T' || *p==' ') {
+            ++p;
+            if ( !read_clock(p,hour,minute,second) )
+                return false;
+        }
+        std::memset(&when,0,sizeof(tm));
+        when.tm_year = year - 1900;
+        when.tm_mon = month - 1;
+        when.tm_mday = day;
+    }
+    else {
+        if ( !read_clock(p,hour,minute,second) )
+            return false;
+        ::localtime_r(&now,&when);
+        timeOfDay = true;
+    }
+    if (*p != 0)
+        return false;
+    when.tm_hour = hour;
+    when.tm_min = minute;
+    when.tm_sec = second;
+    when.tm_isdst = -1;
+    time_t result = ::mktime(&when);
+    if (timeOfDay && result>now) {
+        // a time of day means the last time the clock read that
+        ::localtime_r(&now,&when);
+        --when.tm_mday;
+        when.tm_hour = hour;
+        when.tm_min = minute;
+        when.tm_sec = second;
+        when.tm_isdst = -1;
+        result = ::mktime(&when);
+    }
+    if (result == time_t(-1))
+        return false;
+    out = uint64(result);
+    return true;
+}
+/*static*/ bool minecraft_server_archive::parse_gists(const char* text,uint32& mask)
+{
+    mask = 0;
+    while (*text != 0) {
+        size_type length = std::strcspn(text,",");
+        int gist = 0;
+        while (gist <= IRREGULAR_GIST) {
+            const char* name = gist_name(gist);
+            if (std::strlen(name)==length && std::strncmp(name,text,length)==0)
+                break;
+            ++gist;
+        }
+        if (gist > IRREGULAR_GIST)
+            return false;
+        mask |= uint32(1) << gist;
+        text += length;
+        if (*text == ',')
+            ++text;
+    }
+    return mask != 0;
+}
+/*static*/ const char* minecraft_server_archive::gist_name(int gist)
+{
+    if (gist<0 || gist>=gist_count)
+        return "irregular";
+    return minecraft_server_message::gist_name(minecraft_server_message_gist(gist));
+}
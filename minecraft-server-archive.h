@@ -0,0 +1,131 @@
+// minecraft-server-archive.h
+#ifndef MINECRAFT_SERVER_ARCHIVE_H
+#define MINECRAFT_SERVER_ARCHIVE_H
+#include "mutex.h"
+#include <rlibrary/rtypestypes.h>
+#include <rlibrary/rstring.h>
+#include <string>
+
+namespace minecraft_controller
+{
+    /* keeps every line a Minecraft server prints in an append-only archive under the
+       server directory; lines are written in zlib-compressed blocks of about 64K and the
+       blocks are grouped into segments (one file per segment, named by sequence number
+       and the time of its first line); a small index file beside each segment records,
+       for every block, its time range and the gists of its lines, so a query only opens
+       the segments that overlap its time range and only inflates the blocks that may
+       hold a matching line */
+    class minecraft_server_archive
+    {
+    public:
+        struct query
+        {
+            query();
+
+            rtypes::uint64 since, until; // seconds since the epoch; 'until' is exclusive
+            rtypes::uint32 gists; // bit (1 << gist) for each gist to match; zero matches any gist
+            rtypes::str match; // substring to find in the line; empty matches any line
+            rtypes::size_type limit; // most lines to report
+        };
+
+        struct query_result
+        {
+            query_result();
+
+            rtypes::size_type segments; // segments in the archive
+            rtypes::size_type segmentsScanned; // segments whose index was read
+            rtypes::size_type blocksScanned; // blocks that were inflated
+            rtypes::size_type matched;
+            bool truncated; // the limit was reached
+        };
+
+        // receives the matching lines in the order they were archived; returning
+        // false ends the query early
+        class query_sink
+        {
+        public:
+            virtual ~query_sink() {}
+
+            virtual bool archive_line(rtypes::uint64 time,int gist,const char* text,rtypes::size_type length) = 0;
+        };
+
+        // the archive directory is created under 'serverDirectory' if needed; it and
+        // its files are created with the owner's file system credentials and the
+        // archive is disabled if the directory isn't the owner's; nothing is written
+        // until the first line is appended
+        minecraft_server_archive(const rtypes::str& serverDirectory,int uid,int gid);
+        ~minecraft_server_archive();
+
+        // appends a line (without its newline); 'gist' is -1 for a line that isn't
+        // in the regular server format; called by the authority's processing thread
+        void append(rtypes::uint64 time,int gist,const char* line,rtypes::size_type length);
+
+        // writes the pending block so that a query sees every line appended so far
+        void flush();
+
+        // scans the archive of the server in 'serverDirectory'; this reads only the
+        // files, so it works whether or not the server is running (call 'flush' on a
+        // running server's archive first); the files are read with the owner's file
+        // system credentials and only if the owner owns them; false if there is no
+        // archive
+        static bool run_query(const rtypes::str& serverDirectory,int uid,int gid,const query& q,query_sink& sink,query_result& result);
+
+        // parses seconds since the epoch, "YYYY-MM-DD[THH:MM[:SS]]" or "HH:MM[:SS]"
+        // (the last time of day that has passed) in local time, or "-N[smhdw]"
+        // (that long ago)
+        static bool parse_time(const char* text,rtypes::uint64& out);
+
+        // parses a comma-separated list of gist names into a query mask
+        static bool parse_gists(const char* text,rtypes::uint32& mask);
+
+        // the name of a gist as used by queries; "irregular" names a line that
+        // isn't in the regular server format
+        static const char* gist_name(int gist);
+
+        static const char* const ARCHIVE_DIRECTORY;
+    private:
+        static const rtypes::size_type BLOCK_SIZE = 64 * 1024; // uncompressed bytes
+        static const rtypes::uint64 BLOCK_AGE = 10; // seconds before a pending block is written anyway
+        static const rtypes::uint64 SEGMENT_SIZE = 32 << 20; // uncompressed bytes
+        static const rtypes::uint64 SEGMENT_AGE = 3600; // seconds
+        static const rtypes::uint64 ARCHIVE_LIMIT = rtypes::uint64(1) << 30; // bytes on disk before the oldest segments go
+
+        // one per block in a segment's index file
+        struct _index_entry
+        {
+            rtypes::uint64 offset; // of the compressed block in the segment file
+            rtypes::uint64 firstTime, lastTime;
+            rtypes::uint32 compressedLength, rawLength;
+            rtypes::uint32 gists; // bit (1 << gist) for each gist in the block
+            rtypes::uint32 lines;
+        };
+
+        mutex _mtx; // the processing thread appends while a client thread flushes
+        std::string _directory;
+        int _uid, _gid;
+        bool _enabled;
+        int _directoryFd; // files are created relative to this, never by path
+        int _segmentFd, _indexFd;
+        rtypes::uint32 _sequence; // of the open segment
+        rtypes::uint64 _segmentStart; // time of the segment's first line
+        rtypes::uint64 _segmentBytes; // uncompressed bytes in the segment
+        rtypes::uint64 _segmentOffset; // size of the segment file
+        std::string _block; // records waiting to be compressed
+        _index_entry _pending; // describes '_block'
+
+        bool _open_segment(rtypes::uint64 time);
+        void _remove_old_segments();
+        void _close_segment();
+        void _write_block();
+    };
+}
+
+#endif
+
+/*
+ * Local Variables:
+ * mode:c++
+ * indent-tabs-mode:nil
+ * tab-width:4
+ * End:
+ */
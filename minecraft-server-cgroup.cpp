@@ -0,0 +1,189 @@
+// minecraft-server-cgroup.cpp
+#include "minecraft-server-cgroup.h"
+#include "minecraft-controller.h"
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+using namespace rtypes;
+using namespace minecraft_controller;
+
+namespace
+{
+    const char* const LIMIT_FILES[] = {
+        "cpu.max", "cpu.weight", "memory.max", "memory.high", "memory.swap.max", "io.max", "io.weight"
+    };
+
+    // controllers that the limit files depend on; enabled in the parent's subtree_control
+    const char* const CONTROLLERS[] = { "+cpu", "+memory", "+io" };
+
+    uint64 find_value(const std::string& text,const char* key)
+    {
+        // finds 'key' (followed by a space or '=') at the start of a word and parses the number after it
+        size_t len = std::strlen(key), at = 0;
+        while ((at = text.find(key,at)) != std::string::npos) {
+            if ((at == 0 || isspace(text[at-1])) && at+len < text.length()
+                && (text[at+len] == ' ' || text[at+len] == '='))
+            {
+                return std::strtoull(text.c_str() + at + len + 1,NULL,10);
+            }
+            at += len;
+        }
+        return 0;
+    }
+}
+
+minecraft_server_cgroup::minecraft_server_cgroup()
+    : _madePath(false), _madeServerLeaf(false), _madeAuthorityLeaf(false)
+{
+}
+minecraft_server_cgroup::~minecraft_server_cgroup()
+{
+    destroy();
+}
+bool minecraft_server_cgroup::create(const char* root,const std::string& name,const limit_list& limits,bool confineAuthority)
+{
+    destroy();
+    _path = root;
+    _path.push_back('/');
+    _path += name;
+    if ( !_make_directory(_path,_madePath) ) {
+        _path.clear();
+        return false;
+    }
+
+    // the limits are set on the subtree, so the parent must delegate the
+    // controllers; a controller the parent doesn't have is simply left out
+    std::string subtreeControl(root);
+    subtreeControl += "/cgroup.subtree_control";
+    for (size_t i = 0;i < sizeof(CONTROLLERS)/sizeof(CONTROLLERS[0]);++i)
+        _write_file(subtreeControl,CONTROLLERS[i]);
+
+    // processes may only live in leaves once the subtree has limits
+    _serverLeaf = _path + "/server";
+    if ( !_make_directory(_serverLeaf,_madeServerLeaf) ) {
+        destroy();
+        return false;
+    }
+    if (confineAuthority) {
+        _authorityLeaf = _path + "/authority";
+        if ( !_make_directory(_authorityLeaf,_madeAuthorityLeaf) ) {
+            destroy();
+            return false;
+        }
+    }
+
+    for (limit_list::const_iterator iter = limits.begin();iter != limits.end();++iter) {
+        if (!is_limit_file(iter->first.c_str()) || !_write_file(_path + "/" + iter->first,iter->second)) {
+            destroy();
+            return false;
+        }
+    }
+    return true;
+}
+void minecraft_server_cgroup::destroy()
+{
+    if (_path.length() == 0)
+        return;
+    // a directory that was already there may belong to something else (or to
+    // a server that outlived an earlier daemon), so it is left alone
+    if (_madeServerLeaf)
+        _remove_directory(_serverLeaf);
+    if (_madeAuthorityLeaf)
+        _remove_directory(_authorityLeaf);
+    if (_madePath)
+        _remove_directory(_path);
+    _madePath = _madeServerLeaf = _madeAuthorityLeaf = false;
+    _path.clear();
+    _serverLeaf.clear();
+    _authorityLeaf.clear();
+}
+/*static*/ bool minecraft_server_cgroup::_make_directory(const std::string& path,bool& made)
+{
+    made = ::mkdir(path.c_str(),0755) == 0;
+    return made || errno == EEXIST;
+}
+/*static*/ void minecraft_server_cgroup::_remove_directory(const std::string& path)
+{
+    if (::rmdir(path.c_str()) == -1)
+        minecontrold::standardLog << "couldn't remove cgroup " << path.c_str() << ": " << strerror(errno) << endline;
+}
+bool minecraft_server_cgroup::read_usage(usage& out) const
+{
+    std::string text;
+    std::memset(&out,0,sizeof(usage));
+    if (_path.length() == 0 || !_read_file(_path + "/cpu.stat",text))
+        return false;
+    out.cpuUsec = find_value(text,"usage_usec");
+    // the memory and io files only exist if the parent delegated those controllers
+    if ( _read_file(_path + "/memory.current",text) )
+        out.memoryCurrent = std::strtoull(text.c_str(),NULL,10);
+    if ( _read_file(_path + "/memory.peak",text) )
+        out.memoryPeak = std::strtoull(text.c_str(),NULL,10);
+    if ( _read_file(_path + "/io.stat",text) ) {
+        // one line per device: "MAJ:MIN rbytes=N wbytes=N rios=N ..."
+        size_t begin = 0;
+        while (begin < text.length()) {
+            size_t end = text.find('\n',begin);
+            if (end == std::string::npos)
+                end = text.length();
+            std::string line(text,begin,end-begin);
+            out.ioRead += find_value(line,"rbytes");
+            out.ioWrite += find_value(line,"wbytes");
+            begin = end + 1;
+        }
+    }
+    return true;
+}
+/*static*/ bool minecraft_server_cgroup::join(const char* leaf)
+{
+    static const char* const PROCS = "/cgroup.procs";
+    char path[PATH_MAX];
+    size_t len = std::strlen(leaf);
+    if (len + std::strlen(PROCS) >= sizeof(path))
+        return false;
+    std::memcpy(path,leaf,len);
+    std::strcpy(path+len,PROCS);
+    int fd = ::open(path,O_WRONLY);
+    if (fd == -1)
+        return false;
+    // writing "0" moves the writing process
+    bool result = ::write(fd,"0",1) == 1;
+    ::close(fd);
+    return result;
+}
+/*static*/ bool minecraft_server_cgroup::is_limit_file(const char* fileName)
+{
+    for (size_t i = 0;i < sizeof(LIMIT_FILES)/sizeof(LIMIT_FILES[0]);++i)
+        if (std::strcmp(LIMIT_FILES[i],fileName) == 0)
+            return true;
+    return false;
+}
+/*static*/ bool minecraft_server_cgroup::_write_file(const std::string& path,const std::string& value)
+{
+    int fd = ::open(path.c_str(),O_WRONLY);
+    if (fd == -1)
+        return false;
+    // cgroup files take each value in a single write
+    bool result = ::write(fd,value.c_str(),value.length()) == ssize_t(value.length());
+    ::close(fd);
+    return result;
+}
+/*static*/ bool minecraft_server_cgroup::_read_file(const std::string& path,std::string& value)
+{
+    char buffer[4096];
+    ssize_t n;
+    int fd = ::open(path.c_str(),O_RDONLY);
+    if (fd == -1)
+        return false;
+    value.clear();
+    while ((n = ::read(fd,buffer,sizeof(buffer))) > 0)
+        value.append(buffer,n);
+    ::close(fd);
+    return n == 0;
+}
@@ -0,0 +1,81 @@
+// minecraft-server-cgroup.h
+#ifndef MINECRAFT_SERVER_CGROUP_H
+#define MINECRAFT_SERVER_CGROUP_H
+#include <rlibrary/rtypestypes.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace minecraft_controller
+{
+    /* a cgroup v2 subtree for one Minecraft server; the subtree directory holds the
+       resource limits (cpu.max, memory.max, io.max) and has two leaves: 'server' for
+       the Java process and 'authority' for authority programs (if they are confined
+       with the server); the parent directory must be a delegated cgroup with the
+       cpu, memory and io controllers available */
+    class minecraft_server_cgroup
+    {
+    public:
+        typedef std::vector<std::pair<std::string,std::string> > limit_list; // file name, value
+
+        struct usage
+        {
+            rtypes::uint64 cpuUsec; // from cpu.stat
+            rtypes::uint64 memoryCurrent; // bytes; from memory.current
+            rtypes::uint64 memoryPeak; // bytes; from memory.peak (zero if the kernel lacks it)
+            rtypes::uint64 ioRead; // bytes; summed from io.stat
+            rtypes::uint64 ioWrite;
+        };
+
+        minecraft_server_cgroup();
+        ~minecraft_server_cgroup();
+
+        // creates 'root'/'name' and its leaves and applies the limits; directories that
+        // already exist are used as they are; if anything fails the directories this
+        // call made are removed again and false is returned
+        bool create(const char* root,const std::string& name,const limit_list& limits,bool confineAuthority);
+
+        // removes the directories that create() made; this fails (and is logged) while
+        // processes remain in them
+        void destroy();
+
+        bool is_active() const
+        { return _path.length() > 0; }
+        const std::string& get_server_leaf() const
+        { return _serverLeaf; }
+        const std::string& get_authority_leaf() const // empty if not confined
+        { return _authorityLeaf; }
+
+        bool read_usage(usage& out) const;
+
+        // moves the calling process into the specified leaf directory; only uses
+        // system calls so that it may be called between fork and exec
+        static bool join(const char* leaf);
+
+        // the limit files a profile may set
+        static bool is_limit_file(const char* fileName);
+    private:
+        minecraft_server_cgroup(const minecraft_server_cgroup&);
+        minecraft_server_cgroup& operator =(const minecraft_server_cgroup&);
+
+        std::string _path;
+        std::string _serverLeaf;
+        std::string _authorityLeaf;
+        bool _madePath, _madeServerLeaf, _madeAuthorityLeaf; // by create()
+
+        static bool _make_directory(const std::string& path,bool& made);
+        static void _remove_directory(const std::string& path);
+        static bool _write_file(const std::string& path,const std::string& value);
+        static bool _read_file(const std::string& path,std::string& value);
+    };
+}
+
+#endif
+
+/*
+ * Local Variables:
+ * mode:c++
+ * indent-tabs-mode:nil
+ * tab-width:4
+ * End:
+ */
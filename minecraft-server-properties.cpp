@@ -1,9 +1,209 @@
 // minecraft-server-properties.cpp
 #include "minecraft-server-properties.h"
+#include "minecontrol-user-fs.h"
 #include <rlibrary/rutility.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <limits.h>
+#include <errno.h>
 using namespace rtypes;
 using namespace minecraft_controller;
 
+namespace
+{
+    // special value handling for some properties
+    enum property_flag
+    {
+        prop_plain = 0x00,
+        prop_level_type = 0x01, // numeric value is spelled as a level type name
+        prop_whole_line = 0x02 // string value is the rest of the line, not a single token
+    };
+
+    // enumerations for numeric properties
+    enum mcraft_difficulty
+    {
+        mcraft_difficulty_peaceful,
+        mcraft_difficulty_easy,
+        mcraft_difficulty_normal,
+        mcraft_difficulty_hard
+    };
+
+    enum mcraft_gamemode
+    {
+        mcraft_gamemode_survival = 0,
+        mcraft_gamemode_creative = 1,
+        mcraft_gamemode_adventure = 2
+    };
+
+    enum mcraft_level_type
+    {
+        mcraft_level_default,
+        mcraft_level_flat,
+        mcraft_level_largebiomes,
+        mcraft_level_amplified,
+        mcraft_level_customized
+    };
+
+    enum mcraft_op_permission_level
+    {
+        mcraft_op_level1 = 1,
+        mcraft_op_level2 = 2,
+        mcraft_op_level3 = 3,
+        mcraft_op_level4 = 4
+    };
+
+    struct property_schema
+    {
+        const char* key; // (must be lower-case)
+        minecraft_property_type type;
+        int number; // default value for boolean and numeric properties
+        const char* text; // default value for string properties; NULL means the field is null
+        int flags;
+    };
+
+    // the schema: the order here is the order properties are written to
+    // server.properties; string properties must come last
+    constexpr property_schema SCHEMA[] = {
+        {"allow-flight", mcraft_prop_boolean, false, nullptr, prop_plain},
+        {"allow-nether", mcraft_prop_boolean, true, nullptr, prop_plain},
+        {"announce-player-achievements", mcraft_prop_boolean, true, nullptr, prop_plain},
+        {"broadcast-console-to-ops", mcraft_prop_boolean, false, nullptr, prop_plain},
+        {"enable-query", mcraft_prop_boolean, false, nullptr, prop_plain},
+        {"enable-rcon", mcraft_prop_boolean, false, nullptr, prop_plain},
+        {"enable-command-block", mcraft_prop_boolean, false, nullptr, prop_plain},
+        {"force-gamemode", mcraft_prop_boolean, true, nullptr, prop_plain},
+        {"generate-structures", mcraft_prop_boolean, true, nullptr, prop_plain},
+        {"hardcore", mcraft_prop_boolean, false, nullptr, prop_plain},
+        {"online-mode", mcraft_prop_boolean, true, nullptr, prop_plain},
+        {"prevent-proxy-connections", mcraft_prop_boolean, true, nullptr, prop_plain},
+        {"pvp", mcraft_prop_boolean, true, nullptr, prop_plain},
+        {"snooper-enabled", mcraft_prop_boolean, false, nullptr, prop_plain},
+        {"spawn-animals", mcraft_prop_boolean, true, nullptr, prop_plain},
+        {"spawn-monsters", mcraft_prop_boolean, true, nullptr, prop_plain},
+        {"spawn-npcs", mcraft_prop_boolean, true, nullptr, prop_plain},
+        {"use-native-transport", mcraft_prop_boolean, true, nullptr, prop_plain},
+        {"white-list", mcraft_prop_boolean, false, nullptr, prop_plain},
+
+        {"difficulty", mcraft_prop_numeric, mcraft_difficulty_easy, nullptr, prop_plain},
+        {"gamemode", mcraft_prop_numeric, mcraft_gamemode_survival, nullptr, prop_plain},
+        {"level-type", mcraft_prop_numeric, mcraft_level_default, nullptr, prop_level_type},
+        {"max-build-height", mcraft_prop_numeric, 256, nullptr, prop_plain},
+        {"max-players", mcraft_prop_numeric, 20, nullptr, prop_plain},
+        {"max-tick-time", mcraft_prop_numeric, 60000, nullptr, prop_plain},
+        {"max-world-size", mcraft_prop_numeric, 29999984, nullptr, prop_plain},
+        {"network-compression-threshold", mcraft_prop_numeric, 256, nullptr, prop_plain},
+        {"op-permission-level", mcraft_prop_numeric, mcraft_op_level3, nullptr, prop_plain},
+        {"player-idle-timeout", mcraft_prop_numeric, 20, nullptr, prop_plain},
+        {"server-port", mcraft_prop_numeric, 25565, nullptr, prop_plain},
+        {"spawn-protection", mcraft_prop_numeric, 16, nullptr, prop_plain},
+        {"view-distance", mcraft_prop_numeric, 10, nullptr, prop_plain},
+
+        {"generator-settings", mcraft_prop_string, 0, nullptr, prop_plain},
+        {"level-seed", mcraft_prop_string, 0, nullptr, prop_plain},
+        {"motd", mcraft_prop_string, 0, "A Minecraft Server", prop_whole_line},
+        {"resource-pack", mcraft_prop_string, 0, nullptr, prop_plain},
+        {"resource-pack-sha1", mcraft_prop_string, 0, nullptr, prop_plain},
+        {"server-ip", mcraft_prop_string, 0, nullptr, prop_plain},
+        {"server-name", mcraft_prop_string, 0, nullptr, prop_plain} // NOTE: server-name is now defunct but kept for legacy support
+    };
+
+    constexpr size_type COUNT = minecraft_server_property_list::PROPERTY_COUNT;
+    constexpr size_type FIRST_STRING = COUNT - minecraft_server_property_list::STRING_COUNT;
+    static_assert(sizeof(SCHEMA) / sizeof(SCHEMA[0]) == COUNT,"PROPERTY_COUNT doesn't match the schema");
+
+    constexpr bool strings_are_last(size_type i = 0)
+    {
+        return i >= COUNT || ((SCHEMA[i].type == mcraft_prop_string) == (i >= FIRST_STRING) && strings_are_last(i+1));
+    }
+    static_assert(strings_are_last(),"STRING_COUNT doesn't match the schema or string properties aren't last");
+
+    /* perfect hash: FNV-1a with a seed chosen so that no two schema keys share a slot;
+       if the schema changes and the assertion below fails then search for a new seed */
+    constexpr uint32 HASH_SEED = 933;
+    constexpr size_type HASH_SIZE = 128;
+
+    constexpr uint32 fnv1a(const char* s,uint32 h)
+    {
+        return *s == 0 ? h : fnv1a(s+1,(h ^ static_cast<unsigned char>(*s)) * 16777619u);
+    }
+    constexpr size_type hash_slot(const char* key)
+    {
+        return (fnv1a(key,2166136261u ^ HASH_SEED) >> 8) & (HASH_SIZE-1);
+    }
+
+    constexpr bool slot_is_unique(size_type i,size_type j)
+    {
+        return j >= COUNT || (hash_slot(SCHEMA[i].key) != hash_slot(SCHEMA[j].key) && slot_is_unique(i,j+1));
+    }
+    constexpr bool hash_is_perfect(size_type i = 0)
+    {
+        return i >= COUNT || (slot_is_unique(i,i+1) && hash_is_perfect(i+1));
+    }
+    static_assert(hash_is_perfect(),"property keys collide: choose a different HASH_SEED");
+
+    constexpr int schema_index_for_slot(size_type slot,size_type i = 0)
+    {
+        return i >= COUNT ? -1 : (hash_slot(SCHEMA[i].key) == slot ? int(i) : schema_index_for_slot(slot,i+1));
+    }
+
+    // maps hash slot to schema index (or -1)
+#define SLOTS4(n) schema_index_for_slot(n), schema_index_for_slot(n+1), \
+        schema_index_for_slot(n+2), schema_index_for_slot(n+3)
+#define SLOTS16(n) SLOTS4(n), SLOTS4(n+4), SLOTS4(n+8), SLOTS4(n+12)
+    constexpr signed char SLOTS[HASH_SIZE] = {
+        SLOTS16(0), SLOTS16(16), SLOTS16(32), SLOTS16(48),
+        SLOTS16(64), SLOTS16(80), SLOTS16(96), SLOTS16(112)
+    };
+#undef SLOTS16
+#undef SLOTS4
+
+    bool read_level_type(rstream& stream,int& value)
+    {
+        str id;
+        stream >> id;
+        rutil_to_lower_ref(id);
+        if (id == "flat")
+            value = mcraft_level_flat;
+        else if (id == "largebiomes")
+            value = mcraft_level_largebiomes;
+        else if (id == "amplified")
+            value = mcraft_level_amplified;
+        else if (id == "customized")
+            value = mcraft_level_customized;
+        else if (id == "default")
+            value = mcraft_level_default;
+        else
+            return false;
+        return true;
+    }
+
+    void put_level_type(rstream& stream,int value)
+    {
+        switch (value)
+        {
+        case mcraft_level_flat:
+            stream << "FLAT";
+            break;
+        case mcraft_level_largebiomes:
+            stream << "LARGEBIOMES";
+            break;
+        case mcraft_level_amplified:
+            stream << "AMPLIFIED";
+            break;
+        case mcraft_level_customized:
+            stream << "CUSTOMIZED";
+            break;
+        default:
+            stream << "DEFAULT";
+            break;
+        }
+    }
+}
+
 // minecraft_controller::minecraft_server_input_property
 
 minecraft_server_input_property::minecraft_server_input_property()
@@ -14,136 +214,290 @@ minecraft_server_input_property::minecraft_server_input_property(const char* pke
 {
 }
 
-// minecraft_controller::minecraft_server_property derivations
+// minecraft_controller::minecraft_server_property_list
 
-bool mcraft_level_type::_readValue(rstream& stream)
+minecraft_server_property_list::minecraft_server_property_list()
 {
-    str id;
-    stream >> id;
-    rutil_to_lower_ref(id);
-    if (id == "flat")
-        _value = mcraft_level_flat;
-    else if (id == "largebiomes")
-        _value = mcraft_level_largebiomes;
-    else if (id == "amplified")
-        _value = mcraft_level_amplified;
-    else if (id == "customized")
-        _value = mcraft_level_customized;
-    else if (id == "default")
-        _value = mcraft_level_default;
-    else
-        return false;
-    return true;
+    for (size_type i = 0;i<COUNT;i++) {
+        _numbers[i] = SCHEMA[i].number;
+        _flags[i] = 0;
+        if (SCHEMA[i].type == mcraft_prop_string) {
+            if (SCHEMA[i].text != nullptr)
+                _strings[i-FIRST_STRING] = SCHEMA[i].text;
+            else
+                _flags[i] = _flag_null;
+        }
+    }
 }
-void mcraft_level_type::_putValue(rstream& stream) const
+/*static*/ int minecraft_server_property_list::lookup(const char* key)
 {
-    switch ( get_value() )
-    {
-    case mcraft_level_flat:
-        stream << "FLAT";
-        break;
-    case mcraft_level_largebiomes:
-        stream << "LARGEBIOMES";
-        break;
-    case mcraft_level_amplified:
-        stream << "AMPLIFIED";
-        break;
-    case mcraft_level_customized:
-        stream << "CUSTOMIZED";
-    default:
-        stream << "DEFAULT";
-        break;
+    int index = SLOTS[hash_slot(key)];
+    if (index != -1 && ::strcmp(SCHEMA[index].key,key) == 0)
+        return index;
+    return -1;
+}
+/*static*/ const char* minecraft_server_property_list::get_key(int index)
+{
+    return SCHEMA[index].key;
+}
+/*static*/ minecraft_property_type minecraft_server_property_list::get_type(int index)
+{
+    return SCHEMA[index].type;
+}
+bool minecraft_server_property_list::set_value(int index,const str& value)
+{
+    const property_schema& schema = SCHEMA[index];
+    const_stringstream ss(value);
+    if (schema.type == mcraft_prop_string) {
+        str result;
+        if (schema.flags & prop_whole_line) {
+            ss.getline(result);
+            if (result.length() == 0)
+                return false;
+        }
+        else if ( !(ss >> result) )
+            return false;
+        _strings[index-FIRST_STRING] = result;
+    }
+    else if (schema.flags & prop_level_type) {
+        if ( !read_level_type(ss,_numbers[index]) )
+            return false;
+    }
+    else if (schema.type == mcraft_prop_boolean) {
+        bool result;
+        if ( !(ss >> result) )
+            return false;
+        _numbers[index] = result;
+    }
+    else {
+        int result;
+        if ( !(ss >> result) )
+            return false;
+        _numbers[index] = result;
     }
+    // since the user intentionally set the value (and it was successful) it
+    // shouldn't be left null; flagging it as user-supplied is important for the
+    // server manager when applying default properties (so that it doesn't
+    // override a user's property)
+    _flags[index] = _flag_user;
+    return true;
 }
-
-bool mcraft_motd::_readValue(rstream& stream)
+void minecraft_server_property_list::put(int index,rstream& stream) const
 {
-    stream.getline(_value);
-    return _value.length() > 0;
+    const property_schema& schema = SCHEMA[index];
+    stream << schema.key << '=';
+    if (_flags[index] & _flag_null)
+        return;
+    if (schema.type == mcraft_prop_string)
+        stream << _strings[index-FIRST_STRING];
+    else if (schema.flags & prop_level_type)
+        put_level_type(stream,_numbers[index]);
+    else if (schema.type == mcraft_prop_boolean)
+        stream << bool(_numbers[index] != 0);
+    else
+        stream << _numbers[index];
 }
 
-// minecraft_controller::minecraft_server_generic_property_list derivations
-minecraft_boolean_property_list::minecraft_boolean_property_list()
+// minecraft_controller::minecraft_server_properties_file
+
+/*static*/ const int minecraft_server_properties_file::MAX_FILE_SIZE;
+
+minecraft_server_properties_file::minecraft_server_properties_file()
+    : _data(NULL), _size(0)
 {
-    _pushBack( new mcraft_allow_flight );
-    _pushBack( new mcraft_allow_nether );
-    _pushBack( new mcraft_announce_player_achievements );
-    _pushBack( new mcraft_broadcast_console_to_ops );
-    _pushBack( new mcraft_enable_query );
-    _pushBack( new mcraft_enable_rcon );
-    _pushBack( new mcraft_enable_command_block );
-    _pushBack( new mcraft_force_gamemode );
-    _pushBack( new mcraft_generate_structures );
-    _pushBack( new mcraft_hardcore );
-    _pushBack( new mcraft_online_mode );
-    _pushBack( new mcraft_prevent_proxy_connections );
-    _pushBack( new mcraft_pvp );
-    _pushBack( new mcraft_snooper_enabled );
-    _pushBack( new mcraft_spawn_animals );
-    _pushBack( new mcraft_spawn_monsters );
-    _pushBack( new mcraft_spawn_npcs );
-    _pushBack( new mcraft_use_native_transport );
-    _pushBack( new mcraft_white_list );
 }
-minecraft_numeric_property_list::minecraft_numeric_property_list()
+minecraft_server_properties_file::~minecraft_server_properties_file()
 {
-    _pushBack( new mcraft_difficulty );
-    _pushBack( new mcraft_gamemode );
-    _pushBack( new mcraft_level_type );
-    _pushBack( new mcraft_max_build_height );
-    _pushBack( new mcraft_max_players );
-    _pushBack( new mcraft_max_tick_time );
-    _pushBack( new mcraft_max_world_size );
-    _pushBack( new mcraft_network_compression_threshold );
-    _pushBack( new mcraft_op_permission_level );
-    _pushBack( new mcraft_player_idle_timeout );
-    _pushBack( new mcraft_server_port );
-    _pushBack( new mcraft_spawn_protection );
-    _pushBack( new mcraft_view_distance );
+    delete[] _data;
 }
-minecraft_string_property_list::minecraft_string_property_list()
+bool minecraft_server_properties_file::load(const char* fileName,int uid,int gid)
 {
-    _pushBack( new mcraft_generator_settings );
-    _pushBack( new mcraft_level_seed );
-    _pushBack( new mcraft_motd );
-    _pushBack( new mcraft_resource_pack );
-    _pushBack( new mcraft_resource_pack_sha1 );
-    _pushBack( new mcraft_server_ip );
-    _pushBack( new mcraft_server_name );
-}
+    // the file belongs to the user, so it is read into memory (a mapping would
+    // fault if the user truncated the file) and opened with the user's file
+    // system credentials; a symbolic link, FIFO or device is refused
+    static const int FLAGS = O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY | O_CLOEXEC;
+    int fd;
+    struct stat st;
+    if (uid >= 0) {
+        user_fs_scope scope(uid,gid);
+        fd = ::open(fileName,FLAGS);
+    }
+    else
+        fd = ::open(fileName,FLAGS);
+    if (fd == -1)
+        return false;
+    if (::fstat(fd,&st)==-1 || !S_ISREG(st.st_mode) || st.st_size>MAX_FILE_SIZE) {
+        ::close(fd);
+        return false;
+    }
+    if (st.st_size > 0) {
+        // the file may change size while it is read; keep what was there
+        _data = new char[st.st_size];
+        while (_size < size_type(st.st_size)) {
+            ssize_t n = ::read(fd,_data+_size,st.st_size-_size);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                ::close(fd);
+                delete[] _data;
+                _data = NULL;
+                _size = 0;
+                return false;
+            }
+            if (n == 0)
+                break;
+            _size += n;
+        }
+    }
+    ::close(fd);
 
-// minecraft_controller::minecraft_server_property_list
-void minecraft_server_property_list::read(rstream& input)
+    // split the file into lines; find the key for each line that could be a property
+    size_type offset = 0;
+    while (offset < _size) {
+        const char* begin = _data + offset;
+        const char* end = static_cast<const char*>(::memchr(begin,'\n',_size-offset));
+        if (end == NULL)
+            end = _data + _size;
+        _line& line = ++_lines;
+        line.offset = offset;
+        line.length = end - begin;
+        line.keyLength = 0;
+        line.index = -1;
+        if (line.length>0 && *begin!='#' && *begin!='!') {
+            const char* eq = static_cast<const char*>(::memchr(begin,'=',line.length));
+            char key[64];
+            if (eq!=NULL && size_type(eq-begin) < sizeof(key)) {
+                line.keyLength = eq - begin;
+                ::memcpy(key,begin,line.keyLength);
+                key[line.keyLength] = 0;
+                line.index = minecraft_server_property_list::lookup(key);
+            }
+        }
+        offset += line.length + 1;
+    }
+    return true;
+}
+void minecraft_server_properties_file::apply(minecraft_server_property_list& props) const
 {
-    stringstream lineInput;
-    lineInput.delimit_whitespace(false);
-    lineInput.add_extra_delimiter("=\n");
-    while ( input.has_input() ) {
-        str key, value;
-        lineInput.clear();
-        input.getline( lineInput.get_device() );
-        lineInput >> key >> value;
-        if (key.length() > 0) {
-            // check each type of property; if not found then strip
-            // from the properties list
-            minecraft_server_property<bool>* bprop;
-            minecraft_server_property<int>* iprop;
-            minecraft_server_property<str>* sprop;
-            if ((bprop = booleanProps.lookup(key.c_str())) != NULL)
-                bprop->set_value(value);
-            else if ((iprop = numericProps.lookup(key.c_str())) != NULL)
-                iprop->set_value(value);
-            else if ((sprop = stringProps.lookup(key.c_str())) != NULL)
-                sprop->set_value(value);
+    for (size_type i = 0;i<_lines.size();i++) {
+        const _line& line = _lines[i];
+        if (line.index != -1) {
+            size_type length = line.length - line.keyLength - 1;
+            const char* value = _data + line.offset + line.keyLength + 1;
+            if (length>0 && value[length-1]=='\r')
+                --length;
+            str s;
+            s.append(value,length);
+            props.set_value(line.index,s);
         }
     }
 }
-void minecraft_server_property_list::write(rstream& output) const
+bool minecraft_server_properties_file::save(const char* fileName,const minecraft_server_property_list& props) const
 {
-    for (size_type i = 0;i<booleanProps.size();i++)
-        booleanProps[i]->put(output), output << newline;
-    for (size_type i = 0;i<numericProps.size();i++)
-        numericProps[i]->put(output), output << newline;
-    for (size_type i = 0;i<stringProps.size();i++)
-        stringProps[i]->put(output), output << newline;
+    bool seen[minecraft_server_property_list::PROPERTY_COUNT] = {};
+    bool changed = false;
+    dynamic_array<_segment> segments;
+    stringstream rendered;
+    auto rendered_length = [&rendered]() -> size_type {
+        rendered.flush_output();
+        return rendered.get_device().length();
+    };
+    auto add_segment = [&segments](bool fromRendered,size_type offset,size_type length) {
+        // coalesce with the previous segment when contiguous
+        if (segments.size()>0 && segments.last().rendered==fromRendered
+            && segments.last().offset+segments.last().length==offset)
+        {
+            segments.last().length += length;
+            return;
+        }
+        _segment& seg = ++segments;
+        seg.rendered = fromRendered;
+        seg.offset = offset;
+        seg.length = length;
+    };
+
+    for (size_type i = 0;i<_lines.size();i++) {
+        const _line& line = _lines[i];
+        size_type length = line.length;
+        if (line.offset+length < _size)
+            ++length; // include newline
+        // keep the line if it's not a property or if nobody assigned it a new
+        // value (it may hold a value the schema can't parse, like 'difficulty=easy')
+        if (line.index != -1)
+            seen[line.index] = true;
+        if (line.index==-1 || !props.is_user_supplied(line.index)) {
+            add_segment(false,line.offset,length);
+            continue;
+        }
+        size_type start = rendered_length();
+        props.put(line.index,rendered);
+        rendered << newline;
+        size_type renderedLength = rendered_length() - start;
+        if (renderedLength==line.length+1 && ::memcmp(rendered.get_device().c_str()+start,_data+line.offset,line.length)==0) {
+            // the line is unchanged: use the original bytes
+            rendered.get_device().truncate(start);
+            add_segment(false,line.offset,length);
+        }
+        else {
+            changed = true;
+            add_segment(true,start,renderedLength);
+        }
+    }
+    bool terminated = _size==0 || _data[_size-1]=='\n';
+    for (int i = 0;i<int(minecraft_server_property_list::PROPERTY_COUNT);i++) {
+        if (!seen[i]) {
+            size_type start = rendered_length();
+            if (!terminated) {
+                // make sure the property starts on its own line
+                rendered << newline;
+                terminated = true;
+            }
+            props.put(i,rendered);
+            rendered << newline;
+            add_segment(true,start,rendered_length()-start);
+            changed = true;
+        }
+    }
+    if (!changed)
+        return true;
+
+    // write everything to a temporary file and atomically replace the original
+    str tmpName(fileName);
+    tmpName += ".tmp";
+    int fd = ::open(tmpName.c_str(),O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,0666);
+    if (fd == -1)
+        return false;
+    rendered.flush_output();
+    const char* text = rendered.get_device().c_str();
+    dynamic_array<iovec> iov;
+    for (size_type i = 0;i<segments.size();i++) {
+        iovec& v = ++iov;
+        v.iov_base = const_cast<char*>((segments[i].rendered ? text : _data) + segments[i].offset);
+        v.iov_len = segments[i].length;
+    }
+    // a single writev normally suffices; continue after a short write or if there
+    // are more segments than a single call accepts
+    size_type first = 0;
+    while (first < iov.size()) {
+        int count = int(iov.size()-first < IOV_MAX ? iov.size()-first : IOV_MAX);
+        ssize_t n = ::writev(fd,&iov[first],count);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            ::close(fd);
+            ::unlink(tmpName.c_str());
+            return false;
+        }
+        while (first<iov.size() && size_type(n)>=iov[first].iov_len)
+            n -= iov[first++].iov_len;
+        if (n > 0) {
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + n;
+            iov[first].iov_len -= n;
+        }
+    }
+    if (::close(fd)==-1 || ::rename(tmpName.c_str(),fileName)==-1) {
+        ::unlink(tmpName.c_str());
+        return false;
+    }
+    return true;
 }
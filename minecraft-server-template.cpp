@@ -0,0 +1,257 @@
+// minecraft-server-template.cpp
+#include "minecraft-server-template.h"
+#include "minecontrol-user-fs.h"
+#include <atomic>
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <limits.h>
+#include <errno.h>
+#ifdef __linux__
+#include <linux/fs.h> // gets FICLONE
+#endif
+using namespace minecraft_controller;
+
+namespace
+{
+    // files in the top-level of a server directory that minecontrol creates
+    // itself; these are never taken from a template
+    const char* const MANAGED_FILES[] = {
+        "archive", "errors", "eula.txt", "minecontrol.exec", "minecontrol.properties",
+        "player-ledger", "session.lock"
+    };
+
+    // number of threads used to copy files when they can't be cloned
+    const int COPY_THREADS = 4;
+
+    // the daemon runs with a umask of zero; templates shouldn't produce files
+    // that other users can write
+    const mode_t DENIED_MODE = S_IWGRP | S_IWOTH;
+
+    struct copy_context
+    {
+        const void* files; // std::vector<_file>
+        int uid, gid;
+        std::atomic<size_t> next;
+        std::atomic<bool> failed;
+    };
+
+    bool is_managed_file(const char* name)
+    {
+        for (size_t i = 0;i < sizeof(MANAGED_FILES)/sizeof(MANAGED_FILES[0]);++i)
+            if (std::strcmp(MANAGED_FILES[i],name) == 0)
+                return true;
+        return false;
+    }
+
+    // determine if the symbolic link 'target', found 'depth' directories below
+    // the top of the template, resolves to somewhere inside the template
+    bool link_stays_inside(const char* target,int depth)
+    {
+        if (target[0] == '/')
+            return false;
+        while (*target) {
+            const char* end = std::strchr(target,'/');
+            size_t len = end != NULL ? size_t(end - target) : std::strlen(target);
+            if (len==2 && target[0]=='.' && target[1]=='.') {
+                if (--depth < 0)
+                    return false;
+            }
+            else if (len>0 && !(len==1 && target[0]=='.'))
+                ++depth;
+            target += len;
+            if (*target == '/')
+                ++target;
+        }
+        return true;
+    }
+}
+
+/*static*/ bool minecraft_server_template::clone(const char* source,const char* destination,int uid,int gid)
+{
+    std::vector<_file> files;
+
+    // create the directory structure first; this gives us the list of files to
+    // clone; (the user must be able to read the template and will own the copy)
+    {
+        user_fs_scope scope(uid,gid);
+        if ( !_walk(source,destination,0,files) )
+            return false;
+    }
+
+    // clone the files: when the filesystem supports sharing extents each file
+    // takes a single ioctl, else the copies proceed in parallel
+    copy_context context;
+    context.files = &files;
+    context.uid = uid;
+    context.gid = gid;
+    context.next = 0;
+    context.failed = false;
+    pthread_t threads[COPY_THREADS];
+    int count = 0;
+    while (count < COPY_THREADS-1 && size_t(count+1) < files.size()) {
+        if (::pthread_create(threads+count,NULL,&minecraft_server_template::_copy_thread,&context) != 0)
+            break;
+        ++count;
+    }
+    _copy_thread(&context);
+    for (int i = 0;i < count;++i)
+        ::pthread_join(threads[i],NULL);
+    return !context.failed;
+}
+/*static*/ bool minecraft_server_template::remove(const char* directory,int uid,int gid)
+{
+    user_fs_scope scope(uid,gid);
+    int fd = ::open(directory,O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    bool success = _remove_contents(fd);
+    return ::rmdir(directory)==0 && success;
+}
+/*static*/ bool minecraft_server_template::_walk(const std::string& source,const std::string& destination,
+    int depth,std::vector<_file>& files)
+{
+    DIR* dir = ::opendir(source.c_str());
+    if (dir == NULL)
+        return false;
+    bool success = true;
+    while (success) {
+        struct stat st;
+        struct dirent* result = ::readdir(dir);
+        if (result == NULL)
+            break;
+        if (std::strcmp(result->d_name,".")==0 || std::strcmp(result->d_name,"..")==0
+            || (depth==0 && is_managed_file(result->d_name)))
+        {
+            continue;
+        }
+
+        std::string from = source + '/' + result->d_name;
+        std::string to = destination + '/' + result->d_name;
+        if (::lstat(from.c_str(),&st) == -1) {
+            success = false;
+            break;
+        }
+        if ( S_ISDIR(st.st_mode) ) {
+            if (::mkdir(to.c_str(),((st.st_mode & 07777) | S_IRWXU) & ~DENIED_MODE)==-1 && errno!=EEXIST)
+                success = false;
+            else
+                success = _walk(from,to,depth+1,files);
+        }
+        else if ( S_ISREG(st.st_mode) ) {
+            files.push_back(_file());
+            files.back().source = from;
+            files.back().destination = to;
+            files.back().mode = ((st.st_mode & 07777) | S_IRUSR | S_IWUSR) & ~DENIED_MODE;
+        }
+        else if ( S_ISLNK(st.st_mode) ) {
+            char target[PATH_MAX];
+            ssize_t len = ::readlink(from.c_str(),target,sizeof(target)-1);
+            if (len == -1)
+                success = false;
+            else {
+                // links that lead out of the template would expose whatever they
+                // point at to the new server; leave those out
+                target[len] = 0;
+                if (link_stays_inside(target,depth) && ::symlink(target,to.c_str())==-1 && errno!=EEXIST)
+                    success = false;
+            }
+        }
+        // anything else (sockets, fifos, devices) doesn't belong in a template
+    }
+    ::closedir(dir);
+    return success;
+}
+/*static*/ bool minecraft_server_template::_remove_contents(int fd)
+{
+    // takes ownership of 'fd'; directories are opened relative to their parent
+    // so a name swapped for a symbolic link is unlinked rather than followed
+    DIR* dir = ::fdopendir(fd);
+    if (dir == NULL) {
+        ::close(fd);
+        return false;
+    }
+    bool success = true;
+    struct dirent* result;
+    while ((result = ::readdir(dir)) != NULL) {
+        if (std::strcmp(result->d_name,".")==0 || std::strcmp(result->d_name,"..")==0)
+            continue;
+        if (::unlinkat(fd,result->d_name,0) == 0)
+            continue;
+        if (errno!=EISDIR && errno!=EPERM) {
+            success = false;
+            continue;
+        }
+        int sub = ::openat(fd,result->d_name,O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (sub==-1 || !_remove_contents(sub) || ::unlinkat(fd,result->d_name,AT_REMOVEDIR)==-1)
+            success = false;
+    }
+    ::closedir(dir);
+    return success;
+}
+/*static*/ bool minecraft_server_template::_clone_file(const _file& file)
+{
+    int fdin, fdout;
+    bool success = true;
+    if ((fdin = ::open(file.source.c_str(),O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC)) == -1)
+        return false;
+    if ((fdout = ::open(file.destination.c_str(),O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,file.mode)) == -1) {
+        ::close(fdin);
+        // leave files that already exist alone
+        return errno == EEXIST;
+    }
+#ifdef FICLONE
+    if (::ioctl(fdout,FICLONE,fdin) == -1)
+#endif
+        success = _copy_data(fdin,fdout);
+    ::close(fdin);
+    if (::close(fdout) == -1)
+        success = false;
+    return success;
+}
+/*static*/ bool minecraft_server_template::_copy_data(int fdin,int fdout)
+{
+    ssize_t n;
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+    // let the kernel copy (or share) the data; fall back if the filesystems involved
+    // don't support it
+    bool started = false;
+    while ((n = ::copy_file_range(fdin,NULL,fdout,NULL,1 << 30,0)) > 0)
+        started = true;
+    if (n == 0)
+        return true;
+    if (started || (errno!=ENOSYS && errno!=EXDEV && errno!=EINVAL && errno!=EOPNOTSUPP))
+        return false;
+#endif
+    std::vector<char> buffer(1 << 20);
+    while ((n = ::read(fdin,&buffer[0],buffer.size())) > 0) {
+        for (ssize_t done = 0;done < n;) {
+            ssize_t m = ::write(fdout,&buffer[done],n-done);
+            if (m == -1) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            done += m;
+        }
+    }
+    return n == 0;
+}
+/*static*/ void* minecraft_server_template::_copy_thread(void* pcontext)
+{
+    copy_context* context = reinterpret_cast<copy_context*>(pcontext);
+    const std::vector<_file>& files = *reinterpret_cast<const std::vector<_file>*>(context->files);
+    user_fs_scope scope(context->uid,context->gid);
+    while ( !context->failed ) {
+        size_t i = context->next++;
+        if (i >= files.size())
+            break;
+        if ( !_clone_file(files[i]) )
+            context->failed = true;
+    }
+    return NULL;
+}
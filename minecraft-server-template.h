@@ -0,0 +1,53 @@
+// minecraft-server-template.h
+#ifndef MINECRAFT_SERVER_TEMPLATE_H
+#define MINECRAFT_SERVER_TEMPLATE_H
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+namespace minecraft_controller
+{
+    /* clones a server template (a directory holding a pre-generated world and any other
+       server files) into a new server directory; each file is cloned with FICLONE when the
+       filesystem can share extents, else copied in the kernel with copy_file_range, else
+       copied through a buffer by several threads at once */
+    class minecraft_server_template
+    {
+    public:
+        // clone the contents of 'source' into the existing directory 'destination';
+        // files that already exist in 'destination', top-level files that minecontrol
+        // manages itself and symbolic links that point outside the template are left
+        // alone; every thread involved accesses files with the filesystem credentials
+        // of 'uid' and 'gid', so this is run by the daemon before it forks the server
+        static bool clone(const char* source,const char* destination,int uid,int gid);
+
+        // remove 'directory' and everything in it with the filesystem credentials of
+        // 'uid' and 'gid' without following symbolic links; this undoes a clone into
+        // a new server directory that failed partway
+        static bool remove(const char* directory,int uid,int gid);
+    private:
+        struct _file
+        {
+            std::string source;
+            std::string destination;
+            mode_t mode;
+        };
+
+        static bool _walk(const std::string& source,const std::string& destination,
+            int depth,std::vector<_file>& files);
+        static bool _remove_contents(int fd);
+        static bool _clone_file(const _file& file);
+        static bool _copy_data(int fdin,int fdout);
+        static void* _copy_thread(void*);
+    };
+}
+
+#endif
+
+/*
+ * Local Variables:
+ * mode:c++
+ * indent-tabs-mode:nil
+ * tab-width:4
+ * End:
+ */
@@ -1,8 +1,11 @@
 // minecraft-server.cpp
 #include "minecraft-server.h"
 #include "minecraft-controller.h"
+#include "minecraft-server-template.h"
+#include "minecontrol-metrics.h"
 #include <cstring>
 #include <stdexcept>
+#include <algorithm>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -11,6 +14,10 @@
 #include <sys/time.h>
 #include <sys/wait.h>
 #include <dirent.h>
+#include <poll.h>
+#ifndef __APPLE__
+#include <sys/inotify.h>
+#endif
 #include <pwd.h>
 #include <time.h>
 #include <errno.h>
@@ -43,6 +50,22 @@ extern char **environ;
     "# profile defined in the global \"minecontrol.init\" file. Warning - changing this\n" \
     "# property may result in undefined behavior that may break your server!\n"
 
+// writes a byte count with a binary unit suffix (e.g. 1.5G)
+static void print_size(rstream& stream,uint64 bytes)
+{
+    static const char UNITS[] = "BKMGT";
+    int unit = 0;
+    uint64 tenths = bytes*10;
+    while (tenths >= 10240 && unit < 4) {
+        tenths /= 1024;
+        ++unit;
+    }
+    stream << tenths/10;
+    if (unit > 0)
+        stream << '.' << tenths%10;
+    stream << UNITS[unit];
+}
+
 // minecraft_controller::minecraft_server_info
 
 /* static */ const char* const minecraft_server_info::MINECRAFT_USER_DIRECTORY = "minecraft";
@@ -53,11 +76,10 @@ minecraft_server_info::minecraft_server_info(bool createNew,const char* serverNa
     // set extended property defaults
     serverTime = uint64(-1);
     // read in server props if server is pre-existing; we must read the minecontrol init file to see if an alternate home exists
-    minecraft_server_init_manager initInfo;
-    initInfo.read_from_file();
+    minecraft_server_init_manager::snapshot initInfo = minecraft_server_init_manager::get_snapshot();
     path serverDir;
-    if (initInfo.alternate_home().length() > 0) {
-        serverDir = initInfo.alternate_home();
+    if (initInfo->alternate_home().length() > 0) {
+        serverDir = initInfo->alternate_home();
         serverDir += userInfo.userName;
     }
     else
@@ -65,9 +87,9 @@ minecraft_server_info::minecraft_server_info(bool createNew,const char* serverNa
     serverDir += MINECRAFT_USER_DIRECTORY;
     serverDir += serverName;
     if (!isNew && serverDir.exists()) {
-        file_stream fstream( filename(serverDir,"server.properties").get_full_name().c_str() );
-        if ( fstream.get_device().is_valid_context() )
-            _properties.read(fstream);
+        minecraft_server_properties_file propsFile;
+        if ( propsFile.load(filename(serverDir,"server.properties").get_full_name().c_str(),userInfo.uid,userInfo.gid) )
+            propsFile.apply(_properties);
     }
 }
 void minecraft_server_info::read_props(str& propertyList,rstream& errorStream)
@@ -153,51 +175,139 @@ minecraft_server_info::_process_ex_prop(const str& key,const str& value)
         return _prop_process_success;
     }
 
+    // "template" [string]: The template to clone a new server from.
+    if (key == "template") {
+        templateName = value;
+        return _prop_process_success;
+    }
+
     return _prop_process_bad_key;
 }
 
 minecraft_server_info::_prop_process_flag
 minecraft_server_info::_process_prop(const str& key,const str& value,bool applyIfDefault)
 {
-    // check the three different types of properties
-    {
-        boolean_prop* pprop = _properties.booleanProps.lookup(key.c_str());
-        if (pprop!=NULL && (!applyIfDefault || !pprop->is_user_supplied())) {
-            if ( !pprop->set_value(value) )
-                return _prop_process_bad_value;
-            return _prop_process_success;
-        }
-    }
-    {
-        numeric_prop* pprop = _properties.numericProps.lookup(key.c_str());
-        if (pprop!=NULL && (!applyIfDefault || !pprop->is_user_supplied())) {
-            if ( !pprop->set_value(value) )
-                return _prop_process_bad_value;
-            return _prop_process_success;
-        }
-    }
-    {
-        string_prop* pprop = _properties.stringProps.lookup(key.c_str());
-        if (pprop!=NULL && (!applyIfDefault || !pprop->is_user_supplied())) {
-            if ( !pprop->set_value(value) )
-                return _prop_process_bad_value;
-            return _prop_process_success;
-        }
+    int index = minecraft_server_property_list::lookup(key.c_str());
+    if (index!=-1 && (!applyIfDefault || !_properties.is_user_supplied(index))) {
+        if ( !_properties.set_value(index,value) )
+            return _prop_process_bad_value;
+        return _prop_process_success;
     }
     return _prop_process_bad_key;
 }
 
 // minecraft_controller::minecraft_server_init_manager
 
+/*static*/ minecraft_server_init_manager::snapshot minecraft_server_init_manager::_current;
+/*static*/ pthread_t minecraft_server_init_manager::_watchThreadID;
+/*static*/ volatile bool minecraft_server_init_manager::_watchCondition = false;
 /*static*/ void minecraft_server_init_manager::list_profiles(rtypes::dynamic_array<rtypes::str>& out)
 {
-    minecraft_server_init_manager initInfo;
+    snapshot initInfo = get_snapshot();
 
-    initInfo.read_from_file();
-    for (auto it = initInfo.profiles.begin();it != initInfo.profiles.end();++it) {
+    for (auto it = initInfo->profiles.begin();it != initInfo->profiles.end();++it) {
         out.push_back(it->first.c_str());
     }
 }
+/*static*/ minecraft_server_init_manager::snapshot minecraft_server_init_manager::get_snapshot()
+{
+    snapshot result = std::atomic_load(&_current);
+    if (result == nullptr) {
+        // nothing has been published yet (the watcher isn't running); parse the
+        // file now; if another thread beat us to it then use its snapshot
+        std::shared_ptr<minecraft_server_init_manager> fresh = std::make_shared<minecraft_server_init_manager>();
+        fresh->read_from_file();
+        snapshot expected;
+        snapshot desired = fresh;
+        if ( !std::atomic_compare_exchange_strong(&_current,&expected,desired) )
+            return expected;
+        return desired;
+    }
+    return result;
+}
+/*static*/ void minecraft_server_init_manager::start_watcher()
+{
+    // publish an initial snapshot and then watch for changes
+    _publish();
+    _watchCondition = true;
+    if (::pthread_create(&_watchThreadID,NULL,&minecraft_server_init_manager::_watch_thread,NULL) != 0)
+        throw minecraft_server_error();
+}
+/*static*/ void minecraft_server_init_manager::stop_watcher()
+{
+    if (_watchCondition) {
+        _watchCondition = false;
+        if (::pthread_join(_watchThreadID,NULL) != 0)
+            throw minecraft_server_error();
+    }
+}
+/*static*/ void minecraft_server_init_manager::_publish()
+{
+    std::shared_ptr<minecraft_server_init_manager> fresh = std::make_shared<minecraft_server_init_manager>();
+    fresh->read_from_file();
+    std::atomic_store(&_current,snapshot(fresh));
+}
+/*static*/ void* minecraft_server_init_manager::_watch_thread(void*)
+{
+    // watch the directory instead of the file itself: editors commonly replace the
+    // file by renaming a new one over it which would orphan a watch on the file
+    struct stat st;
+    time_t lastModified = 0;
+    int fd = -1;
+#ifndef __APPLE__
+    fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd!=-1 && ::inotify_add_watch(fd,".",IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_CREATE|IN_DELETE)==-1) {
+        ::close(fd);
+        fd = -1;
+    }
+#endif
+    if (fd == -1) {
+        minecontrold::standardLog << "init file changes will be detected by polling" << endline;
+        if (::stat(SERVER_INIT_FILE,&st) == 0)
+            lastModified = st.st_mtime;
+    }
+    while (_watchCondition) {
+        bool changed = false;
+#ifndef __APPLE__
+        if (fd != -1) {
+            pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            if (::poll(&pfd,1,1000) > 0) {
+                // drain all pending events and see if any of them name the init file
+                char buffer[4096] __attribute__((aligned(__alignof__(inotify_event))));
+                ssize_t len;
+                while ((len = ::read(fd,buffer,sizeof(buffer))) > 0) {
+                    for (char* p = buffer;p < buffer+len;) {
+                        const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+                        if (event->len>0 && std::strcmp(event->name,SERVER_INIT_FILE)==0)
+                            changed = true;
+                        p += sizeof(inotify_event) + event->len;
+                    }
+                }
+            }
+        }
+        else
+#endif
+        {
+            ::sleep(1);
+            time_t modified = 0;
+            if (::stat(SERVER_INIT_FILE,&st) == 0)
+                modified = st.st_mtime;
+            if (modified != lastModified) {
+                lastModified = modified;
+                changed = true;
+            }
+        }
+        if (changed) {
+            _publish();
+            minecontrold::standardLog << "reloaded " SERVER_INIT_FILE << endline;
+        }
+    }
+    if (fd != -1)
+        ::close(fd);
+    return NULL;
+}
 
 minecraft_server_init_manager::minecraft_server_init_manager()
 {
@@ -205,11 +315,12 @@ minecraft_server_init_manager::minecraft_server_init_manager()
     _shutdownCountdown = 30; // 30 seconds
     _maxSeconds = 3600*4; // 4 hours
     _maxServers = 0xffff; // allow unlimited (virtually)
+    _cgroupAuthority = false;
 }
 
-char* minecraft_server_init_manager::arguments(const char* profileName)
+const char* minecraft_server_init_manager::arguments(const char* profileName) const
 {
-    minecraft_server_profile* profile;
+    const minecraft_server_profile* profile;
 
     try {
         profile = &profiles.at(profileName);
@@ -217,12 +328,26 @@ char* minecraft_server_init_manager::arguments(const char* profileName)
         return nullptr;
     }
 
-    return &profile->cmdline[0];
+    return profile->cmdline.c_str();
+}
+
+const minecraft_server_cgroup::limit_list& minecraft_server_init_manager::cgroup_limits(const char* profileName) const
+{
+    static const minecraft_server_cgroup::limit_list NONE;
+    auto iter = limits.find(profileName);
+    return iter != limits.end() ? iter->second : NONE;
+}
+
+const char* minecraft_server_init_manager::template_path(const char* templateName) const
+{
+    auto iter = templates.find(templateName);
+    if (iter == templates.end())
+        return nullptr;
+    return iter->second.c_str();
 }
 
 void minecraft_server_init_manager::read_from_file()
 {
-    _mtx.lock();
     // load global attributes from file
     file initFile;
     if ( initFile.open_input(SERVER_INIT_FILE,file_open_existing) ) {
@@ -310,6 +435,49 @@ void minecraft_server_init_manager::read_from_file()
 
                 profiles[newProfile.profileName.c_str()] = newProfile;
             }
+            else if (key == "template") {
+                // template=<name>:<directory>
+                str line;
+                ssValue.getline(line);
+                size_type iter = 0;
+                std::string name;
+                while (iter < line.length() && line[iter] != ':')
+                    name.push_back(line[iter++]);
+                if (iter < line.length())
+                    templates[name] = line.c_str() + iter + 1;
+            }
+            else if (key == "default-template") {
+                ssValue.getline(defaultTemplate);
+            }
+            else if (key == "cgroup-root") {
+                ssValue.getline(_cgroupRoot);
+                size_type i = _cgroupRoot.length();
+                while (i>1 && _cgroupRoot[i-1]=='/')
+                    --i;
+                _cgroupRoot.truncate(i);
+            }
+            else if (key == "cgroup-authority") {
+                str value;
+                ssValue >> value;
+                rutil_to_lower_ref(value);
+                _cgroupAuthority = (value=="yes" || value=="true" || value=="1");
+            }
+            else if (key == "limit") {
+                // limit=<profile>:<file>=<value>, e.g. limit=vanilla:memory.max=4G
+                str line;
+                ssValue.getline(line);
+                size_type iter = 0;
+                std::string profile, file;
+                while (iter < line.length() && line[iter] != ':')
+                    profile.push_back(line[iter++]);
+                ++iter;
+                while (iter < line.length() && line[iter] != '=')
+                    file.push_back(line[iter++]);
+                if (iter < line.length() && minecraft_server_cgroup::is_limit_file(file.c_str()))
+                    limits[profile].push_back(std::make_pair(file,std::string(line.c_str() + iter + 1)));
+                else
+                    minecontrold::standardLog << "!!warning!!: ignoring bad limit line in init file: " << line << endline;
+            }
             else if (key == "server-time") {
                 ssValue >> _maxSeconds;
                 _maxSeconds *= 3600; // assume value was in hours; make units in seconds
@@ -356,9 +524,8 @@ void minecraft_server_init_manager::read_from_file()
     }
     else
         minecontrold::standardLog << "!!warning!!: no init file found or can't open it: using internal defaults" << endline;
-    _mtx.unlock();
 }
-void minecraft_server_init_manager::apply_properties(minecraft_server_info& info)
+void minecraft_server_init_manager::apply_properties(minecraft_server_info& info) const
 {
     for (uint32 i = 0;i<_overrideProperties.size();i++)
         info.set_prop(_overrideProperties[i].key,_overrideProperties[i].value);
@@ -366,19 +533,70 @@ void minecraft_server_init_manager::apply_properties(minecraft_server_info& info
         info.set_prop(_defaultProperties[i].key,_defaultProperties[i].value,true);
 }
 
+// minecraft_controller::minecraft_startup_stats
+
+/*static*/ mutex minecraft_startup_stats::_mtx("startup-stats");
+/*static*/ std::map<std::string,minecraft_startup_stats::_profile> minecraft_startup_stats::_profiles;
+/*static*/ void minecraft_startup_stats::record(const str& profileName,startup_stage stage,uint64 milliseconds)
+{
+    _mtx.lock();
+    _profiles[profileName.c_str()].stages[stage].add(milliseconds);
+    _mtx.unlock();
+}
+/*static*/ void minecraft_startup_stats::print(rstream& stream,const char* profileName)
+{
+    static const char* const STAGE_NAMES[] = { "first-line", "bind", "ready" };
+    bool noneFound = true;
+    _mtx.lock();
+    for (auto iter = _profiles.begin();iter != _profiles.end();++iter) {
+        if (profileName != NULL && iter->first != profileName)
+            continue;
+        for (int i = 0;i < startup_stage_count;++i) {
+            const latency_histogram& hist = iter->second.stages[i];
+            if (hist.count() == 0)
+                continue;
+            stream << iter->first.c_str() << ' ' << STAGE_NAMES[i] << ": n=" << hist.count()
+                   << " mean=" << hist.sum()/hist.count() << "ms min=" << hist.min()
+                   << "ms p50=" << hist.quantile(0.50) << "ms p90=" << hist.quantile(0.90)
+                   << "ms p99=" << hist.quantile(0.99) << "ms max=" << hist.max() << "ms" << newline;
+            noneFound = false;
+        }
+    }
+    _mtx.unlock();
+    if (noneFound)
+        stream << "No server start-ups have been recorded" << newline;
+}
+
 // minecraft_controller::minecraft_server
 
+// a user's minecraft directory as of its last scan; catalogs are replaced, never modified
+struct minecraft_server::_catalog
+{
+#ifdef __APPLE__
+    timespec dirModified() const
+    { return dirStat.st_mtimespec; }
+#else
+    timespec dirModified() const
+    { return dirStat.st_mtim; }
+#endif
+
+    struct stat dirStat; // the directory as of the scan
+    bool trusted; // false if the directory changed too close to the scan to rely on its mtime
+    std::vector<std::string> servers; // sorted names of directories that have a world
+    std::vector<std::string> candidates; // directories that don't have a world (yet)
+};
+/*static*/ std::map<std::string,std::shared_ptr<const minecraft_server::_catalog> > minecraft_server::_catalogs;
+/*static*/ mutex minecraft_server::_catalogMutex("server-catalog");
 /*static*/ void minecraft_server::list_servers(rtypes::dynamic_array<rtypes::str>& out,
-    const user_info& userInfo)
+    const user_info& userInfo,const char* prefix,size_type offset,size_type limit)
 {
     str mcraftdir;
     stringstream formatter;
-    minecraft_server_init_manager initInfo;
+    minecraft_server_init_manager::snapshot initInfo = minecraft_server_init_manager::get_snapshot();
 
     // Deduce the user's minecraft directory.
-    initInfo.read_from_file();
-    if (initInfo.alternate_home().length() > 0) {
-        formatter << initInfo.alternate_home() << '/' << userInfo.userName;
+    if (initInfo->alternate_home().length() > 0) {
+        formatter << initInfo->alternate_home() << '/' << userInfo.userName;
     }
     else {
         formatter << userInfo.homeDirectory;
@@ -386,43 +604,173 @@ void minecraft_server_init_manager::apply_properties(minecraft_server_info& info
     formatter << '/' << minecraft_server_info::MINECRAFT_USER_DIRECTORY;
     mcraftdir = static_cast<str&>(formatter.get_device());
 
+    // Find the cached catalog. Adding, removing or renaming a server directory
+    // changes the modification time of the minecraft directory so a single stat
+    // tells us if the catalog is still good.
+    struct stat st;
+    std::shared_ptr<const _catalog> catalog;
+    _catalogMutex.lock();
+    auto iter = _catalogs.find(mcraftdir.c_str());
+    if (iter != _catalogs.end())
+        catalog = iter->second;
+    _catalogMutex.unlock();
+    if (::stat(mcraftdir.c_str(),&st) == -1) {
+        if (catalog != nullptr) {
+            _catalogMutex.lock();
+            _catalogs.erase(mcraftdir.c_str());
+            _catalogMutex.unlock();
+        }
+        return;
+    }
+    if (catalog != nullptr) {
+        timespec modified = catalog->dirModified();
+#ifdef __APPLE__
+        const timespec& current = st.st_mtimespec;
+#else
+        const timespec& current = st.st_mtim;
+#endif
+        if (!catalog->trusted || current.tv_sec!=modified.tv_sec || current.tv_nsec!=modified.tv_nsec
+            || st.st_ino!=catalog->dirStat.st_ino || st.st_dev!=catalog->dirStat.st_dev)
+        {
+            catalog.reset();
+        }
+    }
+    if (catalog == nullptr) {
+        std::shared_ptr<_catalog> fresh = _scan_catalog(mcraftdir);
+        if (fresh == nullptr)
+            return;
+        catalog = fresh;
+        _catalogMutex.lock();
+        _catalogs[mcraftdir.c_str()] = catalog;
+        _catalogMutex.unlock();
+    }
+    else {
+        // Creating or deleting a world inside a server directory doesn't modify the
+        // minecraft directory, so check that each entry still has (or lacks) a world.
+        auto has_world = [&mcraftdir](const std::string& name) {
+            struct stat st;
+            std::string worldPath = mcraftdir.c_str();
+            worldPath += '/';
+            worldPath += name;
+            worldPath += "/world";
+            return ::stat(worldPath.c_str(),&st)==0 && S_ISDIR(st.st_mode);
+        };
+        bool changed = false;
+        for (size_type i = 0;!changed && i < catalog->servers.size();++i)
+            changed = !has_world(catalog->servers[i]);
+        for (size_type i = 0;!changed && i < catalog->candidates.size();++i)
+            changed = has_world(catalog->candidates[i]);
+        if (changed) {
+            std::shared_ptr<_catalog> updated = std::make_shared<_catalog>();
+            updated->dirStat = catalog->dirStat;
+            updated->trusted = catalog->trusted;
+            for (size_type i = 0;i < catalog->servers.size();++i)
+                (has_world(catalog->servers[i]) ? updated->servers : updated->candidates).push_back(catalog->servers[i]);
+            for (size_type i = 0;i < catalog->candidates.size();++i)
+                (has_world(catalog->candidates[i]) ? updated->servers : updated->candidates).push_back(catalog->candidates[i]);
+            std::sort(updated->servers.begin(),updated->servers.end());
+            catalog = updated;
+            _catalogMutex.lock();
+            _catalogs[mcraftdir.c_str()] = catalog;
+            _catalogMutex.unlock();
+        }
+    }
+
+    // Select the requested page of names that begin with the prefix.
+    size_type prefixLength = std::strlen(prefix);
+    auto it = std::lower_bound(catalog->servers.begin(),catalog->servers.end(),std::string(prefix));
+    for (;it != catalog->servers.end() && limit > 0;++it) {
+        if (it->compare(0,prefixLength,prefix) != 0)
+            break;
+        if (offset > 0) {
+            --offset;
+            continue;
+        }
+        out.push_back(it->c_str());
+        --limit;
+    }
+}
+/*static*/ bool minecraft_server::find_server_directory(const user_info& userInfo,const char* serverName,str& out)
+{
+    stringstream formatter;
+    minecraft_server_init_manager::snapshot initInfo = minecraft_server_init_manager::get_snapshot();
+    struct stat st;
+
+    if (*serverName==0 || std::strchr(serverName,'/')!=NULL
+        || std::strcmp(serverName,".")==0 || std::strcmp(serverName,"..")==0)
+    {
+        return false;
+    }
+
+    if (initInfo->alternate_home().length() > 0) {
+        formatter << initInfo->alternate_home() << '/' << userInfo.userName;
+    }
+    else {
+        formatter << userInfo.homeDirectory;
+    }
+    formatter << '/' << minecraft_server_info::MINECRAFT_USER_DIRECTORY << '/' << serverName;
+    out = static_cast<str&>(formatter.get_device());
+    // not a link to some other place, and the user's own
+    return ::lstat(out.c_str(),&st)==0 && S_ISDIR(st.st_mode) && int(st.st_uid)==userInfo.uid;
+}
+/*static*/ std::shared_ptr<minecraft_server::_catalog> minecraft_server::_scan_catalog(const str& mcraftdir)
+{
+    std::shared_ptr<_catalog> catalog = std::make_shared<_catalog>();
+    time_t scanTime = ::time(NULL);
+
+    // Stat before reading so that any change made during the scan shows up as a
+    // different modification time next time.
+    if (::stat(mcraftdir.c_str(),&catalog->dirStat) == -1)
+        return nullptr;
+    catalog->trusted = catalog->dirModified().tv_sec < scanTime-1;
+
     // Walk the user's minecraft directory to discover minecraft servers.
     DIR* dir = opendir(mcraftdir.c_str());
+    if (dir == nullptr) {
+        return nullptr;
+    }
+    while (true) {
+        struct stat st;
+        struct dirent* result;
+        result = readdir(dir);
 
-    if (dir != nullptr) {
-        while (true) {
-            struct stat st;
-            struct dirent* result;
-            result = readdir(dir);
-
-            if (result == nullptr) {
-                break;
-            }
+        if (result == nullptr) {
+            break;
+        }
 
-            if (result->d_type != DT_DIR) {
-                continue;
-            }
+        if ((result->d_type != DT_DIR && result->d_type != DT_UNKNOWN)
+            || std::strcmp(result->d_name,".") == 0 || std::strcmp(result->d_name,"..") == 0) {
+            continue;
+        }
 
-            // Verify that the folder contains a "world" subdirectory.
-            stringstream dirPath(mcraftdir.c_str());
-            dirPath << '/' << result->d_name << "/world";
-            if (stat(dirPath.get_device().c_str(),&st) == -1) {
-                continue;
-            }
-            if (S_ISDIR(st.st_mode)) {
-                out.push_back(result->d_name);
-            }
+        // Some (network) filesystems don't fill in the type; lstat the entry so
+        // that only real directories are taken, as with DT_DIR.
+        stringstream dirPath(mcraftdir.c_str());
+        dirPath << '/' << result->d_name;
+        if (result->d_type == DT_UNKNOWN
+            && (::lstat(dirPath.get_device().c_str(),&st) == -1 || !S_ISDIR(st.st_mode))) {
+            continue;
         }
 
-        closedir(dir);
+        // Verify that the folder contains a "world" subdirectory.
+        dirPath << "/world";
+        if (stat(dirPath.get_device().c_str(),&st) == 0 && S_ISDIR(st.st_mode)) {
+            catalog->servers.push_back(result->d_name);
+        }
+        else {
+            catalog->candidates.push_back(result->d_name);
+        }
     }
+    closedir(dir);
+
+    std::sort(catalog->servers.begin(),catalog->servers.end());
+    return catalog;
 }
 
 /*static*/ set<uint32> minecraft_server::_idSet;
-/*static*/ mutex minecraft_server::_idSetProtect;
+/*static*/ mutex minecraft_server::_idSetProtect("server-ids");
 /*static*/ short minecraft_server::_handlerRef = 0;
 /*static*/ uint64 minecraft_server::_alarmTick = 0;
-/*static*/ minecraft_server_init_manager minecraft_server::_initManager;
 
 minecraft_server::minecraft_server()
 {
@@ -451,8 +799,12 @@ minecraft_server::minecraft_server()
     _gid = -1;
     _fderr = -1;
     _propsFileIsDirty = false;
-    // reload global settings in case they have changed
-    _initManager.read_from_file();
+    _forkTime = 0;
+    for (int i = 0;i < minecraft_startup_stats::startup_stage_count;++i)
+        _stageRecorded[i] = false;
+    _usageTime = 0;
+    _cpuRate = 0;
+    _ioReadRate = _ioWriteRate = 0;
 }
 
 minecraft_server::~minecraft_server() noexcept(false)
@@ -475,9 +827,12 @@ minecraft_server::~minecraft_server() noexcept(false)
 minecraft_server::minecraft_server_start_condition minecraft_server::begin(minecraft_server_info& info)
 {
     pid_t pid;
-    char* javaArgs;
+    const char* javaArgs;
     path mcraftdir;
-    const str& altHome = _initManager.alternate_home();
+
+    // use the current global settings for the lifetime of this server
+    _initManager = minecraft_server_init_manager::get_snapshot();
+    const str& altHome = _initManager->alternate_home();
 
     // Figure out the path to the minecraft server.
     if (altHome.length() > 0) {
@@ -521,7 +876,7 @@ minecraft_server::minecraft_server_start_condition minecraft_server::begin(minec
     // options are applied.
     _serverDir = mcraftdir;
     _internalName = info.internalName;
-    _maxTime = _initManager.server_time();
+    _maxTime = _initManager->server_time();
 
     // create or open existing error file; we'll send child process error output
     // here; we need the descriptor in the parent process so we'll have to
@@ -543,12 +898,12 @@ minecraft_server::minecraft_server_start_condition minecraft_server::begin(minec
     // available. The loaded profile can either be specified in the extended
     // options or in the minecontrol properties file.
     if (_profileName.length() == 0) {
-        _profileName = _initManager.default_profile();
+        _profileName = _initManager->default_profile();
         _propsFileIsDirty = true;
     }
 
     // Lookup server arguments from profile.
-    javaArgs = _initManager.arguments(_profileName.c_str());
+    javaArgs = _initManager->arguments(_profileName.c_str());
     if (javaArgs == nullptr) {
         if (_profileName.length() == 0) {
             return mcraft_start_server_no_default_profile;
@@ -557,14 +912,57 @@ minecraft_server::minecraft_server_start_condition minecraft_server::begin(minec
         return mcraft_start_server_bad_profile;
     }
 
+    // A new server may be cloned from a template instead of having the Java
+    // process generate its world.
+    const char* templatePath = nullptr;
+    if (info.isNew) {
+        const str& templateName = info.templateName.length() > 0 ? info.templateName : _initManager->default_template();
+        if (templateName.length() > 0 && (templatePath = _initManager->template_path(templateName.c_str())) == nullptr)
+            return mcraft_start_server_bad_template;
+    }
+
+    // Clone the template now: the child of the fork may only do what is safe
+    // in a multithreaded process until it execs. This goes before the server
+    // properties so that they are applied on top of the template's.
+    if (templatePath!=nullptr && !minecraft_server_template::clone(templatePath,mcraftdir.get_full_name().c_str(),
+            info.userInfo.uid,info.userInfo.gid))
+    {
+        // the directory was made by this call (the server is new), so take it
+        // away again; otherwise a retry would find that the server exists
+        ::close(_fderr);
+        _fderr = -1;
+        if ( !minecraft_server_template::remove(mcraftdir.get_full_name().c_str(),info.userInfo.uid,info.userInfo.gid) )
+            minecontrold::standardLog << "could not remove '" << mcraftdir.get_full_name() << "' after a failed clone" << endline;
+        return mcraft_start_server_filesystem_error;
+    }
+
+    // Place the server (and maybe its authority programs) in a cgroup subtree
+    // of its own that carries the profile's resource limits.
+    if (_initManager->cgroup_root().length() > 0) {
+        stringstream cgroupName;
+        cgroupName << info.userInfo.uid << '-' << info.internalName;
+        if (!_cgroup.create(_initManager->cgroup_root().c_str(),cgroupName.get_device().c_str(),
+                _initManager->cgroup_limits(_profileName.c_str()),_initManager->cgroup_authority()))
+        {
+            return mcraft_start_server_cgroup_fail;
+        }
+    }
+
     // create new pipe for communication; this needs to be done before the fork
     _iochannel.open();
+    _forkTime = monotonic_milliseconds();
+    for (int i = 0;i < minecraft_startup_stats::startup_stage_count;++i)
+        _stageRecorded[i] = false;
     pid = ::fork();
     if (pid == 0) { // child
         // check server limit before proceeding
-        if (_idSet.size()+1 > size_type(_initManager.max_servers()))
+        if (_idSet.size()+1 > size_type(_initManager->max_servers()))
             _exit((int)mcraft_start_server_too_many_servers);
 
+        // join the server's cgroup before giving up privileges
+        if (_cgroup.is_active() && !minecraft_server_cgroup::join(_cgroup.get_server_leaf().c_str()))
+            _exit((int)mcraft_start_server_cgroup_fail);
+
         // setup the environment for the minecraft server:
         // change process privilages
 #ifdef __APPLE__
@@ -601,9 +999,9 @@ minecraft_server::minecraft_server_start_condition minecraft_server::begin(minec
 
         // prepare execve arguments
         int top = 0;
-        char* pstr = javaArgs;
+        char* pstr = const_cast<char*>(javaArgs);
         char* args[128];
-        args[top++] = _initManager.exec();
+        args[top++] = const_cast<char*>(_initManager->exec());
         while (top+1 < 128) {
             args[top++] = pstr;
             while (*pstr) {
@@ -631,7 +1029,7 @@ minecraft_server::minecraft_server_start_condition minecraft_server::begin(minec
             ::close(fd);
 
         // execute program
-        if (::execve(_initManager.exec(),args,environ) == -1)
+        if (::execve(_initManager->exec(),args,environ) == -1)
             _exit((int)mcraft_start_server_process_fail);
 
         // (control does not exist in this program anymore)
@@ -640,7 +1038,8 @@ minecraft_server::minecraft_server_start_condition minecraft_server::begin(minec
         _iochannel.close_open(); // close open ends of pipe
 
         // initialize the authority which will manage the minecraft server
-        _authority = new minecontrol_authority(_iochannel,_fderr,mcraftdir.get_full_name(),info.userInfo);
+        _authority = new minecontrol_authority(_iochannel,_fderr,mcraftdir.get_full_name(),info.userInfo,
+            _cgroup.get_authority_leaf().c_str(),info.startupListener);
 
         // close the input side for our copy of the io channel; the authority
         // will maintain the read end of the pipe
@@ -673,6 +1072,41 @@ minecraft_server::minecraft_server_start_condition minecraft_server::begin(minec
     return mcraft_start_success;
 }
 
+void minecraft_server::_record_startup()
+{
+    if (_authority == NULL || _stageRecorded[minecraft_startup_stats::startup_ready])
+        return;
+    uint64 times[] = {
+        _authority->get_first_line_time(),
+        _authority->get_bind_time(),
+        _authority->get_ready_time()
+    };
+    for (int i = 0;i < minecraft_startup_stats::startup_stage_count;++i) {
+        if (!_stageRecorded[i] && times[i] != 0) {
+            minecraft_startup_stats::record(_profileName,minecraft_startup_stats::startup_stage(i),times[i] - _forkTime);
+            _stageRecorded[i] = true;
+        }
+    }
+}
+
+void minecraft_server::_sample_usage()
+{
+    // rates are averaged over the sampling interval
+    static const uint64 INTERVAL = 5000;
+    minecraft_server_cgroup::usage sample;
+    uint64 now = monotonic_milliseconds();
+    if (!_cgroup.is_active() || now-_usageTime < INTERVAL || !_cgroup.read_usage(sample))
+        return;
+    if (_usageTime != 0) {
+        uint64 ms = now - _usageTime;
+        _cpuRate = uint32((sample.cpuUsec - _usage.cpuUsec) / ms); // usec per msec is tenths of a percent
+        _ioReadRate = (sample.ioRead - _usage.ioRead) * 1000 / ms;
+        _ioWriteRate = (sample.ioWrite - _usage.ioWrite) * 1000 / ms;
+    }
+    _usage = sample;
+    _usageTime = now;
+}
+
 void minecraft_server::extend_time_limit(uint32 hoursMore)
 {
     if (_processID != -1) {
@@ -743,6 +1177,18 @@ minecraft_server::minecraft_server_exit_condition minecraft_server::end()
                     throw minecraft_server_error();
             ::sleep(1);
         }
+        // log what the server used over its lifetime
+        minecraft_server_cgroup::usage total;
+        if ( _cgroup.read_usage(total) ) {
+            minecontrold::standardLog << "server '" << _internalName << "' {" << _internalID << "} used cpu="
+                                      << total.cpuUsec/1000000 << '.' << (total.cpuUsec/100000)%10 << "s peak-memory=";
+            print_size(minecontrold::standardLog,total.memoryPeak);
+            minecontrold::standardLog << " read=";
+            print_size(minecontrold::standardLog,total.ioRead);
+            minecontrold::standardLog << " written=";
+            print_size(minecontrold::standardLog,total.ioWrite);
+            minecontrold::standardLog << endline;
+        }
         // put every "per-server" attribute back in an invalid state
         _iochannel.close();
         _internalName.clear();
@@ -757,6 +1203,10 @@ minecraft_server::minecraft_server_exit_condition minecraft_server::end()
         }
         /* we must wait until the authority has finished using the error file descriptor */
         _close_error_file();
+        _cgroup.destroy(); // the authority has reaped its programs
+        _usageTime = 0;
+        _cpuRate = 0;
+        _ioReadRate = _ioWriteRate = 0;
         //_threadID = -1;
         _threadExit = mcraft_noexit;
         _maxTime = 0;
@@ -800,6 +1250,9 @@ minecraft_server::minecraft_server_exit_condition minecraft_server::end()
             pserver->_threadCondition = false;
             break;
         }
+        // record start-up latencies as the authority sees each milestone
+        pserver->_record_startup();
+        pserver->_sample_usage();
         // perform elapsed time-dependent operations if this
         // server is to countdown time for the minecraft server
         // process; if maxTime is zero then time is unlimited
@@ -855,15 +1308,14 @@ minecraft_server::minecraft_server_exit_condition minecraft_server::end()
 
 bool minecraft_server::_create_server_properties_file(minecraft_server_info& info)
 {
-    file props("server.properties",file_create_always);
-    if ( !props.is_valid_context() ) // couldn't open file
-        return false;
-    file_stream fstream(props);
+    // load the existing file (if any) so that lines minecontrol doesn't
+    // understand survive the rewrite
+    minecraft_server_properties_file props;
+    props.load("server.properties");
     // apply default and/or override properties
-    _initManager.apply_properties(info);
-    // write props to properties file
-    info.get_props().write(fstream);
-    return true;
+    _initManager->apply_properties(info);
+    // write props to properties file; this is skipped if nothing changed
+    return props.save("server.properties",info.get_props());
 }
 
 bool minecraft_server::_create_eula_txt_file()
@@ -1041,6 +1493,10 @@ rstream& minecraft_controller::operator <<(rstream& stream,minecraft_server::min
     else if (condition == minecraft_server::mcraft_start_server_no_default_profile) {
         stream << "no profile found: the default profile is not configured";
     }
+    else if (condition == minecraft_server::mcraft_start_server_bad_template)
+        stream << "the specified template does not exist";
+    else if (condition == minecraft_server::mcraft_start_server_cgroup_fail)
+        stream << "the server's cgroup could not be created or joined";
     else if (condition == minecraft_server::mcraft_start_server_process_fail)
         stream << "the minecraft server process could not be executed";
     else if (condition == minecraft_server::mcraft_start_java_process_fail)
@@ -1082,14 +1538,15 @@ server_handle::server_handle()
 }
 
 // minecraft_controller::minecraft_server_manager
-/*static*/ mutex minecraft_server_manager::_mutex;
+/*static*/ mutex minecraft_server_manager::_mutex("server-manager");
 /*static*/ dynamic_array<server_handle*> minecraft_server_manager::_handles;
 /*static*/ pthread_t minecraft_server_manager::_threadID;
 /*static*/ volatile bool minecraft_server_manager::_threadCondition = false;
+/*static*/ uint64 minecraft_server_manager::_lockTime;
 /*static*/ server_handle* minecraft_server_manager::allocate_server()
 {
     size_type index = 0;
-    _mutex.lock();
+    _lock();
     while (index<_handles.size() && _handles[index]->pserver!=NULL)
         ++index;
     if (index >= _handles.size())
@@ -1097,26 +1554,26 @@ server_handle::server_handle()
     server_handle* handle = _handles[index];
     handle->pserver = new minecraft_server;
     handle->_issued = true;
-    _mutex.unlock();
+    _unlock();
     return handle;
 }
 /*static*/ void minecraft_server_manager::attach_server(server_handle* handle)
 {
-    _mutex.lock();
+    _lock();
     handle->_issued = false;
-    _mutex.unlock();
+    _unlock();
 }
 /*static*/ void minecraft_server_manager::attach_server(server_handle** handles,size_type count)
 {
-    _mutex.lock();
+    _lock();
     for (size_type i = 0;i<count;i++)
         handles[i]->_issued = false;
-    _mutex.unlock();
+    _unlock();
 }
 /*static*/ minecraft_server_manager::auth_lookup_result minecraft_server_manager::lookup_auth_servers(const user_info& login,dynamic_array<server_handle*>& outList)
 {
     auth_lookup_result result = auth_lookup_none;
-    _mutex.lock();
+    _lock();
     for (size_type i = 0;i<_handles.size();i++) {
         if (_handles[i]->pserver!=NULL && !_handles[i]->_issued) {
             if (_handles[i]->pserver->_uid==login.uid || _handles[i]->pserver->_gid==login.gid || login.uid==0/*is root*/ || login.gid==0) {
@@ -1128,13 +1585,13 @@ server_handle::server_handle()
                 result = auth_lookup_no_owned;
         }
     }
-    _mutex.unlock();
+    _unlock();
     return result;
 }
 /*static*/ void minecraft_server_manager::print_servers(rstream& stream,const user_info* login)
 {
     bool noneFound = true;
-    _mutex.lock();
+    _lock();
     for (size_type i = 0;i<_handles.size();i++) {
         if (_handles[i]->pserver!=NULL && _handles[i]->pserver->is_running()) {
             uint64 var;
@@ -1166,6 +1623,7 @@ server_handle::server_handle()
                 stream << ']';
             }
             stream << " user=" << (userInfo==NULL ? "unknown" : userInfo->pw_name)
+                   << " state=" << (_handles[i]->pserver->is_ready() ? "ready" : "starting")
                    << " time=";
             stream.fill('0');
             stream << setw(2) << hoursElapsed << ':' << minutesElapsed << ':' << secondsElapsed
@@ -1176,6 +1634,16 @@ server_handle::server_handle()
                 stream << "unlimited";
             stream << setw(0);
             stream.fill(' ');
+            if ( _handles[i]->pserver->_cgroup.is_active() ) {
+                const minecraft_server* pserver = _handles[i]->pserver;
+                stream << " cpu=" << pserver->_cpuRate/10 << '.' << pserver->_cpuRate%10 << "% memory=";
+                print_size(stream,pserver->_usage.memoryCurrent);
+                stream << " io=";
+                print_size(stream,pserver->_ioReadRate);
+                stream << "/s read,";
+                print_size(stream,pserver->_ioWriteRate);
+                stream << "/s written";
+            }
             stream << newline;
             noneFound = false;
         }
@@ -1185,10 +1653,88 @@ server_handle::server_handle()
     }
     if (noneFound)
         stream << "No active servers running at this time\n";
-    _mutex.unlock();
+    _unlock();
+}
+/*static*/ void minecraft_server_manager::write_metrics(rstream& stream)
+{
+    struct server_metrics
+    {
+        str name;
+        uint32 id;
+        uint64 lines, gists[gist_count], drops;
+        int subscribers, children;
+    };
+    std::vector<server_metrics> servers;
+    _lock();
+    for (size_type i = 0;i<_handles.size();i++) {
+        const minecraft_server* pserver = _handles[i]->pserver;
+        if (pserver!=NULL && pserver->_authority!=NULL && const_cast<minecraft_server*>(pserver)->is_running()) {
+            const minecontrol_authority* authority = pserver->_authority;
+            server_metrics m;
+            m.name = pserver->_internalName;
+            m.id = pserver->_internalID;
+            m.lines = authority->get_line_count();
+            for (int g = 0;g < gist_count;++g)
+                m.gists[g] = authority->get_gist_count(minecraft_server_message_gist(g));
+            m.drops = authority->get_console_drops();
+            m.subscribers = authority->get_console_subscribers();
+            m.children = authority->get_child_count();
+            servers.push_back(m);
+        }
+    }
+    _unlock();
+
+    // write each family in one block, as the text format requires
+    stream << "# HELP minecontrol_servers Minecraft servers that are running\n"
+           << "# TYPE minecontrol_servers gauge\n"
+           << "minecontrol_servers " << uint64(servers.size()) << newline;
+    static const char* const FAMILIES[][3] = {
+        {"minecontrol_server_lines_total","counter","Lines the server printed; rate() gives lines per second"},
+        {"minecontrol_server_gist_total","counter","Lines the server printed by message gist"},
+        {"minecontrol_console_subscribers","gauge","Clients in console mode"},
+        {"minecontrol_console_dropped_total","counter","Console messages that could not be written to a client"},
+        {"minecontrol_authority_children","gauge","Authority programs running"}
+    };
+    for (size_type f = 0;f < sizeof(FAMILIES)/sizeof(FAMILIES[0]);++f) {
+        stream << "# HELP " << FAMILIES[f][0] << ' ' << FAMILIES[f][2] << newline
+               << "# TYPE " << FAMILIES[f][0] << ' ' << FAMILIES[f][1] << newline;
+        for (size_type i = 0;i < servers.size();++i) {
+            const server_metrics& m = servers[i];
+            if (f == 1) {
+                for (int g = 0;g < gist_count;++g) {
+                    stream << FAMILIES[f][0] << "{server=\"";
+                    minecontrol_metrics::write_label(stream,m.name.c_str());
+                    stream << "\",id=\"" << m.id << "\",gist=\""
+                           << minecraft_server_message::gist_name(minecraft_server_message_gist(g)) << "\"} "
+                           << m.gists[g] << newline;
+                }
+                continue;
+            }
+            stream << FAMILIES[f][0] << "{server=\"";
+            minecontrol_metrics::write_label(stream,m.name.c_str());
+            stream << "\",id=\"" << m.id << "\"} ";
+            switch (f) {
+            case 0:
+                stream << m.lines;
+                break;
+            case 2:
+                stream << m.subscribers;
+                break;
+            case 3:
+                stream << m.drops;
+                break;
+            default:
+                stream << m.children;
+                break;
+            }
+            stream << newline;
+        }
+    }
 }
 /*static*/ void minecraft_server_manager::startup_server_manager()
 {
+    // watch the init file so that changes apply without a restart
+    minecraft_server_init_manager::start_watcher();
     // set up manager thread
     _threadCondition = true;
     if (::pthread_create(&_threadID,NULL,&minecraft_server_manager::_manager_thread,NULL) != 0)
@@ -1196,11 +1742,12 @@ server_handle::server_handle()
 }
 /*static*/ void minecraft_server_manager::shutdown_server_manager()
 {
-    // wait for the thread to quit
+    // wait for the threads to quit
     _threadCondition = false;
     if (::pthread_join(_threadID,NULL) != 0)
         throw minecraft_server_manager_error();
-    _mutex.lock();
+    minecraft_server_init_manager::stop_watcher();
+    _lock();
     for (size_type i = 0;i<_handles.size();i++) {
         if (_handles[i]->pserver != NULL) {
             if ( _handles[i]->pserver->was_started() ) {
@@ -1214,14 +1761,14 @@ server_handle::server_handle()
         delete _handles[i];
     }
     _handles.clear();
-    _mutex.unlock();
+    _unlock();
 }
 /*static*/ void* minecraft_server_manager::_manager_thread(void*)
 {
     // check the run condition of each server; if the server hasn't
     // been issued and has stopped running, destroy it
     while (_threadCondition) {
-        _mutex.lock();
+        _lock();
         for (size_type i = 0;i<_handles.size();i++) {
             if (_handles[i]->pserver!=NULL && !_handles[i]->_issued && !_handles[i]->pserver->is_running()) {
                 // the server quit (most likely from a timeout or in-game event)
@@ -1237,8 +1784,23 @@ server_handle::server_handle()
                 _handles[i]->pserver = NULL;
             }
         }
-        _mutex.unlock();
+        _unlock();
         ::sleep(1);
     }
     return NULL;
 }
+/*static*/ void minecraft_server_manager::_lock()
+{
+    uint64 begin = monotonic_microseconds();
+    _mutex.lock();
+    _lockTime = monotonic_microseconds();
+    // charge the wait to the client request being handled on this thread, if any
+    request_trace::charge(request_trace::span_lock,_lockTime - begin);
+}
+/*static*/ void minecraft_server_manager::_unlock()
+{
+    // read the start time before letting go of the lock that protects it
+    uint64 held = monotonic_microseconds() - _lockTime;
+    _mutex.unlock();
+    minecontrol_metrics::observe(minecontrol_metrics::hist_manager_lock_hold,held);
+}
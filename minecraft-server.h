@@ -2,8 +2,10 @@
 #ifndef MINECRAFT_SERVER_H
 #define MINECRAFT_SERVER_H
 #include "minecraft-server-properties.h" // gets rstringstream
+#include "minecraft-server-cgroup.h"
 #include "minecontrol-authority.h"
 #include "minecontrol-misc-types.h"
+#include "minecontrol-histogram.h"
 #include "pipe.h"
 #include "mutex.h"
 #include <rlibrary/rdynarray.h>
@@ -11,6 +13,8 @@
 #include <rlibrary/rfilename.h>
 #include <string>
 #include <map>
+#include <memory>
+#include <vector>
 
 namespace minecraft_controller
 {
@@ -25,7 +29,9 @@ namespace minecraft_controller
         bool isNew; // request (if possible) that a new server be made with the specified name
         rtypes::str internalName; // corresponds to the directory that contains the Minecraft server files
         rtypes::str profileName; // the profile to use
+        rtypes::str templateName; // the template to clone a new server from
         user_info userInfo; // information for user that is running the server
+        std::shared_ptr<minecraft_startup_listener> startupListener; // optional; is told about start-up progress
 
         /* extended properties: these properties extend those found in server.properties, often
            implementing a feature provided by this network server program; some properties may
@@ -79,14 +85,19 @@ namespace minecraft_controller
             rtypes::str cmdline;
         };
 
+        /* a snapshot of the init file settings; snapshots are never modified after they
+           are published so any number of threads may read one without locking; a new
+           snapshot is published when the init file changes on disk */
+        typedef std::shared_ptr<const minecraft_server_init_manager> snapshot;
+
         minecraft_server_init_manager();
 
-        void read_from_file(); // reload settings from master file
-        void apply_properties(minecraft_server_info&); // apply override and default properties
+        void read_from_file(); // load settings from master file
+        void apply_properties(minecraft_server_info&) const; // apply override and default properties
 
-        char* exec()
+        const char* exec() const
         {
-            return &_exec[0];
+            return _exec.c_str();
         }
 
         const rtypes::str& default_profile() const
@@ -94,7 +105,9 @@ namespace minecraft_controller
             return defaultProfile;
         }
 
-        char* arguments(const char* profileName);
+        // gets the NUL-separated argument list (ending in an empty string) for
+        // the specified profile or NULL if the profile doesn't exist
+        const char* arguments(const char* profileName) const;
 
         rtypes::byte shutdown_countdown() const
         {
@@ -116,14 +129,56 @@ namespace minecraft_controller
             return _altHome;
         }
 
+        const rtypes::str& default_template() const
+        {
+            return defaultTemplate;
+        }
+
+        // gets the directory of the specified server template or NULL if the
+        // template doesn't exist
+        const char* template_path(const char* templateName) const;
+
+        // the delegated cgroup under which each server gets a subtree; empty if
+        // servers aren't placed in cgroups
+        const rtypes::str& cgroup_root() const
+        {
+            return _cgroupRoot;
+        }
+
+        // true if authority programs are placed in their server's subtree
+        bool cgroup_authority() const
+        {
+            return _cgroupAuthority;
+        }
+
+        // gets the cgroup limits set for the specified profile
+        const minecraft_server_cgroup::limit_list& cgroup_limits(const char* profileName) const;
+
         // Gets a list of the server profiles available.
         static void list_profiles(rtypes::dynamic_array<rtypes::str>& out);
+
+        // gets the current snapshot; this never blocks on a reload
+        static snapshot get_snapshot();
+
+        // starts/stops the thread that watches the init file for changes
+        static void start_watcher();
+        static void stop_watcher();
     private:
-        mutex _mtx;
+        static snapshot _current;
+        static pthread_t _watchThreadID;
+        static volatile bool _watchCondition;
+
+        static void _publish();
+        static void* _watch_thread(void*);
 
         rtypes::str _exec; // path to executable
         rtypes::str defaultProfile; // name of default profile
         std::map<std::string,minecraft_server_profile> profiles; // server profiles
+        rtypes::str defaultTemplate; // name of template used for new servers (if any)
+        std::map<std::string,std::string> templates; // server template directories by name
+        rtypes::str _cgroupRoot; // delegated cgroup v2 directory for server subtrees
+        bool _cgroupAuthority; // confine authority programs with their server
+        std::map<std::string,minecraft_server_cgroup::limit_list> limits; // cgroup limits by profile name
         rtypes::byte _shutdownCountdown; // the number of seconds to wait for the server to shutdown before killing it
         rtypes::uint64 _maxSeconds; // the number of seconds to allow the server to run before auto-shutdown
         rtypes::uint16 _maxServers; // the maximum number of servers that minecontrol will allow
@@ -132,6 +187,34 @@ namespace minecraft_controller
         rtypes::dynamic_array<minecraft_server_input_property> _defaultProperties; // properties that are only applied when the user doesn't specify them
     };
 
+    /* startup latency statistics: for each profile, keeps a histogram of the time
+       from fork to the server's first line of output, to binding its address and
+       to reporting that it is ready */
+    class minecraft_startup_stats
+    {
+    public:
+        enum startup_stage
+        {
+            startup_first_line,
+            startup_bind,
+            startup_ready,
+            startup_stage_count
+        };
+
+        static void record(const rtypes::str& profileName,startup_stage stage,rtypes::uint64 milliseconds);
+
+        // prints one line per profile and stage (or only the lines for the specified profile)
+        static void print(rtypes::rstream& stream,const char* profileName = NULL);
+    private:
+        struct _profile
+        {
+            latency_histogram stages[startup_stage_count]; // milliseconds
+        };
+
+        static mutex _mtx;
+        static std::map<std::string,_profile> _profiles;
+    };
+
     class minecraft_server_manager;
 
     class minecraft_server
@@ -153,6 +236,8 @@ namespace minecraft_controller
             mcraft_start_server_already_exists, // a new server could not be started because another one already exists
             mcraft_start_server_bad_profile, // the specified profile did not exist
             mcraft_start_server_no_default_profile, // the default profile is not available
+            mcraft_start_server_bad_template, // the specified template did not exist
+            mcraft_start_server_cgroup_fail, // the server's cgroup couldn't be created or joined
             mcraft_start_server_process_fail = 200, // the server process (Java) couldn't be executed (should be a larg(er) value)
             mcraft_start_failure_unknown
         };
@@ -210,15 +295,36 @@ namespace minecraft_controller
         bool is_running() volatile
         { return _threadCondition; }
 
+        // a running server is "starting" until it prints its "Done" line
+        bool is_ready() const
+        { return _authority != NULL && _authority->is_ready(); }
+
         rtypes::str get_internal_name() const
         { return _internalName; }
         rtypes::uint32 get_internal_id() const
         { return _internalID; }
-
-        // Gets a list of the servers available for the specified user.
+        int get_owner_uid() const // the user the server runs as
+        { return _uid; }
+
+        // Gets a list of the servers available for the specified user. The list is
+        // sorted by name and may be limited to names beginning with 'prefix' and to
+        // a page of 'limit' names starting at 'offset'. The list is served from a
+        // catalog that is only rescanned when the user's minecraft directory changes;
+        // each catalog entry is still checked for a world directory on every call.
         static void list_servers(rtypes::dynamic_array<rtypes::str>& out,
-            const user_info& userInfo);
+            const user_info& userInfo,const char* prefix = "",
+            rtypes::size_type offset = 0,rtypes::size_type limit = rtypes::size_type(-1));
+
+        // Gets the directory of the user's server with the specified name, whether
+        // or not it is running. False if the name isn't a plain directory name or
+        // the directory doesn't exist, is a symbolic link or isn't the user's.
+        static bool find_server_directory(const user_info& userInfo,const char* serverName,rtypes::str& out);
     private:
+        struct _catalog;
+        static std::map<std::string,std::shared_ptr<const _catalog> > _catalogs; // by minecraft directory
+        static mutex _catalogMutex;
+        static std::shared_ptr<_catalog> _scan_catalog(const rtypes::str& mcraftdir);
+
         static rtypes::set<rtypes::uint32> _idSet;
         static mutex _idSetProtect;
         static short _handlerRef;
@@ -226,10 +332,8 @@ namespace minecraft_controller
         static void _alarm_handler(int);
         static void* _io_thread(void*);
 
-        // global server settings (read from initialization file)
-        static minecraft_server_init_manager _initManager; // global settings
-
         // per server attributes
+        minecraft_server_init_manager::snapshot _initManager; // global settings in effect when the server started
         rtypes::str _internalName;
         rtypes::path _serverDir;
         rtypes::str _profileName;
@@ -242,11 +346,20 @@ namespace minecraft_controller
         minecraft_server_exit_condition _threadExit; // (this just serves as a memory location that outlives _io_thread)
         rtypes::uint64 _maxTime;
         rtypes::uint64 _elapsed;
+        rtypes::uint64 _forkTime; // monotonic_milliseconds() at fork
+        minecraft_server_cgroup _cgroup; // inactive unless the init file names a cgroup root
+        minecraft_server_cgroup::usage _usage; // last sample taken by the io thread
+        rtypes::uint64 _usageTime; // monotonic_milliseconds() of last sample
+        rtypes::uint32 _cpuRate; // tenths of a percent of one CPU
+        rtypes::uint64 _ioReadRate, _ioWriteRate; // bytes per second
+        bool _stageRecorded[minecraft_startup_stats::startup_stage_count];
         int _uid, _gid;
         int _fderr;
         bool _propsFileIsDirty;
 
         // helpers
+        void _record_startup(); // called by the io thread
+        void _sample_usage(); // called by the io thread
         bool _create_server_properties_file(minecraft_server_info&);
         bool _create_eula_txt_file();
         void _check_extended_options(const minecraft_server_info&); // options that need to be applied in this program
@@ -312,6 +425,10 @@ namespace minecraft_controller
         // additional information that is accessible to an authenticated user might be included
         static void print_servers(rtypes::rstream&,const user_info* login = NULL);
 
+        // writes per-server metrics (lines, gists, console and authority
+        // program counts) in the Prometheus text format
+        static void write_metrics(rtypes::rstream&);
+
         // starts up the server manager system
         static void startup_server_manager();
 
@@ -323,6 +440,11 @@ namespace minecraft_controller
         static rtypes::dynamic_array<server_handle*> _handles;
         static pthread_t _threadID;
         static volatile bool _threadCondition;
+        static rtypes::uint64 _lockTime; // when _mutex was last taken; only valid while it is held
+
+        // take and release _mutex, recording how long it was held
+        static void _lock();
+        static void _unlock();
 
         static void* _manager_thread(void*);
     };
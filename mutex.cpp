@@ -1,17 +1,139 @@
 #include "mutex.h"
+#ifdef MINECONTROL_MUTEX_STATS
+#include "minecontrol-misc-types.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#endif
+using namespace rtypes;
 using namespace minecraft_controller;
 
+#ifdef MINECONTROL_MUTEX_STATS
+namespace
+{
+    void update_max(std::atomic<unsigned long long>& target,unsigned long long value)
+    {
+        unsigned long long current = target.load(std::memory_order_relaxed);
+        while (value>current && !target.compare_exchange_weak(current,value,std::memory_order_relaxed))
+            ;
+    }
+}
+
+struct mutex::_stats_record
+{
+    const char* name;
+    std::atomic<unsigned long long> acquisitions;
+    std::atomic<unsigned long long> contended; // acquisitions that had to wait
+    std::atomic<unsigned long long> waitTotal, waitMax; // microseconds
+    std::atomic<unsigned long long> holdMax;
+};
+
+// the table is constant-initialized, so it is ready before any constructor runs
+/*static*/ mutex::_stats_record* mutex::_records[MAX_NAMES];
+/*static*/ int mutex::_recordCount = 0;
+/*static*/ pthread_mutex_t mutex::_recordsMtx = PTHREAD_MUTEX_INITIALIZER;
+
+/*static*/ mutex::_stats_record* mutex::_lookup(const char* name)
+{
+    _stats_record* record = nullptr;
+    pthread_mutex_lock(&_recordsMtx);
+    for (int i = 0;i < _recordCount;++i) {
+        if (std::strcmp(_records[i]->name,name) == 0) {
+            record = _records[i];
+            break;
+        }
+    }
+    if (record==nullptr && _recordCount<MAX_NAMES) {
+        record = new _stats_record;
+        record->name = name;
+        record->acquisitions = record->contended = 0;
+        record->waitTotal = record->waitMax = record->holdMax = 0;
+        _records[_recordCount++] = record;
+    }
+    pthread_mutex_unlock(&_recordsMtx);
+    return record;
+}
+#endif
+
 mutex::mutex()
     : _mutexID(PTHREAD_MUTEX_INITIALIZER)
 {
+#ifdef MINECONTROL_MUTEX_STATS
+    _stats = nullptr;
+#endif
+}
+mutex::mutex(const char* name)
+    : _mutexID(PTHREAD_MUTEX_INITIALIZER)
+{
+#ifdef MINECONTROL_MUTEX_STATS
+    _stats = _lookup(name);
+#else
+    (void)name;
+#endif
 }
 void mutex::lock()
 {
+#ifdef MINECONTROL_MUTEX_STATS
+    if (_stats != nullptr) {
+        // try first so that uncontended acquisitions can be told apart
+        unsigned long long begin = monotonic_microseconds();
+        int result = ::pthread_mutex_trylock(&_mutexID);
+        bool contended = (result == EBUSY);
+        if (contended)
+            result = ::pthread_mutex_lock(&_mutexID);
+        if (result != 0)
+            throw mutex_error();
+        _lockedAt = monotonic_microseconds();
+        _stats->acquisitions.fetch_add(1,std::memory_order_relaxed);
+        if (contended) {
+            unsigned long long wait = _lockedAt - begin;
+            _stats->contended.fetch_add(1,std::memory_order_relaxed);
+            _stats->waitTotal.fetch_add(wait,std::memory_order_relaxed);
+            update_max(_stats->waitMax,wait);
+        }
+        return;
+    }
+#endif
     if (::pthread_mutex_lock(&_mutexID) != 0)
         throw mutex_error();
 }
 void mutex::unlock()
 {
+#ifdef MINECONTROL_MUTEX_STATS
+    if (_stats != nullptr)
+        // read the time before letting go of the lock that protects it
+        update_max(_stats->holdMax,monotonic_microseconds() - _lockedAt);
+#endif
     if (::pthread_mutex_unlock(&_mutexID) != 0)
         throw mutex_error();
 }
+/*static*/ void mutex::write_stats(rstream& stream)
+{
+#ifdef MINECONTROL_MUTEX_STATS
+    pthread_mutex_lock(&_recordsMtx);
+    int count = _recordCount;
+    pthread_mutex_unlock(&_recordsMtx);
+    for (int i = 0;i < count;++i) {
+        char buffer[256];
+        const _stats_record* record = _records[i];
+        unsigned long long acquisitions = record->acquisitions.load(std::memory_order_relaxed);
+        unsigned long long contended = record->contended.load(std::memory_order_relaxed);
+        std::snprintf(buffer,sizeof(buffer),"%s: %llu acquisitions, %llu contended (%.2f%%), wait %.3fms total %.3fms max, hold %.3fms max",
+            record->name,acquisitions,contended,acquisitions==0 ? 0.0 : 100.0*contended/acquisitions,
+            record->waitTotal.load(std::memory_order_relaxed) / 1000.0,record->waitMax.load(std::memory_order_relaxed) / 1000.0,
+            record->holdMax.load(std::memory_order_relaxed) / 1000.0);
+        stream << buffer << newline;
+    }
+#else
+    (void)stream;
+#endif
+}
+/*static*/ bool mutex::has_stats()
+{
+#ifdef MINECONTROL_MUTEX_STATS
+    return true;
+#else
+    return false;
+#endif
+}
@@ -2,6 +2,7 @@
 #ifndef MUTEX_H
 #define MUTEX_H
 #include <pthread.h>
+#include <rlibrary/rstream.h>
 
 namespace minecraft_controller
 {
@@ -14,11 +15,36 @@ namespace minecraft_controller
     public:
         mutex();
 
+        // a named mutex records contention statistics when built with
+        // MINECONTROL_MUTEX_STATS (configure --enable-mutex-stats); all mutexes
+        // with the same name (e.g. one per authority) are counted together
+        explicit mutex(const char* name);
+
         // these both throw if anything unusual happens
         void lock();
         void unlock();
+
+        // writes a line of statistics for each name that has been used; writes
+        // nothing when the statistics are compiled out
+        static void write_stats(rtypes::rstream& stream);
+        static bool has_stats();
     private:
         pthread_mutex_t _mutexID;
+#ifdef MINECONTROL_MUTEX_STATS
+        struct _stats_record;
+
+        _stats_record* _stats;
+        unsigned long long _lockedAt; // only valid while the mutex is held
+
+        // records are never freed so a mutex may be destroyed (or constructed during
+        // static initialization) at any time
+        static const int MAX_NAMES = 32;
+        static _stats_record* _records[MAX_NAMES];
+        static int _recordCount;
+        static pthread_mutex_t _recordsMtx;
+
+        static _stats_record* _lookup(const char* name);
+#endif
     };
 }
 
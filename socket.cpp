@@ -1,5 +1,11 @@
+#if !defined(__APPLE__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // get 'struct ucred'
+#endif
 #include "socket.h"
+#include "mutex.h"
+#include "minecontrol-trace.h"
 #include <openssl/ssl.h>
+#include <zlib.h>
 #include <openssl/err.h>
 #include <sys/types.h>
 #include <sys/un.h>
@@ -27,15 +33,32 @@ const char* socket_address::get_address_string() const
     return buf;
 }
 
+// minecraft_controller::socket_compression
+
+struct minecraft_controller::socket_compression
+{
+    z_stream deflater;
+    z_stream inflater;
+    mutex deflateMtx; // writes may come from more than one thread (e.g. console mode)
+    Bytef inbuf[4096];
+    socket_compression_stats stats;
+};
+
 // minecraft_controller::socket
 
 /*static*/ uint64 socket::_idTop = 1;
 socket::socket()
-    : _id(0), _sslCtx(nullptr), _ssl(nullptr)
+    : _id(0), _framing(socket_framing_text), _admissionFilter(nullptr), _admissionRelease(nullptr), _hasPeerCred(false), _peerUid(-1), _peerGid(-1),
+      _compression(nullptr), _sslCtx(nullptr), _ssl(nullptr)
 {
 }
 socket::~socket()
 { // allow for virtual destruction
+    if (_compression) {
+        deflateEnd(&_compression->deflater);
+        inflateEnd(&_compression->inflater);
+        delete _compression;
+    }
     if (_ssl) {
         SSL_free(_ssl);
     }
@@ -130,6 +153,15 @@ socket_accept_condition socket::accept(socket*& snew,str& fromAddress)
         len = prelen;
         fd = ::accept(pres->interpret_as<int>(),paddrbuf,&len);
         if (fd != -1) {
+            // get address of remote peer
+            _addressBufferToString(fromAddress);
+            // let the admission filter turn the connection away before we
+            // commit any resources (including a TLS handshake) to it
+            if (_admissionFilter!=nullptr && !(*_admissionFilter)(fromAddress,_getFamily())) {
+                ::close(fd);
+                return socket_refused;
+            }
+
             io_resource* input, *output;
             input = new io_resource;
             output = new io_resource(false);
@@ -144,21 +176,40 @@ socket_accept_condition socket::accept(socket*& snew,str& fromAddress)
             --_ResourceRef(output);
             // assign a unique id to represent the connection
             snew->_id = _idTop++;
-            // get address of remote peer
-            _addressBufferToString(fromAddress);
+            // record who is on the other end of a local connection
+            if (_getFamily() == socket_family_unix) {
+#ifdef __APPLE__
+                uid_t uid;
+                gid_t gid;
+                if (::getpeereid(fd,&uid,&gid) == 0) {
+                    snew->_hasPeerCred = true;
+                    snew->_peerUid = uid;
+                    snew->_peerGid = gid;
+                }
+#else
+                ucred cred;
+                socklen_t credlen = sizeof(cred);
+                if (::getsockopt(fd,SOL_SOCKET,SO_PEERCRED,&cred,&credlen) == 0) {
+                    snew->_hasPeerCred = true;
+                    snew->_peerUid = cred.uid;
+                    snew->_peerGid = cred.gid;
+                }
+#endif
+            }
 
-            // Wrap connection in openssl ctx if we have one.
+            // Wrap connection in openssl ctx if we have one. A client that fails
+            // the handshake is dropped here, so give back its admission slot.
             if (_sslCtx != nullptr) {
                 SSL* ssl = SSL_new(_sslCtx);
-                if (SSL_set_fd(ssl,fd) == 0) {
-                    ERR_print_errors_fp(stderr);
-                    SSL_free(ssl);
-                    throw socket_error();
-                }
-                if (SSL_accept(ssl) <= 0) {
+                if (ssl==nullptr || SSL_set_fd(ssl,fd)==0 || SSL_accept(ssl)<=0) {
                     ERR_print_errors_fp(stderr);
-                    SSL_free(ssl);
-                    throw socket_error();
+                    if (ssl != nullptr)
+                        SSL_free(ssl);
+                    delete snew;
+                    snew = NULL;
+                    if (_admissionFilter!=nullptr && _admissionRelease!=nullptr)
+                        (*_admissionRelease)(fromAddress,_getFamily());
+                    return socket_handshake_failed;
                 }
                 snew->_ssl = ssl;
             }
@@ -258,41 +309,187 @@ bool socket::shutdown()
     }
     return false;
 }
+bool socket::enable_compression()
+{
+    if (_compression != nullptr)
+        return true;
+    socket_compression* z = new socket_compression;
+    z->deflater.zalloc = Z_NULL;
+    z->deflater.zfree = Z_NULL;
+    z->deflater.opaque = Z_NULL;
+    z->inflater.zalloc = Z_NULL;
+    z->inflater.zfree = Z_NULL;
+    z->inflater.opaque = Z_NULL;
+    z->inflater.next_in = Z_NULL;
+    z->inflater.avail_in = 0;
+    if (deflateInit(&z->deflater,Z_DEFAULT_COMPRESSION) != Z_OK) {
+        delete z;
+        return false;
+    }
+    if (inflateInit(&z->inflater) != Z_OK) {
+        deflateEnd(&z->deflater);
+        delete z;
+        return false;
+    }
+    z->stats.plainOut = z->stats.wireOut = 0;
+    z->stats.plainIn = z->stats.wireIn = 0;
+    _compression = z;
+    return true;
+}
+bool socket::get_peer_credentials(int& uid,int& gid) const
+{
+    if ( !_hasPeerCred )
+        return false;
+    uid = _peerUid;
+    gid = _peerGid;
+    return true;
+}
+bool socket::get_compression_stats(socket_compression_stats& stats) const
+{
+    if (_compression == nullptr)
+        return false;
+    _compression->deflateMtx.lock();
+    stats = _compression->stats;
+    _compression->deflateMtx.unlock();
+    return true;
+}
 void socket::_readBuffer(void* buffer,size_type bytesToRead) const
 {
-    if (_ssl) {
-        _sslRead(buffer,bytesToRead);
+    if (_compression) {
+        _inflateRead(NULL,buffer,bytesToRead);
     }
     else {
-        io_device::_readBuffer(buffer,bytesToRead);
+        _rawRead(NULL,buffer,bytesToRead);
     }
+    // tells a request trace when the request started to arrive
+    request_trace::input_arrived();
 }
 void socket::_readBuffer(const io_resource* context,void* buffer,size_type bytesToRead) const
 {
-    if (_ssl) {
-        _sslRead(buffer,bytesToRead);
+    if (_compression) {
+        _inflateRead(context,buffer,bytesToRead);
     }
     else {
-        io_device::_readBuffer(buffer,bytesToRead);
+        _rawRead(context,buffer,bytesToRead);
     }
+    // tells a request trace when the request started to arrive
+    request_trace::input_arrived();
 }
 void socket::_writeBuffer(const void* buffer,size_type length)
 {
-    if (_ssl) {
-        _sslWrite(buffer,length);
+    // charge the write to the thread's request trace, if any
+    uint64 begin = request_trace::active() ? monotonic_microseconds() : 0;
+    if (_compression) {
+        _deflateWrite(NULL,buffer,length);
     }
     else {
-        io_device::_writeBuffer(buffer,length);
+        _rawWrite(NULL,buffer,length);
     }
+    if (begin != 0)
+        request_trace::charge(request_trace::span_write,monotonic_microseconds() - begin);
 }
 void socket::_writeBuffer(const io_resource* context,const void* buffer,size_type length)
+{
+    // charge the write to the thread's request trace, if any
+    uint64 begin = request_trace::active() ? monotonic_microseconds() : 0;
+    if (_compression) {
+        _deflateWrite(context,buffer,length);
+    }
+    else {
+        _rawWrite(context,buffer,length);
+    }
+    if (begin != 0)
+        request_trace::charge(request_trace::span_write,monotonic_microseconds() - begin);
+}
+void socket::_rawRead(const io_resource*,void* buffer,size_type bytesToRead) const
 {
     if (_ssl) {
-        _sslWrite(buffer,length);
+        _sslRead(buffer,bytesToRead);
     }
     else {
+        io_device::_readBuffer(buffer,bytesToRead);
+    }
+}
+void socket::_rawWrite(const io_resource* context,const void* buffer,size_type length)
+{
+    if (_ssl) {
+        _sslWrite(buffer,length);
+    }
+    else if (context != NULL) {
         io_device::_writeBuffer(context,buffer,length);
     }
+    else {
+        io_device::_writeBuffer(buffer,length);
+    }
+}
+void socket::_inflateRead(const io_resource* context,void* buffer,size_type bytesToRead) const
+{
+    // only one thread reads from a connection so the inflate side needs no lock
+    z_stream& strm = _compression->inflater;
+    strm.next_out = reinterpret_cast<Bytef*>(buffer);
+    strm.avail_out = static_cast<uInt>(bytesToRead);
+    while (true) {
+        int ret = inflate(&strm,Z_SYNC_FLUSH);
+        if (ret == Z_STREAM_END) {
+            // the peer ended the compressed stream; treat it like end of input
+            _lastOp = no_input;
+            _byteCount = 0;
+            return;
+        }
+        if (ret!=Z_OK && ret!=Z_BUF_ERROR) {
+            _lastOp = bad_read;
+            _byteCount = 0;
+            return;
+        }
+        size_type have = bytesToRead - strm.avail_out;
+        if (have > 0) {
+            _compression->stats.plainIn += have;
+            _lastOp = success_read;
+            _byteCount = have;
+            return;
+        }
+        // inflate needs more compressed input to make progress
+        _rawRead(context,_compression->inbuf,sizeof(_compression->inbuf));
+        if (_lastOp != success_read)
+            return;
+        _compression->stats.wireIn += _byteCount;
+        strm.next_in = _compression->inbuf;
+        strm.avail_in = static_cast<uInt>(_byteCount);
+    }
+}
+void socket::_deflateWrite(const io_resource* context,const void* buffer,size_type length)
+{
+    Bytef out[4096];
+    z_stream& strm = _compression->deflater;
+    _compression->deflateMtx.lock();
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<void*>(buffer));
+    strm.avail_in = static_cast<uInt>(length);
+    do {
+        strm.next_out = out;
+        strm.avail_out = sizeof(out);
+        // Z_SYNC_FLUSH emits everything written so far so that the peer can
+        // decode this message without waiting for the next one
+        if (deflate(&strm,Z_SYNC_FLUSH) == Z_STREAM_ERROR) {
+            _compression->deflateMtx.unlock();
+            _lastOp = bad_write;
+            _byteCount = 0;
+            return;
+        }
+        size_type have = sizeof(out) - strm.avail_out, offset = 0;
+        while (offset < have) {
+            _rawWrite(context,out+offset,have-offset);
+            if (_lastOp != success_write) {
+                _compression->deflateMtx.unlock();
+                return;
+            }
+            offset += _byteCount;
+        }
+        _compression->stats.wireOut += have;
+    } while (strm.avail_out == 0);
+    _compression->stats.plainOut += length;
+    _compression->deflateMtx.unlock();
+    _lastOp = success_write;
+    _byteCount = length;
 }
 void socket::_sslRead(void* buffer,size_type bytesToRead) const
 {
@@ -360,6 +557,64 @@ void socket::_readAll(generic_string& sbuf) const
 
 // minecraft_controller::socket_stream
 
+/*static*/ const uint32 socket_stream::MAX_FRAME_SIZE = 0x1000000; // 16MB
+bool socket_stream::read_frame(str& payload)
+{
+    uint32 length;
+    unsigned char header[4];
+    if ( !_readExact(reinterpret_cast<char*>(header),4) )
+        return false;
+    length = (uint32(header[0]) << 24) | (uint32(header[1]) << 16) | (uint32(header[2]) << 8) | uint32(header[3]);
+    if (length > MAX_FRAME_SIZE) {
+        // a peer sending a frame this large is either broken or hostile; treat
+        // it as a bad read so the connection gets dropped
+        _device->_lastOp = bad_read;
+        return false;
+    }
+    payload.resize(length);
+    return length == 0 || _readExact(&payload[0],length);
+}
+bool socket_stream::write_frame(const str& payload)
+{
+    if (_device == NULL)
+        return false;
+    // flush anything written with the formatting layer first
+    if ( !_bufOut.is_empty() )
+        flush_output();
+    uint32 length = static_cast<uint32>(payload.length());
+    str frame;
+    frame.push_back( char(length >> 24) );
+    frame.push_back( char((length >> 16) & 0xff) );
+    frame.push_back( char((length >> 8) & 0xff) );
+    frame.push_back( char(length & 0xff) );
+    frame += payload;
+    // send the whole frame in as few writes as possible
+    size_type offset = 0;
+    while (offset < frame.length()) {
+        _device->write(frame.c_str()+offset,frame.length()-offset);
+        if (_device->get_last_operation_status() != success_write)
+            return false;
+        offset += _device->get_last_byte_count();
+    }
+    return true;
+}
+bool socket_stream::_readExact(char* buffer,size_type length)
+{
+    size_type got = 0;
+    // consume bytes already read in by the formatting layer
+    while (got<length && !_bufIn.is_empty())
+        buffer[got++] = _bufIn.pop();
+    while (got < length) {
+        if (_device == NULL)
+            return false;
+        _device->read(buffer+got,length-got);
+        if (_device->get_last_operation_status() != success_read)
+            return false;
+        got += _device->get_last_byte_count();
+    }
+    return true;
+}
+
 bool socket_stream::_openDevice(const char* DeviceID)
 {
     return _device->open(DeviceID);
@@ -18,7 +18,9 @@ namespace minecraft_controller
     {
         socket_nodevice, // the socket does not exist yet
         socket_accepted, // a connection was accepted by the bound socket
-        socket_interrupted // accept was interrupted; the socket may have been shutdown
+        socket_interrupted, // accept was interrupted; the socket may have been shutdown
+        socket_refused, // a connection was accepted but then closed by the admission filter
+        socket_handshake_failed // a connection was admitted but closed when its TLS handshake failed
     };
 
     class socket_error { };
@@ -57,8 +59,38 @@ namespace minecraft_controller
         socket_family_inet
     };
 
+    /* determines how protocol messages are delimited on a connection; all
+       connections begin with text framing and may switch to binary framing
+       after it has been negotiated in the HELLO/GREETINGS exchange */
+    enum socket_framing
+    {
+        socket_framing_text, // CRLF terminated lines ending with a blank line
+        socket_framing_binary // length-prefixed frames (see socket_stream::read_frame)
+    };
+
+    /* byte counts for a compressed connection; 'plain' counts are the
+       bytes before compression (or after decompression) and 'wire' counts
+       are the bytes actually transferred over the connection */
+    struct socket_compression_stats
+    {
+        rtypes::uint64 plainOut, wireOut;
+        rtypes::uint64 plainIn, wireIn;
+    };
+
+    struct socket_compression; // opaque zlib state
+    class socket_stream;
+
+    /* an admission filter is consulted by a listening socket for each
+       accepted connection before any resources are allocated for it; if it
+       returns false then the connection is closed immediately; the release
+       function is called for an admitted connection that accept() drops
+       before handing it to the caller */
+    typedef bool (*socket_admission_filter)(const rtypes::str& address,socket_family family);
+    typedef void (*socket_admission_release)(const rtypes::str& address,socket_family family);
+
     class socket : public rtypes::io_device
     {
+        friend class socket_stream;
     public:
         socket();
         virtual ~socket();
@@ -77,6 +109,25 @@ namespace minecraft_controller
         { return _id; }
         socket_family get_family() const
         { return _getFamily(); }
+        socket_framing get_framing() const
+        { return _framing; }
+        void set_framing(socket_framing framing)
+        { _framing = framing; }
+        void set_admission_filter(socket_admission_filter filter,socket_admission_release release) // server
+        { _admissionFilter = filter; _admissionRelease = release; }
+
+        /* begins deflate compression in both directions for the remainder of
+           the connection; each write is flushed to a byte boundary so a
+           message is never held back waiting for more output */
+        bool enable_compression();
+        bool is_compressed() const
+        { return _compression != nullptr; }
+        bool get_compression_stats(socket_compression_stats& stats) const;
+
+        /* gets the credentials of the process that connected to a local
+           domain socket as verified by the kernel; they are read once when
+           the connection is accepted; false is returned for other sockets */
+        bool get_peer_credentials(int& uid,int& gid) const;
     protected:
         // Override read/write buffer interface for wrapping for OpenSSL.
         virtual void _readBuffer(void* buffer,rtypes::size_type bytesToRead) const;
@@ -87,11 +138,21 @@ namespace minecraft_controller
     private:
         static rtypes::uint64 _idTop; // maintain count of connected clients
         rtypes::uint64 _id;
+        socket_framing _framing;
+        socket_admission_filter _admissionFilter;
+        socket_admission_release _admissionRelease;
+        bool _hasPeerCred;
+        int _peerUid, _peerGid;
+        socket_compression* _compression;
         ::SSL_CTX* _sslCtx;
         ::SSL* _ssl;
 
         void _sslRead(void* buffer,rtypes::size_type bytesToRead) const;
         void _sslWrite(const void* buffer,rtypes::size_type length);
+        void _rawRead(const rtypes::io_resource* context,void* buffer,rtypes::size_type bytesToRead) const;
+        void _rawWrite(const rtypes::io_resource* context,const void* buffer,rtypes::size_type length);
+        void _inflateRead(const rtypes::io_resource* context,void* buffer,rtypes::size_type bytesToRead) const;
+        void _deflateWrite(const rtypes::io_resource* context,const void* buffer,rtypes::size_type length);
 
         // implement virtual io_device interface
         virtual void _openEvent(const char*,rtypes::io_access_flag,rtypes::io_resource**,rtypes::io_resource**,void**,rtypes::uint32);
@@ -110,7 +171,20 @@ namespace minecraft_controller
        encoding in a cross-platform manner (no alterations) */
     class socket_stream : public rtypes::rstream, public rtypes::generic_stream_device<socket>
     {
+    public:
+        /* binary framing: each frame is a 4-byte length (network byte order)
+           followed by that many bytes of payload; these operations bypass the
+           rstream formatting layer; 'read_frame' consumes any input already
+           buffered by the stream and then reads exactly the remaining bytes
+           from the device so that no data past the frame is lost */
+        bool read_frame(rtypes::str& payload);
+        bool write_frame(const rtypes::str& payload);
+
+        // largest payload accepted by 'read_frame'
+        static const rtypes::uint32 MAX_FRAME_SIZE;
     private:
+        bool _readExact(char* buffer,rtypes::size_type length);
+
         // rtypes::generic_stream_device interface
         virtual void _clearDevice() {};
         virtual bool _openDevice(const char* DeviceID);
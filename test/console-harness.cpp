@@ -0,0 +1,423 @@
+// console-harness.cpp - measures console fan-out in a minecontrold that runs
+// test/mimic as its "Minecraft server"; test/harness.sh sets up the daemon
+//
+// The harness logs in by peer credentials, starts a server, attaches authority
+// programs to it and connects console clients. Once every client is attached
+// it tells mimic to start its load (mimic -w) and then measures, for each line
+// that reaches a client, the time since mimic wrote it and whether any lines
+// were skipped. If the daemon serves metrics, the daemon's own per-line parse
+// and fan-out times are read from it to split up the end-to-end latency.
+#include "../domain-socket.h"
+#include "../minecontrol-protocol.h"
+#include "../minecontrol-histogram.h"
+#include "../minecontrol-misc-types.h"
+#include <rlibrary/rutility.h>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+using namespace rtypes;
+using namespace minecraft_controller;
+
+static const char* const DOMAIN_NAME = "@minecontrol";
+
+// a connection to the daemon's domain socket
+struct harness_session
+{
+    domain_socket sock;
+    socket_stream stream;
+    minecontrol_message_buffer request;
+    minecontrol_message response;
+
+    // connects, says HELLO and logs in as the calling user
+    bool open(bool binaryFraming)
+    {
+        domain_socket_address address(DOMAIN_NAME);
+        sock.open();
+        if ( !sock.connect(address) )
+            return false;
+        stream.assign(sock);
+        minecontrol_message hello("HELLO");
+        hello.add_field("Name","console-harness");
+        hello.add_field("Version","1");
+        if (binaryFraming)
+            hello.add_field(minecontrol_message::FRAMING_FIELD,minecontrol_message::FRAMING_BINARY);
+        stream << hello;
+        stream >> response;
+        if (!response.good() || !response.is_command("greetings"))
+            return false;
+        str key, value;
+        while (response.get_field_key_stream() >> key) {
+            response.get_field_value_stream() >> value;
+            rutil_to_lower_ref(value);
+            if (key=="framing" && value==minecontrol_message::FRAMING_BINARY)
+                sock.set_framing(socket_framing_binary);
+        }
+        request.begin("LOGIN");
+        request.enqueue_field_name("Method");
+        request << "peer" << flush;
+        return send(request) && response.is_command("message");
+    }
+
+    bool send(minecontrol_message_buffer& msg)
+    {
+        stream << msg.get_message();
+        stream >> response;
+        return response.good();
+    }
+
+    // the first value of the specified field (or the empty string)
+    str field(const char* name)
+    {
+        str key, value;
+        while (response.get_field_key_stream() >> key) {
+            response.get_field_value_stream() >> value;
+            if (key == name)
+                return value;
+        }
+        return str();
+    }
+};
+
+struct console_client
+{
+    int index;
+    pthread_t thread;
+    latency_histogram latency;
+    unsigned long long messages; // CONSOLE-MESSAGEs with a payload
+    unsigned long long stamped; // payloads that carried a mimic stamp
+    unsigned long long firstSeq, lastSeq;
+    unsigned long long firstUsec, lastUsec;
+    bool ok;
+    std::string error;
+};
+
+static bool binaryFraming = false;
+static uint32 serverID;
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int established = 0;
+static bool released = false;
+
+// finds "#<sequence>@<microseconds>" in a payload
+static bool parse_stamp(const char* payload,unsigned long long& seq,unsigned long long& usec)
+{
+    for (const char* p = std::strchr(payload,'#');p != NULL;p = std::strchr(p+1,'#')) {
+        char* end;
+        seq = std::strtoull(p+1,&end,10);
+        if (end != p+1 && *end == '@') {
+            const char* q = end+1;
+            usec = std::strtoull(q,&end,10);
+            if (end != q)
+                return true;
+        }
+    }
+    return false;
+}
+
+static void* client_thread(void* param)
+{
+    console_client& client = *reinterpret_cast<console_client*>(param);
+    harness_session session;
+    bool counted = false;
+    if ( !session.open(binaryFraming) ) {
+        client.error = "cannot connect and log in";
+        goto done;
+    }
+    session.request.begin("CONSOLE");
+    session.request.enqueue_field_name("ServerID");
+    session.request << serverID << flush;
+    if (!session.send(session.request) || session.field("status") != "established") {
+        client.error = "console mode was refused";
+        goto done;
+    }
+    pthread_mutex_lock(&mtx);
+    ++established;
+    counted = true;
+    pthread_cond_broadcast(&cond);
+    if (client.index == 0) {
+        // the first client releases mimic's load once everyone is attached
+        while (!released)
+            pthread_cond_wait(&cond,&mtx);
+        pthread_mutex_unlock(&mtx);
+        minecontrol_message command("CONSOLE-COMMAND");
+        command.add_field("ServerCommand","load");
+        session.stream << command;
+    }
+    else
+        pthread_mutex_unlock(&mtx);
+
+    while (true) {
+        session.stream >> session.response;
+        if ( !session.response.good() ) {
+            client.error = "connection lost";
+            break;
+        }
+        unsigned long long received = monotonic_microseconds();
+        str key, value, status, payload;
+        while (session.response.get_field_key_stream() >> key) {
+            session.response.get_field_value_stream() >> value;
+            if (key == "status")
+                status = value;
+            else if (key == "payload")
+                payload = value;
+        }
+        if (status == "shutdown") {
+            client.ok = true;
+            break;
+        }
+        if (status != "message")
+            continue;
+        ++client.messages;
+        unsigned long long seq, usec;
+        if ( parse_stamp(payload.c_str(),seq,usec) ) {
+            if (client.stamped++ == 0) {
+                client.firstSeq = seq;
+                client.firstUsec = received;
+            }
+            client.lastSeq = seq;
+            client.lastUsec = received;
+            client.latency.add(received > usec ? received-usec : 0);
+        }
+    }
+done:
+    if (!counted) {
+        pthread_mutex_lock(&mtx);
+        ++established; // don't keep the others waiting
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mtx);
+    }
+    return NULL;
+}
+
+// reads the daemon's metrics; values of a family are summed over their labels
+static bool scrape(const char* endpoint,std::map<std::string,double>& out)
+{
+    int fd;
+    char* end;
+    unsigned long port = std::strtoul(endpoint,&end,10);
+    if (*endpoint!=0 && *end==0) {
+        sockaddr_in addr;
+        std::memset(&addr,0,sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = ::socket(AF_INET,SOCK_STREAM,0);
+        if (fd==-1 || ::connect(fd,reinterpret_cast<sockaddr*>(&addr),sizeof(addr))==-1)
+            return false;
+    }
+    else {
+        sockaddr_un addr;
+        size_t len = std::strlen(endpoint);
+        std::memset(&addr,0,sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path,endpoint,len < sizeof(addr.sun_path) ? len : sizeof(addr.sun_path)-1);
+        if (endpoint[0] == '@')
+            addr.sun_path[0] = 0;
+        fd = ::socket(AF_UNIX,SOCK_STREAM,0);
+        if (fd==-1 || ::connect(fd,reinterpret_cast<sockaddr*>(&addr),socklen_t(offsetof(sockaddr_un,sun_path)+len))==-1)
+            return false;
+    }
+    static const char REQUEST[] = "GET /metrics HTTP/1.0\r\n\r\n";
+    if (::write(fd,REQUEST,sizeof(REQUEST)-1) != ssize_t(sizeof(REQUEST)-1)) {
+        ::close(fd);
+        return false;
+    }
+    std::string text;
+    char buffer[8192];
+    ssize_t n;
+    while ((n = ::read(fd,buffer,sizeof(buffer))) > 0)
+        text.append(buffer,n);
+    ::close(fd);
+    size_t at = text.find("\r\n\r\n");
+    if (at == std::string::npos)
+        return false;
+    out.clear();
+    for (at += 4;at < text.length();) {
+        size_t eol = text.find('\n',at);
+        if (eol == std::string::npos)
+            eol = text.length();
+        std::string line(text,at,eol-at);
+        at = eol + 1;
+        if (line.empty() || line[0] == '#')
+            continue;
+        size_t nameEnd = line.find_first_of("{ ");
+        size_t valueAt = line.rfind(' ');
+        if (nameEnd==std::string::npos || valueAt==std::string::npos)
+            continue;
+        out[line.substr(0,nameEnd)] += std::atof(line.c_str()+valueAt+1);
+    }
+    return true;
+}
+
+static double delta(std::map<std::string,double>& before,std::map<std::string,double>& after,const char* name)
+{
+    return after[name] - before[name];
+}
+
+static void usage(const char* program)
+{
+    std::fprintf(stderr,"usage: %s [-c clients] [-a authority-programs] [-d seconds] [-s server-name] [-x metrics-endpoint] [-B]\n",program);
+    std::exit(1);
+}
+
+int main(int argc,char* argv[])
+{
+    int opt;
+    int clientCount = 1, childCount = 0;
+    double duration = 10;
+    const char* serverName = "harness";
+    const char* metrics = NULL;
+    while ((opt = getopt(argc,argv,"c:a:d:s:x:B")) != -1) {
+        switch (opt) {
+        case 'c':
+            clientCount = std::atoi(optarg);
+            break;
+        case 'a':
+            childCount = std::atoi(optarg);
+            break;
+        case 'd':
+            duration = std::atof(optarg);
+            break;
+        case 's':
+            serverName = optarg;
+            break;
+        case 'x':
+            metrics = optarg;
+            break;
+        case 'B':
+            binaryFraming = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (clientCount < 1 || childCount < 0 || duration <= 0)
+        usage(argv[0]);
+
+    // start the server and find its id
+    harness_session control;
+    if ( !control.open(false) ) {
+        std::fprintf(stderr,"%s: cannot connect to minecontrold and log in by peer credentials\n",argv[0]);
+        return 1;
+    }
+    control.request.begin("START");
+    control.request.enqueue_field_name("ServerName");
+    control.request.enqueue_field_name("IsNew");
+    control.request << serverName << newline << "yes" << flush;
+    if (!control.send(control.request) || !control.response.is_command("list-message")) {
+        std::fprintf(stderr,"%s: cannot start server '%s'\n",argv[0],serverName);
+        return 1;
+    }
+    control.request.begin("STATUS");
+    control.request << flush;
+    serverID = 0;
+    if ( control.send(control.request) ) {
+        // lines look like "<name>: id=<id> pid=..."
+        std::string prefix = std::string(serverName) + ": id=";
+        str key, value;
+        while (control.response.get_field_key_stream() >> key) {
+            control.response.get_field_value_stream() >> value;
+            if (std::strncmp(value.c_str(),prefix.c_str(),prefix.length()) == 0)
+                serverID = std::strtoul(value.c_str()+prefix.length(),NULL,10);
+        }
+    }
+    if (serverID == 0) {
+        std::fprintf(stderr,"%s: server '%s' is not running\n",argv[0],serverName);
+        return 1;
+    }
+    for (int i = 0;i < childCount;++i) {
+        control.request.begin("EXEC");
+        control.request.enqueue_field_name("ServerID");
+        control.request.enqueue_field_name("Command");
+        control.request << serverID << newline << "harness-sink" << flush;
+        if (!control.send(control.request) || !control.response.is_command("message")) {
+            std::fprintf(stderr,"%s: cannot run authority program %d\n",argv[0],i+1);
+            return 1;
+        }
+    }
+
+    // attach the console clients
+    std::vector<console_client> clients(clientCount);
+    for (int i = 0;i < clientCount;++i) {
+        clients[i].index = i;
+        clients[i].messages = clients[i].stamped = 0;
+        clients[i].firstSeq = clients[i].lastSeq = clients[i].firstUsec = clients[i].lastUsec = 0;
+        clients[i].ok = false;
+        if (pthread_create(&clients[i].thread,NULL,&client_thread,&clients[i]) != 0) {
+            std::fprintf(stderr,"%s: cannot create client thread\n",argv[0]);
+            return 1;
+        }
+    }
+    pthread_mutex_lock(&mtx);
+    while (established < clientCount)
+        pthread_cond_wait(&cond,&mtx);
+    pthread_mutex_unlock(&mtx);
+
+    // run the load; the daemon's counters are read while the server is still up
+    std::map<std::string,double> before, after;
+    bool haveMetrics = metrics != NULL && scrape(metrics,before);
+    unsigned long long loadStart = monotonic_microseconds();
+    pthread_mutex_lock(&mtx);
+    released = true;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mtx);
+    usleep(useconds_t(duration * 1000000) + 500000);
+    haveMetrics = haveMetrics && scrape(metrics,after);
+    double elapsed = (monotonic_microseconds() - loadStart) / 1e6;
+
+    control.request.begin("STOP");
+    control.request.enqueue_field_name("ServerID");
+    control.request << serverID << flush;
+    control.send(control.request);
+    for (int i = 0;i < clientCount;++i)
+        pthread_join(clients[i].thread,NULL);
+
+    // report
+    latency_histogram total;
+    unsigned long long messages = 0, stamped = 0, missing = 0;
+    int failed = 0;
+    for (int i = 0;i < clientCount;++i) {
+        const console_client& c = clients[i];
+        if ( !c.ok ) {
+            ++failed;
+            std::fprintf(stderr,"client %d: %s\n",i,c.error.empty() ? "did not finish" : c.error.c_str());
+        }
+        total.merge(c.latency);
+        messages += c.messages;
+        stamped += c.stamped;
+        if (c.stamped > 0)
+            missing += (c.lastSeq - c.firstSeq + 1) - c.stamped;
+    }
+    std::printf("setup: %d console clients, %d authority programs, %.1fs of load\n",clientCount,childCount,duration);
+    std::printf("end-to-end latency (mimic write to client receive): p50 %lluus  p99 %lluus  p99.9 %lluus  max %lluus  mean %.1fus\n",
+        (unsigned long long)total.quantile(0.5),(unsigned long long)total.quantile(0.99),
+        (unsigned long long)total.quantile(0.999),(unsigned long long)total.max(),total.mean());
+    std::printf("client receive: %llu messages (%.0f/s per client), %llu stamped lines\n",
+        messages,messages / elapsed / clientCount,stamped);
+    std::printf("client drops: %llu stamped lines missing (%.3f%%), %d clients failed\n",
+        missing,stamped+missing == 0 ? 0.0 : 100.0*missing/(stamped+missing),failed);
+    if (haveMetrics) {
+        double lines = delta(before,after,"minecontrol_server_lines_total");
+        double fanoutCount = delta(before,after,"minecontrol_console_fanout_seconds_count");
+        double parseCount = delta(before,after,"minecontrol_line_parse_seconds_count");
+        double fanout = fanoutCount == 0 ? 0 : delta(before,after,"minecontrol_console_fanout_seconds_sum") / fanoutCount * 1e6;
+        double parse = parseCount == 0 ? 0 : delta(before,after,"minecontrol_line_parse_seconds_sum") / parseCount * 1e6;
+        std::printf("daemon: %.0f lines read (%.0f/s), fan-out %.1fus/line, parse %.1fus/line, %.0f failed console writes\n",
+            lines,lines / elapsed,fanout,parse,delta(before,after,"minecontrol_console_dropped_total"));
+        std::printf("stages (means): pipe and wake-up %.1fus, fan-out %.1fus, parse %.1fus (after fan-out; delays later lines only)\n",
+            total.mean() > fanout ? total.mean() - fanout : 0.0,fanout,parse);
+    }
+    else if (metrics != NULL)
+        std::printf("daemon: metrics endpoint '%s' could not be read\n",metrics);
+    return failed == 0 ? 0 : 1;
+}
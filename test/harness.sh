@@ -0,0 +1,77 @@
+#!/bin/sh
+# harness.sh - runs test/console-harness against a minecontrold whose servers
+# are test/mimic; minecontrold must be built with --enable-testing so that it
+# reads minecontrol.init from its working directory
+#
+# usage: harness.sh [-c clients] [-a authority-programs] [-r lines-per-second]
+#                   [-d seconds] [-m gist=weight,...] [-B]
+#
+# The daemon listens on @minecontrol and port 44446, so no other minecontrold
+# may be running; openssl makes the certificate its TLS port needs.
+
+CLIENTS=4
+CHILDREN=0
+RATE=20000
+DURATION=10
+MIX=chat=60,server-chat=10,join=5,leave=5,teleport=5,generic=15
+FRAMING=
+while getopts c:a:r:d:m:B opt; do
+    case $opt in
+        c) CLIENTS=$OPTARG ;;
+        a) CHILDREN=$OPTARG ;;
+        r) RATE=$OPTARG ;;
+        d) DURATION=$OPTARG ;;
+        m) MIX=$OPTARG ;;
+        B) FRAMING=-B ;;
+        *) sed -n 5,6p "$0" >&2; exit 1 ;;
+    esac
+done
+
+BUILD=$(pwd)
+for prog in minecontrold mimic console-harness; do
+    if [ ! -x "$BUILD/$prog" ]; then
+        echo "$0: $prog has not been built (run 'make harness')" >&2
+        exit 1
+    fi
+done
+
+TMP=$(mktemp -d) || exit 1
+USER=${USER:-$(id -un)}
+METRICS=@minecontrol-harness-$$
+mkdir -p "$TMP/home/$USER/minecraft"
+cat >"$TMP/minecontrol.init" <<INIT
+exec=$BUILD/mimic
+profile=harness:-w -r $RATE -d $DURATION -m $MIX
+default-profile=harness
+alt-home=$TMP/home
+INIT
+# authority programs just consume the server's output
+cat >"$TMP/home/$USER/minecraft/harness-sink" <<'SINK'
+#!/bin/sh
+exec cat >/dev/null
+SINK
+chmod +x "$TMP/home/$USER/minecraft/harness-sink"
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+    -keyout "$TMP/key.pem" -out "$TMP/cert.pem" >/dev/null 2>&1 || {
+    echo "$0: cannot create a TLS certificate" >&2
+    rm -rf "$TMP"
+    exit 1
+}
+
+(cd "$TMP" && exec "$BUILD/minecontrold" --no-daemon --metrics=$METRICS >"$TMP/minecontrold.log" 2>&1) &
+DAEMON=$!
+trap 'kill -TERM $DAEMON 2>/dev/null; wait $DAEMON; rm -rf "$TMP"' EXIT INT TERM
+
+# wait for the daemon to listen
+tries=0
+until grep -q '@minecontrol$' /proc/net/unix 2>/dev/null; do
+    tries=$((tries+1))
+    if [ $tries -gt 50 ] || ! kill -0 $DAEMON 2>/dev/null; then
+        echo "$0: minecontrold did not start:" >&2
+        cat "$TMP/minecontrold.log" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+
+"$BUILD/console-harness" -c $CLIENTS -a $CHILDREN -d $DURATION -x $METRICS $FRAMING
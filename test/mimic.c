@@ -1,9 +1,50 @@
 // mimic.c - mimic IO qualities of minecraft server
+//
+// Prints the start-up lines of a Minecraft server, then (optionally) a steady
+// stream of server messages at a fixed rate while echoing the commands it
+// reads on stdin, until it reads "stop". Every generated line carries a stamp
+// of the form "#<sequence>@<microseconds>" (CLOCK_MONOTONIC) so that a client
+// can measure how long the line took to reach it and notice lines it missed.
+//
+// usage: mimic [-w] [-r lines-per-second] [-d seconds] [-m gist=weight,...] [-v version]
+//
+// The mix names the gists to generate (chat, server-chat, join, leave,
+// teleport, generic) and their relative weights. With -w the load only begins
+// once the command "load" is read on stdin.
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <poll.h>
+#include <unistd.h>
 
 #define BUFFER_SIZE 4096
+#define TICKS_PER_SECOND 1000
+
+enum gist_kind
+{
+    kind_chat,
+    kind_server_chat,
+    kind_join,
+    kind_leave,
+    kind_teleport,
+    kind_generic,
+    kind_count
+};
+
+static const char* const KIND_NAMES[kind_count] = {
+    "chat", "server-chat", "join", "leave", "teleport", "generic"
+};
+
+static unsigned long long sequence = 0;
+
+static unsigned long long now_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (unsigned long long)ts.tv_sec*1000000ULL + ts.tv_nsec/1000;
+}
 
 void add_time(char* buffer,int* top)
 {
@@ -29,30 +70,208 @@ void generic_message(const char* message)
     top = 0;
     add_time(buffer,&top);
     add_type(buffer,&top);
-    sprintf(buffer+top,"%s",message);
+    snprintf(buffer+top,BUFFER_SIZE-top,"%s",message);
     printf("%s\n",buffer);
 }
 
-int main()
+// writes one generated line of the specified kind; the stamp goes where the
+// server would put a token so the line still parses as that gist
+void load_message(int kind)
+{
+    int top;
+    char stamp[64];
+    char buffer[BUFFER_SIZE];
+    top = 0;
+    add_time(buffer,&top);
+    add_type(buffer,&top);
+    snprintf(stamp,sizeof(stamp),"#%llu@%llu",++sequence,now_usec());
+    switch (kind) {
+    case kind_chat:
+        snprintf(buffer+top,BUFFER_SIZE-top,"<player%llu> %s the quick brown fox jumps over the lazy dog",sequence%64,stamp);
+        break;
+    case kind_server_chat:
+        snprintf(buffer+top,BUFFER_SIZE-top,"[Server] %s scheduled message",stamp);
+        break;
+    case kind_join:
+        snprintf(buffer+top,BUFFER_SIZE-top,"player%s joined the game",stamp);
+        break;
+    case kind_leave:
+        snprintf(buffer+top,BUFFER_SIZE-top,"player%s left the game",stamp);
+        break;
+    case kind_teleport:
+        snprintf(buffer+top,BUFFER_SIZE-top,"Teleported player%s to 100.5, 64.0, -20.5",stamp);
+        break;
+    default:
+        snprintf(buffer+top,BUFFER_SIZE-top,"Saving chunks %s for level 'world'/overworld",stamp);
+        break;
+    }
+    fputs(buffer,stdout);
+    fputc('\n',stdout);
+}
+
+// parses "name=weight,..." into 'weights'; returns 0 on error
+int parse_mix(const char* spec,int* weights)
+{
+    char buffer[BUFFER_SIZE];
+    char* item;
+    char* save;
+    int i;
+    for (i = 0;i < kind_count;++i)
+        weights[i] = 0;
+    snprintf(buffer,sizeof(buffer),"%s",spec);
+    for (item = strtok_r(buffer,",",&save);item != NULL;item = strtok_r(NULL,",",&save)) {
+        char* eq = strchr(item,'=');
+        if (eq == NULL)
+            return 0;
+        *eq = 0;
+        for (i = 0;i < kind_count;++i)
+            if (strcmp(item,KIND_NAMES[i]) == 0)
+                break;
+        if (i >= kind_count)
+            return 0;
+        weights[i] = atoi(eq+1);
+    }
+    return 1;
+}
+
+static int waitForLoad = 0;
+
+// handles one command line read from stdin; returns 0 on "stop"
+int handle_command(char* input)
 {
     int top;
     char output[BUFFER_SIZE];
+    size_t len = strlen(input);
+    if (strcmp(input,"stop") == 0)
+        return 0;
+    if (strcmp(input,"load") == 0)
+        waitForLoad = 0;
+    top = 0;
+    add_time(output,&top);
+    add_type(output,&top);
+    if (len > 4 && strncmp(input,"say",3) == 0)
+        snprintf(output+top,BUFFER_SIZE-top,"[Server] %s",input+4);
+    else
+        snprintf(output+top,BUFFER_SIZE-top,"Unknown command: %s (echo@%llu)",input,now_usec());
+    printf("%s\n",output);
+    return 1;
+}
+
+int main(int argc,char* argv[])
+{
+    int i, opt;
+    int weights[kind_count] = { 60, 10, 5, 5, 5, 15 };
+    int totalWeight;
+    double rate = 0; /* lines per second; zero means only echo commands */
+    double duration = 0; /* seconds of load; zero means until "stop" */
+    const char* version = "1.7.9";
     char input[BUFFER_SIZE];
+    size_t inputLen = 0;
+    char message[BUFFER_SIZE];
+    unsigned long long start, next, tick;
+    double owed = 0;
+    int running = 1;
+    int loadPending;
+    static char outbuf[1<<16];
 
-    generic_message("Starting minecraft server version 1.7.9");
+    while ((opt = getopt(argc,argv,"wr:d:m:v:")) != -1) {
+        switch (opt) {
+        case 'w':
+            waitForLoad = 1;
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 'm':
+            if ( !parse_mix(optarg,weights) ) {
+                fprintf(stderr,"%s: bad mix '%s'\n",argv[0],optarg);
+                return 1;
+            }
+            break;
+        case 'v':
+            version = optarg;
+            break;
+        default:
+            fprintf(stderr,"usage: %s [-w] [-r lines-per-second] [-d seconds] [-m gist=weight,...] [-v version]\n",argv[0]);
+            return 1;
+        }
+    }
+    totalWeight = 0;
+    for (i = 0;i < kind_count;++i)
+        totalWeight += weights[i];
+    if (totalWeight <= 0) {
+        fprintf(stderr,"%s: the mix is empty\n",argv[0]);
+        return 1;
+    }
 
-    while ( gets(input) ) {
-        top = 0;
-        add_time(output,&top);
-        add_type(output,&top);
+    // lines are flushed once per tick instead of once per line
+    setvbuf(stdout,outbuf,_IOFBF,sizeof(outbuf));
 
-        if (strcmp(input,"stop") == 0)
-            break;
-        else if (strlen(input)>4 && strncmp(input,"say",3) == 0) {
-            sprintf(output+top,"[Server] %s\n",input+4);
-            printf("%s\n",output);
+    snprintf(message,sizeof(message),"Starting minecraft server version %s",version);
+    generic_message(message);
+    generic_message("Starting Minecraft server on *:25565");
+    generic_message("Preparing spawn area: 50%");
+    generic_message("Done (0.100s)! For help, type \"help\" or \"?\"");
+    fflush(stdout);
+
+    loadPending = waitForLoad;
+    start = next = now_usec();
+    tick = 1000000 / TICKS_PER_SECOND;
+    while (running) {
+        struct pollfd pfd;
+        int timeout = -1;
+        int loadActive;
+        loadActive = !waitForLoad && rate > 0 && (duration <= 0 || now_usec()-start < (unsigned long long)(duration*1000000));
+        if (loadActive) {
+            unsigned long long t = now_usec();
+            timeout = (next > t) ? (int)((next - t + 999) / 1000) : 0;
+        }
+        pfd.fd = STDIN_FILENO;
+        pfd.events = POLLIN;
+        if (poll(&pfd,1,timeout) > 0) {
+            // read stdin directly: stdio buffering would hide lines from poll
+            char* eol;
+            ssize_t n = read(STDIN_FILENO,input+inputLen,sizeof(input)-1-inputLen);
+            if (n <= 0)
+                break;
+            inputLen += n;
+            input[inputLen] = 0;
+            while (running && (eol = strchr(input,'\n')) != NULL) {
+                *eol = 0;
+                running = handle_command(input);
+                inputLen -= eol+1 - input;
+                memmove(input,eol+1,inputLen+1);
+            }
+            if (inputLen == sizeof(input)-1)
+                inputLen = 0; // drop an overlong line
+            if (loadPending && !waitForLoad) {
+                // the load was just released; time it from here
+                loadPending = 0;
+                start = next = now_usec();
+            }
+        }
+        if (loadActive && now_usec() >= next) {
+            // emit the lines owed for this tick; the kinds are spread over the
+            // mix by a rotating counter rather than at random
+            owed += rate / TICKS_PER_SECOND;
+            while (owed >= 1) {
+                int pick = (int)(sequence % totalWeight);
+                int kind = 0;
+                while (pick >= weights[kind])
+                    pick -= weights[kind++];
+                load_message(kind);
+                owed -= 1;
+            }
+            next += tick;
         }
+        fflush(stdout);
     }
 
-    generic_message("Stopping the server");
+    generic_message("Stopping server");
+    fflush(stdout);
+    fprintf(stderr,"mimic: wrote %llu generated lines in %.3fs\n",sequence,(now_usec()-start)/1e6);
+    return 0;
 }
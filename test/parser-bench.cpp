@@ -0,0 +1,151 @@
+// parser-bench.cpp - measures minecraft_server_message::generate_message over a
+// corpus of labeled server lines; see test/corpus for the corpus format
+#include "../minecontrol-authority.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include <time.h>
+using namespace rtypes;
+using namespace minecraft_controller;
+
+// count every allocation made by the process so the parser's share can be
+// measured; the counter is only touched by the main thread
+static unsigned long long allocations = 0;
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+struct corpus_line
+{
+    std::string gold; // expected gist string, or "none" if the line shouldn't parse
+    str text;
+    int file;
+};
+
+static unsigned long long nanoseconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static bool load_corpus(const char* fileName,int file,std::vector<corpus_line>& out)
+{
+    char buffer[8192];
+    FILE* f = std::fopen(fileName,"r");
+    if (f == NULL)
+        return false;
+    while (std::fgets(buffer,sizeof(buffer),f) != NULL) {
+        size_t len = std::strlen(buffer);
+        if (len > 0 && buffer[len-1] == '\n')
+            buffer[--len] = 0;
+        char* tab = std::strchr(buffer,'\t');
+        if (buffer[0] == '#' || tab == NULL)
+            continue;
+        *tab = 0;
+        corpus_line line;
+        line.gold = buffer;
+        line.text = tab+1;
+        line.file = file;
+        out.push_back(line);
+    }
+    std::fclose(f);
+    return true;
+}
+
+static void usage(const char* program)
+{
+    std::fprintf(stderr,"usage: %s [-v] [-n passes] corpus-file...\n",program);
+    std::exit(1);
+}
+
+int main(int argc,const char* argv[])
+{
+    bool verbose = false;
+    long passes = 0; // zero means: as many as fit in about a second
+    std::vector<const char*> files;
+    std::vector<corpus_line> corpus;
+    for (int i = 1;i < argc;++i) {
+        if (std::strcmp(argv[i],"-v") == 0)
+            verbose = true;
+        else if (std::strcmp(argv[i],"-n") == 0 && i+1 < argc)
+            passes = std::atol(argv[++i]);
+        else if (argv[i][0] == '-')
+            usage(argv[0]);
+        else
+            files.push_back(argv[i]);
+    }
+    if (files.empty())
+        usage(argv[0]);
+    for (size_t i = 0;i < files.size();++i) {
+        if ( !load_corpus(files[i],int(i),corpus) ) {
+            std::fprintf(stderr,"%s: cannot read %s\n",argv[0],files[i]);
+            return 1;
+        }
+    }
+    if (corpus.empty()) {
+        std::fprintf(stderr,"%s: the corpus is empty\n",argv[0]);
+        return 1;
+    }
+
+    // classification pass
+    std::vector<size_t> fileLines(files.size()), fileCorrect(files.size());
+    size_t correct = 0;
+    for (size_t i = 0;i < corpus.size();++i) {
+        minecraft_server_message* msg = minecraft_server_message::generate_message(corpus[i].text);
+        std::string got = (msg == NULL) ? "none" : msg->get_gist_string().c_str();
+        delete msg;
+        ++fileLines[corpus[i].file];
+        if (got == corpus[i].gold) {
+            ++fileCorrect[corpus[i].file];
+            ++correct;
+        }
+        else if (verbose)
+            std::printf("%s: expected %s, got %s: %s\n",files[corpus[i].file],corpus[i].gold.c_str(),got.c_str(),corpus[i].text.c_str());
+    }
+    for (size_t i = 0;i < files.size();++i) {
+        const char* name = std::strrchr(files[i],'/');
+        std::printf("%-24s %6lu lines  %6lu/%-6lu correct (%.1f%%)\n",name == NULL ? files[i] : name+1,
+            (unsigned long)fileLines[i],(unsigned long)fileCorrect[i],(unsigned long)fileLines[i],
+            fileLines[i] == 0 ? 100.0 : 100.0*fileCorrect[i]/fileLines[i]);
+    }
+
+    // timed passes; messages are deleted right away as the authority does
+    unsigned long long start, elapsed, allocStart;
+    long done = 0;
+    allocStart = allocations;
+    start = nanoseconds();
+    do {
+        for (size_t i = 0;i < corpus.size();++i)
+            delete minecraft_server_message::generate_message(corpus[i].text);
+        ++done;
+        elapsed = nanoseconds() - start;
+    } while (passes > 0 ? done < passes : elapsed < 1000000000ULL);
+    double lines = double(done) * corpus.size();
+
+    std::printf("accuracy: %lu/%lu (%.2f%%)\n",(unsigned long)correct,(unsigned long)corpus.size(),100.0*correct/corpus.size());
+    std::printf("throughput: %.0f lines/s, %.1f ns/line, %.2f allocations/line (%ld passes)\n",
+        lines / (elapsed / 1e9),elapsed / lines,(allocations - allocStart) / lines,done);
+    return 0;
+}
@@ -0,0 +1,136 @@
+// properties-test.cpp - round-trips a server.properties file through the codec
+#include "../minecraft-server-properties.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <unistd.h>
+using namespace rtypes;
+using namespace minecraft_controller;
+
+static int failures = 0;
+
+static void check(bool condition,const char* what)
+{
+    if (!condition) {
+        std::fprintf(stderr,"FAIL: %s\n",what);
+        ++failures;
+    }
+}
+
+static std::string read_file(const char* name)
+{
+    std::string content;
+    FILE* f = std::fopen(name,"r");
+    if (f != NULL) {
+        char buffer[4096];
+        size_t n;
+        while ((n = std::fread(buffer,1,sizeof(buffer),f)) > 0)
+            content.append(buffer,n);
+        std::fclose(f);
+    }
+    return content;
+}
+
+static void write_file(const char* name,const char* content)
+{
+    FILE* f = std::fopen(name,"w");
+    if (f != NULL) {
+        std::fputs(content,f);
+        std::fclose(f);
+    }
+}
+
+static std::vector<std::string> split_lines(const std::string& content)
+{
+    std::vector<std::string> lines;
+    size_t begin = 0;
+    while (begin < content.size()) {
+        size_t end = content.find('\n',begin);
+        if (end == std::string::npos)
+            end = content.size();
+        lines.push_back(content.substr(begin,end-begin));
+        begin = end + 1;
+    }
+    return lines;
+}
+
+static bool has_line(const std::vector<std::string>& lines,const char* line)
+{
+    for (size_t i = 0;i < lines.size();++i)
+        if (lines[i] == line)
+            return true;
+    return false;
+}
+
+// saves 'input' with the specified property list and returns the result
+static std::string round_trip(const char* fileName,const char* input,const minecraft_server_property_list& props)
+{
+    write_file(fileName,input);
+    minecraft_server_properties_file file;
+    check(file.load(fileName),"load the input file");
+    check(file.save(fileName,props),"save the file");
+    return read_file(fileName);
+}
+
+int main()
+{
+    char fileName[] = "/tmp/properties-test-XXXXXX";
+    int fd = ::mkstemp(fileName);
+    if (fd == -1) {
+        std::perror("mkstemp");
+        return 1;
+    }
+    ::close(fd);
+
+    // values the schema can't parse ('easy', 'survival'), values that differ from
+    // the defaults, a key minecontrol doesn't know and a comment
+    const char* input =
+        "#Minecraft server properties\n"
+        "difficulty=easy\n"
+        "gamemode=survival\n"
+        "max-players=50\n"
+        "view-distance=4\n"
+        "some-future-key=42\n"
+        "motd=Old message\n";
+
+    // only some keys are supplied, as when a server is started
+    minecraft_server_property_list props;
+    props.set_value(minecraft_server_property_list::lookup("motd"),"New message");
+    props.set_value(minecraft_server_property_list::lookup("max-players"),"50");
+    std::string output = round_trip(fileName,input,props);
+    std::vector<std::string> lines = split_lines(output);
+
+    // no key may appear twice
+    std::map<std::string,int> keys;
+    for (size_t i = 0;i < lines.size();++i) {
+        size_t eq = lines[i].find('=');
+        if (lines[i].size()>0 && lines[i][0]!='#' && eq!=std::string::npos)
+            ++keys[lines[i].substr(0,eq)];
+    }
+    for (std::map<std::string,int>::const_iterator iter = keys.begin();iter != keys.end();++iter) {
+        if (iter->second != 1) {
+            std::fprintf(stderr,"FAIL: key '%s' appears %d times\n",iter->first.c_str(),iter->second);
+            ++failures;
+        }
+    }
+
+    check(has_line(lines,"#Minecraft server properties"),"the comment is kept");
+    check(has_line(lines,"difficulty=easy"),"an unparseable value is kept");
+    check(has_line(lines,"gamemode=survival"),"an unparseable value is kept");
+    check(has_line(lines,"view-distance=4"),"a value nobody supplied is kept");
+    check(has_line(lines,"some-future-key=42"),"an unknown key is kept");
+    check(has_line(lines,"max-players=50"),"a supplied value is written");
+    check(has_line(lines,"motd=New message"),"a supplied value replaces the old one");
+    check(keys.count("pvp") == 1,"a key missing from the file is added");
+
+    // saving the result again changes nothing
+    check(round_trip(fileName,output.c_str(),props) == output,"a second save is a no-op");
+
+    ::unlink(fileName);
+    if (failures > 0)
+        return 1;
+    std::printf("properties-test: all checks passed\n");
+    return 0;
+}
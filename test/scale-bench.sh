@@ -0,0 +1,59 @@
+#!/bin/sh
+# scale-bench.sh - runs minecontrol-bench against a throwaway minecontrold whose
+# servers are test/mimic; minecontrold must be built with --enable-testing so
+# that it reads minecontrol.init from its working directory
+#
+# usage: scale-bench.sh [-T] [minecontrol-bench options]
+#
+# With -T the benchmark connects over TLS to localhost instead of using the
+# domain socket. The daemon always needs a certificate for its TLS port, so a
+# self-signed one is made with openssl. The daemon listens on @minecontrol and
+# port 44446, so no other minecontrold may be running.
+
+TLS=
+if [ "$1" = "-T" ]; then
+    TLS="-t localhost"
+    shift
+fi
+
+BUILD=$(pwd)
+for prog in minecontrold mimic minecontrol-bench; do
+    if [ ! -x "$BUILD/$prog" ]; then
+        echo "$0: $prog has not been built (run 'make scale-bench')" >&2
+        exit 1
+    fi
+done
+
+TMP=$(mktemp -d) || exit 1
+USER=${USER:-$(id -un)}
+mkdir -p "$TMP/home/$USER/minecraft"
+# fake servers only answer commands; they print no load of their own
+cat >"$TMP/minecontrol.init" <<INIT
+exec=$BUILD/mimic
+profile=bench:-v bench
+default-profile=bench
+alt-home=$TMP/home
+INIT
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+    -keyout "$TMP/key.pem" -out "$TMP/cert.pem" >/dev/null 2>&1 || {
+    echo "$0: cannot create a TLS certificate" >&2
+    rm -rf "$TMP"
+    exit 1
+}
+
+(cd "$TMP" && exec "$BUILD/minecontrold" --no-daemon >"$TMP/minecontrold.log" 2>&1) &
+DAEMON=$!
+trap 'kill -TERM $DAEMON 2>/dev/null; wait $DAEMON; rm -rf "$TMP"' EXIT INT TERM
+
+tries=0
+until grep -q '@minecontrol$' /proc/net/unix 2>/dev/null; do
+    tries=$((tries+1))
+    if [ $tries -gt 50 ] || ! kill -0 $DAEMON 2>/dev/null; then
+        echo "$0: minecontrold did not start:" >&2
+        cat "$TMP/minecontrold.log" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+
+"$BUILD/minecontrol-bench" -P $DAEMON $TLS "$@"